@@ -0,0 +1,200 @@
+#include "../common/datasets.h"
+#include "../common/leaf_layout.h"
+#include "benchmark/benchmark.h"
+#include "ds/storage/particleBlock.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// SoA against AoSoA hot blocks on the three loops that read them: P2P over
+// the 26-neighbourhood, the drift step of the integrator and the render
+// extraction. Both P2P kernels run the same full-register arithmetic (zero
+// mass in padding lanes), only the memory layout differs. Drift and render
+// go through the generic get_x()[i] accessors, as engine code does.
+
+#define SOFTENER 1e-20
+#define G 6.67430 * 10e-11
+
+namespace {
+
+template <class Block> struct Arena {
+  std::vector<Block> blocks; // Morton order
+  std::vector<typename Block::ColdBlock> cold;
+  std::vector<uint32_t> nb_offsets;
+  std::vector<uint32_t> nb_slots;
+};
+
+template <class Block> Arena<Block> make_arena(size_t n) {
+  const bench::LeafSet set = bench::build_leaves(
+      bench::make_dataset(bench::Dataset::kUniform, n), Block::N);
+  const std::vector<uint32_t> slot_of =
+      bench::layout_permutation(set, bench::Layout::kMorton);
+  const size_t n_leaves = set.leaves.size();
+
+  Arena<Block> arena;
+  // Blocks can't be moved, so no resize(): built in place at full size
+  arena.blocks = std::vector<Block>(n_leaves);
+  arena.cold.resize(n_leaves);
+  for (uint32_t leaf = 0; leaf < n_leaves; ++leaf) {
+    const uint32_t slot = slot_of[leaf];
+    Block &block = arena.blocks[slot];
+    block.cold_block = &arena.cold[slot];
+    const bench::Leaf &l = set.leaves[leaf];
+    for (size_t p = l.begin; p < l.end && !block.is_full(); ++p)
+      block.addParticle(set.particles[p]);
+  }
+
+  bench::SlotNeighbours nb = bench::slot_neighbours(set, slot_of);
+  arena.nb_offsets = std::move(nb.offsets);
+  arena.nb_slots = std::move(nb.slots);
+  return arena;
+}
+
+// One register of source bodies against target body (x0, y0, z0), summed
+// per lane into acc
+template <size_t Lanes>
+inline void lanes_pair(const double *xs, const double *ys, const double *zs,
+                       const double *ms, double x0, double y0, double z0,
+                       double (&acc)[3][Lanes]) {
+  for (size_t l = 0; l < Lanes; ++l) {
+    const double dx = xs[l] - x0;
+    const double dy = ys[l] - y0;
+    const double dz = zs[l] - z0;
+    const double r2 = dx * dx + dy * dy + dz * dz + SOFTENER;
+    const double inv_r = 1.0 / std::sqrt(r2);
+    const double common = G * ms[l] * inv_r * inv_r * inv_r;
+    acc[0][l] += common * dx;
+    acc[1][l] += common * dy;
+    acc[2][l] += common * dz;
+  }
+}
+
+template <class Block>
+void block_pair(const Block &dst, typename Block::ColdBlock &out,
+                const Block &src) {
+  constexpr size_t kLanes = Block::kLanes;
+  const auto &hot = src.data_block;
+  for (int i = 0; i < dst.size(); ++i) {
+    const double x0 = dst.get_x()[size_t(i)];
+    const double y0 = dst.get_y()[size_t(i)];
+    const double z0 = dst.get_z()[size_t(i)];
+    double acc[3][kLanes] = {};
+    const size_t used = (size_t(src.size()) + kLanes - 1) / kLanes;
+    for (size_t t = 0; t < used; ++t) {
+      if constexpr (Block::kLayout == BlockLayout::kAoSoA) {
+        const auto &tile = hot.tiles[t];
+        lanes_pair<kLanes>(tile.x.data(), tile.y.data(), tile.z.data(),
+                           tile.mass.data(), x0, y0, z0, acc);
+      } else {
+        const size_t j = t * kLanes;
+        lanes_pair<kLanes>(hot.x.data() + j, hot.y.data() + j,
+                           hot.z.data() + j, hot.mass.data() + j, x0, y0, z0,
+                           acc);
+      }
+    }
+    for (size_t l = 0; l < kLanes; ++l) {
+      out.ax[size_t(i)] += acc[0][l];
+      out.ay[size_t(i)] += acc[1][l];
+      out.az[size_t(i)] += acc[2][l];
+    }
+  }
+}
+
+template <class Block> void BM_p2p(benchmark::State &state) {
+  Arena<Block> arena = make_arena<Block>(size_t(state.range(0)));
+  for (auto _ : state) {
+    for (size_t slot = 0; slot < arena.blocks.size(); ++slot)
+      for (uint32_t k = arena.nb_offsets[slot]; k < arena.nb_offsets[slot + 1];
+           ++k)
+        block_pair(arena.blocks[slot], arena.cold[slot],
+                   arena.blocks[arena.nb_slots[k]]);
+    benchmark::ClobberMemory();
+  }
+  state.counters["pairs/s"] =
+      benchmark::Counter(double(arena.nb_slots.size()),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+
+template <class Block> void BM_drift(benchmark::State &state) {
+  Arena<Block> arena = make_arena<Block>(size_t(state.range(0)));
+  const double dt = 1e-3;
+  for (auto _ : state) {
+    for (Block &block : arena.blocks) {
+      auto &&x = block.get_x();
+      auto &&y = block.get_y();
+      auto &&z = block.get_z();
+      const auto &vx = block.get_vx();
+      const auto &vy = block.get_vy();
+      const auto &vz = block.get_vz();
+      for (size_t i = 0; i < Block::kPadded; ++i) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+      }
+    }
+    benchmark::ClobberMemory();
+  }
+  state.counters["bodies/s"] = benchmark::Counter(
+      double(state.range(0)), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+struct RenderPoint {
+  float x, y, z, mass;
+};
+
+template <class Block> void BM_render(benchmark::State &state) {
+  Arena<Block> arena = make_arena<Block>(size_t(state.range(0)));
+  std::vector<RenderPoint> points;
+  points.reserve(size_t(state.range(0)));
+  for (auto _ : state) {
+    points.clear();
+    for (const Block &block : arena.blocks)
+      for (size_t i = 0; i < block.size(); ++i)
+        points.push_back({float(block.get_x()[i]), float(block.get_y()[i]),
+                          float(block.get_z()[i]),
+                          float(block.get_mass()[i])});
+    benchmark::DoNotOptimize(points.data());
+  }
+  state.counters["bodies/s"] = benchmark::Counter(
+      double(points.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+} // namespace
+
+#define LAYOUT_BENCHMARKS(capacity)                                            \
+  BENCHMARK_TEMPLATE(BM_p2p,                                                   \
+                     BasicParticleBlock<double, capacity, BlockLayout::kSoA>)  \
+      ->Arg(1 << 17)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);                                           \
+  BENCHMARK_TEMPLATE(BM_p2p, BasicParticleBlock<double, capacity,              \
+                                                BlockLayout::kAoSoA>)          \
+      ->Arg(1 << 17)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);                                           \
+  BENCHMARK_TEMPLATE(BM_drift,                                                 \
+                     BasicParticleBlock<double, capacity, BlockLayout::kSoA>)  \
+      ->Arg(1 << 20)                                                           \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);                                           \
+  BENCHMARK_TEMPLATE(BM_drift, BasicParticleBlock<double, capacity,            \
+                                                  BlockLayout::kAoSoA>)        \
+      ->Arg(1 << 20)                                                           \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);                                           \
+  BENCHMARK_TEMPLATE(BM_render,                                                \
+                     BasicParticleBlock<double, capacity, BlockLayout::kSoA>)  \
+      ->Arg(1 << 20)                                                           \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);                                           \
+  BENCHMARK_TEMPLATE(BM_render, BasicParticleBlock<double, capacity,           \
+                                                   BlockLayout::kAoSoA>)       \
+      ->Arg(1 << 20)                                                           \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);
+LAYOUT_BENCHMARKS(16)
+LAYOUT_BENCHMARKS(24)
+BENCHMARK_MAIN();
@@ -0,0 +1,49 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+// Bench-local copies of the initial conditions. The real generators live in
+// sim/code/src/utils/generators.cc, but they drag the renderer headers in.
+namespace bench {
+
+enum class Dataset { kUniform, kPlummer };
+
+inline const char *dataset_name(Dataset d) {
+  return d == Dataset::kPlummer ? "plummer" : "uniform";
+}
+
+// Positions inside the unit cube, unit total mass
+inline std::vector<Particle> make_dataset(Dataset d, size_t n,
+                                          unsigned seed = 1) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  const double m = 1.0 / static_cast<double>(n);
+
+  std::vector<Particle> out;
+  out.reserve(n);
+  while (out.size() < n) {
+    if (d == Dataset::kUniform) {
+      out.emplace_back(u(rng), u(rng), u(rng), 0.0, 0.0, 0.0, m);
+      continue;
+    }
+    // Plummer sphere with scale radius 0.05, cut at the cube walls
+    const double q = std::pow(u(rng), 2.0 / 3.0);
+    const double r = 0.05 * std::sqrt(q / (1.0 - q));
+    const double cos_t = 2.0 * u(rng) - 1.0;
+    const double sin_t = std::sqrt(1.0 - cos_t * cos_t);
+    const double phi = 2.0 * M_PI * u(rng);
+    const double x = 0.5 + r * sin_t * std::cos(phi);
+    const double y = 0.5 + r * sin_t * std::sin(phi);
+    const double z = 0.5 + r * cos_t;
+    if (x <= 0.0 || x >= 1.0 || y <= 0.0 || y >= 1.0 || z <= 0.0 || z >= 1.0)
+      continue;
+    out.emplace_back(x, y, z, 0.0, 0.0, 0.0, m);
+  }
+  return out;
+}
+
+} // namespace bench
@@ -0,0 +1,209 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include "ds/tree/sfc.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Adaptive leaf decomposition + exact 26-neighbourhood for benchmarks that
+// want to compare block layouts without going through the whole engine.
+namespace bench {
+
+struct Leaf {
+  sfc::LocationCode code;
+  size_t begin, end; // range in the Morton-sorted particle array
+};
+
+struct LeafSet {
+  std::vector<Particle> particles; // sorted by Morton key
+  std::vector<Leaf> leaves;        // Morton order
+  std::vector<uint32_t> nb_offsets;
+  std::vector<uint32_t> nb_indices; // CSR, indices into leaves
+};
+
+enum class Layout { kMorton, kHilbert, kRandom };
+
+inline const char *layout_name(Layout l) {
+  switch (l) {
+  case Layout::kMorton:
+    return "morton";
+  case Layout::kHilbert:
+    return "hilbert";
+  default:
+    return "random";
+  }
+}
+
+namespace detail {
+inline const MyMath::BoundingBox kUnitBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}};
+
+inline sfc::OrderKey span(unsigned level) {
+  return sfc::OrderKey{1} << (3 * (sfc::kMaxLevel - level));
+}
+
+inline void split(LeafSet &set, const std::vector<sfc::OrderKey> &keys,
+                  sfc::LocationCode code, size_t begin, size_t end,
+                  size_t leaf_cap, unsigned max_level) {
+  const unsigned level = sfc::code_level(code);
+  if (end - begin <= leaf_cap || level == max_level) {
+    set.leaves.push_back({code, begin, end});
+    return;
+  }
+  for (unsigned octant = 0; octant < 8; ++octant) {
+    const sfc::LocationCode child = sfc::child_code(code, octant);
+    const sfc::OrderKey lo = sfc::order_key(sfc::Curve::kMorton, child);
+    const auto first = std::lower_bound(keys.begin() + long(begin),
+                                        keys.begin() + long(end), lo);
+    const auto last =
+        std::lower_bound(first, keys.begin() + long(end), lo + span(level + 1));
+    split(set, keys, child, size_t(first - keys.begin()),
+          size_t(last - keys.begin()), leaf_cap, max_level);
+  }
+}
+
+// Leaf box in finest-level integer units, half open
+inline void leaf_box(sfc::LocationCode code, int64_t lo[3], int64_t hi[3]) {
+  const unsigned level = sfc::code_level(code);
+  const sfc::GridCoord g = sfc::decode_code(code);
+  const int64_t size = int64_t{1} << (sfc::kMaxLevel - level);
+  const uint32_t c[3] = {g.x, g.y, g.z};
+  for (int a = 0; a < 3; ++a) {
+    lo[a] = int64_t(c[a]) * size;
+    hi[a] = lo[a] + size;
+  }
+}
+
+inline bool touches(sfc::LocationCode a, sfc::LocationCode b) {
+  int64_t alo[3], ahi[3], blo[3], bhi[3];
+  leaf_box(a, alo, ahi);
+  leaf_box(b, blo, bhi);
+  for (int i = 0; i < 3; ++i)
+    if (alo[i] > bhi[i] || blo[i] > ahi[i])
+      return false;
+  return true;
+}
+} // namespace detail
+
+inline LeafSet build_leaves(std::vector<Particle> particles,
+                            size_t leaf_cap = 16, unsigned max_level = 10) {
+  LeafSet set;
+  std::vector<sfc::OrderKey> keys(particles.size());
+  std::vector<size_t> order(particles.size());
+  std::iota(order.begin(), order.end(), 0);
+  for (size_t i = 0; i < particles.size(); ++i)
+    keys[i] = sfc::point_key(sfc::Curve::kMorton, particles[i].getPosition(),
+                             detail::kUnitBox);
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+  std::vector<sfc::OrderKey> sorted_keys;
+  sorted_keys.reserve(order.size());
+  set.particles.reserve(order.size());
+  for (size_t i : order) {
+    sorted_keys.push_back(keys[i]);
+    set.particles.push_back(particles[i]);
+  }
+  detail::split(set, sorted_keys, sfc::kRootCode, 0, sorted_keys.size(),
+                leaf_cap, max_level);
+
+  std::vector<sfc::OrderKey> starts;
+  starts.reserve(set.leaves.size());
+  for (const Leaf &l : set.leaves)
+    starts.push_back(sfc::order_key(sfc::Curve::kMorton, l.code));
+
+  set.nb_offsets.push_back(0);
+  for (size_t i = 0; i < set.leaves.size(); ++i) {
+    const sfc::LocationCode code = set.leaves[i].code;
+    const unsigned level = sfc::code_level(code);
+    const sfc::GridCoord g = sfc::decode_code(code);
+    const int64_t side = int64_t{1} << level;
+    const size_t first_nb = set.nb_indices.size();
+
+    for (int dx = -1; dx <= 1; ++dx)
+      for (int dy = -1; dy <= 1; ++dy)
+        for (int dz = -1; dz <= 1; ++dz) {
+          if (!dx && !dy && !dz)
+            continue;
+          const int64_t nx = g.x + dx, ny = g.y + dy, nz = g.z + dz;
+          if (nx < 0 || ny < 0 || nz < 0 || nx >= side || ny >= side ||
+              nz >= side)
+            continue;
+          const sfc::LocationCode cell =
+              sfc::encode_code({uint32_t(nx), uint32_t(ny), uint32_t(nz)},
+                               level);
+          const sfc::OrderKey lo = sfc::order_key(sfc::Curve::kMorton, cell);
+          size_t j = size_t(std::upper_bound(starts.begin(), starts.end(), lo) -
+                            starts.begin()) -
+                     1;
+          if (sfc::code_level(set.leaves[j].code) <= level) {
+            set.nb_indices.push_back(uint32_t(j));
+            continue;
+          }
+          for (; j < starts.size() && starts[j] < lo + detail::span(level); ++j)
+            if (detail::touches(code, set.leaves[j].code))
+              set.nb_indices.push_back(uint32_t(j));
+        }
+
+    // Coarse neighbours are reached through several directions
+    std::sort(set.nb_indices.begin() + long(first_nb), set.nb_indices.end());
+    set.nb_indices.erase(std::unique(set.nb_indices.begin() + long(first_nb),
+                                     set.nb_indices.end()),
+                         set.nb_indices.end());
+    set.nb_offsets.push_back(uint32_t(set.nb_indices.size()));
+  }
+  return set;
+}
+
+// Position of every Morton-ordered leaf in the given layout
+inline std::vector<uint32_t> layout_permutation(const LeafSet &set,
+                                                Layout layout) {
+  std::vector<uint32_t> by_layout(set.leaves.size());
+  std::iota(by_layout.begin(), by_layout.end(), 0u);
+  if (layout == Layout::kHilbert) {
+    std::vector<sfc::OrderKey> keys;
+    keys.reserve(set.leaves.size());
+    for (const Leaf &l : set.leaves)
+      keys.push_back(sfc::order_key(sfc::Curve::kHilbert, l.code));
+    std::sort(by_layout.begin(), by_layout.end(),
+              [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+  } else if (layout == Layout::kRandom) {
+    std::shuffle(by_layout.begin(), by_layout.end(), std::mt19937(7));
+  }
+  std::vector<uint32_t> slot_of(set.leaves.size());
+  for (uint32_t slot = 0; slot < by_layout.size(); ++slot)
+    slot_of[by_layout[slot]] = slot;
+  return slot_of;
+}
+
+// The neighbour CSR of `set` with leaves replaced by their slot_of() slots
+// and rows in slot order. self_first starts every row with its own slot
+struct SlotNeighbours {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> slots;
+};
+
+inline SlotNeighbours slot_neighbours(const LeafSet &set,
+                                      const std::vector<uint32_t> &slot_of,
+                                      bool self_first = false) {
+  const size_t n_leaves = set.leaves.size();
+  std::vector<uint32_t> leaf_at(n_leaves);
+  for (uint32_t leaf = 0; leaf < n_leaves; ++leaf)
+    leaf_at[slot_of[leaf]] = leaf;
+
+  SlotNeighbours nb;
+  nb.offsets.push_back(0);
+  for (uint32_t slot = 0; slot < n_leaves; ++slot) {
+    const uint32_t leaf = leaf_at[slot];
+    if (self_first)
+      nb.slots.push_back(slot);
+    for (uint32_t k = set.nb_offsets[leaf]; k < set.nb_offsets[leaf + 1]; ++k)
+      nb.slots.push_back(slot_of[set.nb_indices[k]]);
+    nb.offsets.push_back(uint32_t(nb.slots.size()));
+  }
+  return nb;
+}
+
+} // namespace bench
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Thin perf_event_open wrapper for user-space hardware counters. If the kernel
+// refuses (perf_event_paranoid, containers, VMs) the counter stays invalid and
+// benchmarks simply skip reporting it.
+class PerfCounter {
+public:
+  PerfCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+  ~PerfCounter() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+  PerfCounter(const PerfCounter &) = delete;
+  PerfCounter &operator=(const PerfCounter &) = delete;
+
+  bool valid() const { return fd_ >= 0; }
+
+  void start() {
+    if (fd_ < 0)
+      return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  uint64_t stop() {
+    if (fd_ < 0)
+      return 0;
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t value = 0;
+    if (read(fd_, &value, sizeof(value)) != sizeof(value))
+      return 0;
+    return value;
+  }
+
+  static PerfCounter cache_misses() {
+    return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+  }
+  static PerfCounter l1d_read_misses() {
+    return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+  }
+  static PerfCounter dtlb_read_misses() {
+    return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+  }
+
+private:
+  int fd_ = -1;
+};
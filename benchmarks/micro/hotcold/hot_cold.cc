@@ -0,0 +1,158 @@
+#include "../common/datasets.h"
+#include "../common/leaf_layout.h"
+#include "../common/perf_counters.h"
+#include "benchmark/benchmark.h"
+#include "ds/storage/particleBlock.h"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// P2P over the full leaf neighbourhood, Morton layout, with the blocks stored
+// the old way (every field of a block in one struct) or split into the hot
+// ParticleBlock::DataBlock and the cold ParticleBlock::ColdBlock. Same
+// arithmetic, the difference is how many bytes each source block drags in.
+
+#define SOFTENER 1e-20
+#define G 6.67430 * 10e-11
+
+namespace {
+
+constexpr int N = ParticleBlock::N;
+
+// Layout of ParticleBlock::DataBlock before the hot/cold split
+struct FullBlock {
+  alignas(16) std::array<double, N> x;
+  alignas(16) std::array<double, N> y;
+  alignas(16) std::array<double, N> z;
+  alignas(16) std::array<double, N> vx;
+  alignas(16) std::array<double, N> vy;
+  alignas(16) std::array<double, N> vz;
+  alignas(16) std::array<double, N> fx;
+  alignas(16) std::array<double, N> fy;
+  alignas(16) std::array<double, N> fz;
+  alignas(16) std::array<double, N> ax;
+  alignas(16) std::array<double, N> ay;
+  alignas(16) std::array<double, N> az;
+  alignas(16) std::array<double, N> mass;
+  alignas(16) std::array<uint64_t, N> visual_id;
+  unsigned short size = 0;
+};
+
+struct SplitBlocks {
+  std::vector<ParticleBlock::DataBlock> hot;
+  std::vector<ParticleBlock::ColdBlock> cold;
+};
+
+enum class Storage { kFull, kSplit };
+
+const char *storage_name(Storage s) {
+  return s == Storage::kFull ? "full" : "hot/cold";
+}
+
+template <class Hot>
+void fill(std::vector<Hot> &blocks, const bench::LeafSet &set,
+          const std::vector<uint32_t> &slot_of) {
+  for (uint32_t leaf = 0; leaf < set.leaves.size(); ++leaf) {
+    Hot &block = blocks[slot_of[leaf]];
+    const bench::Leaf &l = set.leaves[leaf];
+    for (size_t p = l.begin; p < l.end && block.size < N; ++p) {
+      const Particle &src = set.particles[p];
+      block.x[block.size] = src.getX();
+      block.y[block.size] = src.getY();
+      block.z[block.size] = src.getZ();
+      block.mass[block.size] = src.getMass();
+      block.size++;
+    }
+  }
+}
+
+template <class Hot, class Acc>
+inline void block_pair(const Hot &dst, Acc &acc, const Hot &src) {
+  for (int i = 0; i < dst.size; ++i) {
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    for (int j = 0; j < src.size; ++j) {
+      const double dx = src.x[j] - dst.x[i];
+      const double dy = src.y[j] - dst.y[i];
+      const double dz = src.z[j] - dst.z[i];
+      const double r2 = dx * dx + dy * dy + dz * dz + SOFTENER;
+      const double inv_r = 1.0 / std::sqrt(r2);
+      const double common = G * src.mass[j] * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+    acc.ax[i] += ax;
+    acc.ay[i] += ay;
+    acc.az[i] += az;
+  }
+}
+
+void BM_p2p_hot_cold(benchmark::State &state) {
+  const auto storage = static_cast<Storage>(state.range(0));
+  const auto n = static_cast<size_t>(state.range(1));
+
+  const bench::LeafSet set =
+      bench::build_leaves(bench::make_dataset(bench::Dataset::kUniform, n));
+  const std::vector<uint32_t> slot_of =
+      bench::layout_permutation(set, bench::Layout::kMorton);
+  const bench::SlotNeighbours nb = bench::slot_neighbours(set, slot_of);
+  const size_t n_leaves = set.leaves.size();
+
+  std::vector<FullBlock> full;
+  SplitBlocks split;
+  size_t bytes = 0;
+  if (storage == Storage::kFull) {
+    full.resize(n_leaves);
+    fill(full, set, slot_of);
+    bytes = n_leaves * sizeof(FullBlock);
+  } else {
+    split.hot.resize(n_leaves);
+    split.cold.resize(n_leaves);
+    fill(split.hot, set, slot_of);
+    bytes = n_leaves * sizeof(ParticleBlock::DataBlock);
+  }
+
+  PerfCounter misses = PerfCounter::cache_misses();
+  uint64_t total_misses = 0;
+
+  for (auto _ : state) {
+    misses.start();
+    for (size_t slot = 0; slot < n_leaves; ++slot) {
+      for (uint32_t k = nb.offsets[slot]; k < nb.offsets[slot + 1]; ++k) {
+        if (storage == Storage::kFull)
+          block_pair(full[slot], full[slot], full[nb.slots[k]]);
+        else
+          block_pair(split.hot[slot], split.cold[slot],
+                     split.hot[nb.slots[k]]);
+      }
+    }
+    total_misses += misses.stop();
+    benchmark::ClobberMemory();
+  }
+
+  const double pairs = double(nb.slots.size());
+  state.SetLabel(storage_name(storage));
+  state.counters["streamed_MB"] = double(bytes) / double(1 << 20);
+  if (misses.valid())
+    state.counters["llc_miss/pair"] = benchmark::Counter(
+        double(total_misses) / pairs, benchmark::Counter::kAvgIterations);
+  state.counters["pairs/s"] = benchmark::Counter(
+      pairs, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void configs(benchmark::internal::Benchmark *b) {
+  for (long n : {1 << 17, 1 << 21})
+    for (long storage : {long(Storage::kFull), long(Storage::kSplit)})
+      b->Args({storage, n});
+}
+
+} // namespace
+
+BENCHMARK(BM_p2p_hot_cold)
+    ->Apply(configs)
+    ->Unit(benchmark::kMillisecond)
+    ->Repetitions(3)
+    ->DisplayAggregatesOnly(true);
+BENCHMARK_MAIN();
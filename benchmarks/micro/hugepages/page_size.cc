@@ -0,0 +1,150 @@
+#include "../common/datasets.h"
+#include "../common/leaf_layout.h"
+#include "../common/perf_counters.h"
+#include "benchmark/benchmark.h"
+#include "ds/storage/particleBlock.h"
+#include "memory/blocks_arena.h"
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// P2P over the full leaf neighbourhood with the blocks living in a real
+// BlocksAllocator, backed by small or huge pages. Blocks are laid out in
+// Morton or random leaf order: random is the TLB worst case, Morton is what
+// kSpatial placement gives us.
+
+#define SOFTENER 1e-20
+#define G 6.67430 * 10e-11
+
+namespace {
+
+struct Arena {
+  std::unique_ptr<BlocksAllocator> allocator;
+  std::vector<ParticleBlock::DataBlock *> blocks; // layout order
+  std::vector<ParticleBlock::ColdBlock *> cold;
+  std::vector<uint32_t> nb_offsets;
+  std::vector<uint32_t> nb_slots;
+};
+
+Arena make_arena(const bench::LeafSet &set, bench::Layout layout,
+                 PageSize pages) {
+  const std::vector<uint32_t> slot_of = bench::layout_permutation(set, layout);
+  const size_t n_leaves = set.leaves.size();
+
+  Arena arena;
+  arena.allocator = std::make_unique<BlocksAllocator>(
+      n_leaves, n_leaves, BlockPlacement::kSpatial, pages);
+  if (arena.allocator->initialize() != 0)
+    return arena;
+
+  // Spatial placement hands out slot `hint` on an empty arena, so slot k of
+  // the layout sits at arena index k
+  arena.blocks.resize(n_leaves);
+  arena.cold.resize(n_leaves);
+  for (uint32_t slot = 0; slot < n_leaves; ++slot) {
+    ParticleBlock *block = arena.allocator->allocate(slot);
+    new (block) ParticleBlock();
+    arena.blocks[slot] = &block->data_block;
+    arena.cold[slot] = arena.allocator->cold_at(slot);
+  }
+
+  for (uint32_t leaf = 0; leaf < n_leaves; ++leaf) {
+    ParticleBlock::DataBlock &block = *arena.blocks[slot_of[leaf]];
+    const bench::Leaf &l = set.leaves[leaf];
+    for (size_t p = l.begin; p < l.end && block.size < ParticleBlock::N; ++p) {
+      const Particle &src = set.particles[p];
+      block.x[block.size] = src.getX();
+      block.y[block.size] = src.getY();
+      block.z[block.size] = src.getZ();
+      block.mass[block.size] = src.getMass();
+      block.size++;
+    }
+  }
+
+  bench::SlotNeighbours nb = bench::slot_neighbours(set, slot_of);
+  arena.nb_offsets = std::move(nb.offsets);
+  arena.nb_slots = std::move(nb.slots);
+  return arena;
+}
+
+inline void block_pair(const ParticleBlock::DataBlock &dst,
+                       ParticleBlock::ColdBlock &dst_cold,
+                       const ParticleBlock::DataBlock &src) {
+  for (int i = 0; i < dst.size; ++i) {
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    for (int j = 0; j < src.size; ++j) {
+      const double dx = src.x[j] - dst.x[i];
+      const double dy = src.y[j] - dst.y[i];
+      const double dz = src.z[j] - dst.z[i];
+      const double r2 = dx * dx + dy * dy + dz * dz + SOFTENER;
+      const double inv_r = 1.0 / std::sqrt(r2);
+      const double common = G * src.mass[j] * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+    dst_cold.ax[i] += ax;
+    dst_cold.ay[i] += ay;
+    dst_cold.az[i] += az;
+  }
+}
+
+void sweep(Arena &arena) {
+  for (size_t slot = 0; slot < arena.blocks.size(); ++slot) {
+    for (uint32_t k = arena.nb_offsets[slot]; k < arena.nb_offsets[slot + 1];
+         ++k)
+      block_pair(*arena.blocks[slot], *arena.cold[slot],
+                 *arena.blocks[arena.nb_slots[k]]);
+  }
+}
+
+void BM_p2p_pages(benchmark::State &state) {
+  const auto layout = static_cast<bench::Layout>(state.range(0));
+  const auto pages = static_cast<PageSize>(state.range(1));
+  const auto n = static_cast<size_t>(state.range(2));
+
+  const bench::LeafSet set =
+      bench::build_leaves(bench::make_dataset(bench::Dataset::kUniform, n));
+  Arena arena = make_arena(set, layout, pages);
+  if (arena.blocks.empty()) {
+    state.SkipWithError("arena reservation failed");
+    return;
+  }
+
+  PerfCounter tlb_misses = PerfCounter::dtlb_read_misses();
+  uint64_t total_tlb = 0;
+
+  for (auto _ : state) {
+    tlb_misses.start();
+    sweep(arena);
+    total_tlb += tlb_misses.stop();
+    benchmark::ClobberMemory();
+  }
+
+  const double pairs = double(arena.nb_slots.size());
+  state.SetLabel(std::string(bench::layout_name(layout)) + "/" +
+                 page_backing_name(arena.allocator->page_backing()));
+  state.counters["arena_MB"] =
+      double(arena.blocks.size() * sizeof(ParticleBlock)) / double(1 << 20);
+  if (tlb_misses.valid())
+    state.counters["dtlb_miss/pair"] = benchmark::Counter(
+        double(total_tlb) / pairs, benchmark::Counter::kAvgIterations);
+  state.counters["pairs/s"] = benchmark::Counter(
+      pairs, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void configs(benchmark::internal::Benchmark *b) {
+  for (long layout : {long(bench::Layout::kMorton), long(bench::Layout::kRandom)})
+    for (long pages : {long(PageSize::kSmall), long(PageSize::kHuge)})
+      b->Args({layout, pages, 1 << 20});
+}
+
+} // namespace
+
+BENCHMARK(BM_p2p_pages)
+    ->Apply(configs)
+    ->Unit(benchmark::kMillisecond)
+    ->Repetitions(3)
+    ->DisplayAggregatesOnly(true);
+BENCHMARK_MAIN();
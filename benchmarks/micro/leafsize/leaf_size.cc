@@ -0,0 +1,120 @@
+#include "../common/datasets.h"
+#include "../common/leaf_layout.h"
+#include "benchmark/benchmark.h"
+#include "ds/storage/particleBlock.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Near-field cost per leaf size. Leaves split at the block capacity, exactly
+// as the tree does with -DGRAVWLL_BLOCK_CAPACITY=C, blocks sit in Morton
+// order and every leaf interacts with itself and its 26-neighbourhood. Bigger
+// leaves mean fewer, longer pair loops but more bodies per near field; the
+// far field (not measured here) moves the other way.
+
+#define SOFTENER 1e-20
+#define G 6.67430 * 10e-11
+
+namespace {
+
+template <class Block> struct Arena {
+  std::vector<typename Block::DataBlock> hot; // Morton order
+  std::vector<typename Block::ColdBlock> cold;
+  std::vector<uint32_t> nb_offsets;
+  std::vector<uint32_t> nb_slots; // self first
+  double interactions = 0;        // body pairs per sweep
+};
+
+template <class Block> Arena<Block> make_arena(size_t n) {
+  using Scalar = typename Block::scalar_type;
+  const bench::LeafSet set = bench::build_leaves(
+      bench::make_dataset(bench::Dataset::kUniform, n), Block::N);
+  const std::vector<uint32_t> slot_of =
+      bench::layout_permutation(set, bench::Layout::kMorton);
+  const size_t n_leaves = set.leaves.size();
+
+  Arena<Block> arena;
+  arena.hot.resize(n_leaves);
+  arena.cold.resize(n_leaves);
+  for (uint32_t leaf = 0; leaf < n_leaves; ++leaf) {
+    auto &block = arena.hot[slot_of[leaf]];
+    const bench::Leaf &l = set.leaves[leaf];
+    for (size_t p = l.begin; p < l.end && block.size < Block::N; ++p) {
+      const Particle &src = set.particles[p];
+      block.x[block.size] = static_cast<Scalar>(src.getX());
+      block.y[block.size] = static_cast<Scalar>(src.getY());
+      block.z[block.size] = static_cast<Scalar>(src.getZ());
+      block.mass[block.size] = static_cast<Scalar>(src.getMass());
+      block.size++;
+    }
+  }
+
+  bench::SlotNeighbours nb =
+      bench::slot_neighbours(set, slot_of, /*self_first=*/true);
+  arena.nb_offsets = std::move(nb.offsets);
+  arena.nb_slots = std::move(nb.slots);
+  for (uint32_t slot = 0; slot < n_leaves; ++slot)
+    for (uint32_t k = arena.nb_offsets[slot]; k < arena.nb_offsets[slot + 1];
+         ++k)
+      arena.interactions +=
+          double(arena.hot[slot].size) * arena.hot[arena.nb_slots[k]].size;
+  return arena;
+}
+
+template <class Block>
+inline void block_pair(const typename Block::DataBlock &dst,
+                       typename Block::ColdBlock &acc,
+                       const typename Block::DataBlock &src) {
+  using Scalar = typename Block::scalar_type;
+  const Scalar soft = static_cast<Scalar>(SOFTENER);
+  const Scalar g = static_cast<Scalar>(G);
+  for (int i = 0; i < dst.size; ++i) {
+    Scalar ax = 0, ay = 0, az = 0;
+    for (int j = 0; j < src.size; ++j) {
+      const Scalar dx = src.x[j] - dst.x[i];
+      const Scalar dy = src.y[j] - dst.y[i];
+      const Scalar dz = src.z[j] - dst.z[i];
+      const Scalar r2 = dx * dx + dy * dy + dz * dz + soft;
+      const Scalar inv_r = 1 / std::sqrt(r2);
+      const Scalar common = g * src.mass[j] * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+    acc.ax[i] += ax;
+    acc.ay[i] += ay;
+    acc.az[i] += az;
+  }
+}
+
+template <class Block> void BM_p2p_leaf_size(benchmark::State &state) {
+  const auto n = static_cast<size_t>(state.range(0));
+  Arena<Block> arena = make_arena<Block>(n);
+
+  for (auto _ : state) {
+    for (size_t slot = 0; slot < arena.hot.size(); ++slot)
+      for (uint32_t k = arena.nb_offsets[slot]; k < arena.nb_offsets[slot + 1];
+           ++k)
+        block_pair<Block>(arena.hot[slot], arena.cold[slot],
+                          arena.hot[arena.nb_slots[k]]);
+    benchmark::ClobberMemory();
+  }
+
+  state.counters["leaves"] = double(arena.hot.size());
+  state.counters["block_B"] = double(sizeof(typename Block::DataBlock));
+  state.counters["pairs/body"] = arena.interactions / double(n);
+  state.counters["interactions/s"] = benchmark::Counter(
+      arena.interactions, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+} // namespace
+
+#define LEAF_SIZE_BENCHMARK(scalar, capacity)                                  \
+  BENCHMARK_TEMPLATE(BM_p2p_leaf_size, BasicParticleBlock<scalar, capacity>)   \
+      ->Arg(1 << 17)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->Repetitions(3)                                                         \
+      ->DisplayAggregatesOnly(true);
+GRAVWLL_BLOCK_LAYOUTS(LEAF_SIZE_BENCHMARK)
+BENCHMARK_MAIN();
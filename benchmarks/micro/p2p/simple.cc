@@ -54,7 +54,7 @@ static inline double hsum256_pd(__m256d v) {
   return _mm_cvtsd_f64(sum);
 }
 
-ParticleBlock get_random_block() {
+ParticleBlock get_random_block(ParticleBlock::ColdBlock &cold) {
   srand(1);
   std::vector<Particle> tmp_;
   tmp_.reserve(16);
@@ -69,19 +69,21 @@ ParticleBlock get_random_block() {
         static_cast<double>(std::rand()) / RAND_MAX,
     });
   }
-  return ParticleBlock{10, tmp_};
+  return ParticleBlock{10, &cold, tmp_};
 }
 
 std::array<ParticleBlock::DataBlock, 27> get_27_blocks() {
   std::array<ParticleBlock::DataBlock, 27> data_blocks{};
+  ParticleBlock::ColdBlock cold{};
   for (int i = 0; i < 27; ++i) {
-    data_blocks[i] = get_random_block().data_block;
+    data_blocks[i] = get_random_block(cold).data_block;
   }
   return data_blocks;
 }
 
 inline void local_pairwise(
     ParticleBlock::DataBlock &prime_block,
+    ParticleBlock::ColdBlock &prime_cold,
     std::array<ParticleBlock::DataBlock, 27> &interaction_blocks_array) {
 
   const int n0 = prime_block.size;
@@ -94,9 +96,9 @@ inline void local_pairwise(
   double *const y0_arr = const_cast<double *>(prime_block.get_y().data());
   double *const z0_arr = const_cast<double *>(prime_block.get_z().data());
 
-  double *const ax_arr = prime_block.get_ax().data();
-  double *const ay_arr = prime_block.get_ay().data();
-  double *const az_arr = prime_block.get_az().data();
+  double *const ax_arr = prime_cold.ax.data();
+  double *const ay_arr = prime_cold.ay.data();
+  double *const az_arr = prime_cold.az.data();
 
   constexpr double Gval = G;        // локальная копия константы
   constexpr double soft = SOFTENER; // локальная копия softener
@@ -155,6 +157,7 @@ inline void local_pairwise(
 
 inline void local_pairwise_avx2(
     ParticleBlock::DataBlock &prime_block,
+    ParticleBlock::ColdBlock &prime_cold,
     std::array<ParticleBlock::DataBlock, 27> &interaction_blocks_array) {
 
   const int n0 = prime_block.size;
@@ -166,9 +169,9 @@ inline void local_pairwise_avx2(
   double *const y0_arr = const_cast<double *>(prime_block.get_y().data());
   double *const z0_arr = const_cast<double *>(prime_block.get_z().data());
 
-  double *const ax_arr = prime_block.get_ax().data();
-  double *const ay_arr = prime_block.get_ay().data();
-  double *const az_arr = prime_block.get_az().data();
+  double *const ax_arr = prime_cold.ax.data();
+  double *const ay_arr = prime_cold.ay.data();
+  double *const az_arr = prime_cold.az.data();
 
   constexpr double Gval = G;
   constexpr double soft = SOFTENER;
@@ -277,16 +280,18 @@ inline void local_pairwise_avx2(
 // This is the fastest version with 9 microsecs
 void BM_p2p_interaction_list(benchmark::State &state) {
   auto data_set = get_27_blocks();
+  ParticleBlock::ColdBlock cold{};
   for (auto _ : state) {
-    local_pairwise(data_set[0], data_set);
+    local_pairwise(data_set[0], cold, data_set);
   }
   benchmark::DoNotOptimize(data_set[0]);
 }
 
 void BM_p2p_interaction_list_SIMD(benchmark::State &state) {
   auto data_set = get_27_blocks();
+  ParticleBlock::ColdBlock cold{};
   for (auto _ : state) {
-    local_pairwise_avx2(data_set[0], data_set);
+    local_pairwise_avx2(data_set[0], cold, data_set);
   }
   benchmark::DoNotOptimize(data_set[0]);
 }
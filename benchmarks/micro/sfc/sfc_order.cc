@@ -0,0 +1,136 @@
+#include "../common/datasets.h"
+#include "../common/leaf_layout.h"
+#include "../common/perf_counters.h"
+#include "benchmark/benchmark.h"
+#include "ds/storage/particleBlock.h"
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// P2P over the full leaf neighbourhood with blocks stored in Morton, Hilbert
+// or random order. The arithmetic is identical in every run, the difference
+// is where the neighbour blocks sit in memory.
+
+#define SOFTENER 1e-20
+#define G 6.67430 * 10e-11
+
+namespace {
+
+struct Arena {
+  std::vector<ParticleBlock::DataBlock> blocks; // layout order
+  std::vector<ParticleBlock::ColdBlock> cold;
+  std::vector<uint32_t> nb_offsets;
+  std::vector<uint32_t> nb_slots;
+};
+
+Arena make_arena(const bench::LeafSet &set, bench::Layout layout) {
+  const std::vector<uint32_t> slot_of = bench::layout_permutation(set, layout);
+  const size_t n_leaves = set.leaves.size();
+
+  Arena arena;
+  arena.blocks.resize(n_leaves);
+  arena.cold.resize(n_leaves);
+  for (uint32_t leaf = 0; leaf < n_leaves; ++leaf) {
+    ParticleBlock::DataBlock &block = arena.blocks[slot_of[leaf]];
+    const bench::Leaf &l = set.leaves[leaf];
+    for (size_t p = l.begin; p < l.end && block.size < ParticleBlock::N; ++p) {
+      const Particle &src = set.particles[p];
+      block.x[block.size] = src.getX();
+      block.y[block.size] = src.getY();
+      block.z[block.size] = src.getZ();
+      block.mass[block.size] = src.getMass();
+      block.size++;
+    }
+  }
+
+  bench::SlotNeighbours nb = bench::slot_neighbours(set, slot_of);
+  arena.nb_offsets = std::move(nb.offsets);
+  arena.nb_slots = std::move(nb.slots);
+  return arena;
+}
+
+inline void block_pair(const ParticleBlock::DataBlock &dst,
+                       ParticleBlock::ColdBlock &dst_cold,
+                       const ParticleBlock::DataBlock &src) {
+  for (int i = 0; i < dst.size; ++i) {
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    for (int j = 0; j < src.size; ++j) {
+      const double dx = src.x[j] - dst.x[i];
+      const double dy = src.y[j] - dst.y[i];
+      const double dz = src.z[j] - dst.z[i];
+      const double r2 = dx * dx + dy * dy + dz * dz + SOFTENER;
+      const double inv_r = 1.0 / std::sqrt(r2);
+      const double common = G * src.mass[j] * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+    dst_cold.ax[i] += ax;
+    dst_cold.ay[i] += ay;
+    dst_cold.az[i] += az;
+  }
+}
+
+void sweep(Arena &arena) {
+  for (size_t slot = 0; slot < arena.blocks.size(); ++slot) {
+    for (uint32_t k = arena.nb_offsets[slot]; k < arena.nb_offsets[slot + 1];
+         ++k)
+      block_pair(arena.blocks[slot], arena.cold[slot],
+                 arena.blocks[arena.nb_slots[k]]);
+  }
+}
+
+void BM_p2p_layout(benchmark::State &state) {
+  const auto dataset = static_cast<bench::Dataset>(state.range(0));
+  const auto layout = static_cast<bench::Layout>(state.range(1));
+  const auto n = static_cast<size_t>(state.range(2));
+
+  const bench::LeafSet set =
+      bench::build_leaves(bench::make_dataset(dataset, n));
+  Arena arena = make_arena(set, layout);
+
+  PerfCounter misses = PerfCounter::cache_misses();
+  PerfCounter l1_misses = PerfCounter::l1d_read_misses();
+  uint64_t total_misses = 0, total_l1 = 0;
+
+  for (auto _ : state) {
+    misses.start();
+    l1_misses.start();
+    sweep(arena);
+    total_l1 += l1_misses.stop();
+    total_misses += misses.stop();
+    benchmark::ClobberMemory();
+  }
+
+  const double pairs = double(arena.nb_slots.size());
+  state.SetLabel(std::string(bench::dataset_name(dataset)) + "/" +
+                 bench::layout_name(layout));
+  state.counters["leaves"] = double(arena.blocks.size());
+  state.counters["nb_per_leaf"] = pairs / double(arena.blocks.size());
+  if (misses.valid())
+    state.counters["llc_miss/pair"] = benchmark::Counter(
+        double(total_misses) / pairs, benchmark::Counter::kAvgIterations);
+  if (l1_misses.valid())
+    state.counters["l1d_miss/pair"] = benchmark::Counter(
+        double(total_l1) / pairs, benchmark::Counter::kAvgIterations);
+  state.counters["pairs/s"] = benchmark::Counter(
+      pairs, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void layouts(benchmark::internal::Benchmark *b) {
+  for (long dataset : {long(bench::Dataset::kUniform),
+                       long(bench::Dataset::kPlummer)})
+    for (long layout : {long(bench::Layout::kMorton),
+                        long(bench::Layout::kHilbert),
+                        long(bench::Layout::kRandom)})
+      b->Args({dataset, layout, 1 << 17});
+}
+
+} // namespace
+
+BENCHMARK(BM_p2p_layout)
+    ->Apply(layouts)
+    ->Unit(benchmark::kMillisecond)
+    ->Repetitions(3)
+    ->DisplayAggregatesOnly(true);
+BENCHMARK_MAIN();
@@ -0,0 +1,184 @@
+#include "../common/datasets.h"
+#include "benchmark/benchmark.h"
+#include "dist/let.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/neighbour_lists.h"
+#include "ds/tree/octree.h"
+#include "engine/expansions.h"
+#include "engine/load_balance.h"
+#include "engine/pairwise.h"
+#include "engine/task_graph.h"
+#include "memory/expansion_arena.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+// The whole force phase of one tick (P2M/M2M, P2P, far field) on a fixed
+// tree, per number of runners. `graph` is ForceTaskGraph as the engine runs
+// it; `phased` is the same work with a barrier after every upward level and
+// between the near and the far pass, which is what the graph replaced.
+// runners = 1 is the serial reference, no pool at all.
+
+namespace {
+
+enum Mode : int64_t { kGraph, kPhased };
+
+struct Tick {
+  std::unique_ptr<Storage> storage;
+  std::unique_ptr<AROctree> tree;
+  std::vector<AROctreeNode *> leaves, nodes;
+  std::vector<size_t> level_first; // level k is nodes [first[k], first[k+1])
+  LeafNeighbourLists lists;
+  LeafCostModel costs;
+  ExpansionArena arena;
+  Expansions ex;
+  std::vector<size_t> far_first;
+  std::vector<double> far_ax, far_ay, far_az;
+
+  Tick(bench::Dataset dataset, size_t n) {
+    storage = std::make_unique<Storage>(static_cast<unsigned>(n));
+    tree = std::make_unique<AROctree>(
+        16, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}}, *storage);
+    tree->insert_batch(bench::make_dataset(dataset, n));
+    tree->collect_leaves(leaves);
+    tree->collect_nodes(nodes);
+    for (size_t k = 0; k < nodes.size(); ++k)
+      if (k == 0 || nodes[k]->depth != nodes[k - 1]->depth)
+        level_first.push_back(k);
+    level_first.push_back(nodes.size());
+    lists.rebuild(leaves, *storage);
+    costs.reset(lists.leaf_count());
+    for (size_t leaf = 0; leaf < lists.leaf_count(); ++leaf)
+      costs.record(leaf, {.p2p_pairs = leaf_pairs(lists, *storage, leaf)});
+    arena.reserve(Expansions::bytes_for(nodes.size()));
+    ex.carve(arena, nodes.size());
+
+    far_first.assign(leaves.size() + 1, 0);
+    for (size_t leaf = 0; leaf < leaves.size(); ++leaf) {
+      size_t bodies = 0;
+      for (const ParticleBlock *block = leaves[leaf]->localBlock; block;
+           block = storage->next_block(block))
+        bodies += block->size();
+      far_first[leaf + 1] = far_first[leaf] + bodies;
+    }
+    far_ax.assign(far_first.back(), 0.0);
+    far_ay.assign(far_first.back(), 0.0);
+    far_az.assign(far_first.back(), 0.0);
+  }
+
+  void near_field(size_t begin, size_t end) {
+    for (size_t leaf = begin; leaf < end; ++leaf) {
+      for (ParticleBlock *block = storage->block_at(lists.leaf_block(leaf));
+           block; block = storage->next_block(block)) {
+        block->get_ax().fill(0);
+        block->get_ay().fill(0);
+        block->get_az().fill(0);
+      }
+      calc_leaf_ax(lists, *storage, leaf);
+    }
+  }
+
+  // As PhysicsEngine::collect_far_field
+  void far_field(size_t begin, size_t end) {
+    dist::EssentialTree far;
+    std::vector<uint32_t> near;
+    for (size_t leaf = begin; leaf < end; ++leaf) {
+      const uint32_t head = lists.leaf_block(leaf);
+      const std::span<const uint32_t> neighbours = lists.neighbour_blocks(leaf);
+      near.assign(neighbours.begin(), neighbours.end());
+      near.push_back(head);
+      far.clear();
+      dist::collect_far_field(*tree->get_root(), *storage, ex,
+                              leaves[leaf]->bounds, near, dist::kDefaultTheta,
+                              far);
+      size_t at = far_first[leaf];
+      for (std::vector<double> *axis : {&far_ax, &far_ay, &far_az})
+        std::fill(axis->begin() + static_cast<ptrdiff_t>(at),
+                  axis->begin() + static_cast<ptrdiff_t>(far_first[leaf + 1]),
+                  0.0);
+      for (const ParticleBlock *block = storage->block_at(head); block;
+           block = storage->next_block(block)) {
+        dist::apply_essential(far, *block, far_ax.data() + at,
+                              far_ay.data() + at, far_az.data() + at);
+        at += block->size();
+      }
+    }
+  }
+};
+
+void BM_force_phase(benchmark::State &state) {
+  const auto dataset = static_cast<bench::Dataset>(state.range(0));
+  const auto n = static_cast<size_t>(state.range(1));
+  const auto runners = static_cast<unsigned>(state.range(2));
+  const auto mode = static_cast<Mode>(state.range(3));
+  Tick tick{dataset, n};
+  const std::vector<size_t> cuts = tick.costs.partition(size_t{runners} * 4);
+  const auto near = [&](size_t begin, size_t end) {
+    tick.near_field(begin, end);
+  };
+  const auto far = [&](size_t begin, size_t end) {
+    tick.far_field(begin, end);
+  };
+
+  std::unique_ptr<ThreadPool> pool;
+  if (runners > 1)
+    pool = std::make_unique<ThreadPool>(runners - 1);
+  ForceTaskGraph graph;
+  for (auto _ : state) {
+    if (!pool) {
+      upward_pass(tick.nodes, *tick.storage, tick.ex);
+      near(0, tick.leaves.size());
+      far(0, tick.leaves.size());
+    } else if (mode == kGraph) {
+      graph.run(*pool, tick.nodes, *tick.storage, tick.ex, cuts, {}, near,
+                far);
+    } else {
+      for (size_t level = tick.level_first.size() - 1; level-- > 0;)
+        pool->parallel_for(
+            tick.level_first[level + 1] - tick.level_first[level], 0,
+            [&](size_t begin, size_t end) {
+              for (size_t k = begin; k < end; ++k)
+                upward_node(*tick.nodes[tick.level_first[level] + k],
+                            *tick.storage, tick.ex);
+            });
+      pool->for_each_chunk(cuts.size() - 1, {}, [&](size_t c) {
+        near(cuts[c], cuts[c + 1]);
+      });
+      pool->for_each_chunk(cuts.size() - 1, {},
+                           [&](size_t c) { far(cuts[c], cuts[c + 1]); });
+    }
+    benchmark::DoNotOptimize(tick.far_ax.data());
+  }
+  state.SetLabel(std::string(bench::dataset_name(dataset)) + "/" +
+                 (runners == 1 ? "serial" : mode == kGraph ? "graph" : "phased"));
+  state.counters["runners"] = runners;
+  state.counters["hw_threads"] = std::thread::hardware_concurrency();
+  state.counters["leaves"] = double(tick.leaves.size());
+  state.counters["levels"] = double(tick.level_first.size() - 1);
+  state.counters["bodies/s"] = benchmark::Counter(
+      double(n), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void runner_counts(benchmark::internal::Benchmark *b) {
+  for (int64_t dataset : {0, 1}) {
+    b->Args({dataset, 1 << 16, 1, kGraph});
+    for (int64_t runners : {2, 4, 8, 16, 32, 64})
+      for (int64_t mode : {kGraph, kPhased})
+        b->Args({dataset, 1 << 16, runners, mode});
+  }
+}
+} // namespace
+
+BENCHMARK(BM_force_phase)
+    ->Apply(runner_counts)
+    ->ArgNames({"dataset", "n", "runners", "mode"})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime()
+    ->Repetitions(3)
+    ->DisplayAggregatesOnly(true);
+BENCHMARK_MAIN();
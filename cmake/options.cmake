@@ -10,6 +10,7 @@ option(ENABLE_TESTS "Enable unittesting" OFF)
 option(GRAVWLL_SANITIZE "Enable sanitize" OFF)
 option(GRAVWLL_PERF "Perf build" OFF)
 option(GRAVWLL_ENABLE_LTO "Include lto" OFF)
+option(GRAVWLL_RACE_CHECK "Check per-phase block ownership at runtime" OFF)
 
 #======Directories=======#
 
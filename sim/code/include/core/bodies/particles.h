@@ -16,9 +16,10 @@ public:
 
   Particle(double x, double y, double z, double vx, double vy, double vz,
            double fx, double fy, double fz, double ax, double ay, double az,
-           double mass)
+           double mass, uint64_t visual_id = 0)
       : x(x), y(y), z(z), vx(vx), vy(vy), vz(vz), fx(fx), fy(fy), fz(fz),
-        ax(ax), ay(ay), az(az), mass((mass > 0) ? mass : -mass) {}
+        ax(ax), ay(ay), az(az), mass((mass > 0) ? mass : -mass),
+        visual_id(visual_id) {}
 
   Particle(MyMath::Vector3 position, MyMath::Vector3 velocity, double mass)
       : x(position.x), y(position.y), z(position.z), vx(velocity.x),
@@ -56,6 +57,8 @@ public:
   inline double getAy() const;
   inline double getAz() const;
 
+  uint64_t getVisualId() const { return visual_id; }
+
   inline void update_velocity(double dvx, double dvy, double dvz);
   inline void update_position(double dx, double dy, double dz);
   inline void move(double dx, double dy, double dz);
@@ -68,7 +71,7 @@ private:
   double fx, fy, fz;
   double ax, ay, az;
   double mass;
-  uint64_t visual_id;
+  uint64_t visual_id = 0;
 };
 inline std::ostream &operator<<(std::ostream &out, Particle const &p);
 
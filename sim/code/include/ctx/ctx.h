@@ -1,12 +1,17 @@
 #pragma once
 #include "core/bodies/particles.h"
+#include "dist/domain.h"
+#include "dist/transport.h"
 #include "ds/storage/storage.h"
+#include "io/body_source.h"
 #include "simulation_config.h"
 #include "simulation_state.h"
+#include "utils/affinity.h"
 #include "utils/namespaces/MyMath.h"
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <string>
 #include <sys/types.h>
 #include <vector>
 
@@ -31,14 +36,53 @@ struct PhysicsCtx {
   std::chrono::microseconds integration_step;
   unsigned short tree_max_depth = 10;
   bool debug = false;
+  // Prints the near-field balance every few ticks (PhysicsEngine)
+  bool verbose = false;
+  // Pool workers besides the engine thread, 0 = one per hardware thread
+  unsigned workers = 0;
+  // [0] engine thread, [1 + i] worker i; filled by Ctx from the plan
+  std::vector<std::vector<unsigned>> runner_cpus;
+  // Arena region (NUMA node) of each runner, same indexing. Empty on one
+  // node. A region's leaves go to its runners first
+  std::vector<unsigned> runner_homes;
+  // Set by Ctx when the run has more than one rank, otherwise nullptr. Not
+  // owned
+  dist::Transport *transport = nullptr;
+  const dist::Decomposition *domain = nullptr;
+  // Snapshots every this many ticks, 0 = never, to "<prefix>_<tick>.gwp"
+  // or, with several ranks, a share per rank plus a manifest
+  // (io/snapshot_writer.h). The writer thread runs on io_cpus, filled by
+  // Ctx. GADGET snapshots use the input's GADGET units, so they read back
+  // with the same config
+  uint snapshot_every = 0;
+  std::string snapshot_prefix;
+  io::SnapshotFormat snapshot_format = io::SnapshotFormat::kGwp;
+  io::GadgetUnits snapshot_units;
+  std::vector<unsigned> io_cpus;
 
   static PhysicsCtx from_config(const SimulationConfig &config) {
     return PhysicsCtx{.integration_step =
                           std::chrono::microseconds(config.integration_step),
                       .tree_max_depth = config.kTreeMaxDepth,
-                      .debug = config.kDebug};
+                      .debug = config.kDebug,
+                      .verbose = config.kVerbose,
+                      .workers = config.kWorkers,
+                      .runner_cpus = {},
+                      .runner_homes = {},
+                      .transport = nullptr,
+                      .domain = nullptr,
+                      .snapshot_every = config.kSnapshotEvery,
+                      .snapshot_prefix = snapshot_prefix_for(config),
+                      .snapshot_format = config.kSnapshotFormat,
+                      .snapshot_units = config.gadget_units,
+                      .io_cpus = {}};
   }
   unsigned short tree_depth() const { return tree_max_depth; }
+
+private:
+  static std::string snapshot_prefix_for(const SimulationConfig &config) {
+    return config.kSnapshotDir + "/snapshot";
+  }
 };
 
 // Контекст для данных
@@ -47,7 +91,11 @@ struct DataCtx {
   SimulationConfig::PUPULATION_MODE population_mode;
   size_t body_count = 0;
   int random_seed = 42;
-  const MyMath::BoundingBox bounding_box_ = {{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}};
+  // DATAMODE=file: the opened input, which the engine inserts from
+  // directly instead of initial_dataset. Released once the tree is built
+  std::shared_ptr<const io::BodySource> input = nullptr;
+  // Taken from the input in DATAMODE=file
+  MyMath::BoundingBox bounding_box_ = {{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}};
   // const MyMath::BoundingBox bounding_box_ = {{0.0, 0.0, 0.0},
   // {4.0, 4.0, 2.0}};
 
@@ -81,6 +129,12 @@ public:
   Storage &storage() { return std::ref(storage_); }
   const Storage &storage() const { return storage_; }
 
+  // Where every thread runs, see utils/affinity.h
+  const affinity::Plan &affinity() const { return affinity_; }
+  // nullptr for a single-rank run
+  dist::Transport *transport() { return transport_.get(); }
+  const dist::Decomposition &domain() const { return domain_; }
+
   const MyMath::BoundingBox &bounding_box() const {
     return data_ctx_.bounding_box_;
   }
@@ -91,13 +145,21 @@ public:
 
 private:
   void initialize_components();
+  void plan_affinity();
+  // Joins the other ranks and keeps only this rank's share of the dataset
+  void connect_ranks();
   std::vector<Particle> create_initial_dataset();
 
   SimulationConfig config_;
+  // DATAMODE=file input until create_initial_dataset() hands it to data_ctx_
+  std::shared_ptr<const io::BodySource> input_;
   SimulationState state_;
   Storage storage_;
 
   GfxCtx gfx_ctx_;
   PhysicsCtx physics_ctx_;
   DataCtx data_ctx_;
+  affinity::Plan affinity_;
+  std::unique_ptr<dist::Transport> transport_;
+  dist::Decomposition domain_;
 };
@@ -91,8 +91,4 @@ public:
   static std::vector<Particle> download_dataset(const std::string &dataset_name,
                                                 size_t max_particles = 0);
   static std::vector<DatasetInfo> get_available_datasets();
-
-private:
-  static std::vector<Particle> parse_hdf5(const std::string &filename);
-  static std::vector<Particle> parse_csv(const std::string &filename);
 };
@@ -1,6 +1,13 @@
 #pragma once
 
 #include "config.h"
+#include "ds/tree/sfc.h"
+#include "io/gadget.h"
+#include "io/snapshot_writer.h"
+#include "io/text_table.h"
+#include "memory/blocks_arena.h"
+#include "memory/numa.h"
+#include "utils/affinity.h"
 #include "utils/namespaces/error_namespace.h"
 #include <functional>
 #include <limits>
@@ -9,6 +16,7 @@
 #include <sys/types.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace config {
 
@@ -37,7 +45,13 @@ private:
       {"--N_bodies", "n"},
       {"-n", "n"},
       {"-s", "seed"},
-      {"-seed", "seed"}};
+      {"-seed", "seed"},
+      {"--workers", "workers"},
+      {"-w", "workers"},
+      {"--file", "file"},
+      {"-f", "file"},
+      {"--ranks", "ranks"},
+      {"--rank", "rank"}};
 };
 
 class ConfigFileReader {
@@ -48,8 +62,13 @@ public:
 
   ConfigFileReader() = default;
   ConfigFileReader(const std::string &config_directory);
+  // Keys and values are lowercased, except the values of kVerbatimKeys. An
+  // absolute `filename` is not looked up in the config directory
   ConfigData read_config(const std::string &filename);
 
+  static inline const std::unordered_set<std::string> kVerbatimKeys = {
+      "file", "snapshotdir", "shmname"};
+
 private:
   std::string config_directory_ = CONFIG_DIRECTORY;
 };
@@ -66,7 +85,29 @@ struct SimulationConfig {
   ushort kFpsDesired = 0;
   uint integration_step = 0;
   int random_seed = 0;
-  std::string filename;
+  sfc::Curve kSfcCurve = sfc::Curve::kMorton;
+  BlockPlacement kBlockPlacement = BlockPlacement::kSpatial;
+  PageSize kPageSize = PageSize::kSmall;
+  bool kNumaRegions = true;
+  uint kWorkers = 0; // physics pool, 0 = one per hardware thread
+  // Thread placement, see utils/affinity.h. Empty lists follow kAffinity
+  affinity::Layout kAffinity = affinity::Layout::kNone;
+  std::vector<unsigned> physics_cpus;
+  std::vector<unsigned> render_cpus;
+  std::vector<unsigned> io_cpus;
+  // Domain decomposition over processes, see dist/domain.h. Every rank of a
+  // run has the same kRanks and kShmName and its own kRank
+  uint kRanks = 1;
+  uint kRank = 0;
+  std::string kShmName = "/gravwll";
+  // Every kSnapshotEvery ticks (0: never) the bodies are written to
+  // kSnapshotDir as kSnapshotFormat, see io/snapshot_writer.h
+  uint kSnapshotEvery = 0;
+  std::string kSnapshotDir = "snapshots";
+  io::SnapshotFormat kSnapshotFormat = io::SnapshotFormat::kGwp;
+  std::string filename; // DATAMODE=file input, N comes from the file
+  io::TextFormat text_format; // when `filename` is a CSV/whitespace table
+  io::GadgetUnits gadget_units; // when it is a GADGET snapshot
   std::string data_set_name;
   std::string fetch_url;
 
@@ -109,8 +150,10 @@ public:
            int value = std::stoi(val);
            if (value < 3)
              throw std::out_of_range("kTreeMaxDepth must be > 3");
-           if (value > 30)
-             throw std::out_of_range("kTreeMaxDepth is over 30. Rethink");
+           // Location codes hold sfc::kMaxLevel levels below the root
+           if (value > static_cast<int>(sfc::kMaxLevel))
+             throw std::out_of_range("kTreeMaxDepth must be <= " +
+                                     std::to_string(sfc::kMaxLevel));
            config_.kTreeMaxDepth = static_cast<unsigned short>(value);
          }},
         {"integrationstep",
@@ -138,6 +181,28 @@ public:
          [this](const std::string &val) {
            config_.data_population_mode = config_.from_string(val);
          }},
+        {"file",
+         [this](const std::string &val) { config_.filename = val; }},
+        {"csvheader",
+         [this](const std::string &val) {
+           config_.text_format.header = io::header_from_string(val);
+         }},
+        {"csvcolumns",
+         [this](const std::string &val) {
+           config_.text_format.columns = val;
+         }},
+        {"gadgetlength",
+         [this](const std::string &val) {
+           config_.gadget_units.length = positive(val, "GadgetLength");
+         }},
+        {"gadgetmass",
+         [this](const std::string &val) {
+           config_.gadget_units.mass = positive(val, "GadgetMass");
+         }},
+        {"gadgetvelocity",
+         [this](const std::string &val) {
+           config_.gadget_units.velocity = positive(val, "GadgetVelocity");
+         }},
         {"n",
          [this](const std::string &val) {
            debug::debug_print("n value {}", val);
@@ -149,6 +214,87 @@ public:
                  "integrationstep is too big for int to handle");
            config_.kNBodies = static_cast<uint>(value);
          }},
+        {"curve",
+         [this](const std::string &val) {
+           config_.kSfcCurve = sfc::curve_from_string(val);
+         }},
+        {"placement",
+         [this](const std::string &val) {
+           config_.kBlockPlacement = placement_from_string(val);
+         }},
+        {"pages",
+         [this](const std::string &val) {
+           config_.kPageSize = page_size_from_string(val);
+         }},
+        {"numa",
+         [this](const std::string &val) {
+           config_.kNumaRegions = config_.process_bools(val);
+         }},
+        {"workers",
+         [this](const std::string &val) {
+           debug::debug_print("workers value {}", val);
+           int value = std::stoi(val);
+           if (value < 0)
+             throw std::out_of_range("workers must be >= 0");
+           if (value > 1024)
+             throw std::out_of_range("workers is over 1024. Rethink");
+           config_.kWorkers = static_cast<uint>(value);
+         }},
+        {"affinity",
+         [this](const std::string &val) {
+           config_.kAffinity = affinity::layout_from_string(val);
+         }},
+        {"physicscpus",
+         [this](const std::string &val) {
+           config_.physics_cpus = parse_cpus(val);
+         }},
+        {"rendercpus",
+         [this](const std::string &val) {
+           config_.render_cpus = parse_cpus(val);
+         }},
+        {"iocpus",
+         [this](const std::string &val) {
+           config_.io_cpus = parse_cpus(val);
+         }},
+        {"ranks",
+         [this](const std::string &val) {
+           int value = std::stoi(val);
+           if (value < 1)
+             throw std::out_of_range("ranks must be >= 1");
+           if (value > 256)
+             throw std::out_of_range("ranks is over 256. Rethink");
+           config_.kRanks = static_cast<uint>(value);
+         }},
+        {"rank",
+         [this](const std::string &val) {
+           int value = std::stoi(val);
+           if (value < 0)
+             throw std::out_of_range("rank must be >= 0");
+           config_.kRank = static_cast<uint>(value);
+         }},
+        {"shmname",
+         [this](const std::string &val) {
+           if (val.empty() || val.front() != '/')
+             throw std::invalid_argument("ShmName must start with '/'");
+           config_.kShmName = val;
+         }},
+        {"snapshotevery",
+         [this](const std::string &val) {
+           int value = std::stoi(val);
+           if (value < 0)
+             throw std::out_of_range("snapshotevery must be >= 0");
+           config_.kSnapshotEvery = static_cast<uint>(value);
+         }},
+        {"snapshotdir",
+         [this](const std::string &val) {
+           if (val.empty())
+             throw std::invalid_argument("SnapshotDir must not be empty");
+           config_.kSnapshotDir = val;
+         }},
+        {"snapshotformat",
+         [this](const std::string &val) {
+           config_.kSnapshotFormat = io::snapshot_format_from_string(val);
+         }},
         {"seed", // добавлен обработчик для seed
          [this](const std::string &val) {
            debug::debug_print("seed value {}", val);
@@ -158,6 +304,18 @@ public:
   };
 
 private:
+  static double positive(const std::string &val, const char *key) {
+    const double value = std::stod(val);
+    if (!(value > 0.0))
+      throw std::out_of_range(std::string(key) + " must be > 0");
+    return value;
+  }
+  static std::vector<unsigned> parse_cpus(const std::string &list) {
+    std::vector<unsigned> cpus = numa::parse_cpu_list(list);
+    if (cpus.empty())
+      throw std::invalid_argument("Bad CPU list: " + list);
+    return cpus;
+  }
   void
   apply_mappings(const std::unordered_map<std::string, std::string> &source);
 
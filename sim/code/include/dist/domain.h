@@ -0,0 +1,56 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include "dist/transport.h"
+#include "ds/tree/sfc.h"
+#include "utils/namespaces/MyMath.h"
+#include <cstdint>
+#include <vector>
+
+/* Split of the simulation volume between ranks.
+ *
+ * Every rank owns one contiguous range [splits[r], splits[r + 1]) of Morton
+ * point keys (sfc::point_key with Curve::kMorton, kMaxLevel bits per axis),
+ * cut so each range starts with the same number of bodies. A key range is a
+ * union of aligned octree cells; cells() lists the largest ones, which is
+ * the shape the other ranks test their tree against when they build the
+ * rank's essential tree (dist/let.h).
+ */
+namespace dist {
+class Decomposition {
+public:
+  // One past the largest point key
+  static constexpr sfc::OrderKey kEnd = sfc::OrderKey{1}
+                                        << (3 * sfc::kMaxLevel);
+
+  Decomposition() = default;
+  // Cuts the keys of `bodies` into `ranks` ranges of equal count. Every rank
+  // must pass the same set to agree on the cut
+  static Decomposition balance(const std::vector<Particle> &bodies,
+                               const MyMath::BoundingBox &bounds,
+                               unsigned ranks);
+  // Same from the bodies' point keys; `sorted` skips sorting them
+  static Decomposition balance(std::vector<sfc::OrderKey> keys,
+                               const MyMath::BoundingBox &bounds,
+                               unsigned ranks, bool sorted = false);
+
+  unsigned ranks() const {
+    return splits_.empty() ? 0 : static_cast<unsigned>(splits_.size() - 1);
+  }
+  const MyMath::BoundingBox &bounds() const { return bounds_; }
+  const std::vector<sfc::OrderKey> &splits() const { return splits_; }
+
+  unsigned owner(sfc::OrderKey key) const;
+  unsigned owner(const MyMath::Vector3 &p) const;
+  // Largest aligned cells whose union is the rank's key range
+  std::vector<MyMath::BoundingBox> cells(unsigned rank) const;
+
+private:
+  MyMath::BoundingBox bounds_{};
+  std::vector<sfc::OrderKey> splits_; // ranks + 1 entries, 0 .. kEnd
+};
+
+// Bodies that crossed into another rank's domain, as sent between ranks
+Bytes pack_bodies(const std::vector<Particle> &bodies);
+// Appends to `out`; false if `bytes` is not a whole number of bodies
+bool unpack_bodies(const Bytes &bytes, std::vector<Particle> &out);
+} // namespace dist
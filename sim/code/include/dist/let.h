@@ -0,0 +1,77 @@
+#pragma once
+#include "dist/transport.h"
+#include "ds/storage/particleBlock.h"
+#include "utils/namespaces/MyMath.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct AROctreeNode;
+struct Expansions;
+class Storage;
+
+/* Locally essential tree: the part of one rank's tree another rank needs to
+ * compute the pull of the first rank's bodies on its own.
+ *
+ * The exporter walks its tree against the receiver's domain cells
+ * (Decomposition::cells). A node far enough from every cell, edge / distance
+ * < theta, goes out as its multipole (monopole plus second central
+ * moments, as in engine/expansions.h); a nearer node is opened, and a leaf
+ * that is still too close goes out body by body. The receiver applies the
+ * lot directly to its bodies: bodies as P2P, multipoles as M2P.
+ *
+ * A rank's own far field is the same walk against one leaf's box at a
+ * time, minus the leaves the near field (engine/pairwise.h) already pulls
+ * from. Both passes together count every body once, whatever the number of
+ * ranks.
+ */
+namespace dist {
+struct RemoteMultipole {
+  double mass;
+  double x, y, z; // centre of mass
+  double qxx, qxy, qxz, qyy, qyz, qzz;
+};
+
+struct RemoteBody {
+  double x, y, z, mass;
+};
+
+struct EssentialTree {
+  std::vector<RemoteMultipole> multipoles;
+  std::vector<RemoteBody> bodies;
+
+  void clear() {
+    multipoles.clear();
+    bodies.clear();
+  }
+  void append(const EssentialTree &other);
+};
+
+inline constexpr double kDefaultTheta = 0.5;
+
+// Appends to `out` what the owner of `cells` needs from the tree under
+// `root`. `ex` must hold the upward pass of the same tree
+void export_essential(const AROctreeNode &root, const Storage &storage,
+                      const Expansions &ex,
+                      const std::vector<MyMath::BoundingBox> &cells,
+                      double theta, EssentialTree &out);
+
+// Appends to `out` the far field of the local leaf with box `leaf`: every
+// node of the tree under `root` except the leaves whose head blocks are in
+// `near` (the leaf itself and its neighbour list). Touching leaves are never
+// well separated, so none of them hides in a multipole
+void collect_far_field(const AROctreeNode &root, const Storage &storage,
+                       const Expansions &ex, const MyMath::BoundingBox &leaf,
+                       std::span<const uint32_t> near, double theta,
+                       EssentialTree &out);
+
+Bytes pack(const EssentialTree &tree);
+// Appends the contents of `bytes` to `out`; false if it is not a packed tree
+bool unpack(const Bytes &bytes, EssentialTree &out);
+
+// Adds the pull of `remote` to the accelerations of every body in `block`
+void apply_essential(const EssentialTree &remote, ParticleBlock &block);
+// Same, into ax/ay/az[0, block.size()) instead of the block's own columns
+void apply_essential(const EssentialTree &remote, const ParticleBlock &block,
+                     double *ax, double *ay, double *az);
+} // namespace dist
@@ -0,0 +1,71 @@
+#pragma once
+#include "dist/transport.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Transport between processes on one box, over a POSIX shared-memory
+ * segment (shm_open + mmap).
+ *
+ * The segment holds one single-producer single-consumer byte ring per
+ * ordered pair of ranks. exchange() streams every outgoing message (length
+ * prefix, then payload) into its ring and drains every incoming ring in the
+ * same loop, so messages of any size go through rings of fixed size and two
+ * ranks sending to each other never deadlock. Cursors are process-shared
+ * lock-free atomics; waiting is spin-then-yield, there is no kernel object.
+ *
+ * Rank 0 creates the segment (replacing a stale one of the same name) and
+ * unlinks it on destruction; the other ranks attach to it and wait for rank
+ * 0 if they start first. Start rank 0 before any other rank of a new run.
+ */
+namespace dist {
+class ShmTransport final : public Transport {
+public:
+  static constexpr size_t kDefaultRingBytes = size_t{1} << 20;
+
+  // Rank 0. Throws std::runtime_error if the segment cannot be made
+  static std::unique_ptr<ShmTransport>
+  create(const std::string &name, unsigned ranks,
+         size_t ring_bytes = kDefaultRingBytes);
+  // Ranks 1..n-1. Throws std::runtime_error after `timeout` without rank 0
+  static std::unique_ptr<ShmTransport>
+  attach(const std::string &name, unsigned rank,
+         std::chrono::milliseconds timeout = std::chrono::seconds(10));
+
+  ~ShmTransport() override;
+  ShmTransport(const ShmTransport &) = delete;
+  ShmTransport &operator=(const ShmTransport &) = delete;
+
+  unsigned rank() const override { return rank_; }
+  unsigned size() const override { return ranks_; }
+  std::vector<Bytes> exchange(const std::vector<Bytes> &out) override;
+  void barrier() override;
+
+private:
+  struct Header;
+  struct RingControl;
+
+  ShmTransport(std::string name, void *base, size_t bytes, unsigned rank,
+               bool owner);
+
+  std::string name_;
+  std::byte *base_;
+  size_t bytes_;
+  unsigned rank_;
+  unsigned ranks_ = 0;
+  size_t ring_bytes_ = 0;
+  bool owner_;
+
+  Header &header() const;
+  RingControl &control(unsigned from, unsigned to) const;
+  std::byte *ring(unsigned from, unsigned to) const;
+  // Moves what fits / what is there; returns bytes moved
+  size_t push(unsigned to, const std::byte *data, size_t bytes);
+  size_t pull(unsigned from, std::byte *data, size_t bytes);
+
+  static size_t segment_bytes(unsigned ranks, size_t ring_bytes);
+};
+} // namespace dist
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+/* Message passing between the ranks (processes) of one distributed run.
+ *
+ * Everything the ranks share per tick is an all-to-all exchange: the
+ * essential tree each rank builds for every other one, then the bodies that
+ * crossed a domain boundary. So the interface is that one collective plus a
+ * barrier; ShmTransport implements it over a shared-memory segment, a
+ * network transport (MPI_Alltoallv, sockets) would implement the same two
+ * calls.
+ */
+namespace dist {
+using Bytes = std::vector<std::byte>;
+
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual unsigned rank() const = 0;
+  virtual unsigned size() const = 0;
+
+  // out[r] goes to rank r; returns in[r] = what rank r sent us. out[rank()]
+  // comes straight back as in[rank()]. Collective: every rank makes the
+  // same sequence of calls
+  virtual std::vector<Bytes> exchange(const std::vector<Bytes> &out) = 0;
+  virtual void barrier() = 0;
+};
+} // namespace dist
@@ -1,78 +1,192 @@
 #pragma once
 #include "core/bodies/particles.h"
+#include "ds/tree/sfc.h"
 #include "utils/namespaces/error_namespace.h"
 #include <array>
 #include <cstddef>
 #include <cstdint>
-#include <mutex>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
+// Morton location code of the tree cell owning the block (see ds/tree/sfc.h)
 struct MortonKey {
-  uint key_number;
+  sfc::LocationCode key_number;
 };
 
-class ParticleBlock {
+// Bodies per block, and so per leaf before it splits. The whole engine runs
+// on one layout, chosen at build time: -DGRAVWLL_BLOCK_CAPACITY=8|16|24|32|64
+#ifndef GRAVWLL_BLOCK_CAPACITY
+#define GRAVWLL_BLOCK_CAPACITY 16
+#endif
+
+/* Layout of the hot part of a block.
+ *
+ * kSoA   - one array per field: x[0..N), y[0..N), z[0..N), mass[0..N).
+ * kAoSoA - tiles of one SIMD register worth of bodies (8 doubles, 16 floats)
+ *          holding x, y, z and mass for those bodies: 256 bytes, two cache
+ *          line pairs, one AVX-512 iteration. Fields are then strided, so
+ *          get_x() and friends return a TileColumn instead of an array.
+ */
+enum class BlockLayout : uint8_t { kSoA, kAoSoA };
+
+// Indexable view of one field of a tiled block, what get_x() returns for
+// kAoSoA. Body i sits in tile i / Lanes, lane i % Lanes
+template <class Scalar, size_t Lanes, size_t Length> class TileColumn {
+public:
+  // Tiles are {x[Lanes], y[Lanes], z[Lanes], mass[Lanes]}
+  static constexpr size_t kTileStride = 4 * Lanes;
+
+  explicit TileColumn(Scalar *first) : first_(first) {}
+
+  Scalar &operator[](size_t i) const {
+    return first_[i / Lanes * kTileStride + i % Lanes];
+  }
+  constexpr size_t size() const { return Length; }
+  void fill(Scalar value) const {
+    for (size_t i = 0; i < Length; ++i)
+      (*this)[i] = value;
+  }
+
+private:
+  Scalar *first_; // lane 0 of this field in tile 0
+};
+
+/* No internal locking. Who may touch a block is decided by the engine phase
+ * (see engine/phases.h): one writer per block per phase, positions and
+ * masses are read-only while forces are computed.
+ *
+ * A block is split in two. The block itself holds what every P2P pass
+ * streams through (positions, masses) plus the meta data, and lives in the
+ * main arena. Velocities, forces, accelerations and render ids sit in a
+ * ColdBlock of a separate arena at the same slot index, reached through
+ * cold_block. Neighbour sources are read hot-only.
+ *
+ * Every array is padded to a whole number of cache lines (8 doubles, 16
+ * floats: one AVX-512 register) and starts on its own line, so kernels can
+ * run full-width loads past `size` without a scalar tail. Padding lanes are
+ * never written by the block and must be ignored by readers.
+ *
+ * The hot part is SoA or AoSoA (see BlockLayout); the cold part is always
+ * SoA. Code that goes through get_x()[i] and friends works on both, kernels
+ * that take raw pointers (engine/pairwise.cpp) need kSoA.
+ */
+template <class Scalar, int Capacity, BlockLayout Layout = BlockLayout::kSoA>
+class BasicParticleBlock {
+  static_assert(std::is_floating_point_v<Scalar>);
+  static_assert(Capacity > 0 && Capacity % 8 == 0 && Capacity <= 256,
+                "block capacity must be a multiple of 8 that fits size");
+
 public:
-  ParticleBlock(uint morton_key, const std::vector<Particle> &particles);
-  ParticleBlock(const ParticleBlock &) = delete;
-  ParticleBlock() = default;
+  using scalar_type = Scalar;
+  static constexpr BlockLayout kLayout = Layout;
+  static constexpr int N{Capacity};
+  static constexpr size_t kLanes = 64 / sizeof(Scalar);
+  // Array length, N rounded up to whole SIMD registers
+  static constexpr size_t kPadded = (N + kLanes - 1) / kLanes * kLanes;
+  using Array = std::array<Scalar, kPadded>;
+  using IdArray = std::array<uint64_t, kPadded>;
+  // next_logical_block of the last block in a chain
+  static constexpr uint kNoNextBlock = std::numeric_limits<uint>::max();
+  struct ColdBlock;
 
-  ParticleBlock &operator=(const ParticleBlock &) = delete;
-  ParticleBlock(ParticleBlock &&other) noexcept;
-  ParticleBlock &operator=(ParticleBlock &&other) noexcept;
-  ~ParticleBlock() = default;
+  BasicParticleBlock(sfc::LocationCode morton_key, ColdBlock *cold,
+                     const std::vector<Particle> &particles);
+  BasicParticleBlock(const BasicParticleBlock &) = delete;
+  BasicParticleBlock() = default;
 
-  void swap(ParticleBlock &other) noexcept;
+  BasicParticleBlock &operator=(const BasicParticleBlock &) = delete;
+  // A block is bound to its arena slot through cold_block; contents move
+  // between slots with swap(), never by moving the block
+  BasicParticleBlock(BasicParticleBlock &&) = delete;
+  BasicParticleBlock &operator=(BasicParticleBlock &&) = delete;
+  ~BasicParticleBlock() = default;
+
+  // Exchanges contents, cold data included. Each block keeps its own
+  // cold_block, so both stay bound to their arena slot
+  void swap(BasicParticleBlock &other) noexcept;
   void initialize() { debug::debug_print("we must impl part initialize"); }
 
-  static constexpr int N{4 * 6};
-  struct DataBlock {
-
-    alignas(16) std::array<double, N> x;
-    alignas(16) std::array<double, N> y;
-    alignas(16) std::array<double, N> z;
-    alignas(16) std::array<double, N> vx;
-    alignas(16) std::array<double, N> vy;
-    alignas(16) std::array<double, N> vz;
-    alignas(16) std::array<double, N> fx;
-    alignas(16) std::array<double, N> fy;
-    alignas(16) std::array<double, N> fz;
-    alignas(16) std::array<double, N> ax;
-    alignas(16) std::array<double, N> ay;
-    alignas(16) std::array<double, N> az;
-    alignas(16) std::array<double, N> mass;
-    alignas(16) std::array<uint64_t, N> visual_id;
+  // Hot part, read for every source block of a P2P pass
+  struct SoABlock {
+
+    alignas(64) Array x;
+    alignas(64) Array y;
+    alignas(64) Array z;
+    alignas(64) Array mass;
+
+    unsigned short size = 0;
+
+    SoABlock() noexcept = default;
+    SoABlock(SoABlock &&other) noexcept = default;
+    SoABlock &operator=(SoABlock &&other) noexcept = default;
+#define DEFINE_GETTER(field)                                                   \
+  const Array &get_##field() const { return field; }                           \
+  Array &get_##field() { return field; }
+    DEFINE_GETTER(x)
+    DEFINE_GETTER(y)
+    DEFINE_GETTER(z)
+    DEFINE_GETTER(mass)
+
+#undef DEFINE_GETTER
+  };
+
+  struct TiledBlock {
+    using Lane = std::array<Scalar, kLanes>;
+    struct Tile {
+      alignas(64) Lane x;
+      Lane y;
+      Lane z;
+      Lane mass;
+    };
+    static constexpr size_t kTiles = kPadded / kLanes;
+    using Column = TileColumn<Scalar, kLanes, kPadded>;
+    using ConstColumn = TileColumn<const Scalar, kLanes, kPadded>;
+
+    std::array<Tile, kTiles> tiles;
 
     unsigned short size = 0;
 
-    DataBlock() noexcept = default;
-    DataBlock(DataBlock &&other) noexcept = default;
-    DataBlock &operator=(DataBlock &&other) noexcept = default;
+    TiledBlock() noexcept = default;
+    TiledBlock(TiledBlock &&other) noexcept = default;
+    TiledBlock &operator=(TiledBlock &&other) noexcept = default;
 #define DEFINE_GETTER(field)                                                   \
-  const std::array<double, N> &get_##field() const { return field; }           \
-  std::array<double, N> &get_##field() { return field; }
+  ConstColumn get_##field() const {                                            \
+    return ConstColumn{tiles[0].field.data()};                                 \
+  }                                                                            \
+  Column get_##field() { return Column{tiles[0].field.data()}; }
     DEFINE_GETTER(x)
     DEFINE_GETTER(y)
     DEFINE_GETTER(z)
-    DEFINE_GETTER(vx)
-    DEFINE_GETTER(vy)
-    DEFINE_GETTER(vz)
-    DEFINE_GETTER(fx)
-    DEFINE_GETTER(fy)
-    DEFINE_GETTER(fz)
-    DEFINE_GETTER(ax)
-    DEFINE_GETTER(ay)
-    DEFINE_GETTER(az)
     DEFINE_GETTER(mass)
 
 #undef DEFINE_GETTER
   };
 
+  using DataBlock =
+      std::conditional_t<Layout == BlockLayout::kSoA, SoABlock, TiledBlock>;
+
+  // Cold part: written once per target block in P2P, read by the integrator
+  // and the render snapshot
+  struct ColdBlock {
+    alignas(64) Array vx;
+    alignas(64) Array vy;
+    alignas(64) Array vz;
+    alignas(64) Array fx;
+    alignas(64) Array fy;
+    alignas(64) Array fz;
+    alignas(64) Array ax;
+    alignas(64) Array ay;
+    alignas(64) Array az;
+    alignas(64) IdArray visual_id;
+  };
+
   struct MetaBlock {
     MortonKey key;
     uint arena_block = 0;
     float hotness = 0.7f;
-    uint next_logical_block;
+    // Arena index of the next overflow block of a max-depth leaf
+    uint next_logical_block = kNoNextBlock;
 
     MetaBlock() noexcept = default;
     MetaBlock(MortonKey key) noexcept : key(key) {};
@@ -81,29 +195,35 @@ public:
   };
 
   size_t addParticle(const Particle &p);
+  // Writes slot `index` without locking or touching size. For callers that
+  // reserved the slot themselves (lock-free tree insert)
+  void store_particle(size_t index, const Particle &p);
   Particle deleteParticle(size_t index);
   void printParticles();
   Particle getParticle(size_t index) const;
   MyMath::Vector3 getPosition(size_t index) const;
 
 #define DEFINE_GETTER(field)                                                   \
-  const std::array<double, N> &get_##field() const {                           \
-    return data_block.field;                                                   \
-  }                                                                            \
-  std::array<double, N> &get_##field() { return data_block.field; }
+  decltype(auto) get_##field() const { return data_block.get_##field(); }      \
+  decltype(auto) get_##field() { return data_block.get_##field(); }
   DEFINE_GETTER(x)
   DEFINE_GETTER(y)
   DEFINE_GETTER(z)
-  DEFINE_GETTER(vx)
-  DEFINE_GETTER(vy)
-  DEFINE_GETTER(vz)
-  DEFINE_GETTER(fx)
-  DEFINE_GETTER(fy)
-  DEFINE_GETTER(fz)
-  DEFINE_GETTER(ax)
-  DEFINE_GETTER(ay)
-  DEFINE_GETTER(az)
   DEFINE_GETTER(mass)
+#undef DEFINE_GETTER
+#define DEFINE_GETTER(field, type)                                             \
+  const type &get_##field() const { return cold_block->field; }                \
+  type &get_##field() { return cold_block->field; }
+  DEFINE_GETTER(vx, Array)
+  DEFINE_GETTER(vy, Array)
+  DEFINE_GETTER(vz, Array)
+  DEFINE_GETTER(fx, Array)
+  DEFINE_GETTER(fy, Array)
+  DEFINE_GETTER(fz, Array)
+  DEFINE_GETTER(ax, Array)
+  DEFINE_GETTER(ay, Array)
+  DEFINE_GETTER(az, Array)
+  DEFINE_GETTER(visual_id, IdArray)
 
 #undef DEFINE_GETTER
 
@@ -112,9 +232,36 @@ public:
   bool is_empty() const { return data_block.size == 0; }
   DataBlock data_block;
   MetaBlock meta_block;
-
-private:
-  mutable std::mutex m_mutex; // Мьютекс теперь в ParticleBlock
-public:
-  std::mutex &get_mutex() { return m_mutex; }
+  // Slot of the same index in the cold arena, set by whoever places the block
+  ColdBlock *cold_block = nullptr;
 };
+
+// Layouts the member functions are compiled for (particleBlock.cc), each as
+// kSoA and kAoSoA
+#define GRAVWLL_BLOCK_LAYOUTS(X)                                               \
+  X(double, 8)                                                                 \
+  X(double, 16)                                                                \
+  X(double, 24)                                                                \
+  X(double, 32)                                                                \
+  X(double, 64)                                                                \
+  X(float, 8)                                                                  \
+  X(float, 16)                                                                 \
+  X(float, 24)                                                                 \
+  X(float, 32)                                                                 \
+  X(float, 64)
+
+#define GRAVWLL_EXTERN_LAYOUT(scalar, capacity)                                \
+  extern template class BasicParticleBlock<scalar, capacity,                   \
+                                           BlockLayout::kSoA>;                 \
+  extern template class BasicParticleBlock<scalar, capacity,                   \
+                                           BlockLayout::kAoSoA>;
+GRAVWLL_BLOCK_LAYOUTS(GRAVWLL_EXTERN_LAYOUT)
+#undef GRAVWLL_EXTERN_LAYOUT
+
+static_assert(GRAVWLL_BLOCK_CAPACITY == 8 || GRAVWLL_BLOCK_CAPACITY == 16 ||
+                  GRAVWLL_BLOCK_CAPACITY == 24 ||
+                  GRAVWLL_BLOCK_CAPACITY == 32 || GRAVWLL_BLOCK_CAPACITY == 64,
+              "GRAVWLL_BLOCK_CAPACITY must be one of GRAVWLL_BLOCK_LAYOUTS");
+
+// The engine's layout. Physics kernels work in double
+using ParticleBlock = BasicParticleBlock<double, GRAVWLL_BLOCK_CAPACITY>;
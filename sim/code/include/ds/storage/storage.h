@@ -6,15 +6,75 @@
 
 class Storage {
 public:
-  Storage(uint N_body);
+  Storage(uint N_body, sfc::Curve curve = sfc::Curve::kMorton,
+          BlockPlacement placement = BlockPlacement::kSpatial,
+          PageSize pages = PageSize::kSmall, bool numa_regions = false,
+          unsigned tree_max_depth = sfc::kMaxLevel);
 
 private:
+  // Thread-safe: per-thread magazines over the arena
   BlockMemoryManager manager_;
 
 public:
-  ParticleBlock *create_memory_block(uint morton_key,
+  sfc::Curve curve() const { return manager_.get_curve(); }
+  size_t capacity() const { return manager_.get_capacity(); }
+  size_t max_capacity() const { return manager_.get_max_capacity(); }
+  PageBacking page_backing() const { return manager_.get_page_backing(); }
+  // One arena region per NUMA node. Region r holds the r-th equal share of
+  // the curve; whoever processes those leaves should run on region_node(r)
+  size_t region_count() const { return manager_.get_region_count(); }
+  size_t region_of(size_t block_index) const {
+    return manager_.get_region_of(block_index);
+  }
+  // Region whose share of the curve holds the cell, or the point
+  size_t region_of_cell(sfc::LocationCode code) const {
+    return manager_.get_region_for(sfc::order_key(curve(), code));
+  }
+  size_t region_of_point(const MyMath::Vector3 &p,
+                         const MyMath::BoundingBox &bounds) const {
+    return manager_.get_region_for(sfc::point_key(curve(), p, bounds));
+  }
+  const numa::Node *region_node(size_t region) const {
+    return manager_.get_region_node(region);
+  }
+  ParticleBlock *create_memory_block(sfc::LocationCode morton_key,
                                      const std::vector<Particle> &particles);
+  // Empty blocks for the 8 children of `parent`, out[octant]. false (and all
+  // nullptr) if the arena is out of slots
+  bool create_child_blocks(sfc::LocationCode parent, ParticleBlock *out[8]);
   void release_block(ParticleBlock *block);
+  // Returns slots cached by worker threads to the arena. Call between phases
+  void flush_block_caches();
+  // Defragments the arena into curve order, see BlockMemoryManager::compact.
+  // Every ParticleBlock* held outside must be remapped with the result
+  std::vector<uint32_t> compact_blocks() { return manager_.compact(); }
+  size_t used_blocks() const { return manager_.get_used_blocks(); }
+  size_t block_index(const ParticleBlock *block) const {
+    return manager_.get_block_index(block);
+  }
+  // Whether slot `index` holds a block of the tree
+  bool block_in_use(size_t index) const {
+    return manager_.is_active(index);
+  }
+  ParticleBlock *block_at(size_t index) { return manager_.block_at(index); }
+  const ParticleBlock *block_at(size_t index) const {
+    return manager_.block_at(index);
+  }
+
+  // Overflow chains of max-depth leaves are linked through
+  // MetaBlock::next_logical_block. nullptr at the end of the chain. Plain
+  // reads: only for phases where the chain can't grow
+  ParticleBlock *next_block(const ParticleBlock *block) {
+    const uint next = block->meta_block.next_logical_block;
+    return next == ParticleBlock::kNoNextBlock ? nullptr : block_at(next);
+  }
+  const ParticleBlock *next_block(const ParticleBlock *block) const {
+    const uint next = block->meta_block.next_logical_block;
+    return next == ParticleBlock::kNoNextBlock ? nullptr : block_at(next);
+  }
+  // Next block of the chain, appending a fresh one if `block` is the tail.
+  // Safe for concurrent inserters; nullptr if the arena is full
+  ParticleBlock *next_block_or_grow(ParticleBlock *block);
   void transferParticle(ParticleBlock *fromBlock, ParticleBlock *toBlock,
                         size_t index);
 };
@@ -0,0 +1,51 @@
+#pragma once
+#include "ds/storage/storage.h"
+#include "ds/tree/sfc.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct AROctreeNode;
+
+/* Near-field connectivity of the leaves, rebuilt whenever the tree topology
+ * changes (approach 3 in docs/MEMORY_MANAGER.md).
+ *
+ * Leaf ids are positions in the leaf vector passed to rebuild(), i.e. curve
+ * order when it comes from AROctree::collect_leaves. Neighbours are found by
+ * Morton arithmetic on the location codes: the same-depth cell in each of the
+ * 26 directions is located in the Morton-sorted leaf ranges, then resolved to
+ * the coarser leaf containing it or to the finer leaves touching us.
+ *
+ * Both the leaf's own block and its neighbour blocks are stored as arena
+ * indices, so P2P resolves them as base + index * block_size.
+ */
+class LeafNeighbourLists {
+public:
+  void rebuild(const std::vector<AROctreeNode *> &leaves,
+               const Storage &storage);
+
+  size_t leaf_count() const { return leaf_blocks_.size(); }
+  uint32_t leaf_block(size_t leaf) const { return leaf_blocks_[leaf]; }
+  sfc::LocationCode leaf_code(size_t leaf) const { return leaf_codes_[leaf]; }
+
+  // Neighbour leaf ids of `leaf`, ascending
+  std::span<const uint32_t> neighbours(size_t leaf) const {
+    return {neighbours_.data() + offsets_[leaf],
+            offsets_[leaf + 1] - offsets_[leaf]};
+  }
+  // Arena indices of the same neighbours, parallel to neighbours()
+  std::span<const uint32_t> neighbour_blocks(size_t leaf) const {
+    return {neighbour_blocks_.data() + offsets_[leaf],
+            offsets_[leaf + 1] - offsets_[leaf]};
+  }
+
+  size_t pair_count() const { return neighbours_.size(); }
+
+private:
+  std::vector<sfc::LocationCode> leaf_codes_;
+  std::vector<uint32_t> leaf_blocks_;
+  std::vector<uint32_t> offsets_;
+  std::vector<uint32_t> neighbours_;
+  std::vector<uint32_t> neighbour_blocks_;
+};
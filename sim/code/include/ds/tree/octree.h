@@ -1,9 +1,13 @@
 #pragma once
 #include "ds/storage/storage.h"
+#include "ds/tree/sfc.h"
 #include "gfx/renderer/scene.h"
+#include "utils/thread_pool.h"
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
-#include <mutex>
 #include <vector>
 
 struct Multipole {
@@ -14,34 +18,65 @@ struct Multipole {
   Multipole();
 };
 
+/* Insertion is lock-free on the common path and safe from many threads:
+ *
+ * - a leaf hands out slots of its block with fetch_add on reserved_; the
+ *   writer stores the particle and then bumps the block size (release),
+ * - the inserter that draws slot kSplitThreshold CASes state_ kLeaf ->
+ *   kSplitting and splits; it waits only for writers that already hold a
+ *   slot, so nobody waits on a preempted lock holder,
+ * - children are built privately and published with a release store of
+ *   kInternal; inserters that overflowed meanwhile spin until then and retry
+ *   one level down.
+ *
+ * Readers (traversals, physics) must not run concurrently with inserts.
+ */
 struct AROctreeNode {
   friend class AROctree;
 
+  // A leaf splits once its block is full
+  static constexpr uint32_t kSplitThreshold = ParticleBlock::N;
+
   MyMath::BoundingBox bounds;
-  AROctreeNode *children[8] = {nullptr};
+  std::atomic<AROctreeNode *> children[8]{};
   Multipole multipole;
   int depth;
   MyMath::Vector3 center;
+  sfc::LocationCode code;
+  // Position in the last AROctree::collect_nodes, indexes per-tick arrays
+  uint32_t node_index = 0;
+  AROctreeNode *parent = nullptr; // nullptr for the root
+  // Children whose upward step is still to run this tick, see
+  // engine/task_graph.h
+  std::atomic<uint32_t> pending_children{0};
 
+  // Both throw if the arena has no block for the node
   AROctreeNode(MyMath::BoundingBox bounds, Multipole multipole, const int depth,
-               const int maxDepth, Storage &storage);
+               const int maxDepth, Storage &storage,
+               sfc::LocationCode code = sfc::kRootCode,
+               ParticleBlock *block = nullptr);
   AROctreeNode(MyMath::BoundingBox &prime_bounds,
                const unsigned short tree_max_depth, Storage &storage);
   ~AROctreeNode();
-  std::mutex &getMutex() const { return m_mutex; };
 
   ParticleBlock *localBlock;
 
   void printOctreeMasses();
 
 private:
-  mutable std::mutex m_mutex;
+  enum class State : uint8_t { kLeaf, kSplitting, kInternal };
+
   int maxDepth;
   Storage &storage;
+  std::atomic<State> state_{State::kLeaf};
+  std::atomic<uint32_t> reserved_{0}; // slots handed out in localBlock
 
   void setCalculatedCenter();
-  void insert(const Particle &P);
-  void split(const Particle &P);
+  // false if the arena had no block for the particle, which is then not
+  // stored. Sets did_split if the insert split a leaf
+  bool insert(const Particle &P, bool &did_split);
+  // false if the arena had no blocks for the children
+  bool split();
   int boundsCheck(MyMath::Vector3 p) const;
   std::array<MyMath::BoundingBox, 8> childBounds();
   int getChildIndex(const MyMath::Vector3 &p);
@@ -53,14 +88,43 @@ public:
            Storage &storage);
   ~AROctree();
 
-  void insert(const Particle &p);
-  void insert_batch(const std::vector<Particle> &dataSet);
+  // Safe to call from several threads at once. false if the block arena is
+  // exhausted: the particle is not in the tree
+  bool insert(const Particle &p);
+  // threads > 1 runs the pool overload on a pool of that many runners.
+  // Both return how many particles found no room in the arena
+  size_t insert_batch(const std::vector<Particle> &dataSet,
+                      unsigned threads = 1);
+  // Contiguous chunks of the set inserted as pool tasks. With NUMA regions
+  // and a pool with homes, chunks hold one region's bodies and go to the
+  // runners of that region (ThreadPool::for_each_chunk)
+  size_t insert_batch(const std::vector<Particle> &dataSet, ThreadPool &pool);
   void print();
   AROctreeNode *get_root();
-  std::vector<gfx::renderer::SceneParticle> get_particles_for_render();
+  // Leaves in the order of the storage's curve. Used to hand out contiguous
+  // curve ranges (work partitions, output order)
+  void collect_leaves(std::vector<AROctreeNode *> &leaves) const;
+  // All nodes in level order, root first, and sets node_index to match
+  void collect_nodes(std::vector<AROctreeNode *> &nodes);
+  // Migrate phase: removes from `leaves` every particle that no longer
+  // descends to its leaf, or that `leaves_domain` says left this process'
+  // domain, and appends it to `out` for reinsertion or export
+  void extract_migrants(
+      const std::vector<AROctreeNode *> &leaves, std::vector<Particle> &out,
+      const std::function<bool(const MyMath::Vector3 &)> &leaves_domain = {});
+  // Points every node at its block's new slot after Storage::compact_blocks
+  void relocate_blocks(const std::vector<uint32_t> &moved);
+  // Bumped on every split or relocation, consumers cache leaf-derived data
+  // (block indices included) against it
+  uint64_t topology_version() const {
+    return topology_version_.load(std::memory_order_acquire);
+  }
+  // Flat copy of every body for the renderer, see engine/render_snapshot.h
+  void write_render_snapshot(std::vector<gfx::renderer::SceneParticle> &out);
 
 private:
   std::unique_ptr<AROctreeNode> root;
+  std::atomic<uint64_t> topology_version_{0};
   int maxDepth;
   Storage &storage;
 };
@@ -0,0 +1,131 @@
+#pragma once
+#include "utils/namespaces/MyMath.h"
+#include <array>
+#include <cstdint>
+#include <string>
+
+/* Space-filling curve keys.
+ *
+ * A node is identified by its Morton location code: a leading 1 bit followed
+ * by one octant digit (3 bits, x|y|z) per level. The code is independent of
+ * the curve we order by, so neighbour arithmetic always works on it.
+ *
+ * An order key is the position of the cell along the configured curve,
+ * left-aligned to kMaxLevel. Keys of cells at different depth compare as the
+ * start of their curve range, so sorting leaves by order key walks the curve.
+ */
+namespace sfc {
+
+enum class Curve : uint8_t { kMorton, kHilbert };
+
+using LocationCode = uint64_t;
+using OrderKey = uint64_t;
+
+constexpr unsigned kMaxLevel = 21;
+constexpr LocationCode kRootCode = 1;
+
+constexpr LocationCode child_code(LocationCode parent, unsigned octant) {
+  return (parent << 3) | octant;
+}
+constexpr LocationCode parent_code(LocationCode code) { return code >> 3; }
+constexpr unsigned code_level(LocationCode code) {
+  return static_cast<unsigned>(63 - __builtin_clzll(code)) / 3;
+}
+
+namespace detail {
+
+constexpr unsigned rotr3(unsigned v, unsigned r) {
+  r %= 3;
+  return ((v >> r) | (v << (3 - r))) & 7u;
+}
+constexpr unsigned rotl3(unsigned v, unsigned r) {
+  r %= 3;
+  return ((v << r) | (v >> (3 - r))) & 7u;
+}
+constexpr unsigned gray(unsigned i) { return i ^ (i >> 1); }
+constexpr unsigned gray_inverse(unsigned g) {
+  g ^= g >> 1;
+  g ^= g >> 2;
+  return g & 7u;
+}
+constexpr unsigned trailing_set_bits(unsigned i) {
+  unsigned count = 0;
+  while (i & 1u) {
+    ++count;
+    i >>= 1;
+  }
+  return count;
+}
+
+// Hamilton, "Compact Hilbert Indices": a state is (entry corner e, direction
+// d), stored as e * 3 + d. Only 12 of the 24 states are reachable from 0.
+constexpr unsigned kHilbertStates = 24;
+
+struct HilbertTables {
+  std::array<std::array<uint8_t, 8>, kHilbertStates> rank{};   // octant -> pos
+  std::array<std::array<uint8_t, 8>, kHilbertStates> octant{}; // pos -> octant
+  std::array<std::array<uint8_t, 8>, kHilbertStates> next{};   // octant -> st
+};
+
+constexpr HilbertTables make_hilbert_tables() {
+  HilbertTables t;
+  for (unsigned e = 0; e < 8; ++e) {
+    for (unsigned d = 0; d < 3; ++d) {
+      const unsigned state = e * 3 + d;
+      for (unsigned oct = 0; oct < 8; ++oct) {
+        const unsigned w = gray_inverse(rotr3(oct ^ e, d + 1));
+        const unsigned entry = w == 0 ? 0 : gray(2 * ((w - 1) / 2));
+        const unsigned dir = w == 0         ? 0
+                             : (w % 2 == 0) ? trailing_set_bits(w - 1) % 3
+                                            : trailing_set_bits(w) % 3;
+        const unsigned next_e = e ^ rotl3(entry, d + 1);
+        const unsigned next_d = (d + dir + 1) % 3;
+        t.rank[state][oct] = static_cast<uint8_t>(w);
+        t.octant[state][w] = static_cast<uint8_t>(oct);
+        t.next[state][oct] = static_cast<uint8_t>(next_e * 3 + next_d);
+      }
+    }
+  }
+  return t;
+}
+
+inline constexpr HilbertTables kHilbert = make_hilbert_tables();
+
+} // namespace detail
+
+// Curve state carried down a traversal. Always 0 for Morton.
+using CurveState = uint8_t;
+constexpr CurveState kRootState = 0;
+
+// Position of `octant` among its siblings along the curve.
+constexpr unsigned child_rank(Curve curve, CurveState state, unsigned octant) {
+  return curve == Curve::kHilbert ? detail::kHilbert.rank[state][octant]
+                                  : octant;
+}
+// Octant visited at position `rank` among siblings.
+constexpr unsigned child_at_rank(Curve curve, CurveState state,
+                                 unsigned rank) {
+  return curve == Curve::kHilbert ? detail::kHilbert.octant[state][rank] : rank;
+}
+constexpr CurveState child_state(Curve curve, CurveState state,
+                                 unsigned octant) {
+  return curve == Curve::kHilbert ? detail::kHilbert.next[state][octant]
+                                  : kRootState;
+}
+
+// Grid coordinates of a cell at its own level.
+struct GridCoord {
+  uint32_t x, y, z;
+};
+
+LocationCode encode_code(GridCoord cell, unsigned level);
+GridCoord decode_code(LocationCode code);
+
+OrderKey order_key(Curve curve, LocationCode code);
+OrderKey point_key(Curve curve, const MyMath::Vector3 &p,
+                   const MyMath::BoundingBox &bounds);
+
+Curve curve_from_string(const std::string &value);
+const char *curve_name(Curve curve);
+
+} // namespace sfc
@@ -0,0 +1,7 @@
+#pragma once
+
+// Shared by every kernel that computes a pull (engine/pairwise.h,
+// dist/let.h), so the near field, the far field and other ranks' pull agree
+inline constexpr double kG = 6.67430 * 10e-11;
+// Added to r^2 so coincident bodies don't divide by zero
+inline constexpr double kSoftener = 1e-20;
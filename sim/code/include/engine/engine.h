@@ -2,7 +2,19 @@
 
 #include "ctx/ctx.h"
 #include "ctx/simulation_state.h"
+#include "dist/let.h"
+#include "ds/tree/neighbour_lists.h"
 #include "ds/tree/octree.h"
+#include "engine/expansions.h"
+#include "engine/load_balance.h"
+#include "engine/phases.h"
+#include "engine/render_snapshot.h"
+#include "engine/task_graph.h"
+#include "io/snapshot_writer.h"
+#include "memory/expansion_arena.h"
+#include "utils/thread_pool.h"
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -16,16 +28,12 @@ public:
   explicit PhysicsEngine(PhysicsCtx &p_ctx, SimulationState &state,
                          Storage &storage, DataCtx &d_ctx);
 
-  ~PhysicsEngine() {
-    for (size_t th_n = 0; th_n < threads.size(); ++th_n) {
-      if (threads[th_n].joinable())
-        threads[th_n].join();
-    }
-    return;
-  };
-
   void MainCycle();
   void Init();
+  // Consumer end belongs to the render thread
+  RenderSnapshot &render_snapshot() { return snapshot_; }
+  // Per-leaf costs and the achieved balance of the last tick
+  const LeafCostModel &leaf_costs() const { return leaf_costs_; }
 
 private:
   PhysicsCtx &p_ctx;
@@ -34,12 +42,70 @@ private:
   Storage &storage;
   int physicsTick(std::chrono::high_resolution_clock::time_point tickTime);
 
-  std::vector<std::thread> threads;
-
   CloseInteractionElement closeInteraction;
   MultipoleInteractionElement multipoleInteraction;
 
-  void init_threads();
+  // Leaves in curve order and their near-field lists, refreshed when the tree
+  // topology changes
+  std::vector<AROctreeNode *> leaves_;
+  LeafNeighbourLists neighbour_lists_;
+  uint64_t neighbours_version_ = std::numeric_limits<uint64_t>::max();
+  std::vector<Particle> migrants_;
+  uint64_t compacted_version_ = 0;
+  PhaseTracker phases_;
+  // Every phase of a tick runs its loops as tasks here
+  ThreadPool pool_;
+
+  // Level-order nodes and their expansions, rebuilt from the arena each tick
+  std::vector<AROctreeNode *> nodes_;
+  ExpansionArena expansion_arena_;
+  Expansions expansions_;
+  ForceTaskGraph force_graph_;
+  // Near-field cost per leaf, cuts the next tick's P2P chunks
+  LeafCostModel leaf_costs_;
+  // With p_ctx.verbose, ticks between two balance reports
+  static constexpr uint64_t kBalanceReportEvery = 100;
+  // With NUMA homes (PhysicsCtx::runner_homes): the arena region of each
+  // leaf, the leaf ranges of the regions and their chunk counts. Chunks
+  // never cross a region, chunk c goes to the runners of chunk_homes_[c]
+  std::vector<unsigned> leaf_homes_;
+  std::vector<size_t> region_bounds_;
+  std::vector<size_t> region_parts_;
+  std::vector<unsigned> chunk_homes_;
+
+  // This tick's far-field pull, leaf l's bodies from far_first_[l] in chain
+  // order. Empty when there was no upward pass
+  std::vector<size_t> far_first_;
+  std::vector<double> far_ax_, far_ay_, far_az_;
+
+  // Multi-rank runs only: the other ranks' essential trees merged for this
+  // tick, and each rank's domain cells to export against
+  dist::EssentialTree remote_;
+  std::vector<std::vector<MyMath::BoundingBox>> rank_cells_;
+
+  RenderSnapshot snapshot_;
+  // Ticks run so far; snapshots_ only with snapshot_every set
+  uint64_t tick_ = 0;
+  std::unique_ptr<io::SnapshotWriter> snapshots_;
+
+  // How many input bodies found no room in the block arena
+  size_t insert_input();
+  void refresh_neighbour_lists();
+  void refresh_regions();
+  static constexpr size_t kChunksPerRunner = 4;
+  void compute_forces();
+  void report_balance() const;
+  bool carve_expansions();
+  void size_far_field();
+  void collect_far_field(size_t begin, size_t end);
+  void exchange_essential();
+  void exchange_migrants();
+  void integrate();
+  // How many migrants found no room in the block arena
+  size_t migrate();
+  void maybe_compact();
+  void publish_snapshot();
+  void maybe_write_snapshot();
 
 public:
   std::unique_ptr<AROctree> tree;
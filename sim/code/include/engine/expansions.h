@@ -0,0 +1,43 @@
+#pragma once
+#include "memory/expansion_arena.h"
+#include <cstddef>
+#include <vector>
+
+struct AROctreeNode;
+class Storage;
+
+/* Multipole expansions of every tree node for one FMM step, as SoA arrays
+ * indexed by AROctreeNode::node_index. The storage comes from an
+ * ExpansionArena that is reset every tick, so M2M and the far-field walk
+ * (dist/let.h) read contiguous arrays instead of chasing per-node objects.
+ *
+ * There are no local expansions: the far field is applied per leaf straight
+ * from the multipoles (M2P), so nothing would read them.
+ */
+struct Expansions {
+  size_t count = 0;
+
+  // Multipole about the centre of mass: monopole and second central moments
+  double *mass = nullptr;
+  double *com_x = nullptr, *com_y = nullptr, *com_z = nullptr;
+  double *qxx = nullptr, *qxy = nullptr, *qxz = nullptr;
+  double *qyy = nullptr, *qyz = nullptr, *qzz = nullptr;
+
+  static constexpr size_t kArrays = 10;
+
+  // Arena bytes needed for `nodes` nodes, alignment padding included
+  static size_t bytes_for(size_t nodes) {
+    return kArrays * (nodes * sizeof(double) + ExpansionArena::kAlignment);
+  }
+  // Takes the arrays from `arena`; false if it is too small
+  bool carve(ExpansionArena &arena, size_t nodes);
+};
+
+// P2M on the leaves, then M2M towards the root. `nodes` must be in level
+// order with node_index == position (AROctree::collect_nodes)
+void upward_pass(const std::vector<AROctreeNode *> &nodes,
+                 const Storage &storage, Expansions &ex);
+// One step of it: P2M for a leaf, M2M for an internal node whose children
+// are done. Writes only the node's own slot
+void upward_node(const AROctreeNode &node, const Storage &storage,
+                 Expansions &ex);
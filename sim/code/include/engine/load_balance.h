@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/* Per-leaf near-field cost, recorded during a tick and used to cut the
+ * curve-ordered leaf sequence into equal-cost chunks for the next one.
+ *
+ * Splitting by leaf count balances badly on clustered sets (Plummer): a core
+ * leaf has full neighbours on every side, a halo leaf has a few bodies
+ * around it. The cut uses the measured time of each leaf in the last tick;
+ * right after the topology changes, before anything was measured, it falls
+ * back to the P2P pair count. Chunks are contiguous in curve order, so a
+ * thread's targets and sources stay close in the block arena.
+ *
+ * record() and record_far() may be called concurrently for distinct leaves,
+ * and for the same leaf one of each: the near and the far field of a leaf
+ * are separate tasks (engine/task_graph.h) and keep separate slots until
+ * close_tick() adds them up.
+ */
+struct LeafCost {
+  uint64_t p2p_pairs = 0; // body pairs evaluated
+  // Multipoles the far-field walk (M2P) applied to the leaf's bodies
+  uint32_t far_multipoles = 0;
+  uint64_t ns = 0; // wall time of the leaf's near and far field
+};
+
+class LeafCostModel {
+public:
+  // New leaf set (topology changed): forget the measured times
+  void reset(size_t leaves);
+  void record(size_t leaf, const LeafCost &cost) { costs_[leaf] = cost; }
+  // The far field's share: its multipoles and its own ns, merged by
+  // close_tick()
+  void record_far(size_t leaf, uint32_t far_multipoles, uint64_t ns) {
+    far_[leaf] = {.far_multipoles = far_multipoles, .ns = ns};
+  }
+
+  // [cuts[i], cuts[i + 1]) is chunk i; `parts` chunks of about equal cost,
+  // fewer if there are fewer leaves
+  const std::vector<size_t> &partition(size_t parts);
+  // The same per segment: [bounds[s], bounds[s + 1]) is cut into parts[s]
+  // chunks of its own, so no chunk crosses a bound. bounds runs from 0 to
+  // leaf_count(); the engine passes its NUMA regions' leaf ranges
+  const std::vector<size_t> &partition(std::span<const size_t> bounds,
+                                       std::span<const size_t> parts);
+  // Folds the far field into each leaf's cost and sums the costs per chunk
+  // of the last partition. Call after the tick that used it
+  void close_tick();
+
+  // Instrumentation
+  size_t leaf_count() const { return costs_.size(); }
+  std::span<const LeafCost> costs() const { return costs_; }
+  const std::vector<size_t> &cuts() const { return cuts_; }
+  // Measured ns per chunk in the last closed tick
+  const std::vector<uint64_t> &chunk_ns() const { return chunk_ns_; }
+  // Slowest chunk over the mean chunk, 1.0 is perfect balance
+  double imbalance() const;
+
+private:
+  std::vector<LeafCost> costs_;
+  std::vector<LeafCost> far_; // only far_multipoles and ns, this tick's
+  std::vector<size_t> cuts_;
+  std::vector<uint64_t> chunk_ns_;
+  bool measured_ = false;
+
+  uint64_t weight(size_t leaf) const;
+  // Appends the cuts of [begin, end) into `parts` chunks, `end` last
+  void cut(size_t begin, size_t end, size_t parts);
+};
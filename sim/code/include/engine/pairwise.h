@@ -1,6 +1,21 @@
 #pragma once
 #include "ds/storage/particleBlock.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/neighbour_lists.h"
+#include <cstdint>
 
 void calcBlocskAx(ParticleBlock &block);
 
+// Pull of every body in `source` onto the bodies of `target`
+void calc_pair_ax(ParticleBlock &target, const ParticleBlock &source);
+
+// Near field of one leaf: own block plus the precomputed neighbour blocks.
+// Writes only the accelerations of the leaf's own chain. Returns the body
+// pairs evaluated
+uint64_t calc_leaf_ax(const LeafNeighbourLists &lists, Storage &storage,
+                      size_t leaf);
+// What calc_leaf_ax would return, without computing anything
+uint64_t leaf_pairs(const LeafNeighbourLists &lists, const Storage &storage,
+                    size_t leaf);
+
 void updateCoords(ParticleBlock &block, std::chrono::microseconds dt);
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/* A tick is a fixed sequence of phases. The ownership rules below are what
+ * lets blocks and tree nodes go without locks:
+ *
+ * kBuild     - tree inserts from any number of threads (lock-free protocol in
+ *              ds/tree/octree.h). Nothing else reads the tree.
+ * kForce     - the tree and all positions/masses are read-only. A block's
+ *              accelerations are written only by the thread that claimed it.
+ *              The far field goes to a side buffer, not into the blocks.
+ * kIntegrate - each block is read and written only by its claimer, which
+ *              first adds the far field and the other ranks' pull to it
+ *              (dist/let.h).
+ * kMigrate   - particles that left their leaf are pulled out and reinserted;
+ *              tree topology may change, one thread per claimed block.
+ *              Ends with the render snapshot being written and published
+ *              and, every snapshot_every ticks, the arena being copied out
+ *              for io/snapshot_writer.h.
+ *
+ * A checking tracker records every claim and reports and aborts on a second
+ * claimer of the same block in the same phase. Build with GRAVWLL_RACE_CHECK
+ * to make checking the default; otherwise claim() is a single branch on a
+ * flag that is never set outside tests.
+ */
+enum class Phase : uint8_t { kIdle, kBuild, kForce, kIntegrate, kMigrate };
+
+const char *phase_name(Phase phase);
+
+#ifdef GRAVWLL_RACE_CHECK
+inline constexpr bool kRaceCheck = true;
+#else
+inline constexpr bool kRaceCheck = false;
+#endif
+
+class PhaseTracker {
+public:
+  explicit PhaseTracker(size_t blocks, bool check = kRaceCheck);
+
+  Phase current() const { return phase_; }
+  // Aborts on a transition that skips or reorders phases
+  void enter(Phase next);
+  // The block arena grows between ticks; call before the next phase begins
+  void track_blocks(size_t blocks);
+
+  // The calling thread is the only one touching `block` until the phase ends
+  void claim(size_t block) {
+    if (check_)
+      record_claim(block);
+  }
+
+private:
+  Phase phase_ = Phase::kIdle;
+  size_t blocks_;
+  bool check_;
+  std::unique_ptr<std::atomic<uint32_t>[]> owners_; // 0 = unclaimed
+
+  void record_claim(size_t block);
+};
@@ -0,0 +1,8 @@
+#pragma once
+#include "gfx/renderer/scene.h"
+#include "utils/triple_buffer.h"
+#include <vector>
+
+// Positions, masses and visual ids written by physics at the end of every
+// tick and picked up by the render thread without touching the tree
+using RenderSnapshot = TripleBuffer<std::vector<gfx::renderer::SceneParticle>>;
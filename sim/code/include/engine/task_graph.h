@@ -0,0 +1,52 @@
+#pragma once
+#include "engine/expansions.h"
+#include "utils/thread_pool.h"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+struct AROctreeNode;
+class Storage;
+
+/* The force phase as a dependency graph instead of barrier-separated loops.
+ *
+ * - Leaf P2M tasks and near-field (P2P) tasks are all ready at the start
+ *   and go into the pool together, upward work first since it is on the
+ *   critical path.
+ * - An internal node's M2M depends on its 8 children. Each node counts
+ *   them down in AROctreeNode::pending_children; whoever finishes the last
+ *   child runs the parent's M2M right away on the same thread and keeps
+ *   climbing. No task is spawned for it and no level waits for the one
+ *   below to drain.
+ * - P2P chunks fill the gaps while the upward pass narrows towards the
+ *   root, so nothing waits on a phase tail. Their boundaries come from the
+ *   caller, normally equal-cost cuts (engine/load_balance.h).
+ * - The far field of a leaf reads multipoles from anywhere in the tree, so
+ *   it depends on the root's M2M and nothing else. The thread that finishes
+ *   the root submits one far-field task per near-field chunk, same range
+ *   and same home, into the same group; they overlap whatever P2P is still
+ *   queued. There is no barrier between the two passes.
+ */
+class ForceTaskGraph {
+public:
+  // Called with [begin, end) ranges of the near-field items, in any order
+  // and from any pool thread
+  using NearField = std::function<void(size_t, size_t)>;
+  // Same ranges, each once the upward pass has reached the root. May run
+  // alongside the near field of the same range
+  using FarField = std::function<void(size_t, size_t)>;
+
+  // `nodes` in level order with node_index == position
+  // (AROctree::collect_nodes). Near-field chunk c is
+  // [near_cuts[c], near_cuts[c + 1]), submitted for pool home near_homes[c]
+  // (any runner past its end), and so is far-field chunk c when `far_field`
+  // is set. Returns when every task is done
+  void run(ThreadPool &pool, const std::vector<AROctreeNode *> &nodes,
+           const Storage &storage, Expansions &ex,
+           const std::vector<size_t> &near_cuts,
+           const std::vector<unsigned> &near_homes,
+           const NearField &near_field, const FarField &far_field = {});
+
+private:
+  std::vector<const AROctreeNode *> leaves_; // reused between ticks
+};
@@ -2,7 +2,7 @@
 
 #include "ctx/ctx.h"
 #include "ctx/simulation_state.h"
-#include "ds/tree/octree.h"
+#include "engine/render_snapshot.h"
 #include "renderer/renderer.h"
 #include "utils/namespaces/error_namespace.h"
 #include "window.h"
@@ -11,7 +11,8 @@ namespace gfx {
 
 class GfxEngine {
 public:
-  explicit GfxEngine(GfxCtx &g_ctx, SimulationState &s_state, AROctree &tree);
+  explicit GfxEngine(GfxCtx &g_ctx, SimulationState &s_state,
+                     RenderSnapshot &snapshot);
 
   error::Result<bool> init();
   void run();
@@ -19,11 +20,11 @@ public:
 
 private:
   void tick_(float delta_time);
-  void update_scene_from_tree();
+  void update_scene_from_snapshot();
 
   GfxCtx &g_ctx_;            // gfx context
   SimulationState &s_state_; // shared state
-  AROctree &tree_;
+  RenderSnapshot &snapshot_; // consumer end, physics publishes
 
   window::MyWindow window_;
   std::unique_ptr<renderer::Renderer> render_;
@@ -0,0 +1,55 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include "utils/namespaces/MyMath.h"
+#include "utils/namespaces/error_namespace.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+class ThreadPool;
+
+/* An opened DATAMODE=file input, whatever its format.
+ *
+ * The engine builds the tree straight from it: the input is cut into parts
+ * that can be read independently, and each pool task visits the bodies of
+ * one part and inserts them. No format hands over a std::vector<Particle>,
+ * so the set is never held twice.
+ */
+namespace io {
+struct TextFormat;
+struct GadgetUnits;
+
+class BodySource {
+public:
+  using Visitor = std::function<void(const Particle &)>;
+
+  virtual ~BodySource() = default;
+
+  virtual size_t size() const = 0;
+  // Simulation units; every body lies inside
+  virtual MyMath::BoundingBox bounds() const = 0;
+  // Bodies come in ascending Morton point key order (within bounds())
+  virtual bool morton_sorted() const { return false; }
+
+  virtual size_t parts() const = 0;
+  // Visits the bodies of `part` in input order. Parts in ascending order
+  // visit the whole input in order. Safe to call for different parts at
+  // once
+  virtual void for_each(size_t part, const Visitor &visit) const = 0;
+};
+
+// Smallest cube around [lo, hi], grown a little so that bodies on the far
+// faces are inside. For formats that do not record their bounds
+MyMath::BoundingBox enclosing_cube(const MyMath::Vector3 &lo,
+                                   const MyMath::Vector3 &hi);
+
+// Opens `path` as whichever format its first bytes say it is: a particle
+// file (io/particle_file.h), a multi-rank snapshot (io/snapshot_writer.h),
+// a GADGET set (io/gadget.h) converted with
+// `gadget`, else a text table (io/text_table.h) read with `text`. `pool`
+// runs whatever scan the format needs up front
+error::CResult<std::shared_ptr<const BodySource>>
+open_body_source(const std::string &path, const TextFormat &text,
+                 const GadgetUnits &gadget, ThreadPool &pool);
+} // namespace io
@@ -0,0 +1,182 @@
+#pragma once
+#include "ds/storage/particleBlock.h"
+#include "io/body_source.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Storage;
+
+/* GADGET-2/3 snapshots and initial conditions, what cosmology codes write.
+ *
+ * A file is a run of Fortran records, [int32 n][n bytes][int32 n]:
+ *
+ *   HEAD  GadgetHeader, 256 bytes
+ *   POS   float or double [N][3]
+ *   VEL   same precision [N][3]
+ *   ID    uint32 or uint64 [N]
+ *   MASS  [bodies of the types whose header mass is 0]
+ *
+ * with bodies grouped by type 0..5 in every block. Format 2 puts an
+ * 8-byte record {"NAME", int32 next record + 8} before each block and may
+ * order and add blocks freely; blocks other than the four above are
+ * skipped. Precision and id width come from the block sizes. A set written
+ * as several files is snap.0 .. snap.<num_files - 1>; open either "snap"
+ * or "snap.0".
+ *
+ * Every type is read; gravity does not care which is which. Values are
+ * converted with GadgetUnits, velocities as stored (sqrt(a) times the
+ * peculiar velocity in comoving runs). The box is [0, BoxSize)^3 when the
+ * header has one, otherwise the smallest cube around the positions.
+ * Little-endian files only.
+ */
+namespace io {
+// What one GADGET unit is in SI. Defaults are GADGET's: kpc, 1e10 Msun,
+// km/s, without factors of h
+struct GadgetUnits {
+  double length = 3.085678e19; // metres
+  double mass = 1.989e40;      // kilograms
+  double velocity = 1e3;       // metres per second
+};
+
+struct GadgetHeader {
+  static constexpr size_t kTypes = 6;
+
+  int32_t npart[kTypes]; // in this file
+  double mass[kTypes];   // per type; 0: per body, from the MASS block
+  double time;
+  double redshift;
+  int32_t flag_sfr;
+  int32_t flag_feedback;
+  uint32_t npart_total[kTypes]; // whole set, low 32 bits
+  int32_t flag_cooling;
+  int32_t num_files;
+  double box_size;
+  double omega0;
+  double omega_lambda;
+  double hubble_param;
+  int32_t flag_stellarage;
+  int32_t flag_metals;
+  uint32_t npart_total_high_word[kTypes];
+  int32_t flag_entropy_instead_u;
+  int32_t flag_doubleprecision;
+  uint8_t fill[256 - 6 * 4 - 6 * 8 - 2 * 8 - 2 * 4 - 6 * 4 - 2 * 4 -
+               4 * 8 - 2 * 4 - 6 * 4 - 2 * 4];
+};
+static_assert(sizeof(GadgetHeader) == 256);
+
+// Reads a whole snapshot set, every file mapped
+class GadgetSnapshot final : public BodySource {
+public:
+  static constexpr size_t kPartBodies = size_t{1} << 16;
+
+  static error::CResult<std::shared_ptr<const GadgetSnapshot>>
+  open(const std::string &path, const GadgetUnits &units, ThreadPool &pool);
+  // Whether `path` (or "<path>.0") starts like a GADGET file
+  static bool looks_like(const std::string &path);
+
+  ~GadgetSnapshot() override;
+  GadgetSnapshot(const GadgetSnapshot &) = delete;
+  GadgetSnapshot &operator=(const GadgetSnapshot &) = delete;
+
+  size_t size() const override { return count_; }
+  MyMath::BoundingBox bounds() const override { return bounds_; }
+  size_t parts() const override { return parts_.size(); }
+  void for_each(size_t part, const Visitor &visit) const override;
+  // Header of the first file
+  const GadgetHeader &header() const { return files_.front().header; }
+  size_t files() const { return files_.size(); }
+
+private:
+  struct File {
+    const std::byte *base = nullptr;
+    size_t bytes = 0;
+    GadgetHeader header{}; // copied out: records are not 8-byte aligned
+    const std::byte *pos = nullptr, *vel = nullptr, *ids = nullptr,
+                    *masses = nullptr;
+    size_t real_bytes = 4; // float or double
+    size_t id_bytes = 4;
+    // Bodies of types below t, and of those only the ones in MASS
+    std::array<size_t, GadgetHeader::kTypes + 1> type_first{};
+    std::array<size_t, GadgetHeader::kTypes> mass_first{};
+  };
+  struct Part {
+    size_t file, begin, end; // bodies [begin, end) of files_[file]
+  };
+
+  GadgetSnapshot() = default;
+  // Maps `path` and finds its blocks; nullptr or why not
+  const char *add_file(const std::string &path);
+  Particle body(const File &file, size_t type, size_t i) const;
+
+  GadgetUnits units_;
+  std::vector<File> files_;
+  std::vector<Part> parts_;
+  size_t count_ = 0;
+  MyMath::BoundingBox bounds_{};
+};
+
+// What the writer records besides the bodies, in GADGET units
+struct GadgetLayout {
+  uint64_t count = 0;
+  GadgetUnits units{};
+  double box_size = 0.0; // 0: not a periodic box
+  double time = 0.0;
+  double redshift = 0.0;
+  int type = 1;                 // every body is written as this type
+  bool double_precision = false;
+  bool long_ids = true;
+  bool format2 = false;         // tag every block with its name
+  // > 1: this file is one of a split set (".0" .. ".<num_files - 1>"). The
+  // set's totals are left 0, no file knows the others' counts
+  int num_files = 1;
+};
+
+// Writes one GADGET file of a single type with per-body masses. Bodies are
+// appended in order, block by block, through a staging chunk per record
+// that is flushed with pwrite when full; the header goes in last
+class GadgetWriter {
+public:
+  static constexpr size_t kChunkBodies = size_t{1} << 14;
+
+  static error::CResult<std::unique_ptr<GadgetWriter>>
+  create(const std::string &path, const GadgetLayout &layout);
+  ~GadgetWriter();
+  GadgetWriter(const GadgetWriter &) = delete;
+  GadgetWriter &operator=(const GadgetWriter &) = delete;
+
+  // Every body of `block`, the visual id as the GADGET id. false past
+  // layout.count or on I/O failure
+  bool append(const ParticleBlock &block);
+  // One body, in simulation units
+  bool append(const double (&position)[3], const double (&velocity)[3],
+              double mass, uint64_t id);
+  // Flushes and writes the header; false if fewer than `count` bodies came
+  bool finish();
+
+private:
+  enum Record : size_t { kPos, kVel, kIds, kMass, kRecords };
+
+  GadgetWriter(int fd, const GadgetLayout &layout);
+  bool flush();
+  bool write_at(uint64_t offset, const void *data, size_t bytes);
+
+  int fd_;
+  GadgetLayout layout_;
+  size_t real_bytes_, id_bytes_;
+  // Payload offset of each record, and the header's
+  std::array<uint64_t, kRecords> offset_{};
+  uint64_t header_offset_ = 0;
+  std::array<std::vector<std::byte>, kRecords> chunk_;
+  size_t staged_ = 0;  // bodies in the chunks
+  size_t written_ = 0; // bodies flushed before them
+};
+
+// Every body in the active blocks of `storage`, in slot order. The layout's
+// count is taken from the storage
+bool write_gadget_snapshot(const std::string &path, const Storage &storage,
+                           GadgetLayout layout);
+} // namespace io
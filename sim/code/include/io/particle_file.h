@@ -0,0 +1,154 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include "io/body_source.h"
+#include "utils/namespaces/MyMath.h"
+#include "utils/namespaces/error_namespace.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* Native particle file (.gwp), what DATAMODE=file loads.
+ *
+ *   [FileHeader, 256 bytes][column][column]...
+ *
+ * Little-endian throughout. Every present field is one contiguous column of
+ * `count` values (doubles, uint64 for kId) starting at a page-aligned
+ * offset listed in the header, so a mapped file is already SoA and a reader
+ * touches only the pages of the columns it uses. Position and mass columns
+ * are required, velocity and id optional (zero / index when absent).
+ *
+ * Values are in file units; the header says how many metres, kilograms and
+ * metres per second one unit is, and body() converts to the simulation's SI.
+ * The bounding box is in file units too. kMortonSorted promises the bodies
+ * are in ascending sfc::point_key(kMorton, position, bounds) order: loaders
+ * can cut the file into contiguous curve ranges without sorting anything.
+ *
+ * The version is bumped on any layout change; readers reject versions they
+ * do not know.
+ */
+namespace io {
+static_assert(std::endian::native == std::endian::little,
+              "particle files are read and written in host byte order");
+
+enum class Column : uint8_t { kX, kY, kZ, kVx, kVy, kVz, kMass, kId };
+inline constexpr size_t kColumns = 8;
+
+constexpr uint32_t column_bit(Column c) {
+  return 1u << static_cast<unsigned>(c);
+}
+inline constexpr uint32_t kPositionColumns =
+    column_bit(Column::kX) | column_bit(Column::kY) | column_bit(Column::kZ);
+inline constexpr uint32_t kVelocityColumns =
+    column_bit(Column::kVx) | column_bit(Column::kVy) | column_bit(Column::kVz);
+inline constexpr uint32_t kBodyColumns =
+    kPositionColumns | kVelocityColumns | column_bit(Column::kMass);
+inline constexpr uint32_t kAllColumns = kBodyColumns | column_bit(Column::kId);
+
+struct FileHeader {
+  static constexpr char kMagic[8] = {'G', 'R', 'A', 'V', 'W', 'L', 'L', 'P'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kMortonSorted = 1u << 0;
+  static constexpr size_t kColumnAlignment = 4096;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes; // columns start at or after this
+  uint64_t count;
+  uint32_t columns; // column_bit() of every present column
+  uint32_t flags;
+  double length_unit;   // metres
+  double mass_unit;     // kilograms
+  double velocity_unit; // metres per second
+  double bounds_min[3];
+  double bounds_max[3];
+  uint64_t column_offset[kColumns]; // bytes from file start, 0 if absent
+  uint8_t reserved[256 - 8 - 4 - 4 - 8 - 4 - 4 - 3 * 8 - 6 * 8 -
+                   kColumns * 8];
+};
+static_assert(sizeof(FileHeader) == 256);
+
+// What the writer records besides the columns
+struct FileLayout {
+  uint64_t count = 0;
+  uint32_t columns = kBodyColumns;
+  bool morton_sorted = false;
+  MyMath::BoundingBox bounds{};
+  double length_unit = 1.0, mass_unit = 1.0, velocity_unit = 1.0;
+};
+
+// Read-only mapping of a particle file
+class ParticleFile final : public BodySource {
+public:
+  // Bodies per part handed to one insert task
+  static constexpr size_t kPartBodies = size_t{1} << 16;
+
+  static error::CResult<std::shared_ptr<const ParticleFile>>
+  open(const std::string &path);
+  // Body count from the header alone, without mapping the file
+  static std::optional<uint64_t> peek_count(const std::string &path);
+
+  ~ParticleFile() override;
+  ParticleFile(const ParticleFile &) = delete;
+  ParticleFile &operator=(const ParticleFile &) = delete;
+
+  size_t size() const override {
+    return static_cast<size_t>(header_->count);
+  }
+  const FileHeader &header() const { return *header_; }
+  bool morton_sorted() const override {
+    return (header_->flags & FileHeader::kMortonSorted) != 0;
+  }
+  MyMath::BoundingBox bounds() const override;
+  size_t parts() const override {
+    return (size() + kPartBodies - 1) / kPartBodies;
+  }
+  void for_each(size_t part, const Visitor &visit) const override;
+  // Body `i` in simulation units, visual id from kId or the index
+  Particle body(size_t i) const;
+  // Raw column in file units, nullptr if absent
+  const double *column(Column c) const;
+  const uint64_t *ids() const;
+
+private:
+  ParticleFile(const void *base, size_t bytes);
+
+  const std::byte *base_;
+  size_t bytes_;
+  const FileHeader *header_;
+};
+
+// Streams columns into a new particle file with pwrite. Columns may be
+// written in any order and in pieces, e.g. block by block from the arena
+class ParticleFileWriter {
+public:
+  static error::CResult<std::unique_ptr<ParticleFileWriter>>
+  create(const std::string &path, const FileLayout &layout);
+  ~ParticleFileWriter();
+  ParticleFileWriter(const ParticleFileWriter &) = delete;
+  ParticleFileWriter &operator=(const ParticleFileWriter &) = delete;
+
+  const FileHeader &header() const { return header_; }
+  // values[0, n) land at bodies [first, first + n) of column `c`
+  bool write(Column c, size_t first, const double *values, size_t n);
+  bool write_ids(size_t first, const uint64_t *ids, size_t n);
+  // Writes the header last, so a file cut short never looks complete
+  bool finish();
+
+private:
+  ParticleFileWriter(int fd, FileHeader header);
+  bool write_at(uint64_t offset, const void *data, size_t bytes);
+
+  int fd_;
+  FileHeader header_;
+};
+
+// Whole set in one go, for tools and tests. Particle keeps no id, so no
+// kId column is written
+bool write_particle_file(const std::string &path,
+                         const std::vector<Particle> &bodies,
+                         FileLayout layout);
+} // namespace io
@@ -0,0 +1,159 @@
+#pragma once
+#include "ds/tree/sfc.h"
+#include "io/body_source.h"
+#include "io/gadget.h"
+#include "io/particle_file.h"
+#include "utils/namespaces/MyMath.h"
+#include "utils/namespaces/error_namespace.h"
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AROctreeNode;
+class Storage;
+class ThreadPool;
+
+/* Periodic snapshots that do not hold up the physics loop.
+ *
+ * At a tick boundary the engine calls capture(): the positions, velocities,
+ * masses and visual ids under every leaf are memcpy'd from the arena into
+ * staging columns, leaves in curve order and each leaf's chain in turn, one
+ * pool task per range of leaves. That copy is all the physics thread pays.
+ * A background I/O thread then writes the columns as a particle file
+ * (io/particle_file.h), one large sequential pwrite per column, to
+ * "<name>.part" and renames it into place once complete, so a crash never
+ * leaves a half-written snapshot under the real name. A snapshot is a valid
+ * DATAMODE=file input, which is how a run restarts.
+ *
+ * On the Morton curve the I/O thread also sorts each leaf's bodies by key.
+ * The file is then in curve order throughout and is marked kMortonSorted,
+ * so a restart cuts it into ranges without sorting. Should a body's key
+ * fall outside its leaf's range (the recorded box is not the tree's), the
+ * mark is left off.
+ *
+ * There is one staging area. A capture that comes while the previous
+ * snapshot is still being written is skipped and counted rather than
+ * waited for.
+ *
+ * In a multi-rank run every rank writes its own share of the bodies,
+ * "<prefix>_r<rank>_<tick>.gwp", and rank 0 also writes the manifest
+ * "<prefix>_<tick>.gws" (SnapshotSet) listing every share. The manifest is
+ * what a restart loads, with any number of ranks.
+ *
+ * With SnapshotFormat::kGadget the same columns go out as a GADGET file
+ * (io/gadget.h) instead, double precision with 64-bit ids, for analysis
+ * codes that read that. It is "<prefix>_<tick>"; with several ranks each
+ * writes "<prefix>_<tick>.<rank>" of a split set, which needs no manifest.
+ */
+namespace io {
+enum class SnapshotFormat : uint8_t { kGwp, kGadget };
+
+// "gwp" or "gadget", throws otherwise
+SnapshotFormat snapshot_format_from_string(const std::string &name);
+
+class SnapshotWriter {
+public:
+  struct Stats {
+    uint64_t written = 0;
+    uint64_t skipped = 0; // the I/O thread was still busy
+    uint64_t failed = 0;
+  };
+
+  // Files are "<prefix>_<tick>.gwp"; the prefix's directory is created.
+  // With `ranks` > 1 this is rank `rank`'s writer, see above. The I/O
+  // thread runs on `cpus`, unpinned if empty. GADGET files are in `units`
+  SnapshotWriter(std::string prefix, std::vector<unsigned> cpus = {},
+                 unsigned rank = 0, unsigned ranks = 1,
+                 SnapshotFormat format = SnapshotFormat::kGwp,
+                 GadgetUnits units = {});
+  // Finishes the snapshot in flight
+  ~SnapshotWriter();
+  SnapshotWriter(const SnapshotWriter &) = delete;
+  SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+  // Stages every body under `leaves`, as AROctree::collect_leaves gives
+  // them, and queues the write. `bounds` is the run's box, recorded unless
+  // bodies have left it. false if skipped. Only between phases: nothing may
+  // move bodies meanwhile
+  bool capture(const Storage &storage,
+               const std::vector<AROctreeNode *> &leaves, uint64_t tick,
+               const MyMath::BoundingBox &bounds, ThreadPool &pool);
+  // Returns once no snapshot is in flight
+  void wait();
+  Stats stats() const;
+  // This rank's file
+  std::string path_for(uint64_t tick) const;
+  // What DATAMODE=file restarts from: path_for(), or the manifest if the
+  // run has several ranks
+  std::string restart_path_for(uint64_t tick) const;
+
+private:
+  void run();
+  bool write(uint64_t tick);
+  bool sort_leaves(const MyMath::BoundingBox &bounds);
+  bool write_particle_file(const std::string &path,
+                           const MyMath::BoundingBox &bounds,
+                           bool morton_sorted) const;
+  bool write_gadget(const std::string &path,
+                    const MyMath::BoundingBox &bounds) const;
+  bool write_manifest(uint64_t tick) const;
+
+  std::string prefix_;
+  unsigned rank_, ranks_;
+  SnapshotFormat format_;
+  GadgetUnits units_;
+  std::array<std::vector<double>, kColumns - 1> columns_; // kX .. kMass
+  std::vector<uint64_t> ids_;
+  std::vector<size_t> first_; // staged index of each leaf's first body
+  size_t count_ = 0;
+  sfc::Curve curve_ = sfc::Curve::kMorton; // the leaves'
+  MyMath::BoundingBox bounds_{};
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_, idle_;
+  bool pending_ = false; // staged, not yet written
+  bool stop_ = false;
+  uint64_t tick_ = 0;
+  Stats stats_;
+  std::thread thread_;
+};
+
+/* A snapshot written by several ranks, loaded as one input.
+ *
+ * The manifest (.gws) is text: kMagic on the first line, then the file
+ * name of every rank's share, relative to the manifest's directory. The
+ * set visits the shares one after the other, so every rank of a restart
+ * sees the full set and cuts it as usual (Ctx::connect_ranks). Shares
+ * only appear under their name once complete, but rank 0 does not wait for
+ * the others before writing the manifest: a share that is not there fails
+ * the open instead of restarting from part of the bodies.
+ */
+class SnapshotSet final : public BodySource {
+public:
+  static constexpr char kMagic[8] = {'G', 'R', 'A', 'V', 'W', 'L', 'L', 'S'};
+
+  static error::CResult<std::shared_ptr<const SnapshotSet>>
+  open(const std::string &path);
+
+  size_t size() const override { return size_; }
+  // The run's box if every share kept it, else a cube around all of them
+  MyMath::BoundingBox bounds() const override { return bounds_; }
+  size_t parts() const override { return first_part_.back(); }
+  void for_each(size_t part, const Visitor &visit) const override;
+  size_t shares() const { return shares_.size(); }
+
+private:
+  SnapshotSet() = default;
+
+  std::vector<std::shared_ptr<const ParticleFile>> shares_;
+  std::vector<size_t> first_part_{0}; // of each share, then the total
+  size_t size_ = 0;
+  MyMath::BoundingBox bounds_{};
+};
+} // namespace io
@@ -0,0 +1,87 @@
+#pragma once
+#include "io/body_source.h"
+#include "io/particle_file.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* CSV or whitespace-separated table of bodies, one per line.
+ *
+ * The file is mapped and cut into newline-aligned parts of about
+ * kPartBytes. open() scans the parts in parallel once: rows, bounds and
+ * syntax, with std::from_chars straight on the mapped bytes. for_each()
+ * parses a part again and hands each row over as it goes, so a catalog of
+ * any size is inserted without a copy of it in memory. Blank lines and
+ * lines starting with '#' are skipped; numbers are plain decimal or
+ * scientific.
+ *
+ * A line with a comma is split on commas, otherwise on runs of blanks.
+ * Which column is which comes from TextFormat::columns, or failing that
+ * from the header row's names (x y z vx vy vz mass|m id), or failing that
+ * from the column count: x y z mass, x y z vx vy vz mass, or the same
+ * followed by id. Velocities default to 0, mass to 1, id to the row.
+ * Values are taken as SI.
+ */
+namespace io {
+struct TextFormat {
+  enum class Header : uint8_t { kAuto, kYes, kNo };
+  // kAuto: a first line with anything that is not a number is the header
+  Header header = Header::kAuto;
+  // "field=source,...", e.g. "x=pos_x,y=pos_y,z=pos_z,mass=4": source is a
+  // header name or a 0-based column index. Empty for the defaults above
+  std::string columns;
+};
+
+TextFormat::Header header_from_string(const std::string &name);
+
+class TextTable final : public BodySource {
+public:
+  static constexpr size_t kPartBytes = size_t{4} << 20;
+
+  static error::CResult<std::shared_ptr<const TextTable>>
+  open(const std::string &path, const TextFormat &format, ThreadPool &pool);
+
+  ~TextTable() override;
+  TextTable(const TextTable &) = delete;
+  TextTable &operator=(const TextTable &) = delete;
+
+  size_t size() const override { return rows_; }
+  // Smallest cube around every body, with a little margin
+  MyMath::BoundingBox bounds() const override { return bounds_; }
+  size_t parts() const override { return parts_.size(); }
+  void for_each(size_t part, const Visitor &visit) const override;
+
+private:
+  struct Part {
+    const char *begin, *end;
+    size_t first_row = 0;
+    size_t rows = 0;
+  };
+  // Field value per io::Column of one row
+  using Row = std::array<double, kColumns>;
+  static constexpr int8_t kUnused = -1;
+
+  TextTable(const char *base, size_t bytes);
+
+  const char *base_;
+  size_t bytes_;
+  char delimiter_ = ','; // '\0': runs of blanks
+  // Column of each input field, kUnused for fields nobody reads
+  std::vector<int8_t> field_column_;
+  uint32_t mapped_ = 0; // column_bit() of every mapped column
+  std::vector<Part> parts_;
+  size_t rows_ = 0;
+  MyMath::BoundingBox bounds_{};
+
+  // Where the columns are, from the first line; nullptr or why not
+  const char *map_columns(const std::vector<std::string> &names,
+                          size_t fields, const TextFormat &format);
+  // false if a mapped field is missing or not a number
+  bool parse_row(const char *begin, const char *end, Row &row,
+                 uint64_t &id) const;
+  Particle to_body(const Row &row, uint64_t id) const;
+};
+} // namespace io
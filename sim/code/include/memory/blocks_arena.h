@@ -1,39 +1,185 @@
 #pragma once
 #include "ds/storage/particleBlock.h"
+#include "memory/numa.h"
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 /* This file contains memory arena used by BlockMemnoryManager */
 
+/* How free slots are picked.
+ *
+ * kFreeList - LIFO stack of freed slots. O(1), but after a few splits the
+ *             blocks of neighbouring leaves sit at arbitrary offsets.
+ * kSpatial  - the caller passes a slot hint derived from the cell's curve key
+ *             (approach 1/2 in docs/MEMORY_MANAGER.md) and gets the free slot
+ *             nearest to it; split siblings are placed as one contiguous run.
+ */
+enum class BlockPlacement : uint8_t { kFreeList, kSpatial };
+
+BlockPlacement placement_from_string(const std::string &name);
+
+/* Page size requested for the arena. P2P reads neighbour blocks all over the
+ * arena, so with 4 KB pages most of them cost a TLB miss.
+ *
+ * kSmall - regular pages.
+ * kHuge  - 2 MB pages: MAP_HUGETLB for each chunk the arena commits, so the
+ *          hugetlbfs pool only backs what is in use. Once the pool can't
+ *          back a chunk, the rest of the arena uses transparent huge pages
+ *          via madvise.
+ */
+enum class PageSize : uint8_t { kSmall, kHuge };
+// What the kernel actually gave us, for the latest commit
+enum class PageBacking : uint8_t { kSmall, kHugeTlb, kTransparent };
+
+PageSize page_size_from_string(const std::string &name);
+const char *page_backing_name(PageBacking backing);
+
+/* Slots live in one virtual range reserved up front for `max_capacity`
+ * blocks with PROT_NONE; only part of it is backed by committed pages. When
+ * every committed slot is taken, allocate() commits more with mprotect, or
+ * with MAP_FIXED hugetlb pages over the reserve for PageSize::kHuge. The
+ * range never moves, so ParticleBlock* and slot indices stay valid while the
+ * arena grows.
+ *
+ * Given more than one NUMA node the range is cut into one region per node.
+ * A region covers an equal share of the curve (region_for, slot_for) and
+ * commits its own pages with its node as their preferred node, so they land
+ * there whichever thread touches them first. The engine hands each region's
+ * leaves to the workers pinned to that node (PhysicsCtx::runner_homes).
+ * Slots between a region's committed end and the next region are holes,
+ * kept marked as occupied. `capacity` is the end of the last region's
+ * committed slots.
+ *
+ * The cold halves of the blocks (ParticleBlock::ColdBlock) live in a second
+ * range with the same slot indices, committed in step with the first one.
+ * It always uses regular pages: only the hot range is streamed by P2P.
+ */
 class BlocksAllocator {
 public:
-  BlocksAllocator(size_t capacity)
-      : k_block_size(sizeof(ParticleBlock)), capacity(capacity),
-        current_counter(0), free_head(0), next_free_array(capacity) {
-    if (capacity > 0) {
-      for (uint i = 0; i < capacity; ++i) {
-        next_free_array[i] = (i + 1);
-      }
-      next_free_array[capacity - 1] = capacity;
-    }
-  }
+  static constexpr size_t kNoSlot = std::numeric_limits<size_t>::max();
+
+  static constexpr size_t kHugePageSize = size_t{2} << 20;
+
+  BlocksAllocator(size_t capacity, size_t max_capacity,
+                  BlockPlacement placement = BlockPlacement::kFreeList,
+                  PageSize pages = PageSize::kSmall,
+                  std::vector<numa::Node> nodes = {})
+      : k_block_size(sizeof(ParticleBlock)),
+        k_cold_size(sizeof(ParticleBlock::ColdBlock)), capacity(0),
+        max_capacity(std::max(capacity, max_capacity)), placement(placement),
+        pages(pages), current_counter(0), initial_capacity_(capacity),
+        nodes_(nodes.size() > 1 ? std::move(nodes)
+                                : std::vector<numa::Node>{}) {}
   ~BlocksAllocator();
 
   int initialize();
   void clean_up();
 
-  ParticleBlock *allocate();
+  // hint is a slot index. It picks the region for both policies, only
+  // kSpatial looks for a slot near it
+  ParticleBlock *allocate(size_t hint = 0);
+  // `count` adjacent slots in the hint's region, the first one as close after
+  // `hint` as possible. nullptr if no such run exists or the policy can't
+  // provide one
+  ParticleBlock *allocate_run(size_t count, size_t hint);
   void deallocate(ParticleBlock *block);
 
+  // Maps a position along the curve, as a 32-bit fraction, onto the
+  // committed slots of the region owning that part of the curve
+  size_t slot_for(uint64_t fraction) const;
+  // Region owning that part of the curve, 0 on a single node
+  size_t region_for(uint64_t fraction) const;
+  size_t region_count() const { return regions_.size(); }
+  size_t region_of(size_t index) const { return index / region_slots_; }
+  // Bound on any slot index the arena can ever hand out
+  size_t slot_limit() const { return regions_.size() * region_slots_; }
+  // Committed slots of a region are [region_begin, region_begin + committed)
+  size_t region_begin(size_t region) const { return regions_[region].begin; }
+  size_t region_committed(size_t region) const {
+    return regions_[region].committed;
+  }
+  // Commits at least `slots` in the region. false if its reserve is smaller
+  bool reserve(size_t region, size_t slots) { return grow(region, slots); }
+  // Exactly `slots` become occupied, every other committed slot free. For
+  // compaction, once the caller has moved its blocks there
+  void reassign(const std::vector<size_t> &slots);
+  // nullptr unless the arena is split across NUMA nodes
+  const numa::Node *region_node(size_t region) const {
+    return nodes_.empty() ? nullptr : &nodes_[region];
+  }
+
+  PageBacking page_backing() const { return backing_; }
+
+  // Cold half of the block in slot `index`
+  ParticleBlock::ColdBlock *cold_at(size_t index) const {
+    return reinterpret_cast<ParticleBlock::ColdBlock *>(cold_base +
+                                                        index * k_cold_size);
+  }
+
+  bool is_occupied(size_t index) const {
+    return (occupied_[index / 64] >> (index % 64)) & 1u;
+  }
+
 public:
   const size_t k_block_size = sizeof(ParticleBlock);
-  size_t capacity;
+  const size_t k_cold_size = sizeof(ParticleBlock::ColdBlock);
+  size_t capacity; // slot index bound
+  const size_t max_capacity;
+  const BlockPlacement placement;
+  const PageSize pages;
 
   size_t current_counter = 0;
-  size_t free_head;
 
   std::byte *base = nullptr;
   std::byte *last_block = nullptr;
+  std::byte *cold_base = nullptr;
 
 private:
+  struct Region {
+    size_t begin = 0;     // first slot
+    size_t committed = 0; // slots backed by pages, from begin
+    size_t committed_bytes = 0;
+    size_t cold_committed_bytes = 0;
+    size_t free_head = kNoSlot; // kFreeList stack
+    size_t end() const { return begin + committed; }
+  };
+
   std::vector<size_t> next_free_array; // forms the indexes with free blockss
+  std::vector<uint64_t> occupied_;     // one bit per slot, both policies
+  size_t initial_capacity_;
+  std::vector<numa::Node> nodes_; // one per region, empty on a single node
+  std::vector<Region> regions_;
+  // Region::committed mirrored for slot_for(), which runs without the lock
+  // that guards allocate() in BlockMemoryManager
+  std::unique_ptr<std::atomic<size_t>[]> spans_;
+  size_t region_slots_ = 1; // reserved slots per region
+  size_t reserved_bytes_ = 0;
+  size_t cold_reserved_bytes_ = 0;
+  size_t small_page_ = 0;
+  size_t commit_granularity_ = 0; // mprotect steps, a whole page
+  PageBacking backing_ = PageBacking::kSmall;
+
+  bool reserve_range(size_t bytes);
+  // Commits `bytes` of the reserve on hugetlb pages, regular ones if the
+  // pool is short. false if neither could be mapped
+  bool map_huge_tlb(std::byte *fresh, size_t bytes);
+  void fall_back_from_huge_tlb();
+  // mprotect (or hugetlb mapping) of freshly committed bytes of a region,
+  // bound to its node
+  bool commit(size_t region, std::byte *fresh, size_t bytes);
+  // Commits at least `min_committed` slots of the region. false once its
+  // share of the reserve is used up
+  bool grow(size_t region, size_t min_committed);
+  // Free slot of the region per the placement policy, kNoSlot if full
+  size_t take_slot(size_t region, size_t hint);
+
+  void mark(size_t index, bool used);
+  size_t find_free_after(size_t from, size_t end) const;
+  size_t find_free_before(size_t from, size_t begin) const;
+  size_t find_run_after(size_t from, size_t end, size_t count) const;
 };
@@ -1,61 +1,169 @@
 #pragma once
 #include "ds/storage/particleBlock.h"
+#include "ds/tree/sfc.h"
 #include "memory/blocks_arena.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstddef>
-#include <limits>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+/* Thread-safe front end of the block arena.
+ *
+ * Every thread gets a magazine: a small private stack of free slot indices
+ * taken from the arena in batches of kRefillBatch under depot_mutex_. Block
+ * creation and release only touch the caller's magazine, so parallel splits
+ * lock once per batch instead of once per block. With kSpatial a cached
+ * slot is only used if it lies within kSpatialWindow slots of the hint,
+ * otherwise the magazine refills near the hint. Sibling runs of a split
+ * always come from the arena.
+ *
+ * Cached slots count as occupied for the arena; flush_magazines() hands them
+ * back and must run when no other thread allocates (phase boundaries).
+ */
 class BlockMemoryManager {
 public:
-  explicit BlockMemoryManager(size_t N_body);
+  explicit BlockMemoryManager(
+      size_t N_body, sfc::Curve curve = sfc::Curve::kMorton,
+      BlockPlacement placement = BlockPlacement::kSpatial,
+      PageSize pages = PageSize::kSmall, bool numa_regions = false,
+      unsigned max_depth = sfc::kMaxLevel);
   ~BlockMemoryManager() = default;
 
   ParticleBlock *create_block(MortonKey key);
+  // Blocks for the 8 children of `parent`, out[octant]. With kSpatial they
+  // form one run of adjacent slots in curve order. All-or-nothing
+  bool create_child_blocks(MortonKey parent, ParticleBlock *out[8]);
   void destroy_block(ParticleBlock *p_bl);
+  // Returns every cached slot to the arena. No concurrent allocations
+  void flush_magazines();
 
   ParticleBlock *get_block_data(size_t inx);
   const ParticleBlock *get_block_data(size_t inx) const;
   MortonKey get_block_key(size_t inx) const;
+  // Position of the block's cell along the configured curve
+  sfc::OrderKey get_block_order_key(size_t inx) const;
+  sfc::Curve get_curve() const { return curve_; }
+  BlockPlacement get_placement() const { return arena_.placement; }
+  PageBacking get_page_backing() const { return arena_.page_backing(); }
+  size_t get_region_count() const { return arena_.region_count(); }
+  size_t get_region_of(size_t inx) const { return arena_.region_of(inx); }
+  // Region the blocks of that part of the curve are placed in
+  size_t get_region_for(sfc::OrderKey key) const {
+    return arena_.region_for(curve_fraction(key));
+  }
+  const numa::Node *get_region_node(size_t region) const {
+    return arena_.region_node(region);
+  }
+
+  // Unchecked index <-> address mapping for hot loops
+  size_t get_block_index(const ParticleBlock *p_bl) const {
+    return static_cast<size_t>(reinterpret_cast<const std::byte *>(p_bl) -
+                               arena_.base) /
+           arena_.k_block_size;
+  }
+  ParticleBlock *block_at(size_t inx) {
+    return reinterpret_cast<ParticleBlock *>(arena_.base +
+                                             inx * arena_.k_block_size);
+  }
+  const ParticleBlock *block_at(size_t inx) const {
+    return reinterpret_cast<const ParticleBlock *>(arena_.base +
+                                                   inx * arena_.k_block_size);
+  }
+  // Cold half of slot `inx`, to be stored in the block's cold_block
+  ParticleBlock::ColdBlock *cold_at(size_t inx) const {
+    return arena_.cold_at(inx);
+  }
 
   void swap_blocks(size_t inx_a, size_t inx_b);
-  void compact();
+  // Moves the live blocks into curve order, overflow chains right behind
+  // their head, and rewrites the chain links. Cold halves move along.
+  // Returns old -> new index for every live block (kNoNextBlock elsewhere);
+  // the caller must fix any ParticleBlock* it holds. Empty if nothing
+  // moved. No concurrent use
+  std::vector<uint32_t> compact();
 
   class Iterator;
   Iterator begin();
   Iterator end();
 
   size_t get_capacity() const { return arena_.capacity; };
+  size_t get_max_capacity() const { return arena_.max_capacity; }
   size_t get_used_blocks() const {
-    return arena_.current_counter;
-    ;
+    return live_blocks_.load(std::memory_order_relaxed);
   }
+  // Whether slot `inx` holds a block
+  bool is_active(size_t inx) const {
+    return inx < active_words_ * 64 &&
+           (active_[inx / 64].load(std::memory_order_relaxed) >> (inx % 64)) &
+               1u;
+  }
+
+  static constexpr size_t kMagazineSize = 32;
+  static constexpr size_t kRefillBatch = 8;
+  static constexpr size_t kSpatialWindow = 64;
+  // Threads beyond this many live ones take the locked path
+  static constexpr size_t kMaxThreads = 64;
 
 private:
+  // The arena grows on demand, so start small: room for the leaves of a
+  // balanced tree (one block per ParticleBlock::N bodies) with the spare half
+  // absorbing the first splits
   static size_t compute_capacity(size_t N_body) {
-    // Базовое количество блоков (округление вверх)
-    const size_t base_blocks = (N_body + 15) / 16;
-
-    // Эмпирические коэффициенты на основе тестирования октодеревьев:
-    // - Множитель 4-6 хорошо работает для средних деревьев
-    // - Учитываем что при делении получается 8 новых блоков
-    // - Минимальный размер дает место для начального роста
-
-    const size_t multiplier = 6;  // эмпирически подобранный множитель
+    const size_t base_blocks =
+        (N_body + ParticleBlock::N - 1) / ParticleBlock::N;
     const size_t min_blocks = 32; // минимум для 2 уровней дерева (1 + 8)
-    const size_t max_blocks = std::max(
-        N_body * 2, std::numeric_limits<size_t>::max()); // разумный предел
+    return std::max(base_blocks * 2, min_blocks);
+  }
+  // Address space only, so be generous. A split takes 8 blocks and needs
+  // more than ParticleBlock::N bodies in its cell. Cells of one level are
+  // disjoint, so one build splits at most N / (ParticleBlock::N + 1) times
+  // per level. The tree never merges, hence twice that for splits left
+  // behind by bodies that moved on, plus the overflow chains at max depth
+  static size_t compute_max_capacity(size_t N_body, unsigned max_depth) {
+    const size_t splits = N_body / (ParticleBlock::N + 1) * max_depth;
+    const size_t chains = N_body / ParticleBlock::N;
+    const size_t min_blocks = 4096;
+    return std::max(2 * (1 + 8 * splits) + chains, min_blocks);
+  }
+  // Curve keys are mapped linearly onto the arena (per NUMA region), so slot
+  // order follows curve order and the spare slots are spread between cells.
+  // The key is cut to 32 bits of fraction first so the product fits for
+  // < 2^32 slots
+  static uint64_t curve_fraction(sfc::OrderKey key) {
+    constexpr unsigned kFractionBits = 32;
+    return key >> (3 * sfc::kMaxLevel - kFractionBits);
+  }
+  size_t slot_hint(sfc::OrderKey key) const {
+    return arena_.slot_for(curve_fraction(key));
+  }
 
-    size_t estimated_blocks = base_blocks * multiplier;
+  struct alignas(64) Magazine {
+    uint32_t count = 0;
+    std::array<uint32_t, kMagazineSize> slots{};
+  };
+
+  Magazine *own_magazine();
+  // Free slot near `hint` from the caller's magazine or the arena
+  size_t take_slot(size_t hint);
+  // Cached slot within `window` of the hint (kSpatial) or the top one
+  size_t take_cached(Magazine &magazine, size_t hint, size_t window) const;
+  void refill(Magazine &magazine, size_t hint);
+  void give_back(size_t inx);
+  void activate(size_t inx, MortonKey key);
 
-    // Гарантируем, что выделенного места хватит хотя бы на 2 уровня деления
-    estimated_blocks = std::max(estimated_blocks, min_blocks);
 
-    // Защита от астрономических значений
-    return std::min(estimated_blocks, max_blocks);
-  }
   BlocksAllocator arena_;
-  std::vector<bool> active_blocks_;
-  std::vector<MortonKey> block_keys_;
+  sfc::Curve curve_;
+  std::mutex depot_mutex_; // the arena itself is single-threaded
+  std::unique_ptr<Magazine[]> magazines_;
+  // Live blocks, one bit per slot for the whole reserve so it never resizes
+  std::unique_ptr<std::atomic<uint64_t>[]> active_;
+  size_t active_words_ = 0;
+  std::atomic<size_t> live_blocks_{0};
 };
 
 class BlockMemoryManager::Iterator {
@@ -73,7 +181,7 @@ public:
     do {
       current_index_++;
     } while (current_index_ < manager_->get_capacity() &&
-             !manager_->active_blocks_[current_index_]);
+             !manager_->is_active(current_index_));
     return *this;
   }
   bool operator!=(const Iterator &other) const {
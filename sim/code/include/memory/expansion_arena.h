@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+/* Second arena from docs/TODO.md: the nodes' multipoles live for one FMM
+ * step only, so allocation is a bump pointer and freeing is reset().
+ * The buffer is sized after the first tree build and only grows when the
+ * tree outgrows it, never per tick.
+ */
+
+class ExpansionArena {
+public:
+  static constexpr size_t kAlignment = 64; // one cache line per array start
+
+  ExpansionArena() = default;
+  ExpansionArena(const ExpansionArena &) = delete;
+  ExpansionArena &operator=(const ExpansionArena &) = delete;
+  ~ExpansionArena();
+
+  // (Re)allocates the buffer, dropping everything handed out so far.
+  // 0 on success, -1 if the allocation failed
+  int reserve(size_t bytes);
+  void reset() { used_ = 0; }
+
+  // `count` uninitialised objects, nullptr if the buffer is exhausted
+  template <typename T> T *allocate(size_t count) {
+    const size_t offset = (used_ + kAlignment - 1) & ~(kAlignment - 1);
+    const size_t bytes = count * sizeof(T);
+    if (offset + bytes > capacity_)
+      return nullptr;
+    used_ = offset + bytes;
+    return reinterpret_cast<T *>(base_ + offset);
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t used() const { return used_; }
+
+private:
+  std::byte *base_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* NUMA topology as the kernel exposes it under /sys/devices/system/node,
+ * without libnuma. An empty result means no sysfs (or a kernel without
+ * NUMA), callers then treat the machine as one node.
+ */
+namespace numa {
+inline constexpr const char *kSysfsNodes = "/sys/devices/system/node";
+
+struct Node {
+  unsigned id = 0;
+  std::vector<unsigned> cpus;
+};
+
+// Nodes with at least one CPU, ascending by id. `root` is overridable so tests
+// can point it at a fake tree
+std::vector<Node> read_nodes(const std::string &root = kSysfsNodes);
+// "0-3,8,10-11" -> {0,1,2,3,8,10,11}; empty on malformed input
+std::vector<unsigned> parse_cpu_list(const std::string &list);
+
+// Pins the calling thread to the node's CPUs. false if the kernel refused
+bool pin_to(const Node &node);
+// Makes `node` the preferred node of the page-aligned range: its pages land
+// there whichever thread faults them in, falling back to other nodes when
+// it is full. false if the kernel has no NUMA policy support or refused
+bool prefer(const Node &node, void *begin, size_t bytes);
+} // namespace numa
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Which CPUs the simulator's threads run on.
+ *
+ * Unpinned, the engine thread, the pool workers and the render loop wander
+ * between cores every few milliseconds: tick timings get noisy and a
+ * worker's blocks are cold in the L1/L2 it lands on. A plan gives every
+ * physics runner one CPU and the render and I/O threads a set each.
+ *
+ * Automatic layouts order the CPUs the process may use:
+ *   kCompact - fill a core's SMT siblings, then the next core, then the
+ *              next package; runners share caches
+ *   kScatter - one CPU per core round-robin over packages, siblings last;
+ *              runners get the most cache and memory bandwidth each
+ *   kNoSmt   - like kCompact but one CPU per core, siblings left idle
+ * Physics runners take the front of that order, render and I/O the back.
+ * Explicit CPU lists (PhysicsCpus=, RenderCpus=, IoCpus=) win over the
+ * layout for their role. Render and I/O never share a runner's CPU: when
+ * the runners take them all, an automatic pool (Workers=0) shrinks by one
+ * and a fixed one leaves render and I/O unpinned.
+ *
+ * Given the CPUs of more than one NUMA node (one per arena region), the
+ * runners are split into contiguous groups, one per node, and each group
+ * takes its CPUs from its own node: the layout's order filtered to the
+ * node, or the whole node with kNone. Plan::homes says which node (region)
+ * a runner belongs to.
+ */
+namespace affinity {
+inline constexpr const char *kSysfsCpus = "/sys/devices/system/cpu";
+
+enum class Layout : uint8_t { kNone, kCompact, kScatter, kNoSmt };
+
+Layout layout_from_string(const std::string &name);
+
+struct Cpu {
+  unsigned id = 0;
+  unsigned core = 0;     // core_id, unique within a package
+  unsigned package = 0;  // physical_package_id
+  unsigned smt_rank = 0; // position among the core's siblings, 0 = first
+};
+
+// CPUs this process may run on, with their topology. `root` is overridable
+// so tests can point it at a fake tree; CPUs without topology files count
+// as their own core on package 0
+std::vector<Cpu> read_topology(const std::string &root = kSysfsCpus);
+// CPU ids in the order `layout` hands them out; empty for kNone
+std::vector<unsigned> order(std::vector<Cpu> cpus, Layout layout);
+
+struct Plan {
+  // [0] is the engine thread, [1 + i] pool worker i. Empty set = unpinned
+  std::vector<std::vector<unsigned>> physics;
+  // Region of each entry of `physics`; empty without NUMA nodes
+  std::vector<unsigned> homes;
+  std::vector<unsigned> render;
+  std::vector<unsigned> io;
+};
+
+struct Request {
+  Layout layout = Layout::kNone;
+  unsigned physics_runners = 1; // engine thread + workers
+  // physics_runners was sized from the machine, the plan may lower it;
+  // Plan::physics has the final count
+  bool auto_runners = false;
+  std::vector<unsigned> physics_cpus{}, render_cpus{}, io_cpus{};
+  // CPUs of each NUMA region, in region order
+  std::vector<std::vector<unsigned>> nodes{};
+};
+
+Plan plan(const Request &request, const std::vector<Cpu> &topology);
+
+// false if the set is empty or the kernel refused
+bool pin(std::thread::native_handle_type thread,
+         const std::vector<unsigned> &cpus);
+bool pin_current(const std::vector<unsigned> &cpus);
+} // namespace affinity
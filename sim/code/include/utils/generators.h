@@ -34,6 +34,8 @@ std::vector<Particle> generate_empty();
 namespace data_loader {
 
 // Отдельный namespace для загрузки данных
+// Whole input file (io/body_source.h; default TextFormat and GadgetUnits)
+// as a vector. The engine inserts from the opened file directly instead
 CResult<std::vector<Particle>> load_from_file(const std::string &filename);
 CResult<std::vector<Particle>> download_dataset(const std::string &dataset_name,
                                                 size_t max_bodies = 0);
@@ -0,0 +1,154 @@
+#pragma once
+#include "utils/work_stealing_deque.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Completion counter for a set of tasks. Lives on the submitter's stack for
+ * the duration of ThreadPool::wait.
+ */
+class TaskGroup {
+public:
+  bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class ThreadPool;
+  std::atomic<size_t> pending_{0};
+};
+
+/* Work-stealing pool the physics engine owns for its lifetime.
+ *
+ * Every worker has a Chase-Lev deque (utils/work_stealing_deque.h). A task
+ * submitted from a worker goes onto that worker's deque; one submitted from
+ * outside goes to a shared inbox. An idle worker looks at its own deque,
+ * then the inbox, then steals from the others starting at a random victim.
+ *
+ * Runners can have a home, their NUMA region. A task submitted for a home
+ * goes to that home's inbox, which its runners look at right after their
+ * own deque; everyone else only takes from it once there is nothing to
+ * steal, so regions keep to their own data without leaving a core idle.
+ *
+ * Parking: a worker that finds nothing spins kSpinRounds times, yields
+ * kYieldRounds times and then sleeps on an epoch counter that every submit
+ * bumps, so a tick's worth of phases never pays for a futex wake between
+ * them, while an idle engine (paused, headless and done) costs no CPU.
+ *
+ * The thread that calls wait() runs tasks too until its group is done, so
+ * concurrency() is workers() + 1. Tasks must not throw.
+ */
+class ThreadPool {
+public:
+  static constexpr unsigned kSpinRounds = 64;
+  static constexpr unsigned kYieldRounds = 16;
+
+  static constexpr unsigned kAnyHome = ~0u;
+
+  // 0 workers: one per hardware thread, minus the one that waits. Worker i
+  // pins itself to worker_cpus[i] when that set is given and non-empty.
+  // runner_homes[0] is the home of threads outside the pool (the one that
+  // waits), runner_homes[1 + i] worker i's; none given, nobody has one
+  explicit ThreadPool(unsigned workers = 0,
+                      std::vector<std::vector<unsigned>> worker_cpus = {},
+                      std::vector<unsigned> runner_homes = {});
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // What the constructor makes of `workers`
+  static unsigned resolve_workers(unsigned workers);
+
+  unsigned workers() const { return static_cast<unsigned>(workers_.size()); }
+  unsigned concurrency() const { return workers() + 1; }
+  unsigned homes() const { return static_cast<unsigned>(homes_.size()); }
+
+  // `home` past homes() (kAnyHome) is the plain path
+  void submit(TaskGroup &group, std::function<void()> job,
+              unsigned home = kAnyHome);
+  // Runs tasks (any group's) until `group` has none left
+  void wait(TaskGroup &group);
+
+  // body(begin, end) over [0, n) in chunks of `grain` items; 0 picks a grain
+  // giving each runner ~8 chunks to steal from. Returns when all are done
+  template <typename F> void parallel_for(size_t n, size_t grain, F &&body) {
+    if (n == 0)
+      return;
+    if (grain == 0)
+      grain = std::max<size_t>(1, n / (size_t{concurrency()} * 8));
+    if (workers_.empty() || n <= grain) {
+      body(size_t{0}, n);
+      return;
+    }
+    TaskGroup group;
+    for (size_t begin = 0; begin < n; begin += grain) {
+      const size_t end = std::min(begin + grain, n);
+      submit(group, [&body, begin, end] { body(begin, end); });
+    }
+    wait(group);
+  }
+
+  // body(c) for c in [0, chunks), chunk c submitted for home homes[c]
+  // (kAnyHome past its end). Returns when all are done
+  template <typename F>
+  void for_each_chunk(size_t chunks, const std::vector<unsigned> &homes,
+                      F &&body) {
+    if (workers_.empty() || chunks <= 1) {
+      for (size_t c = 0; c < chunks; ++c)
+        body(c);
+      return;
+    }
+    TaskGroup group;
+    for (size_t c = 0; c < chunks; ++c)
+      submit(group, [&body, c] { body(c); },
+             c < homes.size() ? homes[c] : kAnyHome);
+    wait(group);
+  }
+
+private:
+  struct Task {
+    std::function<void()> job;
+    TaskGroup *group;
+  };
+
+  struct alignas(64) Worker {
+    WorkStealingDeque<Task> deque;
+    std::thread thread;
+    std::vector<unsigned> cpus;
+    unsigned home = kAnyHome;
+  };
+
+  struct alignas(64) Inbox {
+    std::mutex mutex;
+    std::deque<Task *> tasks;
+    std::atomic<size_t> size{0};
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  Inbox inbox_; // submissions from non-worker threads
+  std::vector<std::unique_ptr<Inbox>> homes_;
+  unsigned outside_home_ = kAnyHome;
+
+  std::atomic<uint64_t> epoch_{0};
+  std::atomic<unsigned> sleepers_{0};
+  std::atomic<bool> stop_{false};
+
+  void worker_loop(unsigned self);
+  // self == workers() for a thread that is not one of ours
+  Task *find_task(unsigned self);
+  static void push(Inbox &inbox, Task *task);
+  static Task *take_from(Inbox &inbox);
+  Task *steal_from_others(unsigned self);
+  Task *take_from_other_homes(unsigned home);
+  bool any_queued() const;
+  void run(Task *task);
+  void park();
+  void wake_one();
+  unsigned current_worker() const;
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/* Single-producer single-consumer triple buffer.
+ *
+ * The producer always has a private back buffer to fill, the consumer a
+ * private front buffer to read; the third one sits in the middle. Publishing
+ * and picking up are one atomic exchange each, so neither side ever waits
+ * on the other. The consumer only sees whole frames, and if it is slower
+ * than the producer the frames in between are overwritten.
+ */
+template <typename T> class TripleBuffer {
+public:
+  // Producer side
+  T &write_buffer() { return buffers_[write_]; }
+  void publish() {
+    const uint8_t prev =
+        middle_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+    write_ = prev & kIndexMask;
+  }
+
+  // Consumer side. Swaps in the newest published buffer, false if nothing
+  // was published since the last call
+  bool acquire() {
+    if (!(middle_.load(std::memory_order_relaxed) & kFresh))
+      return false;
+    const uint8_t prev = middle_.exchange(read_, std::memory_order_acq_rel);
+    read_ = prev & kIndexMask;
+    return true;
+  }
+  const T &read_buffer() const { return buffers_[read_]; }
+
+private:
+  static constexpr uint8_t kIndexMask = 0x3;
+  static constexpr uint8_t kFresh = 0x4;
+
+  std::array<T, 3> buffers_{};
+  std::atomic<uint8_t> middle_{1};
+  uint8_t write_ = 0; // producer only
+  uint8_t read_ = 2;  // consumer only
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Chase-Lev work-stealing deque of T pointers.
+ *
+ * The owner thread pushes and pops at the bottom (LIFO, keeps its own work
+ * hot in cache), any other thread steals from the top (FIFO, takes the
+ * oldest and usually biggest piece). Only the last element is contended:
+ * owner and thief race for it with one CAS on top_. The ring doubles when
+ * full; old rings are kept until the deque dies, since a thief may still be
+ * reading one.
+ *
+ * Memory orders follow Le, Pop, Cohen, Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (PPoPP'13).
+ */
+template <typename T> class WorkStealingDeque {
+public:
+  explicit WorkStealingDeque(size_t capacity = 256) {
+    size_t rounded = 1;
+    while (rounded < capacity)
+      rounded <<= 1;
+    rings_.push_back(std::make_unique<Ring>(rounded));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+  }
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  // Owner only
+  void push(T *item) {
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_acquire);
+    Ring *ring = ring_.load(std::memory_order_relaxed);
+    if (b - t >= static_cast<int64_t>(ring->capacity))
+      ring = grow(ring, b, t);
+    ring->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. nullptr when empty or a thief took the last item
+  T *pop() {
+    const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Ring *ring = ring_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T *item = ring->get(b);
+    if (t == b) {
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        item = nullptr;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread. nullptr when empty or another thread won the race
+  T *steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b)
+      return nullptr;
+    T *item = ring_.load(std::memory_order_acquire)->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return nullptr;
+    return item;
+  }
+
+  // Racy snapshot, good enough for "is there anything to steal"
+  bool empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Ring {
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<std::atomic<T *>[]> slots;
+
+    explicit Ring(size_t cap)
+        : capacity(cap), mask(cap - 1),
+          slots(std::make_unique<std::atomic<T *>[]>(cap)) {}
+    T *get(int64_t i) const {
+      return slots[static_cast<size_t>(i) & mask].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, T *item) {
+      slots[static_cast<size_t>(i) & mask].store(item,
+                                                 std::memory_order_relaxed);
+    }
+  };
+
+  Ring *grow(Ring *old, int64_t b, int64_t t) {
+    rings_.push_back(std::make_unique<Ring>(old->capacity * 2));
+    Ring *ring = rings_.back().get();
+    for (int64_t i = t; i < b; ++i)
+      ring->put(i, old->get(i));
+    ring_.store(ring, std::memory_order_release);
+    return ring;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<Ring *> ring_{nullptr};
+  std::vector<std::unique_ptr<Ring>> rings_; // owner only, see above
+};
@@ -4,9 +4,14 @@
 #include "ctx/dataSets.h"
 #include "ctx/simulation_config.h"
 #include "ctx/simulation_state.h"
+#include "dist/shm_transport.h"
 #include "ds/storage/storage.h"
 #include "utils/generators.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
 #include <exception>
+#include <limits>
+#include <optional>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -14,14 +19,107 @@
 
 using namespace error;
 
+namespace {
+// The arena is sized from N before anything is loaded, so an input file is
+// opened first and brings its own N
+std::shared_ptr<const io::BodySource> open_input(SimulationConfig &config) {
+  if (config.data_population_mode != SimulationConfig::PUPULATION_MODE::FILE)
+    return nullptr;
+  if (config.filename.empty())
+    throw std::runtime_error("Filename not specified for FILE mode");
+  // Text tables are scanned in parallel; the engine's pool does not exist
+  // yet
+  ThreadPool pool{config.kWorkers};
+  auto res = io::open_body_source(config.filename, config.text_format,
+                                  config.gadget_units, pool);
+  if (res.is_error())
+    throw std::runtime_error(config.filename + ": " + res.error_message());
+  std::shared_ptr<const io::BodySource> input = std::move(res.value());
+  if (input->size() > std::numeric_limits<uint>::max())
+    throw std::runtime_error("Too many bodies in " + config.filename);
+  config.kNBodies = static_cast<uint>(input->size());
+  return input;
+}
+} // namespace
+
 Ctx::Ctx(SimulationConfig config)
-    : config_(std::move(config)), storage_(config_.kNBodies),
+    : config_(std::move(config)), input_(open_input(config_)),
+      storage_(config_.kNBodies, config_.kSfcCurve, config_.kBlockPlacement,
+               config_.kPageSize, config_.kNumaRegions,
+               config_.kTreeMaxDepth),
       gfx_ctx_(GfxCtx::from_config(config_)),
       physics_ctx_(PhysicsCtx::from_config(config_)),
       data_ctx_(DataCtx::from_config(config_)) {
+  plan_affinity();
   initialize_components();
 }
 
+void Ctx::plan_affinity() {
+  affinity::Request request{
+      .layout = config_.kAffinity,
+      .physics_runners = ThreadPool::resolve_workers(config_.kWorkers) + 1,
+      .auto_runners = config_.kWorkers == 0,
+      .physics_cpus = config_.physics_cpus,
+      .render_cpus = config_.render_cpus,
+      .io_cpus = config_.io_cpus};
+  // Runners follow the arena's regions, so each works on memory of its node
+  for (size_t r = 0; r < storage_.region_count(); ++r)
+    if (const numa::Node *node = storage_.region_node(r))
+      request.nodes.push_back(node->cpus);
+  affinity_ = affinity::plan(request, affinity::read_topology());
+  // The plan left render and I/O a CPU by dropping a runner
+  if (affinity_.physics.size() < request.physics_runners)
+    physics_ctx_.workers =
+        static_cast<unsigned>(affinity_.physics.size()) - 1;
+  physics_ctx_.runner_cpus = affinity_.physics;
+  physics_ctx_.runner_homes = affinity_.homes;
+  physics_ctx_.io_cpus = affinity_.io;
+}
+
+void Ctx::connect_ranks() {
+  if (config_.kRanks <= 1)
+    return;
+  if (config_.kRank >= config_.kRanks)
+    throw std::runtime_error("Rank " + std::to_string(config_.kRank) +
+                             " out of range for " +
+                             std::to_string(config_.kRanks) + " ranks");
+  if (config_.kRank == 0)
+    transport_ =
+        dist::ShmTransport::create(config_.kShmName, config_.kRanks);
+  else
+    transport_ = dist::ShmTransport::attach(config_.kShmName, config_.kRank);
+
+  // Every rank generated or loaded the same full set, so they all cut it
+  // the same way. A multi-rank snapshot is loaded through its manifest,
+  // which brings in every rank's share (io/snapshot_writer.h)
+  std::vector<Particle> &bodies = data_ctx_.initial_dataset;
+  if (const auto &input = data_ctx_.input) {
+    // The engine skips other ranks' bodies while inserting from the input
+    std::vector<sfc::OrderKey> keys;
+    keys.reserve(input->size());
+    for (size_t part = 0; part < input->parts(); ++part)
+      input->for_each(part, [&](const Particle &p) {
+        keys.push_back(sfc::point_key(sfc::Curve::kMorton, p.getPosition(),
+                                      bounding_box()));
+      });
+    domain_ = dist::Decomposition::balance(std::move(keys), bounding_box(),
+                                           config_.kRanks,
+                                           input->morton_sorted());
+  } else {
+    domain_ = dist::Decomposition::balance(bodies, bounding_box(),
+                                           config_.kRanks);
+    std::erase_if(bodies, [this](const Particle &p) {
+      return domain_.owner(p.getPosition()) != config_.kRank;
+    });
+  }
+  physics_ctx_.transport = transport_.get();
+  physics_ctx_.domain = &domain_;
+  debug::debug_print("Rank {}/{}: {} bodies", config_.kRank, config_.kRanks,
+                     bodies.size());
+  // Nobody starts ticking before everyone has its share
+  transport_->barrier();
+}
+
 void Ctx::initialize_components() {
   state_.set_state(STATE::INITIALIZING);
 
@@ -34,6 +132,7 @@ void Ctx::initialize_components() {
     if (!validate()) {
       throw std::runtime_error("Context validation failed!");
     }
+    connect_ranks();
     state_.set_state(STATE::WARM_UP);
   } catch (const std::exception &e) {
     state_.set_state(STATE::ERROR);
@@ -79,15 +178,13 @@ std::vector<Particle> Ctx::create_initial_dataset() {
     }
   }
   case SimulationConfig::PUPULATION_MODE::FILE: {
-    CResult<std::vector<Particle>> res =
-        data_loader::load_from_file(config_.filename);
-    if (res.is_ok()) {
-      return res.unwrap();
-    } else {
-      debug::debug_print("generate_uniform failed: msg: {}",
-                         res.error_message());
-      return {};
-    }
+    // Opened, not read: the engine inserts straight from it
+    data_ctx_.input = std::move(input_);
+    data_ctx_.bounding_box_ = data_ctx_.input->bounds();
+    debug::debug_print("FILE: {} bodies, {}", data_ctx_.input->size(),
+                       data_ctx_.input->morton_sorted() ? "morton sorted"
+                                                        : "unsorted");
+    return {};
   }
   case SimulationConfig::PUPULATION_MODE::FETCH: {
     if (config_.data_set_name.empty()) {
@@ -1,5 +1,6 @@
 #include "ctx/simulation_config.h"
 #include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <ostream>
@@ -29,6 +30,20 @@ SimulationConfigBuilder &SimulationConfigBuilder::with_defaults() {
   config_.data_population_mode = SimulationConfig::PUPULATION_MODE::PLUMMER;
   config_.kNBodies = 100;
   config_.random_seed = 42;
+  config_.kSfcCurve = sfc::Curve::kMorton;
+  config_.kBlockPlacement = BlockPlacement::kSpatial;
+  config_.kPageSize = PageSize::kSmall;
+  config_.kNumaRegions = true;
+  config_.kWorkers = 0;
+  config_.kAffinity = affinity::Layout::kNone;
+  config_.kRanks = 1;
+  config_.kRank = 0;
+  config_.kShmName = "/gravwll";
+  config_.text_format = {};
+  config_.gadget_units = {};
+  config_.kSnapshotEvery = 0;
+  config_.kSnapshotDir = "snapshots";
+  config_.kSnapshotFormat = io::SnapshotFormat::kGwp;
   return *this;
 }
 
@@ -110,7 +125,9 @@ SimulationConfig::from_string(const std::string &value) {
 config::ConfigFileReader::ConfigData
 config::ConfigFileReader::read_config(const std::string &filename) {
   std::string filepath =
-      config_directory_.empty() ? filename : config_directory_ + "/" + filename;
+      config_directory_.empty() || std::filesystem::path(filename).is_absolute()
+          ? filename
+          : config_directory_ + "/" + filename;
   // std::cout << "This is a filepath we are searching for in read_config: "
   //           << filepath
   //           << "\nThis is a config_directory_: " << config_directory_
@@ -142,7 +159,10 @@ config::ConfigFileReader::read_config(const std::string &filename) {
 
         if (!key.empty()) {
           std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-          std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+          // Paths and names are taken as written
+          if (!kVerbatimKeys.contains(key))
+            std::transform(value.begin(), value.end(), value.begin(),
+                           ::tolower);
           // std::cout << "This is a key-value we proccess: " << key << "-"
           //           << value << std::endl;
           result.values[key] = value;
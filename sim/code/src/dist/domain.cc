@@ -0,0 +1,100 @@
+#include "dist/domain.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace dist {
+static_assert(std::is_trivially_copyable_v<Particle>);
+
+Decomposition Decomposition::balance(const std::vector<Particle> &bodies,
+                                     const MyMath::BoundingBox &bounds,
+                                     unsigned ranks) {
+  std::vector<sfc::OrderKey> keys;
+  keys.reserve(bodies.size());
+  for (const Particle &p : bodies)
+    keys.push_back(
+        sfc::point_key(sfc::Curve::kMorton, p.getPosition(), bounds));
+  return balance(std::move(keys), bounds, ranks);
+}
+
+Decomposition Decomposition::balance(std::vector<sfc::OrderKey> keys,
+                                     const MyMath::BoundingBox &bounds,
+                                     unsigned ranks, bool sorted) {
+  if (ranks == 0)
+    throw std::invalid_argument("Decomposition: no ranks");
+  if (!sorted)
+    std::sort(keys.begin(), keys.end());
+  Decomposition d;
+  d.bounds_ = bounds;
+  d.splits_.resize(ranks + 1);
+  d.splits_.front() = 0;
+  d.splits_.back() = kEnd;
+  for (unsigned r = 1; r < ranks; ++r)
+    d.splits_[r] =
+        keys.empty() ? kEnd / ranks * r : keys[keys.size() * r / ranks];
+  return d;
+}
+
+unsigned Decomposition::owner(sfc::OrderKey key) const {
+  const auto it = std::upper_bound(splits_.begin(), splits_.end(), key);
+  const auto rank = static_cast<unsigned>(it - splits_.begin()) - 1;
+  return std::min(rank, ranks() - 1);
+}
+
+unsigned Decomposition::owner(const MyMath::Vector3 &p) const {
+  return owner(sfc::point_key(sfc::Curve::kMorton, p, bounds_));
+}
+
+std::vector<MyMath::BoundingBox> Decomposition::cells(unsigned rank) const {
+  std::vector<MyMath::BoundingBox> out;
+  const MyMath::Vector3 extent{bounds_.max.x - bounds_.min.x,
+                               bounds_.max.y - bounds_.min.y,
+                               bounds_.max.z - bounds_.min.z};
+  for (sfc::OrderKey lo = splits_[rank], hi = splits_[rank + 1]; lo < hi;) {
+    // Coarsest level whose cell starts at lo and ends by hi
+    unsigned level = 0;
+    while (level < sfc::kMaxLevel) {
+      const unsigned shift = 3 * (sfc::kMaxLevel - level);
+      const sfc::OrderKey span = sfc::OrderKey{1} << shift;
+      if (lo % span == 0 && hi - lo >= span)
+        break;
+      ++level;
+    }
+    const unsigned shift = 3 * (sfc::kMaxLevel - level);
+    const sfc::GridCoord c = sfc::decode_code(
+        (sfc::LocationCode{1} << (3 * level)) | (lo >> shift));
+    const double cells_per_axis = static_cast<double>(1u << level);
+    const MyMath::Vector3 size{extent.x / cells_per_axis,
+                               extent.y / cells_per_axis,
+                               extent.z / cells_per_axis};
+    const MyMath::Vector3 min{bounds_.min.x + c.x * size.x,
+                              bounds_.min.y + c.y * size.y,
+                              bounds_.min.z + c.z * size.z};
+    out.push_back({min, {min.x + size.x, min.y + size.y, min.z + size.z}});
+    lo += sfc::OrderKey{1} << shift;
+  }
+  return out;
+}
+
+Bytes pack_bodies(const std::vector<Particle> &bodies) {
+  Bytes bytes(bodies.size() * sizeof(Particle));
+  if (!bodies.empty())
+    std::memcpy(bytes.data(), bodies.data(), bytes.size());
+  return bytes;
+}
+
+bool unpack_bodies(const Bytes &bytes, std::vector<Particle> &out) {
+  if (bytes.size() % sizeof(Particle) != 0)
+    return false;
+  const size_t n = bytes.size() / sizeof(Particle);
+  for (size_t i = 0; i < n; ++i) {
+    // No default constructor to resize with; copy each one out
+    Particle p(0, 0, 0, 0, 0, 0, 0);
+    std::memcpy(static_cast<void *>(&p), bytes.data() + i * sizeof(Particle),
+                sizeof(Particle));
+    out.push_back(p);
+  }
+  return true;
+}
+} // namespace dist
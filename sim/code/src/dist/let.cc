@@ -0,0 +1,191 @@
+#include "dist/let.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "engine/constants.h"
+#include "engine/expansions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+namespace dist {
+namespace {
+static_assert(std::is_trivially_copyable_v<RemoteMultipole>);
+static_assert(std::is_trivially_copyable_v<RemoteBody>);
+
+double box_distance(const MyMath::BoundingBox &a,
+                    const MyMath::BoundingBox &b) {
+  const auto gap = [](double a_min, double a_max, double b_min, double b_max) {
+    return std::max({0.0, a_min - b_max, b_min - a_max});
+  };
+  const double dx = gap(a.min.x, a.max.x, b.min.x, b.max.x);
+  const double dy = gap(a.min.y, a.max.y, b.min.y, b.max.y);
+  const double dz = gap(a.min.z, a.max.z, b.min.z, b.max.z);
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+bool well_separated(const MyMath::BoundingBox &node,
+                    std::span<const MyMath::BoundingBox> cells,
+                    double theta) {
+  const double edge = std::max({node.max.x - node.min.x,
+                                node.max.y - node.min.y,
+                                node.max.z - node.min.z});
+  return std::all_of(cells.begin(), cells.end(), [&](const auto &cell) {
+    const double d = box_distance(node, cell);
+    return d > 0.0 && edge < theta * d;
+  });
+}
+
+// Leaves whose head block is in `skip` are left out
+void export_node(const AROctreeNode &node, const Storage &storage,
+                 const Expansions &ex,
+                 std::span<const MyMath::BoundingBox> cells, double theta,
+                 std::span<const uint32_t> skip, EssentialTree &out) {
+  const size_t k = node.node_index;
+  if (ex.mass[k] <= 0.0)
+    return;
+  if (well_separated(node.bounds, cells, theta)) {
+    out.multipoles.push_back({ex.mass[k], ex.com_x[k], ex.com_y[k],
+                              ex.com_z[k], ex.qxx[k], ex.qxy[k], ex.qxz[k],
+                              ex.qyy[k], ex.qyz[k], ex.qzz[k]});
+    return;
+  }
+  if (node.children[0].load(std::memory_order_relaxed) == nullptr) {
+    const auto head =
+        static_cast<uint32_t>(storage.block_index(node.localBlock));
+    if (std::find(skip.begin(), skip.end(), head) != skip.end())
+      return;
+    for (const ParticleBlock *block = node.localBlock; block;
+         block = storage.next_block(block))
+      for (size_t i = 0; i < block->size(); ++i)
+        out.bodies.push_back({block->get_x()[i], block->get_y()[i],
+                              block->get_z()[i], block->get_mass()[i]});
+    return;
+  }
+  for (const auto &child : node.children)
+    export_node(*child.load(std::memory_order_relaxed), storage, ex, cells,
+                theta, skip, out);
+}
+
+template <typename T>
+void append_array(Bytes &bytes, const std::vector<T> &items) {
+  const size_t at = bytes.size();
+  bytes.resize(at + items.size() * sizeof(T));
+  if (!items.empty())
+    std::memcpy(bytes.data() + at, items.data(), items.size() * sizeof(T));
+}
+} // namespace
+
+void EssentialTree::append(const EssentialTree &other) {
+  multipoles.insert(multipoles.end(), other.multipoles.begin(),
+                    other.multipoles.end());
+  bodies.insert(bodies.end(), other.bodies.begin(), other.bodies.end());
+}
+
+void export_essential(const AROctreeNode &root, const Storage &storage,
+                      const Expansions &ex,
+                      const std::vector<MyMath::BoundingBox> &cells,
+                      double theta, EssentialTree &out) {
+  if (cells.empty())
+    return;
+  export_node(root, storage, ex, cells, theta, {}, out);
+}
+
+void collect_far_field(const AROctreeNode &root, const Storage &storage,
+                       const Expansions &ex, const MyMath::BoundingBox &leaf,
+                       std::span<const uint32_t> near, double theta,
+                       EssentialTree &out) {
+  export_node(root, storage, ex, std::span(&leaf, 1), theta, near, out);
+}
+
+// Two counts, then the arrays as they are in memory: every rank is the same
+// binary on the same box
+Bytes pack(const EssentialTree &tree) {
+  const uint64_t counts[2] = {tree.multipoles.size(), tree.bodies.size()};
+  Bytes bytes(sizeof(counts));
+  std::memcpy(bytes.data(), counts, sizeof(counts));
+  append_array(bytes, tree.multipoles);
+  append_array(bytes, tree.bodies);
+  return bytes;
+}
+
+bool unpack(const Bytes &bytes, EssentialTree &out) {
+  uint64_t counts[2];
+  if (bytes.size() < sizeof(counts))
+    return false;
+  std::memcpy(counts, bytes.data(), sizeof(counts));
+  const size_t multipole_bytes = counts[0] * sizeof(RemoteMultipole);
+  const size_t body_bytes = counts[1] * sizeof(RemoteBody);
+  if (bytes.size() != sizeof(counts) + multipole_bytes + body_bytes)
+    return false;
+  const std::byte *at = bytes.data() + sizeof(counts);
+  const size_t m = out.multipoles.size();
+  out.multipoles.resize(m + counts[0]);
+  if (counts[0] != 0)
+    std::memcpy(out.multipoles.data() + m, at, multipole_bytes);
+  at += multipole_bytes;
+  const size_t b = out.bodies.size();
+  out.bodies.resize(b + counts[1]);
+  if (counts[1] != 0)
+    std::memcpy(out.bodies.data() + b, at, body_bytes);
+  return true;
+}
+
+// M2P with raw second moments S about the centre of mass, r = target - com:
+//   a = G * (-M r / r^3 + (6 S r / r^5 - 15 (r.S.r) r / r^7
+//                          + 3 tr(S) r / r^5) / 2)
+void apply_essential(const EssentialTree &remote, ParticleBlock &block) {
+  apply_essential(remote, block, block.get_ax().data(),
+                  block.get_ay().data(), block.get_az().data());
+}
+
+void apply_essential(const EssentialTree &remote, const ParticleBlock &block,
+                     double *ax_out, double *ay_out, double *az_out) {
+  for (size_t i = 0; i < block.size(); ++i) {
+    const double x0 = block.get_x()[i];
+    const double y0 = block.get_y()[i];
+    const double z0 = block.get_z()[i];
+    double ax = 0.0, ay = 0.0, az = 0.0;
+
+    for (const RemoteBody &body : remote.bodies) {
+      const double dx = body.x - x0;
+      const double dy = body.y - y0;
+      const double dz = body.z - z0;
+      const double r2 = dx * dx + dy * dy + dz * dz + kSoftener;
+      const double inv_r = 1.0 / std::sqrt(r2);
+      const double common = kG * body.mass * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+
+    for (const RemoteMultipole &m : remote.multipoles) {
+      const double rx = x0 - m.x;
+      const double ry = y0 - m.y;
+      const double rz = z0 - m.z;
+      const double r2 = rx * rx + ry * ry + rz * rz + kSoftener;
+      const double inv_r2 = 1.0 / r2;
+      const double inv_r = std::sqrt(inv_r2);
+      const double inv_r3 = inv_r * inv_r2;
+      const double inv_r5 = inv_r3 * inv_r2;
+      const double sx = m.qxx * rx + m.qxy * ry + m.qxz * rz;
+      const double sy = m.qxy * rx + m.qyy * ry + m.qyz * rz;
+      const double sz = m.qxz * rx + m.qyz * ry + m.qzz * rz;
+      const double rsr = rx * sx + ry * sy + rz * sz;
+      const double trace = m.qxx + m.qyy + m.qzz;
+      const double radial =
+          -m.mass * inv_r3 + 0.5 * (3.0 * trace * inv_r5 -
+                                    15.0 * rsr * inv_r5 * inv_r2);
+      ax += kG * (radial * rx + 3.0 * sx * inv_r5);
+      ay += kG * (radial * ry + 3.0 * sy * inv_r5);
+      az += kG * (radial * rz + 3.0 * sz * inv_r5);
+    }
+
+    ax_out[i] += ax;
+    ay_out[i] += ay;
+    az_out[i] += az;
+  }
+}
+} // namespace dist
@@ -0,0 +1,280 @@
+#include "dist/shm_transport.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace dist {
+namespace {
+constexpr uint64_t kMagic = 0x67726176776c6c31; // "gravwll1"
+constexpr size_t kLine = 64;
+
+// Process-shared atomics must not fall back to a lock in this process' heap
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+size_t round_up(size_t bytes) { return (bytes + kLine - 1) / kLine * kLine; }
+
+std::runtime_error shm_error(const std::string &what, const std::string &name) {
+  return std::runtime_error("ShmTransport: " + what + " " + name + ": " +
+                            std::strerror(errno));
+}
+
+void *map(int fd, size_t bytes, const std::string &name) {
+  void *base =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    throw shm_error("mmap", name);
+  }
+  close(fd);
+  return base;
+}
+} // namespace
+
+struct ShmTransport::Header {
+  std::atomic<uint64_t> magic;
+  uint32_t ranks;
+  uint64_t ring_bytes;
+  alignas(kLine) std::atomic<uint32_t> barrier_count;
+  std::atomic<uint32_t> barrier_generation;
+};
+
+// Monotonic cursors; the ring offset is cursor % ring_bytes. Producer and
+// consumer side on separate lines
+struct ShmTransport::RingControl {
+  alignas(kLine) std::atomic<uint64_t> written;
+  alignas(kLine) std::atomic<uint64_t> read;
+};
+
+size_t ShmTransport::segment_bytes(unsigned ranks, size_t ring_bytes) {
+  const size_t pairs = size_t{ranks} * ranks;
+  return round_up(sizeof(Header)) + pairs * sizeof(RingControl) +
+         pairs * round_up(ring_bytes);
+}
+
+std::unique_ptr<ShmTransport>
+ShmTransport::create(const std::string &name, unsigned ranks,
+                     size_t ring_bytes) {
+  if (ranks == 0 || ring_bytes == 0)
+    throw std::invalid_argument("ShmTransport: ranks and ring size must be "
+                                "positive");
+  // A crashed run leaves its segment behind; attachers of this run must not
+  // see its magic
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    throw shm_error("shm_open", name);
+  const size_t bytes = segment_bytes(ranks, ring_bytes);
+  if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw shm_error("ftruncate", name);
+  }
+  void *base = map(fd, bytes, name);
+  // ftruncate zero-fills: every cursor and the barrier start at 0
+  auto *header = static_cast<Header *>(base);
+  header->ranks = ranks;
+  header->ring_bytes = ring_bytes;
+  header->magic.store(kMagic, std::memory_order_release);
+  return std::unique_ptr<ShmTransport>(
+      new ShmTransport(name, base, bytes, 0, true));
+}
+
+std::unique_ptr<ShmTransport>
+ShmTransport::attach(const std::string &name, unsigned rank,
+                     std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;; std::this_thread::sleep_for(std::chrono::milliseconds(1))) {
+    if (std::chrono::steady_clock::now() > deadline)
+      throw std::runtime_error("ShmTransport: no segment " + name +
+                               " from rank 0");
+    const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+      continue;
+    struct stat st {};
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header)) {
+      close(fd);
+      continue;
+    }
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    void *base = map(fd, bytes, name);
+    auto *header = static_cast<Header *>(base);
+    if (header->magic.load(std::memory_order_acquire) != kMagic ||
+        segment_bytes(header->ranks, header->ring_bytes) != bytes) {
+      munmap(base, bytes);
+      continue;
+    }
+    if (rank == 0 || rank >= header->ranks) {
+      munmap(base, bytes);
+      throw std::runtime_error("ShmTransport: rank " + std::to_string(rank) +
+                               " out of range for " + name);
+    }
+    return std::unique_ptr<ShmTransport>(
+        new ShmTransport(name, base, bytes, rank, false));
+  }
+}
+
+ShmTransport::ShmTransport(std::string name, void *base, size_t bytes,
+                           unsigned rank, bool owner)
+    : name_(std::move(name)), base_(static_cast<std::byte *>(base)),
+      bytes_(bytes), rank_(rank), owner_(owner) {
+  ranks_ = header().ranks;
+  ring_bytes_ = header().ring_bytes;
+}
+
+ShmTransport::~ShmTransport() {
+  munmap(base_, bytes_);
+  if (owner_)
+    shm_unlink(name_.c_str());
+}
+
+ShmTransport::Header &ShmTransport::header() const {
+  return *reinterpret_cast<Header *>(base_);
+}
+
+ShmTransport::RingControl &ShmTransport::control(unsigned from,
+                                                 unsigned to) const {
+  auto *controls =
+      reinterpret_cast<RingControl *>(base_ + round_up(sizeof(Header)));
+  return controls[size_t{from} * ranks_ + to];
+}
+
+std::byte *ShmTransport::ring(unsigned from, unsigned to) const {
+  const size_t pairs = size_t{ranks_} * ranks_;
+  std::byte *rings =
+      base_ + round_up(sizeof(Header)) + pairs * sizeof(RingControl);
+  return rings + (size_t{from} * ranks_ + to) * round_up(ring_bytes_);
+}
+
+size_t ShmTransport::push(unsigned to, const std::byte *data, size_t bytes) {
+  RingControl &c = control(rank_, to);
+  const uint64_t written = c.written.load(std::memory_order_relaxed);
+  const uint64_t read = c.read.load(std::memory_order_acquire);
+  const size_t n = std::min<size_t>(bytes, ring_bytes_ - (written - read));
+  std::byte *buf = ring(rank_, to);
+  const size_t at = written % ring_bytes_;
+  const size_t first = std::min(n, ring_bytes_ - at);
+  std::memcpy(buf + at, data, first);
+  std::memcpy(buf, data + first, n - first);
+  c.written.store(written + n, std::memory_order_release);
+  return n;
+}
+
+size_t ShmTransport::pull(unsigned from, std::byte *data, size_t bytes) {
+  RingControl &c = control(from, rank_);
+  const uint64_t read = c.read.load(std::memory_order_relaxed);
+  const uint64_t written = c.written.load(std::memory_order_acquire);
+  const size_t n = std::min<size_t>(bytes, written - read);
+  const std::byte *buf = ring(from, rank_);
+  const size_t at = read % ring_bytes_;
+  const size_t first = std::min(n, ring_bytes_ - at);
+  std::memcpy(data, buf + at, first);
+  std::memcpy(data + first, buf, n - first);
+  c.read.store(read + n, std::memory_order_release);
+  return n;
+}
+
+std::vector<Bytes> ShmTransport::exchange(const std::vector<Bytes> &out) {
+  if (out.size() != ranks_)
+    throw std::invalid_argument("ShmTransport: exchange needs one message "
+                                "per rank");
+  std::vector<Bytes> in(ranks_);
+  in[rank_] = out[rank_];
+
+  // Per peer: the 8-byte length goes first, then the payload
+  struct Stream {
+    uint64_t length = 0;
+    size_t done = 0; // bytes of prefix + payload moved so far
+    bool finished = false;
+  };
+  std::vector<Stream> send(ranks_), recv(ranks_);
+  unsigned pending = 0;
+  for (unsigned r = 0; r < ranks_; ++r) {
+    if (r == rank_)
+      continue;
+    send[r].length = out[r].size();
+    pending += 2;
+  }
+
+  const auto advance = [](Stream &s, auto &&move_prefix, auto &&move_body) {
+    size_t moved = 0;
+    if (s.done < sizeof(uint64_t)) {
+      const size_t n = move_prefix(s.done);
+      s.done += n;
+      moved += n;
+      if (s.done < sizeof(uint64_t))
+        return moved;
+    }
+    const size_t body = s.done - sizeof(uint64_t);
+    const size_t n = move_body(body);
+    s.done += n;
+    moved += n;
+    s.finished = s.done - sizeof(uint64_t) == s.length;
+    return moved;
+  };
+
+  while (pending > 0) {
+    size_t moved = 0;
+    for (unsigned r = 0; r < ranks_; ++r) {
+      if (r == rank_)
+        continue;
+      Stream &s = send[r];
+      if (!s.finished) {
+        moved += advance(
+            s,
+            [&](size_t at) {
+              const auto *prefix =
+                  reinterpret_cast<const std::byte *>(&s.length);
+              return push(r, prefix + at, sizeof(uint64_t) - at);
+            },
+            [&](size_t at) {
+              return push(r, out[r].data() + at, s.length - at);
+            });
+        pending -= s.finished;
+      }
+      Stream &q = recv[r];
+      if (!q.finished) {
+        moved += advance(
+            q,
+            [&](size_t at) {
+              auto *prefix = reinterpret_cast<std::byte *>(&q.length);
+              const size_t n = pull(r, prefix + at, sizeof(uint64_t) - at);
+              if (at + n == sizeof(uint64_t))
+                in[r].resize(q.length);
+              return n;
+            },
+            [&](size_t at) {
+              return pull(r, in[r].data() + at, q.length - at);
+            });
+        pending -= q.finished;
+      }
+    }
+    if (moved == 0)
+      std::this_thread::yield();
+  }
+  return in;
+}
+
+// Sense-reversing: the last rank in resets the count and bumps the
+// generation everyone else is watching
+void ShmTransport::barrier() {
+  Header &h = header();
+  const uint32_t generation =
+      h.barrier_generation.load(std::memory_order_acquire);
+  if (h.barrier_count.fetch_add(1, std::memory_order_acq_rel) + 1 == ranks_) {
+    h.barrier_count.store(0, std::memory_order_relaxed);
+    h.barrier_generation.fetch_add(1, std::memory_order_release);
+    return;
+  }
+  while (h.barrier_generation.load(std::memory_order_acquire) == generation)
+    std::this_thread::yield();
+}
+} // namespace dist
@@ -2,21 +2,40 @@
 #include "core/bodies/particles.h"
 #include "iostream"
 #include <cstddef>
-#include <mutex>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
-ParticleBlock::ParticleBlock(uint morton_key,
-                             const std::vector<Particle> &particles)
-    : data_block(), meta_block(MortonKey{morton_key}) {
+namespace {
+// Particle is always double; float layouts convert at the block boundary
+template <class Scalar> Scalar narrow(double value) {
+  if constexpr (std::is_same_v<Scalar, double>)
+    return value;
+  else
+    return static_cast<Scalar>(value);
+}
+
+template <class Scalar> double widen(Scalar value) {
+  if constexpr (std::is_same_v<Scalar, double>)
+    return value;
+  else
+    return static_cast<double>(value);
+}
+} // namespace
+
+template <class Scalar, int Capacity, BlockLayout Layout>
+BasicParticleBlock<Scalar, Capacity, Layout>::BasicParticleBlock(
+    sfc::LocationCode morton_key, ColdBlock *cold,
+    const std::vector<Particle> &particles)
+    : data_block(), meta_block(MortonKey{morton_key}), cold_block(cold) {
   for (const auto &p : particles) {
     addParticle(p);
   }
 }
 
-size_t ParticleBlock::addParticle(const Particle &p) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-
+template <class Scalar, int Capacity, BlockLayout Layout>
+size_t
+BasicParticleBlock<Scalar, Capacity, Layout>::addParticle(const Particle &p) {
   if (is_full()) {
     std::cout << "We have exceeded the ParticleBlock size. Were not able to "
                  "add a Particle. Suck it!\n";
@@ -24,106 +43,108 @@ size_t ParticleBlock::addParticle(const Particle &p) {
   }
 
   size_t index = data_block.size++;
-  data_block.x[index] = p.getX();
-  data_block.y[index] = p.getY();
-  data_block.z[index] = p.getZ();
-  data_block.vx[index] = p.getVx();
-  data_block.vy[index] = p.getVy();
-  data_block.vz[index] = p.getVz();
-  data_block.fx[index] = p.getForceX();
-  data_block.fy[index] = p.getForceY();
-  data_block.fz[index] = p.getForceZ();
-  data_block.ax[index] = p.getAx();
-  data_block.ay[index] = p.getAy();
-  data_block.az[index] = p.getAz();
-  data_block.mass[index] = p.getMass();
+  store_particle(index, p);
   return index;
 }
 
-Particle ParticleBlock::deleteParticle(size_t index) {
-  std::lock_guard<std::mutex> lock(m_mutex);
+template <class Scalar, int Capacity, BlockLayout Layout>
+void BasicParticleBlock<Scalar, Capacity, Layout>::store_particle(
+    size_t index, const Particle &p) {
+  get_x()[index] = narrow<Scalar>(p.getX());
+  get_y()[index] = narrow<Scalar>(p.getY());
+  get_z()[index] = narrow<Scalar>(p.getZ());
+  cold_block->vx[index] = narrow<Scalar>(p.getVx());
+  cold_block->vy[index] = narrow<Scalar>(p.getVy());
+  cold_block->vz[index] = narrow<Scalar>(p.getVz());
+  cold_block->fx[index] = narrow<Scalar>(p.getForceX());
+  cold_block->fy[index] = narrow<Scalar>(p.getForceY());
+  cold_block->fz[index] = narrow<Scalar>(p.getForceZ());
+  cold_block->ax[index] = narrow<Scalar>(p.getAx());
+  cold_block->ay[index] = narrow<Scalar>(p.getAy());
+  cold_block->az[index] = narrow<Scalar>(p.getAz());
+  cold_block->visual_id[index] = p.getVisualId();
+  get_mass()[index] = narrow<Scalar>(p.getMass());
+}
 
+template <class Scalar, int Capacity, BlockLayout Layout>
+Particle
+BasicParticleBlock<Scalar, Capacity, Layout>::deleteParticle(size_t index) {
   if (index >= data_block.size)
     return Particle{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
 
-  Particle p{
-      data_block.x[index],    data_block.y[index],  data_block.z[index],
-      data_block.vx[index],   data_block.vy[index], data_block.vz[index],
-      data_block.fx[index],   data_block.fy[index], data_block.fz[index],
-      data_block.ax[index],   data_block.ay[index], data_block.az[index],
-      data_block.mass[index],
-  };
+  Particle p = getParticle(index);
 
   data_block.size--;
 
   if (index != data_block.size) {
-    data_block.x[index] = data_block.x[data_block.size];
-    data_block.y[index] = data_block.y[data_block.size];
-    data_block.z[index] = data_block.z[data_block.size];
-    data_block.vx[index] = data_block.vx[data_block.size];
-    data_block.vy[index] = data_block.vy[data_block.size];
-    data_block.vz[index] = data_block.vz[data_block.size];
-    data_block.fx[index] = data_block.fx[data_block.size];
-    data_block.fy[index] = data_block.fy[data_block.size];
-    data_block.fz[index] = data_block.fz[data_block.size];
-    data_block.ax[index] = data_block.ax[data_block.size];
-    data_block.ay[index] = data_block.ay[data_block.size];
-    data_block.az[index] = data_block.az[data_block.size];
-    data_block.mass[index] = data_block.mass[data_block.size];
+    get_x()[index] = get_x()[data_block.size];
+    get_y()[index] = get_y()[data_block.size];
+    get_z()[index] = get_z()[data_block.size];
+    cold_block->vx[index] = cold_block->vx[data_block.size];
+    cold_block->vy[index] = cold_block->vy[data_block.size];
+    cold_block->vz[index] = cold_block->vz[data_block.size];
+    cold_block->fx[index] = cold_block->fx[data_block.size];
+    cold_block->fy[index] = cold_block->fy[data_block.size];
+    cold_block->fz[index] = cold_block->fz[data_block.size];
+    cold_block->ax[index] = cold_block->ax[data_block.size];
+    cold_block->ay[index] = cold_block->ay[data_block.size];
+    cold_block->az[index] = cold_block->az[data_block.size];
+    cold_block->visual_id[index] = cold_block->visual_id[data_block.size];
+    get_mass()[index] = get_mass()[data_block.size];
   }
 
   return p;
 }
 
-void ParticleBlock::printParticles() {
-  std::lock_guard<std::mutex> lock(m_mutex);
+template <class Scalar, int Capacity, BlockLayout Layout>
+void BasicParticleBlock<Scalar, Capacity, Layout>::printParticles() {
   std::cout << "Particles in block (" << data_block.size << " particles):\n";
   for (size_t i = 0; i < data_block.size; ++i) {
-    std::cout << "Particle " << i << ": x=" << data_block.x[i]
-              << ", y=" << data_block.y[i] << ", z=" << data_block.z[i] << "\n";
+    std::cout << "Particle " << i << ": x=" << get_x()[i]
+              << ", y=" << get_y()[i] << ", z=" << get_z()[i] << "\n";
   }
 }
 
-MyMath::Vector3 ParticleBlock::getPosition(size_t index) const {
-  std::lock_guard<std::mutex> lock(m_mutex);
+template <class Scalar, int Capacity, BlockLayout Layout>
+MyMath::Vector3
+BasicParticleBlock<Scalar, Capacity, Layout>::getPosition(size_t index) const {
   if (index >= data_block.size) {
     return {0.0, 0.0, 0.0};
   }
-  return {data_block.x[index], data_block.y[index], data_block.z[index]};
+  return {widen(get_x()[index]), widen(get_y()[index]),
+          widen(get_z()[index])};
 }
 
-Particle ParticleBlock::getParticle(size_t index) const {
-  std::lock_guard<std::mutex> lock(m_mutex);
+template <class Scalar, int Capacity, BlockLayout Layout>
+Particle
+BasicParticleBlock<Scalar, Capacity, Layout>::getParticle(size_t index) const {
   if (index >= data_block.size) {
     return Particle{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
   }
 
   return Particle{
-      data_block.x[index],    data_block.y[index],  data_block.z[index],
-      data_block.vx[index],   data_block.vy[index], data_block.vz[index],
-      data_block.fx[index],   data_block.fy[index], data_block.fz[index],
-      data_block.ax[index],   data_block.ay[index], data_block.az[index],
-      data_block.mass[index],
+      widen(get_x()[index]),        widen(get_y()[index]),
+      widen(get_z()[index]),        widen(cold_block->vx[index]),
+      widen(cold_block->vy[index]), widen(cold_block->vz[index]),
+      widen(cold_block->fx[index]), widen(cold_block->fy[index]),
+      widen(cold_block->fz[index]), widen(cold_block->ax[index]),
+      widen(cold_block->ay[index]), widen(cold_block->az[index]),
+      widen(get_mass()[index]),     cold_block->visual_id[index],
   };
 }
 
-ParticleBlock::ParticleBlock(ParticleBlock &&other) noexcept
-    : data_block(std::move(other.data_block)),
-      meta_block(std::move(other.meta_block)) {}
-
-ParticleBlock &ParticleBlock::operator=(ParticleBlock &&other) noexcept {
-  if (this != &other) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    data_block = std::move(other.data_block);
-    meta_block = std::move(other.meta_block);
-  }
-  return *this;
-}
-
-void ParticleBlock::swap(ParticleBlock &other) noexcept {
+template <class Scalar, int Capacity, BlockLayout Layout>
+void BasicParticleBlock<Scalar, Capacity, Layout>::swap(
+    BasicParticleBlock &other) noexcept {
   using std::swap;
-  std::lock_guard<std::mutex> lock1(m_mutex);
-  std::lock_guard<std::mutex> lock2(other.m_mutex);
   swap(data_block, other.data_block);
   swap(meta_block, other.meta_block);
+  if (cold_block && other.cold_block)
+    swap(*cold_block, *other.cold_block);
 }
+
+#define GRAVWLL_INSTANTIATE_LAYOUT(scalar, capacity)                           \
+  template class BasicParticleBlock<scalar, capacity, BlockLayout::kSoA>;      \
+  template class BasicParticleBlock<scalar, capacity, BlockLayout::kAoSoA>;
+GRAVWLL_BLOCK_LAYOUTS(GRAVWLL_INSTANTIATE_LAYOUT)
+#undef GRAVWLL_INSTANTIATE_LAYOUT
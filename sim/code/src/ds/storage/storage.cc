@@ -1,78 +1,72 @@
 #include "ds/storage/storage.h"
 #include "ds/storage/particleBlock.h"
-#include <chrono>
+#include <atomic>
 #include <cstddef>
 #include <iostream>
-#include <mutex>
-#include <thread>
 #include <vector>
 
-Storage::Storage(uint N_body) : manager_(N_body) {
-  std::cout << "Storage got initialized!\n";
+Storage::Storage(uint N_body, sfc::Curve curve, BlockPlacement placement,
+                 PageSize pages, bool numa_regions, unsigned tree_max_depth)
+    : manager_(N_body, curve, placement, pages, numa_regions,
+               tree_max_depth) {
+  std::cout << "Storage got initialized! Block arena on "
+            << page_backing_name(manager_.get_page_backing()) << ", "
+            << manager_.get_region_count() << " NUMA region(s)\n";
 }
 
 ParticleBlock *
-Storage::create_memory_block(uint morton_key,
+Storage::create_memory_block(sfc::LocationCode morton_key,
                              const std::vector<Particle> &particles) {
   ParticleBlock *block_address = manager_.create_block(MortonKey{morton_key});
-  new (block_address) ParticleBlock(morton_key, particles);
+  if (!block_address)
+    return nullptr;
+  new (block_address) ParticleBlock(
+      morton_key, manager_.cold_at(manager_.get_block_index(block_address)),
+      particles);
   return block_address;
 }
 
-void Storage::release_block(ParticleBlock *block) {
-  manager_.destroy_block(block);
+bool Storage::create_child_blocks(sfc::LocationCode parent,
+                                  ParticleBlock *out[8]) {
+  if (!manager_.create_child_blocks(MortonKey{parent}, out))
+    return false;
+  for (unsigned octant = 0; octant < 8; ++octant)
+    new (out[octant]) ParticleBlock(
+        sfc::child_code(parent, octant),
+        manager_.cold_at(manager_.get_block_index(out[octant])), {});
+  return true;
 }
 
-void Storage::transferParticle(ParticleBlock *fromBlock, ParticleBlock *toBlock,
-                               size_t index) {
-  std::cout << "TransferParticle: fromBlock = " << fromBlock
-            << ", toBlock = " << toBlock << "\n";
-  auto &mutex1 = fromBlock->get_mutex();
-  auto &mutex2 = toBlock->get_mutex();
-  std::cout << "fromBlock mutex = " << &mutex1
-            << ", toBlock mutex = " << &mutex2 << "\n";
+ParticleBlock *Storage::next_block_or_grow(ParticleBlock *block) {
+  std::atomic_ref<uint> link(block->meta_block.next_logical_block);
+  uint next = link.load(std::memory_order_acquire);
+  if (next != ParticleBlock::kNoNextBlock)
+    return block_at(next);
 
-  // Попытка захвата обоих мьютексов
-  while (true) {
-    int lockResult = std::try_lock(mutex1, mutex2);
-    if (lockResult == -1) { // -1 означает, что оба захвачены
-      break;
-    } else {
-      std::cout << "Не удалось захватить mutex " << lockResult
-                << ", повторяем попытку...\n";
-      std::this_thread::sleep_for(std::chrono::microseconds(10));
-    }
+  ParticleBlock *fresh =
+      create_memory_block(block->meta_block.key.key_number, {});
+  if (!fresh)
+    return nullptr;
+  const uint fresh_index = static_cast<uint>(block_index(fresh));
+  // Someone else may have linked a block meanwhile; theirs wins
+  if (link.compare_exchange_strong(next, fresh_index,
+                                   std::memory_order_acq_rel)) {
+    return fresh;
   }
+  release_block(fresh);
+  return block_at(next);
+}
 
-  // Теперь оба мьютекса захвачены; adopt_lock используется, чтобы сообщить
-  // lock_guard, что мьютекс уже захвачен.
-  std::lock_guard<std::mutex> lock1(mutex1, std::adopt_lock);
-  std::lock_guard<std::mutex> lock2(mutex2, std::adopt_lock);
-
-  std::cout << "we locked our mutexes\n";
-
-  // Читаем значения из fromBlock
-  double x = fromBlock->get_x()[index];
-  double y = fromBlock->get_y()[index];
-  double z = fromBlock->get_z()[index];
-  double vx = fromBlock->get_vx()[index];
-  double vy = fromBlock->get_vy()[index];
-  double vz = fromBlock->get_vz()[index];
-  double fx = fromBlock->get_fx()[index];
-  double fy = fromBlock->get_fy()[index];
-  double fz = fromBlock->get_fz()[index];
-  double ax = fromBlock->get_ax()[index];
-  double ay = fromBlock->get_ay()[index];
-  double az = fromBlock->get_az()[index];
-  double mass = fromBlock->get_mass()[index];
-
-  // Создаем конкретную частицу, используя конструктор
-  Particle newParticle(x, y, z, vx, vy, vz, fx, fy, fz, ax, ay, az, mass);
+void Storage::release_block(ParticleBlock *block) {
+  manager_.destroy_block(block);
+}
 
-  std::cout << "We created P!\n";
-  // Добавляем частицу в целевой блок.
-  toBlock->addParticle(newParticle);
+void Storage::flush_block_caches() { manager_.flush_magazines(); }
 
-  // Удаляем частицу из исходного блока.
+// Migrate phase only: the engine guarantees nobody else touches either block
+void Storage::transferParticle(ParticleBlock *fromBlock, ParticleBlock *toBlock,
+                               size_t index) {
+  // Добавляем частицу в целевой блок и удаляем из исходного.
+  toBlock->addParticle(fromBlock->getParticle(index));
   fromBlock->deleteParticle(index);
 }
@@ -0,0 +1,122 @@
+#include "ds/tree/neighbour_lists.h"
+#include "ds/tree/octree.h"
+#include "ds/tree/sfc.h"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace {
+struct Box {
+  int64_t lo[3], hi[3];
+};
+
+sfc::OrderKey level_span(unsigned level) {
+  return sfc::OrderKey{1} << (3 * (sfc::kMaxLevel - level));
+}
+
+// Cell extent in finest-level grid units
+Box cell_box(sfc::LocationCode code) {
+  const unsigned level = sfc::code_level(code);
+  const sfc::GridCoord g = sfc::decode_code(code);
+  const int64_t size = int64_t{1} << (sfc::kMaxLevel - level);
+  const int64_t c[3] = {g.x, g.y, g.z};
+  Box box;
+  for (int a = 0; a < 3; ++a) {
+    box.lo[a] = c[a] * size;
+    box.hi[a] = box.lo[a] + size;
+  }
+  return box;
+}
+
+// Closed boxes intersect: shared face, edge or corner
+bool touches(const Box &a, const Box &b) {
+  for (int axis = 0; axis < 3; ++axis)
+    if (a.lo[axis] > b.hi[axis] || b.lo[axis] > a.hi[axis])
+      return false;
+  return true;
+}
+} // namespace
+
+void LeafNeighbourLists::rebuild(const std::vector<AROctreeNode *> &leaves,
+                                 const Storage &storage) {
+  const size_t n = leaves.size();
+  leaf_codes_.resize(n);
+  leaf_blocks_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    leaf_codes_[i] = leaves[i]->code;
+    leaf_blocks_[i] =
+        static_cast<uint32_t>(storage.block_index(leaves[i]->localBlock));
+  }
+
+  // Leaves tile the root cell, so their Morton ranges are disjoint and any
+  // cell start falls into exactly one of them
+  std::vector<uint32_t> by_morton(n);
+  std::iota(by_morton.begin(), by_morton.end(), 0u);
+  std::vector<sfc::OrderKey> starts(n);
+  for (size_t i = 0; i < n; ++i)
+    starts[i] = sfc::order_key(sfc::Curve::kMorton, leaf_codes_[i]);
+  std::sort(by_morton.begin(), by_morton.end(),
+            [&](uint32_t a, uint32_t b) { return starts[a] < starts[b]; });
+  std::sort(starts.begin(), starts.end());
+
+  offsets_.assign(1, 0);
+  neighbours_.clear();
+  neighbour_blocks_.clear();
+
+  for (size_t leaf = 0; leaf < n; ++leaf) {
+    const sfc::LocationCode code = leaf_codes_[leaf];
+    const unsigned level = sfc::code_level(code);
+    const sfc::GridCoord g = sfc::decode_code(code);
+    const int64_t side = int64_t{1} << level;
+    const Box own = cell_box(code);
+    const size_t first = neighbours_.size();
+
+    for (int dx = -1; dx <= 1; ++dx) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dz = -1; dz <= 1; ++dz) {
+          if (dx == 0 && dy == 0 && dz == 0)
+            continue;
+          const int64_t nx = int64_t{g.x} + dx, ny = int64_t{g.y} + dy,
+                        nz = int64_t{g.z} + dz;
+          if (nx < 0 || ny < 0 || nz < 0 || nx >= side || ny >= side ||
+              nz >= side)
+            continue;
+
+          const sfc::LocationCode cell = sfc::encode_code(
+              {static_cast<uint32_t>(nx), static_cast<uint32_t>(ny),
+               static_cast<uint32_t>(nz)},
+              level);
+          const sfc::OrderKey lo = sfc::order_key(sfc::Curve::kMorton, cell);
+          size_t pos = static_cast<size_t>(
+                           std::upper_bound(starts.begin(), starts.end(), lo) -
+                           starts.begin()) -
+                       1;
+
+          // Same depth or coarser: one leaf covers the whole cell
+          if (sfc::code_level(leaf_codes_[by_morton[pos]]) <= level) {
+            neighbours_.push_back(by_morton[pos]);
+            continue;
+          }
+          // Finer: the cell's descendants are contiguous in Morton order
+          const sfc::OrderKey hi = lo + level_span(level);
+          for (; pos < n && starts[pos] < hi; ++pos)
+            if (touches(own, cell_box(leaf_codes_[by_morton[pos]])))
+              neighbours_.push_back(by_morton[pos]);
+        }
+      }
+    }
+
+    // A coarse neighbour is reached through several directions
+    std::sort(neighbours_.begin() + static_cast<long>(first),
+              neighbours_.end());
+    neighbours_.erase(std::unique(neighbours_.begin() + static_cast<long>(first),
+                                  neighbours_.end()),
+                      neighbours_.end());
+    offsets_.push_back(static_cast<uint32_t>(neighbours_.size()));
+  }
+
+  neighbour_blocks_.reserve(neighbours_.size());
+  for (uint32_t nb : neighbours_)
+    neighbour_blocks_.push_back(leaf_blocks_[nb]);
+}
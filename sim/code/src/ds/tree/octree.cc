@@ -5,54 +5,91 @@
 #include "gfx/renderer/scene.h"
 #include "utils/namespaces/MyMath.h"
 #include "utils/namespaces/error_namespace.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <iostream>
 #include <memory>
-#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 AROctreeNode::AROctreeNode(MyMath::BoundingBox bounds, Multipole multipole,
                            const int depth, const int maxDepth,
-                           Storage &storage)
-    : bounds(bounds), multipole(multipole), depth(depth), maxDepth(maxDepth),
-      storage(storage) {
+                           Storage &storage, sfc::LocationCode code,
+                           ParticleBlock *block)
+    : bounds(bounds), multipole(multipole), depth(depth), code(code),
+      maxDepth(maxDepth), storage(storage) {
   setCalculatedCenter();
-  localBlock = storage.create_memory_block(1, {});
+  localBlock = block ? block : storage.create_memory_block(code, {});
+  if (!localBlock)
+    throw std::runtime_error("Block arena is full");
 };
 
 AROctreeNode::AROctreeNode(MyMath::BoundingBox &prime_bounds,
                            const unsigned short tree_max_depth,
                            Storage &storage)
     : bounds(prime_bounds), multipole(Multipole{}), depth(0),
-      maxDepth(tree_max_depth), storage(storage) {
+      code(sfc::kRootCode), maxDepth(tree_max_depth), storage(storage) {
   setCalculatedCenter();
-  localBlock = storage.create_memory_block(1, {});
+  localBlock = storage.create_memory_block(code, {});
+  if (!localBlock)
+    throw std::runtime_error("Block arena is full");
 };
 
 AROctreeNode::~AROctreeNode() {
   for (auto &child : children) {
-    delete child;
+    delete child.load(std::memory_order_relaxed);
   }
 }
 
-void AROctreeNode::insert(const Particle &p) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  debug::debug_print("Мы в инверте");
-  if (depth == maxDepth) {
-    localBlock->addParticle(p);
-    return;
-  }
-  if (*children == nullptr) {
-    if (localBlock->data_block.size < 16) {
-      localBlock->addParticle(p);
+bool AROctreeNode::insert(const Particle &p, bool &did_split) {
+  const MyMath::Vector3 pos = p.getPosition();
+  AROctreeNode *node = this;
+
+  while (true) {
+    if (node->state_.load(std::memory_order_acquire) == State::kInternal) {
+      node = node->children[node->boundsCheck(pos)].load(
+          std::memory_order_acquire);
+      continue;
+    }
+
+    const uint32_t slot =
+        node->reserved_.fetch_add(1, std::memory_order_acq_rel);
+    if (node->depth == node->maxDepth) {
+      // No split possible: slot k lives in block k / N of the overflow chain
+      ParticleBlock *block = node->localBlock;
+      uint32_t index = slot;
+      while (block && index >= ParticleBlock::N) {
+        block = node->storage.next_block_or_grow(block);
+        index -= ParticleBlock::N;
+      }
+      if (!block)
+        return false; // arena full, the caller counts the drop
+      block->store_particle(index, p);
+      std::atomic_ref<unsigned short>(block->data_block.size)
+          .fetch_add(1, std::memory_order_release);
+      return true;
+    }
+    if (slot < kSplitThreshold) {
+      node->localBlock->store_particle(slot, p);
+      std::atomic_ref<unsigned short>(node->localBlock->data_block.size)
+          .fetch_add(1, std::memory_order_release);
+      return true;
+    }
+
+    State expected = State::kLeaf;
+    if (node->state_.compare_exchange_strong(expected, State::kSplitting,
+                                             std::memory_order_acq_rel)) {
+      if (!node->split())
+        return false; // arena full, the caller counts the drop
+      did_split = true;
     } else {
-      debug::debug_print("Мы сплипуемся");
-      this->split(p);
+      // Back to kLeaf if the split failed: retry, and fail the same way
+      while (node->state_.load(std::memory_order_acquire) == State::kSplitting)
+        std::this_thread::yield();
     }
-    return;
   }
-  auto bound_number = this->boundsCheck(p.getPosition());
-  this->children[bound_number]->insert(p);
 }
 
 int AROctreeNode::boundsCheck(MyMath::Vector3 p) const {
@@ -102,47 +139,263 @@ std::array<MyMath::BoundingBox, 8> AROctreeNode::childBounds() {
 }
 
 // TODO must get an array for each layer. Not complex as the size is fixed
-void AROctreeNode::split(const Particle &p) {
+// Called by the one inserter that won the kLeaf -> kSplitting CAS. Without
+// blocks for the children the node goes back to kLeaf untouched
+bool AROctreeNode::split() {
+  // Writers that reserved a slot before the overflow may still be storing
+  std::atomic_ref<unsigned short> size(localBlock->data_block.size);
+  while (size.load(std::memory_order_acquire) < kSplitThreshold)
+    std::this_thread::yield();
+
   std::array<MyMath::BoundingBox, 8> childBoundingBoxes = childBounds();
-  for (size_t i = 0; i < 8; ++i) {
-    children[i] = new AROctreeNode(childBoundingBoxes[i], Multipole(),
-                                   depth + 1, maxDepth, storage);
+  // Siblings are allocated together so they land next to each other
+  ParticleBlock *blocks[8] = {nullptr};
+  if (!storage.create_child_blocks(code, blocks)) {
+    state_.store(State::kLeaf, std::memory_order_release);
+    return false;
   }
-  const size_t size_of_initial_block = localBlock->data_block.size;
-  for (size_t n = 0; n < size_of_initial_block; ++n) {
-    Particle tmp_p = localBlock->deleteParticle(0);
-    int childIndex = boundsCheck(tmp_p.getPosition());
-    children[childIndex]->insert(tmp_p);
+  AROctreeNode *fresh[8];
+  for (unsigned i = 0; i < 8; ++i) {
+    fresh[i] = new AROctreeNode(childBoundingBoxes[i], Multipole(), depth + 1,
+                                maxDepth, storage, sfc::child_code(code, i),
+                                blocks[i]);
+    fresh[i]->parent = this;
+  }
+  // The children are still private, plain inserts are enough. They can't
+  // fail: kSplitThreshold bodies fit any child's fresh block
+  bool child_split = false;
+  for (size_t n = 0; n < kSplitThreshold; ++n) {
+    const Particle tmp_p = localBlock->getParticle(n);
+    fresh[boundsCheck(tmp_p.getPosition())]->insert(tmp_p, child_split);
   }
 
-  int childIndex = boundsCheck(p.getPosition());
-  children[childIndex]->insert(p);
-  storage.release_block(this->localBlock);
+  for (unsigned i = 0; i < 8; ++i)
+    children[i].store(fresh[i], std::memory_order_relaxed);
+  ParticleBlock *old_block = localBlock;
   localBlock = nullptr;
-  return;
+  state_.store(State::kInternal, std::memory_order_release);
+  storage.release_block(old_block);
+  return true;
 }
 
-void AROctree::insert(const Particle &p) { root->insert(p); };
+bool AROctree::insert(const Particle &p) {
+  bool did_split = false;
+  const bool stored = root->insert(p, did_split);
+  if (did_split)
+    topology_version_.fetch_add(1, std::memory_order_release);
+  return stored;
+};
 
 AROctree::~AROctree() { root.reset(); };
 
 AROctree::AROctree(unsigned short max_tree_depth,
                    MyMath::BoundingBox prime_bounds, Storage &storage)
-    : maxDepth(max_tree_depth), storage(storage) {
+    // Deeper cells have no location code, see ds/tree/sfc.h
+    : maxDepth(std::min<int>(max_tree_depth, sfc::kMaxLevel)),
+      storage(storage) {
   std::cout << "The tree got initialized!\n";
-  this->root =
-      std::make_unique<AROctreeNode>(prime_bounds, max_tree_depth, storage);
+  this->root = std::make_unique<AROctreeNode>(
+      prime_bounds, static_cast<unsigned short>(maxDepth), storage);
 };
 
-void AROctree::insert_batch(const std::vector<Particle> &dataSet) {
+size_t AROctree::insert_batch(const std::vector<Particle> &dataSet,
+                              unsigned threads) {
   debug::debug_print("insert_batch 11111, len dataSet: {}", dataSet.size());
-  for (auto p : dataSet) {
-    this->insert(p);
+  if (threads <= 1) {
+    size_t dropped = 0;
+    for (auto p : dataSet) {
+      dropped += !this->insert(p);
+    }
+    return dropped;
   }
+
+  ThreadPool pool{threads - 1};
+  return insert_batch(dataSet, pool);
+}
+
+size_t AROctree::insert_batch(const std::vector<Particle> &dataSet,
+                              ThreadPool &pool) {
+  std::atomic<size_t> dropped{0};
+  const size_t regions = storage.region_count();
+  if (regions <= 1 || pool.homes() <= 1) {
+    pool.parallel_for(dataSet.size(), 0, [&](size_t begin, size_t end) {
+      size_t missed = 0;
+      for (size_t i = begin; i < end; ++i)
+        missed += !this->insert(dataSet[i]);
+      if (missed)
+        dropped.fetch_add(missed, std::memory_order_relaxed);
+    });
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+  // Bodies grouped by the region their cell lives in, each group inserted
+  // by runners of that region's node: the blocks a split creates there are
+  // allocated and first written next to the workers that will own them
+  const MyMath::BoundingBox &box = root->bounds;
+  std::vector<uint32_t> region(dataSet.size());
+  std::vector<size_t> first(regions + 1, 0);
+  for (size_t i = 0; i < dataSet.size(); ++i) {
+    region[i] = static_cast<uint32_t>(
+        storage.region_of_point(dataSet[i].getPosition(), box));
+    ++first[region[i] + 1];
+  }
+  for (size_t r = 0; r < regions; ++r)
+    first[r + 1] += first[r];
+  std::vector<uint32_t> order(dataSet.size());
+  std::vector<size_t> at(first.begin(), first.end() - 1);
+  for (size_t i = 0; i < dataSet.size(); ++i)
+    order[at[region[i]]++] = static_cast<uint32_t>(i);
+
+  const size_t grain = std::max<size_t>(
+      1, dataSet.size() / (size_t{pool.concurrency()} * 8));
+  std::vector<size_t> cuts{0};
+  std::vector<unsigned> homes;
+  for (size_t r = 0; r < regions; ++r)
+    for (size_t begin = first[r]; begin < first[r + 1]; begin += grain) {
+      cuts.push_back(std::min(begin + grain, first[r + 1]));
+      homes.push_back(static_cast<unsigned>(r));
+    }
+  pool.for_each_chunk(homes.size(), homes, [&](size_t c) {
+    size_t missed = 0;
+    for (size_t k = cuts[c]; k < cuts[c + 1]; ++k)
+      missed += !this->insert(dataSet[order[k]]);
+    if (missed)
+      dropped.fetch_add(missed, std::memory_order_relaxed);
+  });
+  return dropped.load(std::memory_order_relaxed);
 }
 
 AROctreeNode *AROctree::get_root() { return root.get(); }
 
+void AROctree::collect_leaves(std::vector<AROctreeNode *> &leaves) const {
+  leaves.clear();
+  if (!root)
+    return;
+
+  const sfc::Curve curve = storage.curve();
+  struct Frame {
+    AROctreeNode *node;
+    sfc::CurveState state;
+  };
+  std::vector<Frame> stack;
+  stack.push_back({root.get(), sfc::kRootState});
+
+  while (!stack.empty()) {
+    const Frame frame = stack.back();
+    stack.pop_back();
+
+    if (frame.node->children[0] == nullptr) {
+      leaves.push_back(frame.node);
+      continue;
+    }
+    // Push in reverse curve rank so the lowest rank is popped first
+    for (unsigned rank = 8; rank-- > 0;) {
+      const unsigned octant = sfc::child_at_rank(curve, frame.state, rank);
+      stack.push_back({frame.node->children[octant],
+                       sfc::child_state(curve, frame.state, octant)});
+    }
+  }
+}
+
+void AROctree::collect_nodes(std::vector<AROctreeNode *> &nodes) {
+  nodes.clear();
+  if (!root)
+    return;
+  nodes.push_back(root.get());
+  // The vector doubles as the BFS queue
+  for (size_t head = 0; head < nodes.size(); ++head) {
+    AROctreeNode *node = nodes[head];
+    node->node_index = static_cast<uint32_t>(head);
+    if (node->children[0] == nullptr)
+      continue;
+    for (auto &child : node->children)
+      nodes.push_back(child.load(std::memory_order_relaxed));
+  }
+}
+
+void AROctree::relocate_blocks(const std::vector<uint32_t> &moved) {
+  if (moved.empty() || !root)
+    return;
+  std::vector<AROctreeNode *> stack{root.get()};
+  while (!stack.empty()) {
+    AROctreeNode *node = stack.back();
+    stack.pop_back();
+    if (node->localBlock) {
+      const size_t index = storage.block_index(node->localBlock);
+      if (index < moved.size() && moved[index] != ParticleBlock::kNoNextBlock)
+        node->localBlock = storage.block_at(moved[index]);
+    }
+    if (node->children[0] == nullptr)
+      continue;
+    for (auto &child : node->children)
+      stack.push_back(child.load(std::memory_order_relaxed));
+  }
+  topology_version_.fetch_add(1, std::memory_order_release);
+}
+
+namespace {
+// The insert protocol maps slot k to block k / N of a chain, so after
+// removals the bodies are moved back to keep every block but the last full.
+// Blocks left empty at the tail go back to the arena
+void compact_chain(ParticleBlock *head, Storage &storage) {
+  std::vector<ParticleBlock *> chain;
+  for (ParticleBlock *b = head; b; b = storage.next_block(b))
+    chain.push_back(b);
+  if (chain.size() < 2)
+    return;
+
+  size_t dst = 0, src = chain.size() - 1;
+  while (dst < src) {
+    if (chain[dst]->is_full())
+      ++dst;
+    else if (chain[src]->is_empty())
+      --src;
+    else
+      chain[dst]->addParticle(
+          chain[src]->deleteParticle(chain[src]->size() - 1u));
+  }
+
+  size_t keep = chain.size();
+  while (keep > 1 && chain[keep - 1]->is_empty())
+    --keep;
+  chain[keep - 1]->meta_block.next_logical_block = ParticleBlock::kNoNextBlock;
+  for (size_t k = keep; k < chain.size(); ++k)
+    storage.release_block(chain[k]);
+}
+} // namespace
+
+void AROctree::extract_migrants(
+    const std::vector<AROctreeNode *> &leaves, std::vector<Particle> &out,
+    const std::function<bool(const MyMath::Vector3 &)> &leaves_domain) {
+  for (AROctreeNode *leaf : leaves) {
+    bool removed = false;
+    for (ParticleBlock *block = leaf->localBlock; block;
+         block = storage.next_block(block)) {
+      // Backwards, deleteParticle moves the last particle into the hole
+      for (size_t i = block->data_block.size; i-- > 0;) {
+        const MyMath::Vector3 pos{block->get_x()[i], block->get_y()[i],
+                                  block->get_z()[i]};
+        AROctreeNode *node = root.get();
+        while (AROctreeNode *child = node->children[node->boundsCheck(pos)])
+          node = child;
+        if (node != leaf || (leaves_domain && leaves_domain(pos))) {
+          out.push_back(block->deleteParticle(i));
+          removed = true;
+        }
+      }
+    }
+    if (removed)
+      compact_chain(leaf->localBlock, storage);
+
+    // Keep the slot counter of the insert protocol in step with the blocks
+    uint32_t total = 0;
+    for (const ParticleBlock *block = leaf->localBlock; block;
+         block = storage.next_block(block))
+      total += block->data_block.size;
+    leaf->reserved_.store(total, std::memory_order_relaxed);
+  }
+}
+
 Multipole::Multipole(double mass) : totalMass(mass) {};
 
 Multipole::Multipole() : totalMass(0) {};
@@ -170,9 +423,9 @@ void AROctreeNode::printOctreeMasses() {
 
   // Если узел имеет дочерние узлы, обходим их
   for (int i = 0; i < 8; ++i) {
-    if (this->children[i] != nullptr) {
+    if (AROctreeNode *child = this->children[i]) {
       // Для наглядности добавляем отступ
-      this->children[i]->printOctreeMasses();
+      child->printOctreeMasses();
     }
   }
 }
@@ -190,12 +443,13 @@ inline glm::vec3 transform_simulation_to_gfx(double x, double y, double z) {
 
 } // namespace
 
-std::vector<gfx::renderer::SceneParticle> AROctree::get_particles_for_render() {
-  std::vector<gfx::renderer::SceneParticle> result;
+// Runs on the physics thread between ticks, so no locking. `result` keeps
+// its capacity from the last time this triple-buffer slot was written
+void AROctree::write_render_snapshot(
+    std::vector<gfx::renderer::SceneParticle> &result) {
+  result.clear();
   if (!root)
-    return result;
-
-  result.reserve(100000);
+    return;
 
   std::vector<TraversalStackFrame> stack;
   stack.reserve(15);
@@ -210,13 +464,9 @@ std::vector<gfx::renderer::SceneParticle> AROctree::get_particles_for_render() {
     if (!node)
       continue;
 
-    std::unique_lock<std::mutex> lock(node->getMutex(), std::try_to_lock);
-    if (!lock.owns_lock()) {
-      continue;
-    }
-
-    if (node->localBlock && node->localBlock->data_block.size > 0) {
-      auto &block = node->localBlock->data_block;
+    for (ParticleBlock *chained = node->localBlock; chained;
+         chained = storage.next_block(chained)) {
+      auto &block = chained->data_block;
 
       for (size_t i = 0; i < block.size; ++i) {
         if (i >= ParticleBlock::N)
@@ -229,17 +479,15 @@ std::vector<gfx::renderer::SceneParticle> AROctree::get_particles_for_render() {
 
         particle.mass = static_cast<float>(block.mass[i]);
 
-        particle.visual_id = block.visual_id[i];
+        particle.visual_id = chained->get_visual_id()[i];
 
         result.push_back(particle);
       }
     }
 
-    lock.unlock();
-
     for (int i = 0; i < 8; ++i) {
-      if (node->children[i]) {
-        stack.push_back({node->children[i], frame.depth + 1});
+      if (AROctreeNode *child = node->children[i]) {
+        stack.push_back({child, frame.depth + 1});
       }
     }
   }
@@ -250,19 +498,13 @@ std::vector<gfx::renderer::SceneParticle> AROctree::get_particles_for_render() {
     debug::debug_print("Applying LOD: reducing particles from {} to {}",
                        result.size(), max_particles_for_render);
 
-    // Простой прореживание - берем каждый n-ый элемент
-    std::vector<gfx::renderer::SceneParticle> sampled;
-    sampled.reserve(max_particles_for_render);
-
-    size_t step = result.size() / max_particles_for_render;
+    // Простой прореживание - берем каждый n-ый элемент, на месте
+    const size_t step = result.size() / max_particles_for_render;
+    size_t kept = 0;
     for (size_t i = 0;
-         i < result.size() && sampled.size() < max_particles_for_render;
-         i += step) {
-      sampled.push_back(result[i]);
+         i < result.size() && kept < max_particles_for_render; i += step) {
+      result[kept++] = result[i];
     }
-
-    result.swap(sampled);
+    result.resize(kept);
   }
-
-  return result;
 }
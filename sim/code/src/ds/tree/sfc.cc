@@ -0,0 +1,87 @@
+#include "ds/tree/sfc.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace sfc {
+
+namespace {
+constexpr uint64_t spread_bits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+constexpr uint32_t compact_bits(uint64_t v) {
+  v &= 0x1249249249249249;
+  v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3;
+  v = (v ^ (v >> 4)) & 0x100f00f00f00f00f;
+  v = (v ^ (v >> 8)) & 0x1f0000ff0000ff;
+  v = (v ^ (v >> 16)) & 0x1f00000000ffff;
+  v = (v ^ (v >> 32)) & 0x1fffff;
+  return static_cast<uint32_t>(v);
+}
+
+uint32_t quantize(double v, double lo, double hi) {
+  constexpr double kCells = static_cast<double>(1u << kMaxLevel);
+  const double t = (v - lo) / (hi - lo);
+  const double cell = std::clamp(t * kCells, 0.0, kCells - 1.0);
+  return static_cast<uint32_t>(cell);
+}
+} // namespace
+
+LocationCode encode_code(GridCoord cell, unsigned level) {
+  const uint64_t digits =
+      spread_bits(cell.x) << 2 | spread_bits(cell.y) << 1 | spread_bits(cell.z);
+  return (uint64_t{1} << (3 * level)) | digits;
+}
+
+GridCoord decode_code(LocationCode code) {
+  const uint64_t digits = code ^ (uint64_t{1} << (3 * code_level(code)));
+  return {compact_bits(digits >> 2), compact_bits(digits >> 1),
+          compact_bits(digits)};
+}
+
+OrderKey order_key(Curve curve, LocationCode code) {
+  const unsigned level = code_level(code);
+  OrderKey key = 0;
+  if (curve == Curve::kMorton) {
+    key = code ^ (uint64_t{1} << (3 * level));
+  } else {
+    CurveState state = kRootState;
+    for (unsigned l = level; l-- > 0;) {
+      const unsigned octant = static_cast<unsigned>(code >> (3 * l)) & 7u;
+      key = (key << 3) | child_rank(curve, state, octant);
+      state = child_state(curve, state, octant);
+    }
+  }
+  return key << (3 * (kMaxLevel - level));
+}
+
+OrderKey point_key(Curve curve, const MyMath::Vector3 &p,
+                   const MyMath::BoundingBox &bounds) {
+  const GridCoord cell{quantize(p.x, bounds.min.x, bounds.max.x),
+                       quantize(p.y, bounds.min.y, bounds.max.y),
+                       quantize(p.z, bounds.min.z, bounds.max.z)};
+  return order_key(curve, encode_code(cell, kMaxLevel));
+}
+
+Curve curve_from_string(const std::string &value) {
+  if (value == "morton")
+    return Curve::kMorton;
+  if (value == "hilbert")
+    return Curve::kHilbert;
+  throw std::runtime_error("Unknown curve '" + value +
+                           "', expected morton|hilbert");
+}
+
+const char *curve_name(Curve curve) {
+  return curve == Curve::kHilbert ? "hilbert" : "morton";
+}
+
+} // namespace sfc
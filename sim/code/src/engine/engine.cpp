@@ -2,14 +2,40 @@
 #include "ctx/ctx.h"
 #include "ds/storage/storage.h"
 #include "ds/tree/octree.h"
+#include "engine/pairwise.h"
+#include "utils/affinity.h"
+#include "utils/namespaces/error_namespace.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+namespace {
+// runner_cpus without the engine thread's own entry
+std::vector<std::vector<unsigned>> worker_cpus(const PhysicsCtx &p_ctx) {
+  if (p_ctx.runner_cpus.size() <= 1)
+    return {};
+  return {p_ctx.runner_cpus.begin() + 1, p_ctx.runner_cpus.end()};
+}
+
+// Arena regions only map onto pool homes when the runners were split by
+// region
+bool numa_homes(const PhysicsCtx &p_ctx, const Storage &storage) {
+  return !p_ctx.runner_homes.empty() && storage.region_count() > 1;
+}
+} // namespace
+
 void PhysicsEngine::MainCycle() {
   std::cout << "Мы в основном цикле движка!\n";
+  if (!p_ctx.runner_cpus.empty() && !p_ctx.runner_cpus[0].empty() &&
+      !affinity::pin_current(p_ctx.runner_cpus[0]))
+    std::cerr << "Engine thread: could not pin\n";
   using namespace std::chrono;
 
   // Начальное значение следующего тика
@@ -57,35 +83,411 @@ void PhysicsEngine::MainCycle() {
 // Тут верхнеуровнево вызываем 2 этапа -> каждому треду по pairwise ->
 // синхронизация -> расчет мультиполя -> треды считают воздействие поля на
 // остельные частицы -> синхронизация
+// Ownership rules of each phase are in engine/phases.h
 int PhysicsEngine::physicsTick(
     std::chrono::high_resolution_clock::time_point tickTime) {
   tickTime.max();
-  // Получаем корневой узел дерева
-  // debug::debug_print("We tick!");
-  // AROctreeNode *root = tree->get_root();
-  // std::cout << "We tick!" << root->localBlock->getParticle(0) << "\n";
-  // calcBlocskAx(*root->localBlock);
-  // updateCoords(*root->localBlock, p_ctx.integration_step);
+  phases_.track_blocks(storage.capacity());
+  phases_.enter(Phase::kForce);
+  refresh_neighbour_lists();
+  compute_forces();
+  exchange_essential();
+
+  phases_.enter(Phase::kIntegrate);
+  integrate();
+
+  phases_.enter(Phase::kMigrate);
+  if (const size_t dropped = migrate()) {
+    // The tree no longer holds every body; nothing after this is physics
+    std::cerr << "Block arena is full, " << dropped
+              << " bodies dropped. Stopping\n";
+    state.set_state(STATE::ERROR);
+    return -1;
+  }
+  publish_snapshot();
+  ++tick_;
+  maybe_write_snapshot();
   return 0;
 }
 
+void PhysicsEngine::refresh_neighbour_lists() {
+  if (neighbours_version_ == tree->topology_version())
+    return;
+  tree->collect_leaves(leaves_);
+  tree->collect_nodes(nodes_);
+  neighbour_lists_.rebuild(leaves_, storage);
+  neighbours_version_ = tree->topology_version();
+  // Nothing measured for the new leaves yet, start from pair counts
+  leaf_costs_.reset(neighbour_lists_.leaf_count());
+  for (size_t leaf = 0; leaf < neighbour_lists_.leaf_count(); ++leaf)
+    leaf_costs_.record(leaf,
+                       {.p2p_pairs = leaf_pairs(neighbour_lists_, storage,
+                                                leaf)});
+  refresh_regions();
+}
+
+// Leaves are in curve order and regions own equal shares of the curve, so
+// each region's leaves are one run. A region gets kChunksPerRunner chunks
+// per runner on its node
+void PhysicsEngine::refresh_regions() {
+  const size_t leaves = neighbour_lists_.leaf_count();
+  leaf_homes_.clear();
+  region_bounds_.assign(1, 0);
+  region_parts_.clear();
+  if (!numa_homes(p_ctx, storage)) {
+    region_bounds_.push_back(leaves);
+    region_parts_.push_back(size_t{pool_.concurrency()} * kChunksPerRunner);
+    return;
+  }
+  leaf_homes_.resize(leaves);
+  for (size_t leaf = 0; leaf < leaves; ++leaf) {
+    const auto home = static_cast<unsigned>(
+        storage.region_of_cell(neighbour_lists_.leaf_code(leaf)));
+    leaf_homes_[leaf] = home;
+    if (leaf != 0 && home == leaf_homes_[leaf - 1])
+      continue;
+    if (leaf != 0)
+      region_bounds_.push_back(leaf);
+    const auto runners = static_cast<size_t>(std::count(
+        p_ctx.runner_homes.begin(), p_ctx.runner_homes.end(), home));
+    region_parts_.push_back(std::max<size_t>(runners, 1) * kChunksPerRunner);
+  }
+  region_bounds_.push_back(leaves);
+}
+
+// Upward pass, near field and far field in one task graph, see
+// engine/task_graph.h
+void PhysicsEngine::compute_forces() {
+  const ForceTaskGraph::NearField near_field = [this](size_t begin,
+                                                      size_t end) {
+    for (size_t leaf = begin; leaf < end; ++leaf) {
+      const auto start = std::chrono::steady_clock::now();
+      phases_.claim(neighbour_lists_.leaf_block(leaf));
+      for (ParticleBlock *block =
+               storage.block_at(neighbour_lists_.leaf_block(leaf));
+           block; block = storage.next_block(block)) {
+        block->get_ax().fill(0);
+        block->get_ay().fill(0);
+        block->get_az().fill(0);
+      }
+      const uint64_t pairs = calc_leaf_ax(neighbour_lists_, storage, leaf);
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start);
+      leaf_costs_.record(leaf, {.p2p_pairs = pairs,
+                                .ns = static_cast<uint64_t>(ns.count())});
+    }
+  };
+  // A few equal-cost chunks per runner: the cut does the balancing,
+  // stealing only absorbs what the last tick failed to predict. With NUMA
+  // homes each region is cut for its own runners
+  const std::vector<size_t> &cuts =
+      leaf_costs_.partition(region_bounds_, region_parts_);
+  chunk_homes_.clear();
+  if (!leaf_homes_.empty())
+    for (size_t c = 0; c + 1 < cuts.size(); ++c)
+      chunk_homes_.push_back(leaf_homes_[cuts[c]]);
+  if (carve_expansions()) {
+    size_far_field();
+    force_graph_.run(pool_, nodes_, storage, expansions_, cuts, chunk_homes_,
+                     near_field, [this](size_t begin, size_t end) {
+                       collect_far_field(begin, end);
+                     });
+  } else {
+    far_first_.clear();
+    pool_.for_each_chunk(cuts.size() - 1, chunk_homes_,
+                         [&](size_t c) { near_field(cuts[c], cuts[c + 1]); });
+  }
+  leaf_costs_.close_tick();
+  if (p_ctx.verbose && tick_ % kBalanceReportEvery == 0)
+    report_balance();
+}
+
+// What the cut achieved: chunks, slowest over mean, and the measured time
+// of each chunk
+void PhysicsEngine::report_balance() const {
+  const std::vector<uint64_t> &chunk_ns = leaf_costs_.chunk_ns();
+  std::cout << "Tick " << tick_ << " near field: " << chunk_ns.size()
+            << " chunks, imbalance " << leaf_costs_.imbalance()
+            << ", ns per chunk:";
+  for (uint64_t ns : chunk_ns)
+    std::cout << ' ' << ns;
+  std::cout << std::endl;
+}
+
+// Leaf l's far field goes to far_a*_ from far_first_[l], in chain order
+void PhysicsEngine::size_far_field() {
+  const size_t leaves = neighbour_lists_.leaf_count();
+  far_first_.assign(leaves + 1, 0);
+  for (size_t leaf = 0; leaf < leaves; ++leaf) {
+    size_t bodies = 0;
+    for (const ParticleBlock *block =
+             storage.block_at(neighbour_lists_.leaf_block(leaf));
+         block; block = storage.next_block(block))
+      bodies += block->size();
+    far_first_[leaf + 1] = far_first_[leaf] + bodies;
+  }
+  far_ax_.resize(far_first_[leaves]);
+  far_ay_.resize(far_first_[leaves]);
+  far_az_.resize(far_first_[leaves]);
+}
+
+// Still the force phase: every position is read-only, so each leaf walks
+// the finished tree for its far field (dist/let.h) and keeps the pull in
+// far_a*_ until integrate() adds it to the leaf's own blocks. Runs next to
+// the near field of the same leaves, which is why it can't write the
+// blocks
+void PhysicsEngine::collect_far_field(size_t begin, size_t end) {
+  dist::EssentialTree far;
+  std::vector<uint32_t> near;
+  for (size_t leaf = begin; leaf < end; ++leaf) {
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t head = neighbour_lists_.leaf_block(leaf);
+    const std::span<const uint32_t> neighbours =
+        neighbour_lists_.neighbour_blocks(leaf);
+    near.assign(neighbours.begin(), neighbours.end());
+    near.push_back(head);
+    far.clear();
+    dist::collect_far_field(*tree->get_root(), storage, expansions_,
+                            leaves_[leaf]->bounds, near, dist::kDefaultTheta,
+                            far);
+    size_t at = far_first_[leaf];
+    for (std::vector<double> *axis : {&far_ax_, &far_ay_, &far_az_})
+      std::fill(axis->begin() + static_cast<ptrdiff_t>(at),
+                axis->begin() + static_cast<ptrdiff_t>(far_first_[leaf + 1]),
+                0.0);
+    for (const ParticleBlock *block = storage.block_at(head); block;
+         block = storage.next_block(block)) {
+      dist::apply_essential(far, *block, far_ax_.data() + at,
+                            far_ay_.data() + at, far_az_.data() + at);
+      at += block->size();
+    }
+    // The next cut weighs in the far field as well
+    leaf_costs_.record_far(
+        leaf, static_cast<uint32_t>(far.multipoles.size()),
+        static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count()));
+  }
+}
+
+bool PhysicsEngine::carve_expansions() {
+  expansion_arena_.reset();
+  if (expansions_.carve(expansion_arena_, nodes_.size()))
+    return true;
+  // The tree outgrew the first build's estimate; grow with headroom
+  const size_t bytes = Expansions::bytes_for(nodes_.size() * 3 / 2);
+  if (expansion_arena_.reserve(bytes) != 0 ||
+      !expansions_.carve(expansion_arena_, nodes_.size())) {
+    debug::debug_print("Expansion arena: no memory for {} nodes",
+                       nodes_.size());
+    return false;
+  }
+  return true;
+}
+
+// Every rank sends every other one the part of its tree that rank needs
+// (dist/let.h). Collective: runs every tick on every rank, with empty
+// messages when there is nothing to send
+void PhysicsEngine::exchange_essential() {
+  remote_.clear();
+  if (!p_ctx.transport)
+    return;
+  const unsigned self = p_ctx.transport->rank();
+  const unsigned ranks = p_ctx.transport->size();
+  std::vector<dist::Bytes> out(ranks);
+  // carve() leaves count at 0 when it fails, and then there is no upward
+  // pass to export from
+  if (expansions_.count == nodes_.size() && !nodes_.empty()) {
+    pool_.parallel_for(ranks, 1, [&](size_t begin, size_t end) {
+      for (size_t r = begin; r < end; ++r) {
+        if (r == self)
+          continue;
+        dist::EssentialTree essential;
+        dist::export_essential(*tree->get_root(), storage, expansions_,
+                               rank_cells_[r], dist::kDefaultTheta,
+                               essential);
+        out[r] = dist::pack(essential);
+      }
+    });
+  }
+  const std::vector<dist::Bytes> in = p_ctx.transport->exchange(out);
+  for (unsigned r = 0; r < ranks; ++r)
+    if (r != self && !in[r].empty() && !dist::unpack(in[r], remote_))
+      debug::debug_print("Rank {}: bad essential tree from rank {}", self, r);
+}
+
+// Migrants owned by other ranks go to them, theirs come in for reinsertion
+void PhysicsEngine::exchange_migrants() {
+  const unsigned self = p_ctx.transport->rank();
+  const unsigned ranks = p_ctx.transport->size();
+  std::vector<std::vector<Particle>> leaving(ranks);
+  std::erase_if(migrants_, [&](const Particle &p) {
+    const unsigned owner = p_ctx.domain->owner(p.getPosition());
+    if (owner == self)
+      return false;
+    leaving[owner].push_back(p);
+    return true;
+  });
+  std::vector<dist::Bytes> out(ranks);
+  for (unsigned r = 0; r < ranks; ++r)
+    if (r != self)
+      out[r] = dist::pack_bodies(leaving[r]);
+  const std::vector<dist::Bytes> in = p_ctx.transport->exchange(out);
+  for (unsigned r = 0; r < ranks; ++r)
+    if (r != self && !dist::unpack_bodies(in[r], migrants_))
+      debug::debug_print("Rank {}: bad migrants from rank {}", self, r);
+}
+
+// Same chunks, on the same homes, as the tick's near field
+void PhysicsEngine::integrate() {
+  const std::vector<size_t> &cuts = leaf_costs_.cuts();
+  pool_.for_each_chunk(cuts.size() - 1, chunk_homes_, [&](size_t c) {
+    for (size_t leaf = cuts[c]; leaf < cuts[c + 1]; ++leaf) {
+      phases_.claim(neighbour_lists_.leaf_block(leaf));
+      size_t at = far_first_.empty() ? 0 : far_first_[leaf];
+      for (ParticleBlock *block =
+               storage.block_at(neighbour_lists_.leaf_block(leaf));
+           block; block = storage.next_block(block)) {
+        // The far field and the other ranks' pull land here rather than in
+        // the force phase, where the block already has its near-field
+        // claimer
+        if (!far_first_.empty()) {
+          for (size_t i = 0; i < block->size(); ++i, ++at) {
+            block->get_ax()[i] += far_ax_[at];
+            block->get_ay()[i] += far_ay_[at];
+            block->get_az()[i] += far_az_[at];
+          }
+        }
+        if (!remote_.multipoles.empty() || !remote_.bodies.empty())
+          dist::apply_essential(remote_, *block);
+        updateCoords(*block, p_ctx.integration_step);
+      }
+    }
+  });
+}
+
+size_t PhysicsEngine::migrate() {
+  for (size_t leaf = 0; leaf < neighbour_lists_.leaf_count(); ++leaf)
+    phases_.claim(neighbour_lists_.leaf_block(leaf));
+  migrants_.clear();
+  if (p_ctx.transport) {
+    const unsigned self = p_ctx.transport->rank();
+    tree->extract_migrants(leaves_, migrants_,
+                           [this, self](const MyMath::Vector3 &p) {
+                             return p_ctx.domain->owner(p) != self;
+                           });
+    exchange_migrants();
+  } else {
+    tree->extract_migrants(leaves_, migrants_);
+  }
+  const size_t dropped = tree->insert_batch(migrants_, pool_);
+  storage.flush_block_caches();
+  maybe_compact();
+  return dropped;
+}
+
+// Splits since the last compaction placed 8 blocks each wherever the arena
+// had room; once they make up a quarter of the live blocks, put everything
+// back into curve order
+void PhysicsEngine::maybe_compact() {
+  const uint64_t splits = tree->topology_version() - compacted_version_;
+  if (splits * 8 * 4 < storage.used_blocks())
+    return;
+  tree->relocate_blocks(storage.compact_blocks());
+  compacted_version_ = tree->topology_version();
+}
+
+void PhysicsEngine::publish_snapshot() {
+  tree->write_render_snapshot(snapshot_.write_buffer());
+  snapshot_.publish();
+}
+
+// Bodies don't move between ticks, so the writer stages them here and
+// writes them while the next ticks run
+void PhysicsEngine::maybe_write_snapshot() {
+  if (!snapshots_ || tick_ % p_ctx.snapshot_every != 0)
+    return;
+  // Migration may have split leaves; the next tick starts with this anyway
+  refresh_neighbour_lists();
+  if (!snapshots_->capture(storage, leaves_, tick_, d_ctx.bounding_box_,
+                           pool_))
+    debug::debug_print("Snapshot of tick {} skipped, last one still writing",
+                       tick_);
+}
+
 PhysicsEngine::PhysicsEngine(PhysicsCtx &p_ctx, SimulationState &state,
                              Storage &storage, DataCtx &d_ctx)
     : p_ctx(p_ctx), d_ctx(d_ctx), state(state), storage(storage),
+      phases_(storage.capacity()),
+      pool_(p_ctx.workers, worker_cpus(p_ctx), p_ctx.runner_homes),
       tree(std::make_unique<AROctree>(p_ctx.tree_depth(), d_ctx.bounding_box_,
                                       storage)) {
-  std::cout << "Engine got initialized!\n";
-  tree->insert_batch(d_ctx.access_dataset());
+  std::cout << "Engine got initialized! Pool of " << pool_.concurrency()
+            << " threads\n";
+  phases_.enter(Phase::kBuild);
+  const size_t dropped =
+      d_ctx.input ? insert_input()
+                  : tree->insert_batch(d_ctx.access_dataset(), pool_);
+  if (dropped != 0)
+    throw std::runtime_error("Block arena is full, " +
+                             std::to_string(dropped) + " bodies dropped");
+  storage.flush_block_caches();
+
+  // Sized once after the first build, twice the nodes for the tree to grow
+  tree->collect_nodes(nodes_);
+  if (expansion_arena_.reserve(Expansions::bytes_for(nodes_.size() * 2)) != 0)
+    throw std::runtime_error("Failed to init expansion arena");
+  publish_snapshot();
+
+  if (p_ctx.domain)
+    for (unsigned r = 0; r < p_ctx.domain->ranks(); ++r)
+      rank_cells_.push_back(p_ctx.domain->cells(r));
+  if (p_ctx.snapshot_every > 0) {
+    const dist::Transport *transport = p_ctx.transport;
+    snapshots_ = std::make_unique<io::SnapshotWriter>(
+        p_ctx.snapshot_prefix, p_ctx.io_cpus,
+        transport ? transport->rank() : 0, transport ? transport->size() : 1,
+        p_ctx.snapshot_format, p_ctx.snapshot_units);
+  }
 };
 
-void PhysicsEngine::Init() {
-  // init_threads();
+// Straight from the input into the tree's blocks, no copy of the set in
+// between. Tasks take whole parts, which are contiguous in input order, so
+// with a Morton-sorted input each one fills its own stretch of the curve.
+// With NUMA homes every part is read once per region, each pass inserting
+// that region's bodies on one of its runners (see AROctree::insert_batch)
+size_t PhysicsEngine::insert_input() {
+  const io::BodySource &input = *d_ctx.input;
+  const unsigned self = p_ctx.transport ? p_ctx.transport->rank() : 0;
+  const size_t passes =
+      numa_homes(p_ctx, storage) ? storage.region_count() : 1;
+  std::vector<unsigned> homes;
+  if (passes > 1)
+    for (size_t part = 0; part < input.parts(); ++part)
+      for (size_t r = 0; r < passes; ++r)
+        homes.push_back(static_cast<unsigned>(r));
+  std::atomic<size_t> dropped{0};
+  pool_.for_each_chunk(input.parts() * passes, homes, [&](size_t task) {
+    const size_t part = task / passes, region = task % passes;
+    size_t missed = 0;
+    input.for_each(part, [&](const Particle &p) {
+      if (p_ctx.domain && p_ctx.domain->owner(p.getPosition()) != self)
+        return;
+      if (passes == 1 || storage.region_of_point(p.getPosition(),
+                                                 d_ctx.bounding_box_) ==
+                             region)
+        missed += !tree->insert(p);
+    });
+    if (missed)
+      dropped.fetch_add(missed, std::memory_order_relaxed);
+  });
+  d_ctx.input.reset();
+  return dropped.load(std::memory_order_relaxed);
+}
 
+void PhysicsEngine::Init() {
   std::thread PEthread(&PhysicsEngine::MainCycle, this);
   PEthread.detach();
 }
 
-void PhysicsEngine::init_threads() {
-  for (size_t i = 0; i < std::thread::hardware_concurrency() - 1; ++i)
-    threads.push_back(std::thread());
-};
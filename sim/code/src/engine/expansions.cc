@@ -0,0 +1,123 @@
+#include "engine/expansions.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include <cstddef>
+#include <vector>
+
+bool Expansions::carve(ExpansionArena &arena, size_t nodes) {
+  double **const arrays[kArrays] = {&mass, &com_x, &com_y, &com_z, &qxx,
+                                    &qxy,  &qxz,   &qyy,   &qyz,   &qzz};
+  for (double **array : arrays) {
+    *array = arena.allocate<double>(nodes);
+    if (*array == nullptr) {
+      count = 0;
+      return false;
+    }
+  }
+  count = nodes;
+  return true;
+}
+
+namespace {
+void p2m(const AROctreeNode &leaf, const Storage &storage, Expansions &ex) {
+  const size_t k = leaf.node_index;
+
+  double m = 0.0, sx = 0.0, sy = 0.0, sz = 0.0;
+  for (const ParticleBlock *block = leaf.localBlock; block;
+       block = storage.next_block(block)) {
+    for (size_t i = 0; i < block->data_block.size; ++i) {
+      const double mi = block->get_mass()[i];
+      m += mi;
+      sx += mi * block->get_x()[i];
+      sy += mi * block->get_y()[i];
+      sz += mi * block->get_z()[i];
+    }
+  }
+  const double cx = m > 0.0 ? sx / m : leaf.center.x;
+  const double cy = m > 0.0 ? sy / m : leaf.center.y;
+  const double cz = m > 0.0 ? sz / m : leaf.center.z;
+
+  double xx = 0.0, xy = 0.0, xz = 0.0, yy = 0.0, yz = 0.0, zz = 0.0;
+  for (const ParticleBlock *block = leaf.localBlock; block;
+       block = storage.next_block(block)) {
+    for (size_t i = 0; i < block->data_block.size; ++i) {
+      const double mi = block->get_mass()[i];
+      const double dx = block->get_x()[i] - cx;
+      const double dy = block->get_y()[i] - cy;
+      const double dz = block->get_z()[i] - cz;
+      xx += mi * dx * dx;
+      xy += mi * dx * dy;
+      xz += mi * dx * dz;
+      yy += mi * dy * dy;
+      yz += mi * dy * dz;
+      zz += mi * dz * dz;
+    }
+  }
+  ex.mass[k] = m;
+  ex.com_x[k] = cx;
+  ex.com_y[k] = cy;
+  ex.com_z[k] = cz;
+  ex.qxx[k] = xx;
+  ex.qxy[k] = xy;
+  ex.qxz[k] = xz;
+  ex.qyy[k] = yy;
+  ex.qyz[k] = yz;
+  ex.qzz[k] = zz;
+}
+
+// Parallel axis theorem: child moments shifted to the parent's centre of mass
+void m2m(const AROctreeNode &node, Expansions &ex) {
+  const size_t k = node.node_index;
+  double m = 0.0, sx = 0.0, sy = 0.0, sz = 0.0;
+  for (const auto &child : node.children) {
+    const size_t c = child.load(std::memory_order_relaxed)->node_index;
+    m += ex.mass[c];
+    sx += ex.mass[c] * ex.com_x[c];
+    sy += ex.mass[c] * ex.com_y[c];
+    sz += ex.mass[c] * ex.com_z[c];
+  }
+  const double cx = m > 0.0 ? sx / m : node.center.x;
+  const double cy = m > 0.0 ? sy / m : node.center.y;
+  const double cz = m > 0.0 ? sz / m : node.center.z;
+
+  double xx = 0.0, xy = 0.0, xz = 0.0, yy = 0.0, yz = 0.0, zz = 0.0;
+  for (const auto &child : node.children) {
+    const size_t c = child.load(std::memory_order_relaxed)->node_index;
+    const double mc = ex.mass[c];
+    const double dx = ex.com_x[c] - cx;
+    const double dy = ex.com_y[c] - cy;
+    const double dz = ex.com_z[c] - cz;
+    xx += ex.qxx[c] + mc * dx * dx;
+    xy += ex.qxy[c] + mc * dx * dy;
+    xz += ex.qxz[c] + mc * dx * dz;
+    yy += ex.qyy[c] + mc * dy * dy;
+    yz += ex.qyz[c] + mc * dy * dz;
+    zz += ex.qzz[c] + mc * dz * dz;
+  }
+  ex.mass[k] = m;
+  ex.com_x[k] = cx;
+  ex.com_y[k] = cy;
+  ex.com_z[k] = cz;
+  ex.qxx[k] = xx;
+  ex.qxy[k] = xy;
+  ex.qxz[k] = xz;
+  ex.qyy[k] = yy;
+  ex.qyz[k] = yz;
+  ex.qzz[k] = zz;
+}
+} // namespace
+
+void upward_node(const AROctreeNode &node, const Storage &storage,
+                 Expansions &ex) {
+  if (node.children[0].load(std::memory_order_relaxed) == nullptr)
+    p2m(node, storage, ex);
+  else
+    m2m(node, ex);
+}
+
+void upward_pass(const std::vector<AROctreeNode *> &nodes,
+                 const Storage &storage, Expansions &ex) {
+  // Level order reversed: every child is done before its parent
+  for (size_t k = nodes.size(); k-- > 0;)
+    upward_node(*nodes[k], storage, ex);
+}
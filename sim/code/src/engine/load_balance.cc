@@ -0,0 +1,84 @@
+#include "engine/load_balance.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+void LeafCostModel::reset(size_t leaves) {
+  costs_.assign(leaves, LeafCost{});
+  far_.assign(leaves, LeafCost{});
+  chunk_ns_.clear();
+  measured_ = false;
+}
+
+// A leaf nobody measured still costs something, or a run of empty leaves
+// would collapse into one chunk with no work estimate at all
+uint64_t LeafCostModel::weight(size_t leaf) const {
+  const LeafCost &cost = costs_[leaf];
+  return 1 + (measured_ ? cost.ns : cost.p2p_pairs + cost.far_multipoles);
+}
+
+const std::vector<size_t> &LeafCostModel::partition(size_t parts) {
+  const size_t bounds[] = {0, costs_.size()};
+  return partition(bounds, std::span<const size_t>(&parts, 1));
+}
+
+const std::vector<size_t> &
+LeafCostModel::partition(std::span<const size_t> bounds,
+                         std::span<const size_t> parts) {
+  cuts_.assign(1, 0);
+  for (size_t s = 0; s + 1 < bounds.size(); ++s)
+    if (bounds[s + 1] > bounds[s])
+      cut(bounds[s], bounds[s + 1], s < parts.size() ? parts[s] : 1);
+  if (cuts_.back() != costs_.size())
+    cuts_.push_back(costs_.size());
+  return cuts_;
+}
+
+void LeafCostModel::cut(size_t begin, size_t end, size_t parts) {
+  parts = std::max<size_t>(1, std::min(parts, end - begin));
+  uint64_t total = 0;
+  for (size_t leaf = begin; leaf < end; ++leaf)
+    total += weight(leaf);
+
+  // Cut where the running sum crosses k/parts of the total
+  uint64_t running = 0;
+  size_t k = 1;
+  for (size_t leaf = begin; leaf < end && k < parts; ++leaf) {
+    running += weight(leaf);
+    const uint64_t target = total / parts * k + total % parts * k / parts;
+    if (running >= target) {
+      cuts_.push_back(leaf + 1);
+      ++k;
+    }
+  }
+  if (cuts_.back() != end)
+    cuts_.push_back(end);
+}
+
+void LeafCostModel::close_tick() {
+  for (size_t leaf = 0; leaf < costs_.size(); ++leaf) {
+    costs_[leaf].far_multipoles = far_[leaf].far_multipoles;
+    costs_[leaf].ns += far_[leaf].ns;
+    far_[leaf] = LeafCost{};
+  }
+  chunk_ns_.assign(cuts_.empty() ? 0 : cuts_.size() - 1, 0);
+  for (size_t c = 0; c + 1 < cuts_.size(); ++c)
+    for (size_t leaf = cuts_[c]; leaf < cuts_[c + 1]; ++leaf)
+      chunk_ns_[c] += costs_[leaf].ns;
+  measured_ = !costs_.empty();
+}
+
+double LeafCostModel::imbalance() const {
+  if (chunk_ns_.empty())
+    return 1.0;
+  uint64_t total = 0, slowest = 0;
+  for (uint64_t ns : chunk_ns_) {
+    total += ns;
+    slowest = std::max(slowest, ns);
+  }
+  if (total == 0)
+    return 1.0;
+  return double(slowest) * double(chunk_ns_.size()) / double(total);
+}
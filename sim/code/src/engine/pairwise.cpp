@@ -1,15 +1,11 @@
 #include "engine/pairwise.h"
 #include "ds/storage/particleBlock.h"
+#include "engine/constants.h"
 #include <chrono>
 #include <cmath>
 #include <cstddef>
-#include <mutex>
-
-#define SOFTENER 1e-20
-#define G 6.67430 * 10e-11
 
 void calcBlocskAx(ParticleBlock &block) {
-  std::lock_guard<std::mutex> lock(block.get_mutex());
   for (size_t i = 0; i < block.data_block.size; ++i) {
     for (size_t j = i + 1; j < block.data_block.size; ++j) {
       if (i == j)
@@ -18,12 +14,12 @@ void calcBlocskAx(ParticleBlock &block) {
       double dx = block.get_x()[j] - block.get_x()[i];
       double dy = block.get_y()[j] - block.get_y()[i];
       double dz = block.get_z()[j] - block.get_z()[i];
-      double r2 = dx * dx + dy * dy + dz * dz + SOFTENER;
+      double r2 = dx * dx + dy * dy + dz * dz + kSoftener;
       double r = std::sqrt(r2);
       double inv_r = 1.0 / r;
 
       double forceMagnitude =
-          G * block.get_mass()[i] * block.get_mass()[j] / r2;
+          kG * block.get_mass()[i] * block.get_mass()[j] / r2;
       double fx = forceMagnitude * dx * inv_r;
       double fy = forceMagnitude * dy * inv_r;
       double fz = forceMagnitude * dz * inv_r;
@@ -40,8 +36,96 @@ void calcBlocskAx(ParticleBlock &block) {
   }
 };
 
+void calc_pair_ax(ParticleBlock &target, const ParticleBlock &source) {
+  const double *const xs = source.get_x().data();
+  const double *const ys = source.get_y().data();
+  const double *const zs = source.get_z().data();
+  const double *const ms = source.get_mass().data();
+  const size_t n_source = source.data_block.size;
+
+  for (size_t i = 0; i < target.data_block.size; ++i) {
+    const double x0 = target.get_x()[i];
+    const double y0 = target.get_y()[i];
+    const double z0 = target.get_z()[i];
+    double ax = 0.0, ay = 0.0, az = 0.0;
+
+    for (size_t j = 0; j < n_source; ++j) {
+      const double dx = xs[j] - x0;
+      const double dy = ys[j] - y0;
+      const double dz = zs[j] - z0;
+      const double r2 = dx * dx + dy * dy + dz * dz + kSoftener;
+      const double inv_r = 1.0 / std::sqrt(r2);
+      const double common = kG * ms[j] * inv_r * inv_r * inv_r;
+      ax += common * dx;
+      ay += common * dy;
+      az += common * dz;
+    }
+
+    target.get_ax()[i] += ax;
+    target.get_ay()[i] += ay;
+    target.get_az()[i] += az;
+  }
+}
+
+uint64_t calc_leaf_ax(const LeafNeighbourLists &lists, Storage &storage,
+                      size_t leaf) {
+  uint64_t pairs = 0;
+  ParticleBlock *const head = storage.block_at(lists.leaf_block(leaf));
+  // Max-depth leaves may own an overflow chain, every block of it is a
+  // target and every block of a neighbour's chain a source
+  for (ParticleBlock *target = head; target;
+       target = storage.next_block(target)) {
+    const uint64_t n = target->size();
+    calcBlocskAx(*target);
+    pairs += n * (n - (n > 0)) / 2;
+    for (const ParticleBlock *own = head; own; own = storage.next_block(own))
+      if (own != target) {
+        calc_pair_ax(*target, *own);
+        pairs += n * own->size();
+      }
+
+    const auto blocks = lists.neighbour_blocks(leaf);
+    for (size_t k = 0; k < blocks.size(); ++k) {
+      // Neighbour indices are known up front, fetch the next block's
+      // positions while this pair is computed
+      if (k + 1 < blocks.size()) {
+        const ParticleBlock *next = storage.block_at(blocks[k + 1]);
+        __builtin_prefetch(next->get_x().data());
+        __builtin_prefetch(next->get_y().data());
+        __builtin_prefetch(next->get_z().data());
+        __builtin_prefetch(next->get_mass().data());
+      }
+      for (const ParticleBlock *source = storage.block_at(blocks[k]); source;
+           source = storage.next_block(source)) {
+        calc_pair_ax(*target, *source);
+        pairs += n * source->size();
+      }
+    }
+  }
+  return pairs;
+}
+
+uint64_t leaf_pairs(const LeafNeighbourLists &lists, const Storage &storage,
+                    size_t leaf) {
+  auto chain_bodies = [&storage](const ParticleBlock *block) {
+    uint64_t bodies = 0;
+    for (; block; block = storage.next_block(block))
+      bodies += block->size();
+    return bodies;
+  };
+  const ParticleBlock *head = storage.block_at(lists.leaf_block(leaf));
+  const uint64_t own = chain_bodies(head);
+  uint64_t pairs = 0;
+  for (const ParticleBlock *b = head; b; b = storage.next_block(b)) {
+    const uint64_t n = b->size();
+    pairs += n * (n - (n > 0)) / 2 + n * (own - n);
+  }
+  for (uint32_t block : lists.neighbour_blocks(leaf))
+    pairs += own * chain_bodies(storage.block_at(block));
+  return pairs;
+}
+
 void updateCoords(ParticleBlock &block, std::chrono::microseconds dt) {
-  std::lock_guard<std::mutex> lock(block.get_mutex());
   double dt_sec = (double)dt.count() * 1e-6;
 
   for (size_t i = 0; i < block.data_block.size; ++i) {
@@ -0,0 +1,90 @@
+#include "engine/phases.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+// Small per-thread id, 0 is reserved for "unclaimed"
+uint32_t thread_token() {
+  static std::atomic<uint32_t> next{1};
+  thread_local const uint32_t token = next.fetch_add(1);
+  return token;
+}
+
+bool legal_transition(Phase from, Phase to) {
+  switch (to) {
+  case Phase::kIdle:
+    return true;
+  case Phase::kBuild:
+    return from == Phase::kIdle;
+  case Phase::kForce:
+    return from == Phase::kBuild || from == Phase::kMigrate ||
+           from == Phase::kIdle;
+  case Phase::kIntegrate:
+    return from == Phase::kForce;
+  case Phase::kMigrate:
+    return from == Phase::kIntegrate;
+  }
+  return false;
+}
+} // namespace
+
+const char *phase_name(Phase phase) {
+  switch (phase) {
+  case Phase::kIdle:
+    return "idle";
+  case Phase::kBuild:
+    return "build";
+  case Phase::kForce:
+    return "force";
+  case Phase::kIntegrate:
+    return "integrate";
+  case Phase::kMigrate:
+    return "migrate";
+  }
+  return "unknown";
+}
+
+PhaseTracker::PhaseTracker(size_t blocks, bool check)
+    : blocks_(blocks), check_(check) {
+  if (check_)
+    owners_ = std::make_unique<std::atomic<uint32_t>[]>(blocks);
+}
+
+void PhaseTracker::track_blocks(size_t blocks) {
+  if (blocks <= blocks_)
+    return;
+  if (check_)
+    owners_ = std::make_unique<std::atomic<uint32_t>[]>(blocks);
+  blocks_ = blocks;
+}
+
+void PhaseTracker::enter(Phase next) {
+  if (!legal_transition(phase_, next)) {
+    std::cerr << "PhaseTracker: illegal transition " << phase_name(phase_)
+              << " -> " << phase_name(next) << "\n";
+    std::abort();
+  }
+  if (check_) {
+    for (size_t i = 0; i < blocks_; ++i)
+      owners_[i].store(0, std::memory_order_relaxed);
+  }
+  phase_ = next;
+}
+
+void PhaseTracker::record_claim(size_t block) {
+  if (block >= blocks_) {
+    std::cerr << "PhaseTracker: block " << block << " out of range\n";
+    std::abort();
+  }
+  const uint32_t self = thread_token();
+  uint32_t owner = 0;
+  if (owners_[block].compare_exchange_strong(owner, self,
+                                             std::memory_order_relaxed) ||
+      owner == self)
+    return;
+  std::cerr << "PhaseTracker: block " << block << " claimed by thread "
+            << owner << " and " << self << " in phase " << phase_name(phase_)
+            << "\n";
+  std::abort();
+}
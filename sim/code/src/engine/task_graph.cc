@@ -0,0 +1,74 @@
+#include "engine/task_graph.h"
+#include "ds/tree/octree.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace {
+// P2M on the leaf, then M2M up the tree for as long as this thread is the
+// one that completed a node's last child. acq_rel on the counter: the
+// climber sees every sibling's expansion. True if it finished the root
+bool climb(const AROctreeNode *leaf, const Storage &storage, Expansions &ex) {
+  upward_node(*leaf, storage, ex);
+  for (AROctreeNode *node = leaf->parent; node; node = node->parent) {
+    if (node->pending_children.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return false;
+    upward_node(*node, storage, ex);
+  }
+  return true;
+}
+} // namespace
+
+void ForceTaskGraph::run(ThreadPool &pool,
+                         const std::vector<AROctreeNode *> &nodes,
+                         const Storage &storage, Expansions &ex,
+                         const std::vector<size_t> &near_cuts,
+                         const std::vector<unsigned> &near_homes,
+                         const NearField &near_field,
+                         const FarField &far_field) {
+  leaves_.clear();
+  for (AROctreeNode *node : nodes) {
+    const bool leaf =
+        node->children[0].load(std::memory_order_relaxed) == nullptr;
+    node->pending_children.store(leaf ? 0 : 8, std::memory_order_relaxed);
+    if (leaf)
+      leaves_.push_back(node);
+  }
+
+  const auto home = [&near_homes](size_t c) {
+    return c < near_homes.size() ? near_homes[c] : ThreadPool::kAnyHome;
+  };
+  TaskGroup group;
+  // Submitted from inside the task that finished the root: the group's
+  // count goes up before that task's own comes down, so wait() can't
+  // return in between. The climb's acq_rel chain and the pool's queues
+  // hand every multipole to the far-field tasks
+  const auto release_far_field = [&] {
+    if (!far_field)
+      return;
+    for (size_t c = 0; c + 1 < near_cuts.size(); ++c) {
+      const size_t begin = near_cuts[c], end = near_cuts[c + 1];
+      pool.submit(group, [&far_field, begin, end] { far_field(begin, end); },
+                  home(c));
+    }
+  };
+
+  // The pool publishes the counters to whoever picks up the tasks
+  const size_t runners = size_t{pool.concurrency()} * 8;
+  const size_t leaf_grain = std::max<size_t>(1, leaves_.size() / runners);
+  for (size_t begin = 0; begin < leaves_.size(); begin += leaf_grain) {
+    const size_t end = std::min(begin + leaf_grain, leaves_.size());
+    pool.submit(group, [this, &storage, &ex, &release_far_field, begin, end] {
+      for (size_t k = begin; k < end; ++k)
+        if (climb(leaves_[k], storage, ex))
+          release_far_field();
+    });
+  }
+  for (size_t c = 0; c + 1 < near_cuts.size(); ++c) {
+    const size_t begin = near_cuts[c], end = near_cuts[c + 1];
+    pool.submit(group, [&near_field, begin, end] { near_field(begin, end); },
+                home(c));
+  }
+  pool.wait(group);
+}
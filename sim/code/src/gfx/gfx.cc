@@ -5,8 +5,9 @@
 #include <iostream>
 
 namespace gfx {
-GfxEngine::GfxEngine(GfxCtx &g_ctx, SimulationState &s_state, AROctree &tree)
-    : g_ctx_(g_ctx), s_state_(s_state), tree_(tree) {};
+GfxEngine::GfxEngine(GfxCtx &g_ctx, SimulationState &s_state,
+                     RenderSnapshot &snapshot)
+    : g_ctx_(g_ctx), s_state_(s_state), snapshot_(snapshot) {};
 
 error::Result<bool> GfxEngine::init() {
   if (auto e = window_.init(); e.is_error()) {
@@ -40,7 +41,7 @@ void GfxEngine::run() {
       break;
     }
 
-    update_scene_from_tree();
+    update_scene_from_snapshot();
 
     auto current_time = std::chrono::high_resolution_clock::now();
     float delta_time =
@@ -60,9 +61,12 @@ void GfxEngine::run() {
             << std::endl;
 };
 
-void GfxEngine::update_scene_from_tree() {
-  auto particles = tree_.get_particles_for_render();
-  render_->get_particle_renderer()->get_scene().set_particles(particles);
+// Same frame as last time unless physics finished a tick in between
+void GfxEngine::update_scene_from_snapshot() {
+  if (!snapshot_.acquire())
+    return;
+  render_->get_particle_renderer()->get_scene().set_particles(
+      snapshot_.read_buffer());
 }
 
 // TODO: figure out if we need separate clean_up or raii|destructors can handle
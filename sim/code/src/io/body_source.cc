@@ -0,0 +1,51 @@
+#include "io/body_source.h"
+#include "io/gadget.h"
+#include "io/particle_file.h"
+#include "io/snapshot_writer.h"
+#include "io/text_table.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace io {
+MyMath::BoundingBox enclosing_cube(const MyMath::Vector3 &lo,
+                                   const MyMath::Vector3 &hi) {
+  // A cube keeps the octree's cells cubes
+  const double extent = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+  const double half = extent > 0.0 ? extent * (0.5 + 1e-6) : 0.5;
+  const MyMath::Vector3 center{(lo.x + hi.x) / 2, (lo.y + hi.y) / 2,
+                               (lo.z + hi.z) / 2};
+  return {{center.x - half, center.y - half, center.z - half},
+          {center.x + half, center.y + half, center.z + half}};
+}
+
+error::CResult<std::shared_ptr<const BodySource>>
+open_body_source(const std::string &path, const TextFormat &text,
+                 const GadgetUnits &gadget, ThreadPool &pool) {
+  using Result = error::CResult<std::shared_ptr<const BodySource>>;
+  char magic[sizeof(FileHeader::kMagic)] = {};
+  std::ifstream(path, std::ios::binary).read(magic, sizeof(magic));
+  if (std::memcmp(magic, FileHeader::kMagic, sizeof(magic)) == 0) {
+    auto file = ParticleFile::open(path);
+    if (file.is_error())
+      return Result::error(file.code(), file.error_message());
+    return Result::success(std::move(file.value()));
+  }
+  if (std::memcmp(magic, SnapshotSet::kMagic, sizeof(magic)) == 0) {
+    auto set = SnapshotSet::open(path);
+    if (set.is_error())
+      return Result::error(set.code(), set.error_message());
+    return Result::success(std::move(set.value()));
+  }
+  if (GadgetSnapshot::looks_like(path)) {
+    auto snapshot = GadgetSnapshot::open(path, gadget, pool);
+    if (snapshot.is_error())
+      return Result::error(snapshot.code(), snapshot.error_message());
+    return Result::success(std::move(snapshot.value()));
+  }
+  auto table = TextTable::open(path, text, pool);
+  if (table.is_error())
+    return Result::error(table.code(), table.error_message());
+  return Result::success(std::move(table.value()));
+}
+} // namespace io
@@ -0,0 +1,466 @@
+#include "io/gadget.h"
+#include "ds/storage/storage.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io {
+namespace {
+using SnapshotResult = error::CResult<std::shared_ptr<const GadgetSnapshot>>;
+using WriterResult = error::CResult<std::unique_ptr<GadgetWriter>>;
+
+constexpr size_t kTypes = GadgetHeader::kTypes;
+constexpr size_t kMarker = sizeof(int32_t);
+
+// Records sit at any byte offset, so values are copied out
+template <typename T> T load(const std::byte *at) {
+  T value;
+  std::memcpy(&value, at, sizeof(T));
+  return value;
+}
+
+double load_real(const std::byte *values, size_t i, size_t real_bytes) {
+  return real_bytes == sizeof(double)
+             ? load<double>(values + i * sizeof(double))
+             : static_cast<double>(load<float>(values + i * sizeof(float)));
+}
+
+struct FortranRecord {
+  const std::byte *payload = nullptr;
+  size_t bytes = 0;
+};
+
+bool is_name(const FortranRecord &tag, const char (&name)[5]) {
+  return std::memcmp(tag.payload, name, 4) == 0;
+}
+
+// The first file of a set: "snap" itself, or "snap.0" when split
+std::string first_file(const std::string &path) {
+  std::error_code ec;
+  return std::filesystem::exists(path, ec) ? path : path + ".0";
+}
+} // namespace
+
+bool GadgetSnapshot::looks_like(const std::string &path) {
+  const int fd = ::open(first_file(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  std::byte start[2 * kMarker] = {};
+  const ssize_t got = pread(fd, start, sizeof(start), 0);
+  close(fd);
+  if (got != static_cast<ssize_t>(sizeof(start)))
+    return false;
+  const int32_t first = load<int32_t>(start);
+  return first == sizeof(GadgetHeader) ||
+         (first == 8 && std::memcmp(start + kMarker, "HEAD", 4) == 0);
+}
+
+GadgetSnapshot::~GadgetSnapshot() {
+  for (const File &file : files_)
+    munmap(const_cast<std::byte *>(file.base), file.bytes);
+}
+
+const char *GadgetSnapshot::add_file(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    debug::debug_print("GadgetSnapshot: {}: {}", path, std::strerror(errno));
+    return "cannot open GADGET file";
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return "GADGET file cut short";
+  }
+  const size_t bytes = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return "cannot map GADGET file";
+  // Positions, velocities and ids are three sequential streams
+  madvise(base, bytes, MADV_WILLNEED);
+  files_.push_back({.base = static_cast<const std::byte *>(base),
+                    .bytes = bytes});
+  File &file = files_.back();
+
+  size_t at = 0;
+  const auto next = [&](FortranRecord &record) {
+    if (bytes - at < 2 * kMarker)
+      return false;
+    const int32_t n = load<int32_t>(file.base + at);
+    if (n < 0 || static_cast<size_t>(n) > bytes - at - 2 * kMarker ||
+        load<int32_t>(file.base + at + kMarker + static_cast<size_t>(n)) != n)
+      return false;
+    record = {file.base + at + kMarker, static_cast<size_t>(n)};
+    at += 2 * kMarker + static_cast<size_t>(n);
+    return true;
+  };
+  FortranRecord head, pos, vel, ids, masses;
+  const bool format2 = load<int32_t>(file.base) == 8;
+  if (format2) {
+    FortranRecord tag, block;
+    while (at < bytes) {
+      if (!next(tag) || tag.bytes != 8 || !next(block))
+        return "bad GADGET record";
+      if (is_name(tag, "HEAD"))
+        head = block;
+      else if (is_name(tag, "POS "))
+        pos = block;
+      else if (is_name(tag, "VEL "))
+        vel = block;
+      else if (is_name(tag, "ID  "))
+        ids = block;
+      else if (is_name(tag, "MASS"))
+        masses = block;
+    }
+  } else if (!next(head) || !next(pos) || !next(vel) || !next(ids)) {
+    return "GADGET file cut short";
+  }
+  if (head.bytes != sizeof(GadgetHeader))
+    return "bad GADGET header";
+  std::memcpy(&file.header, head.payload, sizeof(GadgetHeader));
+  const GadgetHeader &h = file.header;
+
+  size_t count = 0, mass_count = 0;
+  for (size_t t = 0; t < kTypes; ++t) {
+    if (h.npart[t] < 0)
+      return "bad GADGET header";
+    const auto n = static_cast<size_t>(h.npart[t]);
+    file.type_first[t] = count;
+    file.mass_first[t] = mass_count;
+    count += n;
+    if (h.mass[t] == 0.0)
+      mass_count += n;
+  }
+  file.type_first[kTypes] = count;
+  if (count == 0)
+    return nullptr;
+
+  if (pos.bytes == 3 * count * sizeof(double))
+    file.real_bytes = sizeof(double);
+  else if (pos.bytes != 3 * count * sizeof(float))
+    return "GADGET POS does not match N";
+  if (vel.bytes != pos.bytes)
+    return "GADGET VEL does not match N";
+  if (ids.bytes == count * sizeof(uint64_t))
+    file.id_bytes = sizeof(uint64_t);
+  else if (ids.bytes != count * sizeof(uint32_t))
+    return "GADGET ID does not match N";
+  // Format 1 has no MASS at all when every type has a header mass
+  if (mass_count > 0 && !format2 && !next(masses))
+    return "GADGET MASS missing";
+  if (masses.bytes != mass_count * file.real_bytes)
+    return "GADGET MASS does not match N";
+  file.pos = pos.payload;
+  file.vel = vel.payload;
+  file.ids = ids.payload;
+  file.masses = masses.payload;
+  return nullptr;
+}
+
+SnapshotResult GadgetSnapshot::open(const std::string &path,
+                                    const GadgetUnits &units,
+                                    ThreadPool &pool) {
+  if (!(units.length > 0.0 && units.mass > 0.0 && units.velocity > 0.0))
+    return SnapshotResult::error(1, "bad GADGET units");
+  // Unmaps on every way out
+  std::shared_ptr<GadgetSnapshot> snapshot(new GadgetSnapshot());
+  snapshot->units_ = units;
+  const std::string first = first_file(path);
+  const auto fail = [&](const std::string &file, const char *problem) {
+    debug::debug_print("GadgetSnapshot: {}: {}", file, problem);
+    return SnapshotResult::error(2, problem);
+  };
+  if (const char *problem = snapshot->add_file(first))
+    return fail(first, problem);
+
+  const int files = std::max(snapshot->header().num_files, 1);
+  if (files > 1) {
+    const std::string suffix = ".0";
+    if (!first.ends_with(suffix))
+      return fail(first, "split GADGET set needs .0");
+    const std::string stem = first.substr(0, first.size() - suffix.size());
+    for (int i = 1; i < files; ++i) {
+      const std::string name = stem + "." + std::to_string(i);
+      if (const char *problem = snapshot->add_file(name))
+        return fail(name, problem);
+    }
+  }
+
+  uint64_t expected = 0;
+  for (size_t t = 0; t < kTypes; ++t)
+    expected += uint64_t{snapshot->header().npart_total_high_word[t]} << 32 |
+                snapshot->header().npart_total[t];
+  for (size_t f = 0; f < snapshot->files_.size(); ++f) {
+    const size_t n = snapshot->files_[f].type_first[kTypes];
+    for (size_t begin = 0; begin < n; begin += kPartBodies)
+      snapshot->parts_.push_back({f, begin, std::min(n, begin + kPartBodies)});
+    snapshot->count_ += n;
+  }
+  // Some IC writers leave the totals 0
+  if (expected != 0 && expected != snapshot->count_)
+    return fail(first, "GADGET files disagree on N");
+  if (snapshot->count_ == 0)
+    return fail(first, "no bodies in GADGET set");
+
+  const double box = snapshot->header().box_size * units.length;
+  if (box > 0.0) {
+    snapshot->bounds_ = {{0.0, 0.0, 0.0}, {box, box, box}};
+  } else {
+    // Not a periodic box: bounds from the positions, a part per task
+    struct Extent {
+      MyMath::Vector3 lo{HUGE_VAL, HUGE_VAL, HUGE_VAL};
+      MyMath::Vector3 hi{-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    };
+    std::vector<Extent> extents(snapshot->parts_.size());
+    pool.parallel_for(extents.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; ++p)
+        snapshot->for_each(p, [&](const Particle &body) {
+          const MyMath::Vector3 r = body.getPosition();
+          Extent &e = extents[p];
+          e.lo = {std::min(e.lo.x, r.x), std::min(e.lo.y, r.y),
+                  std::min(e.lo.z, r.z)};
+          e.hi = {std::max(e.hi.x, r.x), std::max(e.hi.y, r.y),
+                  std::max(e.hi.z, r.z)};
+        });
+    });
+    Extent all;
+    for (const Extent &e : extents) {
+      all.lo = {std::min(all.lo.x, e.lo.x), std::min(all.lo.y, e.lo.y),
+                std::min(all.lo.z, e.lo.z)};
+      all.hi = {std::max(all.hi.x, e.hi.x), std::max(all.hi.y, e.hi.y),
+                std::max(all.hi.z, e.hi.z)};
+    }
+    snapshot->bounds_ = enclosing_cube(all.lo, all.hi);
+  }
+  return SnapshotResult::success(
+      std::shared_ptr<const GadgetSnapshot>(std::move(snapshot)));
+}
+
+Particle GadgetSnapshot::body(const File &file, size_t type, size_t i) const {
+  const size_t real = file.real_bytes;
+  const double l = units_.length, v = units_.velocity;
+  const double mass =
+      file.header.mass[type] != 0.0
+          ? file.header.mass[type]
+          : load_real(file.masses,
+                      file.mass_first[type] + i - file.type_first[type], real);
+  const uint64_t id = file.id_bytes == sizeof(uint64_t)
+                          ? load<uint64_t>(file.ids + i * sizeof(uint64_t))
+                          : load<uint32_t>(file.ids + i * sizeof(uint32_t));
+  return Particle{load_real(file.pos, 3 * i, real) * l,
+                  load_real(file.pos, 3 * i + 1, real) * l,
+                  load_real(file.pos, 3 * i + 2, real) * l,
+                  load_real(file.vel, 3 * i, real) * v,
+                  load_real(file.vel, 3 * i + 1, real) * v,
+                  load_real(file.vel, 3 * i + 2, real) * v,
+                  mass * units_.mass,
+                  id};
+}
+
+void GadgetSnapshot::for_each(size_t part, const Visitor &visit) const {
+  const Part &p = parts_[part];
+  const File &file = files_[p.file];
+  size_t type = 0;
+  for (size_t i = p.begin; i < p.end; ++i) {
+    while (i >= file.type_first[type + 1])
+      ++type;
+    visit(body(file, type, i));
+  }
+}
+
+WriterResult GadgetWriter::create(const std::string &path,
+                                  const GadgetLayout &layout) {
+  const GadgetUnits &u = layout.units;
+  if (!(u.length > 0.0 && u.mass > 0.0 && u.velocity > 0.0))
+    return WriterResult::error(1, "bad GADGET units");
+  if (layout.type < 0 || layout.type >= static_cast<int>(kTypes))
+    return WriterResult::error(2, "bad GADGET type");
+  if (layout.num_files < 1)
+    return WriterResult::error(2, "bad GADGET file count");
+  const size_t real = layout.double_precision ? sizeof(double) : sizeof(float);
+  // Record lengths are int32; bigger sets are written as several files
+  if (layout.count > INT32_MAX / (3 * real))
+    return WriterResult::error(3, "too many bodies for one file");
+
+  const int fd =
+      ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    debug::debug_print("GadgetWriter: {}: {}", path, std::strerror(errno));
+    return WriterResult::error(4, "cannot create GADGET file");
+  }
+  std::unique_ptr<GadgetWriter> writer(new GadgetWriter(fd, layout));
+  // Sized up front so the chunks can be written record by record
+  if (ftruncate(fd, static_cast<off_t>(writer->offset_[kMass] +
+                                       layout.count * real + kMarker)) != 0)
+    return WriterResult::error(5, "cannot size GADGET file");
+  return WriterResult::success(std::move(writer));
+}
+
+GadgetWriter::GadgetWriter(int fd, const GadgetLayout &layout)
+    : fd_(fd), layout_(layout),
+      real_bytes_(layout.double_precision ? sizeof(double) : sizeof(float)),
+      id_bytes_(layout.long_ids ? sizeof(uint64_t) : sizeof(uint32_t)) {
+  const size_t per_body[kRecords] = {3 * real_bytes_, 3 * real_bytes_,
+                                     id_bytes_, real_bytes_};
+  // Format 2 tags are a record of their own: 4 + 8 + 4 bytes
+  const uint64_t tag = layout.format2 ? 2 * kMarker + 8 : 0;
+  uint64_t at = tag;
+  header_offset_ = at + kMarker;
+  at += 2 * kMarker + sizeof(GadgetHeader);
+  for (size_t r = 0; r < kRecords; ++r) {
+    at += tag;
+    offset_[r] = at + kMarker;
+    at += 2 * kMarker + layout.count * per_body[r];
+    chunk_[r].resize(kChunkBodies * per_body[r]);
+  }
+}
+
+GadgetWriter::~GadgetWriter() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool GadgetWriter::write_at(uint64_t offset, const void *data, size_t bytes) {
+  const auto *at = static_cast<const std::byte *>(data);
+  while (bytes > 0) {
+    const ssize_t n = pwrite(fd_, at, bytes, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    at += n;
+    bytes -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool GadgetWriter::append(const double (&position)[3],
+                          const double (&velocity)[3], double mass,
+                          uint64_t id) {
+  if (fd_ < 0 || written_ + staged_ >= layout_.count)
+    return false;
+  const auto put = [&](Record r, size_t index, double value) {
+    std::byte *at = chunk_[r].data() + index * real_bytes_;
+    if (real_bytes_ == sizeof(double)) {
+      std::memcpy(at, &value, sizeof(value));
+    } else {
+      const auto narrow = static_cast<float>(value);
+      std::memcpy(at, &narrow, sizeof(narrow));
+    }
+  };
+  const GadgetUnits &u = layout_.units;
+  for (size_t axis = 0; axis < 3; ++axis) {
+    put(kPos, 3 * staged_ + axis, position[axis] / u.length);
+    put(kVel, 3 * staged_ + axis, velocity[axis] / u.velocity);
+  }
+  put(kMass, staged_, mass / u.mass);
+  std::byte *id_at = chunk_[kIds].data() + staged_ * id_bytes_;
+  if (id_bytes_ == sizeof(uint64_t)) {
+    std::memcpy(id_at, &id, sizeof(id));
+  } else {
+    const auto narrow = static_cast<uint32_t>(id);
+    std::memcpy(id_at, &narrow, sizeof(narrow));
+  }
+  return ++staged_ < kChunkBodies || flush();
+}
+
+bool GadgetWriter::flush() {
+  const size_t per_body[kRecords] = {3 * real_bytes_, 3 * real_bytes_,
+                                     id_bytes_, real_bytes_};
+  bool ok = true;
+  for (size_t r = 0; r < kRecords; ++r)
+    ok = write_at(offset_[r] + written_ * per_body[r], chunk_[r].data(),
+                  staged_ * per_body[r]) &&
+         ok;
+  written_ += staged_;
+  staged_ = 0;
+  return ok;
+}
+
+bool GadgetWriter::append(const ParticleBlock &block) {
+  for (size_t i = 0; i < block.size(); ++i) {
+    const double position[3] = {block.get_x()[i], block.get_y()[i],
+                                block.get_z()[i]};
+    const double velocity[3] = {block.get_vx()[i], block.get_vy()[i],
+                                block.get_vz()[i]};
+    if (!append(position, velocity, block.get_mass()[i],
+                block.get_visual_id()[i]))
+      return false;
+  }
+  return true;
+}
+
+bool GadgetWriter::finish() {
+  if (fd_ < 0)
+    return false;
+  bool ok = flush() && written_ == layout_.count;
+
+  GadgetHeader h{};
+  const auto type = static_cast<size_t>(layout_.type);
+  h.npart[type] = static_cast<int32_t>(layout_.count);
+  if (layout_.num_files == 1) {
+    h.npart_total[type] = static_cast<uint32_t>(layout_.count);
+    h.npart_total_high_word[type] =
+        static_cast<uint32_t>(layout_.count >> 32);
+  }
+  h.time = layout_.time;
+  h.redshift = layout_.redshift;
+  h.num_files = layout_.num_files;
+  h.box_size = layout_.box_size;
+  h.flag_doubleprecision = layout_.double_precision ? 1 : 0;
+
+  // Markers around every record, and format 2 tags in front of them
+  const auto frame = [&](uint64_t payload, size_t bytes, const char *name) {
+    const auto n = static_cast<int32_t>(bytes);
+    ok = write_at(payload - kMarker, &n, kMarker) && ok;
+    ok = write_at(payload + bytes, &n, kMarker) && ok;
+    if (!layout_.format2)
+      return;
+    const int32_t eight = 8, next = n + 2 * static_cast<int32_t>(kMarker);
+    std::byte tag[2 * kMarker + 8];
+    std::memcpy(tag, &eight, kMarker);
+    std::memcpy(tag + kMarker, name, 4);
+    std::memcpy(tag + 2 * kMarker, &next, kMarker);
+    std::memcpy(tag + 3 * kMarker, &eight, kMarker);
+    ok = write_at(payload - kMarker - sizeof(tag), tag, sizeof(tag)) && ok;
+  };
+  const size_t per_body[kRecords] = {3 * real_bytes_, 3 * real_bytes_,
+                                     id_bytes_, real_bytes_};
+  const char *names[kRecords] = {"POS ", "VEL ", "ID  ", "MASS"};
+  for (size_t r = 0; r < kRecords; ++r)
+    frame(offset_[r], layout_.count * per_body[r], names[r]);
+  frame(header_offset_, sizeof(h), "HEAD");
+  ok = write_at(header_offset_, &h, sizeof(h)) && ok;
+  const bool closed = close(fd_) == 0;
+  fd_ = -1;
+  return ok && closed;
+}
+
+bool write_gadget_snapshot(const std::string &path, const Storage &storage,
+                           GadgetLayout layout) {
+  layout.count = 0;
+  for (size_t i = 0; i < storage.capacity(); ++i)
+    if (storage.block_in_use(i))
+      layout.count += storage.block_at(i)->size();
+  auto created = GadgetWriter::create(path, layout);
+  if (created.is_error()) {
+    debug::debug_print("write_gadget_snapshot: {}", created.error_message());
+    return false;
+  }
+  GadgetWriter &writer = *created.value();
+  bool ok = true;
+  for (size_t i = 0; i < storage.capacity() && ok; ++i)
+    if (storage.block_in_use(i))
+      ok = writer.append(*storage.block_at(i));
+  return writer.finish() && ok;
+}
+} // namespace io
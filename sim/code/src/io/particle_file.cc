@@ -0,0 +1,291 @@
+#include "io/particle_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io {
+namespace {
+using FileResult = error::CResult<std::shared_ptr<const ParticleFile>>;
+using WriterResult = error::CResult<std::unique_ptr<ParticleFileWriter>>;
+
+constexpr uint64_t align_up(uint64_t bytes, uint64_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+bool has(uint32_t columns, Column c) { return (columns & column_bit(c)) != 0; }
+
+// Why a header is not usable, nullptr if it is. `file_bytes` 0 skips the
+// size checks
+const char *header_problem(const FileHeader &h, uint64_t file_bytes) {
+  if (std::memcmp(h.magic, FileHeader::kMagic, sizeof(h.magic)) != 0)
+    return "not a particle file";
+  if (h.version != FileHeader::kVersion)
+    return "unknown particle file version";
+  if (h.header_bytes < sizeof(FileHeader))
+    return "bad particle file header";
+  if ((h.columns & kPositionColumns) != kPositionColumns ||
+      !has(h.columns, Column::kMass) || (h.columns & ~kAllColumns) != 0)
+    return "positions or masses missing";
+  for (size_t axis = 0; axis < 3; ++axis)
+    if (!(h.bounds_min[axis] < h.bounds_max[axis]))
+      return "bad particle file bounds";
+  if (!(h.length_unit > 0.0 && h.mass_unit > 0.0 && h.velocity_unit > 0.0))
+    return "bad particle file units";
+  if (file_bytes == 0)
+    return nullptr;
+  for (size_t c = 0; c < kColumns; ++c) {
+    if (!has(h.columns, static_cast<Column>(c)))
+      continue;
+    const uint64_t offset = h.column_offset[c];
+    if (offset < h.header_bytes || offset % sizeof(double) != 0 ||
+        h.count > (file_bytes - std::min(offset, file_bytes)) / sizeof(double))
+      return "particle file cut short";
+  }
+  return nullptr;
+}
+} // namespace
+
+FileResult ParticleFile::open(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    debug::debug_print("ParticleFile: {}: {}", path, std::strerror(errno));
+    return FileResult::error(1, "cannot open particle file");
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+    close(fd);
+    return FileResult::error(2, "not a particle file");
+  }
+  const size_t bytes = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    debug::debug_print("ParticleFile: mmap {}: {}", path,
+                       std::strerror(errno));
+    return FileResult::error(3, "cannot map particle file");
+  }
+  if (const char *problem =
+          header_problem(*static_cast<const FileHeader *>(base), bytes)) {
+    munmap(base, bytes);
+    return FileResult::error(4, problem);
+  }
+  // Loaders stream every column front to back once: start the page-in now
+  // and drop pages behind the reader
+  madvise(base, bytes, MADV_SEQUENTIAL);
+  madvise(base, bytes, MADV_WILLNEED);
+  return FileResult::success(
+      std::shared_ptr<const ParticleFile>(new ParticleFile(base, bytes)));
+}
+
+std::optional<uint64_t> ParticleFile::peek_count(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return std::nullopt;
+  FileHeader header{};
+  const ssize_t got = pread(fd, &header, sizeof(header), 0);
+  close(fd);
+  if (got != static_cast<ssize_t>(sizeof(header)) ||
+      header_problem(header, 0) != nullptr)
+    return std::nullopt;
+  return header.count;
+}
+
+ParticleFile::ParticleFile(const void *base, size_t bytes)
+    : base_(static_cast<const std::byte *>(base)), bytes_(bytes),
+      header_(static_cast<const FileHeader *>(base)) {}
+
+ParticleFile::~ParticleFile() {
+  munmap(const_cast<std::byte *>(base_), bytes_);
+}
+
+MyMath::BoundingBox ParticleFile::bounds() const {
+  const double l = header_->length_unit;
+  return {{header_->bounds_min[0] * l, header_->bounds_min[1] * l,
+           header_->bounds_min[2] * l},
+          {header_->bounds_max[0] * l, header_->bounds_max[1] * l,
+           header_->bounds_max[2] * l}};
+}
+
+const double *ParticleFile::column(Column c) const {
+  if (!has(header_->columns, c) || c == Column::kId)
+    return nullptr;
+  return reinterpret_cast<const double *>(
+      base_ + header_->column_offset[static_cast<size_t>(c)]);
+}
+
+const uint64_t *ParticleFile::ids() const {
+  if (!has(header_->columns, Column::kId))
+    return nullptr;
+  return reinterpret_cast<const uint64_t *>(
+      base_ + header_->column_offset[static_cast<size_t>(Column::kId)]);
+}
+
+Particle ParticleFile::body(size_t i) const {
+  const double l = header_->length_unit;
+  const double v = header_->velocity_unit;
+  const auto value = [&](Column c) {
+    const double *values = column(c);
+    return values ? values[i] : 0.0;
+  };
+  const uint64_t *id = ids();
+  return Particle{value(Column::kX) * l,
+                  value(Column::kY) * l,
+                  value(Column::kZ) * l,
+                  value(Column::kVx) * v,
+                  value(Column::kVy) * v,
+                  value(Column::kVz) * v,
+                  value(Column::kMass) * header_->mass_unit,
+                  id ? id[i] : i};
+}
+
+void ParticleFile::for_each(size_t part, const Visitor &visit) const {
+  const size_t end = std::min(size(), (part + 1) * kPartBodies);
+  for (size_t i = part * kPartBodies; i < end; ++i)
+    visit(body(i));
+}
+
+WriterResult ParticleFileWriter::create(const std::string &path,
+                                        const FileLayout &layout) {
+  FileHeader header{};
+  std::memcpy(header.magic, FileHeader::kMagic, sizeof(header.magic));
+  header.version = FileHeader::kVersion;
+  header.header_bytes = sizeof(FileHeader);
+  header.count = layout.count;
+  header.columns = layout.columns;
+  header.flags = layout.morton_sorted ? FileHeader::kMortonSorted : 0;
+  header.length_unit = layout.length_unit;
+  header.mass_unit = layout.mass_unit;
+  header.velocity_unit = layout.velocity_unit;
+  const MyMath::BoundingBox &b = layout.bounds;
+  const double min[3] = {b.min.x, b.min.y, b.min.z};
+  const double max[3] = {b.max.x, b.max.y, b.max.z};
+  std::copy(min, min + 3, header.bounds_min);
+  std::copy(max, max + 3, header.bounds_max);
+  uint64_t offset = align_up(sizeof(FileHeader), FileHeader::kColumnAlignment);
+  for (size_t c = 0; c < kColumns; ++c) {
+    if (!has(layout.columns, static_cast<Column>(c)))
+      continue;
+    header.column_offset[c] = offset;
+    offset = align_up(offset + layout.count * sizeof(double),
+                      FileHeader::kColumnAlignment);
+  }
+  if (const char *problem = header_problem(header, offset))
+    return WriterResult::error(1, problem);
+
+  const int fd =
+      ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    debug::debug_print("ParticleFileWriter: {}: {}", path,
+                       std::strerror(errno));
+    return WriterResult::error(2, "cannot create particle file");
+  }
+  // Sized up front: the columns can then be written in any order
+  if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+    close(fd);
+    return WriterResult::error(3, "cannot size particle file");
+  }
+  return WriterResult::success(std::unique_ptr<ParticleFileWriter>(
+      new ParticleFileWriter(fd, header)));
+}
+
+ParticleFileWriter::ParticleFileWriter(int fd, FileHeader header)
+    : fd_(fd), header_(header) {}
+
+ParticleFileWriter::~ParticleFileWriter() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool ParticleFileWriter::write_at(uint64_t offset, const void *data,
+                                  size_t bytes) {
+  const auto *at = static_cast<const std::byte *>(data);
+  while (bytes > 0) {
+    const ssize_t n = pwrite(fd_, at, bytes, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    at += n;
+    bytes -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool ParticleFileWriter::write(Column c, size_t first, const double *values,
+                               size_t n) {
+  if (fd_ < 0 || c == Column::kId || !has(header_.columns, c) ||
+      first + n > header_.count)
+    return false;
+  return write_at(header_.column_offset[static_cast<size_t>(c)] +
+                      first * sizeof(double),
+                  values, n * sizeof(double));
+}
+
+bool ParticleFileWriter::write_ids(size_t first, const uint64_t *ids,
+                                   size_t n) {
+  if (fd_ < 0 || !has(header_.columns, Column::kId) ||
+      first + n > header_.count)
+    return false;
+  return write_at(header_.column_offset[static_cast<size_t>(Column::kId)] +
+                      first * sizeof(uint64_t),
+                  ids, n * sizeof(uint64_t));
+}
+
+bool ParticleFileWriter::finish() {
+  if (fd_ < 0)
+    return false;
+  const bool ok = write_at(0, &header_, sizeof(header_));
+  const bool closed = close(fd_) == 0;
+  fd_ = -1;
+  return ok && closed;
+}
+
+bool write_particle_file(const std::string &path,
+                         const std::vector<Particle> &bodies,
+                         FileLayout layout) {
+  layout.count = bodies.size();
+  layout.columns &= ~column_bit(Column::kId);
+  auto created = ParticleFileWriter::create(path, layout);
+  if (created.is_error()) {
+    debug::debug_print("write_particle_file: {}", created.error_message());
+    return false;
+  }
+  ParticleFileWriter &writer = *created.value();
+  // File units from simulation units, one column at a time
+  const double to_length = 1.0 / layout.length_unit;
+  const double to_velocity = 1.0 / layout.velocity_unit;
+  const double to_mass = 1.0 / layout.mass_unit;
+  struct Field {
+    Column column;
+    double (Particle::*get)() const;
+    double scale;
+  };
+  const Field fields[] = {
+      {Column::kX, &Particle::getX, to_length},
+      {Column::kY, &Particle::getY, to_length},
+      {Column::kZ, &Particle::getZ, to_length},
+      {Column::kVx, &Particle::getVx, to_velocity},
+      {Column::kVy, &Particle::getVy, to_velocity},
+      {Column::kVz, &Particle::getVz, to_velocity},
+      {Column::kMass, &Particle::getMass, to_mass},
+  };
+  std::vector<double> values(bodies.size());
+  bool ok = true;
+  for (const Field &field : fields) {
+    if (!has(layout.columns, field.column))
+      continue;
+    std::transform(bodies.begin(), bodies.end(), values.begin(),
+                   [&](const Particle &p) {
+                     return (p.*field.get)() * field.scale;
+                   });
+    ok = writer.write(field.column, 0, values.data(), values.size()) && ok;
+  }
+  return writer.finish() && ok;
+}
+} // namespace io
@@ -0,0 +1,382 @@
+#include "io/snapshot_writer.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "utils/affinity.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+namespace io {
+namespace {
+// Zero-padded so that names sort by tick
+std::string tick_digits(uint64_t tick) {
+  std::string digits = std::to_string(tick);
+  if (digits.size() < 8)
+    digits.insert(0, 8 - digits.size(), '0');
+  return digits;
+}
+
+std::string share_path(const std::string &prefix, unsigned rank,
+                       uint64_t tick) {
+  return prefix + "_r" + std::to_string(rank) + "_" + tick_digits(tick) +
+         ".gwp";
+}
+} // namespace
+
+SnapshotFormat snapshot_format_from_string(const std::string &name) {
+  if (name == "gwp")
+    return SnapshotFormat::kGwp;
+  if (name == "gadget")
+    return SnapshotFormat::kGadget;
+  throw std::runtime_error("Unknown SnapshotFormat '" + name +
+                           "', expected gwp|gadget");
+}
+
+SnapshotWriter::SnapshotWriter(std::string prefix, std::vector<unsigned> cpus,
+                               unsigned rank, unsigned ranks,
+                               SnapshotFormat format, GadgetUnits units)
+    : prefix_(std::move(prefix)), rank_(rank), ranks_(ranks), format_(format),
+      units_(units) {
+  const std::filesystem::path directory =
+      std::filesystem::path(prefix_).parent_path();
+  std::error_code ec;
+  if (!directory.empty())
+    std::filesystem::create_directories(directory, ec);
+  if (ec)
+    throw std::runtime_error("Cannot create snapshot directory " +
+                             directory.string() + ": " + ec.message());
+  thread_ = std::thread(
+      [this, cpus = std::move(cpus)] {
+        if (!cpus.empty() && !affinity::pin_current(cpus))
+          std::cerr << "Snapshot thread: could not pin\n";
+        run();
+      });
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+std::string SnapshotWriter::path_for(uint64_t tick) const {
+  const std::string stem = prefix_ + "_" + tick_digits(tick);
+  if (format_ == SnapshotFormat::kGadget)
+    return ranks_ > 1 ? stem + "." + std::to_string(rank_) : stem;
+  if (ranks_ > 1)
+    return share_path(prefix_, rank_, tick);
+  return stem + ".gwp";
+}
+
+std::string SnapshotWriter::restart_path_for(uint64_t tick) const {
+  if (ranks_ <= 1)
+    return path_for(tick);
+  // The GADGET reader finds the split set from its stem
+  const std::string stem = prefix_ + "_" + tick_digits(tick);
+  return format_ == SnapshotFormat::kGadget ? stem : stem + ".gws";
+}
+
+bool SnapshotWriter::capture(const Storage &storage,
+                             const std::vector<AROctreeNode *> &leaves,
+                             uint64_t tick, const MyMath::BoundingBox &bounds,
+                             ThreadPool &pool) {
+  {
+    std::lock_guard lock(mutex_);
+    if (pending_) {
+      ++stats_.skipped;
+      return false;
+    }
+  }
+  // The I/O thread is idle, so the staging area is ours until pending_
+  const size_t n_leaves = leaves.size();
+  first_.resize(n_leaves + 1);
+  size_t count = 0;
+  for (size_t l = 0; l < n_leaves; ++l) {
+    first_[l] = count;
+    for (const ParticleBlock *block = leaves[l]->localBlock; block;
+         block = storage.next_block(block))
+      count += block->size();
+  }
+  first_[n_leaves] = count;
+  for (std::vector<double> &column : columns_)
+    column.resize(count);
+  ids_.resize(count);
+
+  pool.parallel_for(n_leaves, 0, [&](size_t begin, size_t end) {
+    for (size_t l = begin; l < end; ++l) {
+      size_t at = first_[l];
+      for (const ParticleBlock *block = leaves[l]->localBlock; block;
+           block = storage.next_block(block)) {
+        const size_t n = block->size();
+        const double *from[] = {block->get_x().data(),  block->get_y().data(),
+                                block->get_z().data(),  block->get_vx().data(),
+                                block->get_vy().data(), block->get_vz().data(),
+                                block->get_mass().data()};
+        for (size_t c = 0; c < columns_.size(); ++c)
+          std::memcpy(columns_[c].data() + at, from[c], n * sizeof(double));
+        std::memcpy(ids_.data() + at, block->get_visual_id().data(),
+                    n * sizeof(uint64_t));
+        at += n;
+      }
+    }
+  });
+
+  {
+    std::lock_guard lock(mutex_);
+    count_ = count;
+    curve_ = storage.curve();
+    tick_ = tick;
+    bounds_ = bounds;
+    pending_ = true;
+  }
+  wake_.notify_one();
+  return true;
+}
+
+void SnapshotWriter::wait() {
+  std::unique_lock lock(mutex_);
+  idle_.wait(lock, [this] { return !pending_; });
+}
+
+SnapshotWriter::Stats SnapshotWriter::stats() const {
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
+
+void SnapshotWriter::run() {
+  std::unique_lock lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return pending_ || stop_; });
+    if (!pending_)
+      return;
+    const uint64_t tick = tick_;
+    lock.unlock();
+    const bool ok = write(tick);
+    lock.lock();
+    ++(ok ? stats_.written : stats_.failed);
+    pending_ = false;
+    idle_.notify_all();
+  }
+}
+
+bool SnapshotWriter::write(uint64_t tick) {
+  // The run's box unless bodies have left it: a restart then builds the
+  // same tree
+  MyMath::Vector3 lo{HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  MyMath::Vector3 hi{-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (size_t i = 0; i < count_; ++i) {
+    const double x = columns_[0][i], y = columns_[1][i], z = columns_[2][i];
+    lo = {std::min(lo.x, x), std::min(lo.y, y), std::min(lo.z, z)};
+    hi = {std::max(hi.x, x), std::max(hi.y, y), std::max(hi.z, z)};
+  }
+  const MyMath::BoundingBox &box = bounds_;
+  const bool inside = count_ == 0 ||
+                      (lo.x >= box.min.x && lo.y >= box.min.y &&
+                       lo.z >= box.min.z && hi.x < box.max.x &&
+                       hi.y < box.max.y && hi.z < box.max.z);
+  const MyMath::BoundingBox bounds = inside ? box : enclosing_cube(lo, hi);
+
+  const std::string path = path_for(tick);
+  const std::string part = path + ".part";
+  bool ok;
+  if (format_ == SnapshotFormat::kGadget) {
+    ok = write_gadget(part, bounds);
+  } else {
+    const bool sorted = curve_ == sfc::Curve::kMorton && sort_leaves(bounds);
+    ok = write_particle_file(part, bounds, sorted);
+  }
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(part, path, ec);
+  if (!ok || ec) {
+    debug::debug_print("SnapshotWriter: {} not written", path);
+    std::filesystem::remove(part, ec);
+    return false;
+  }
+  return format_ == SnapshotFormat::kGadget || rank_ != 0 || ranks_ <= 1 ||
+         write_manifest(tick);
+}
+
+// Leaves are already in Morton order, so ordering the bodies inside each one
+// orders the whole set. true if it came out ascending
+bool SnapshotWriter::sort_leaves(const MyMath::BoundingBox &bounds) {
+  std::vector<sfc::OrderKey> keys(count_);
+  for (size_t i = 0; i < count_; ++i)
+    keys[i] = sfc::point_key(
+        sfc::Curve::kMorton,
+        MyMath::Vector3{columns_[0][i], columns_[1][i], columns_[2][i]},
+        bounds);
+  std::vector<size_t> order;
+  std::vector<double> reals;
+  std::vector<uint64_t> words;
+  const auto permute = [&](auto &column, auto &scratch, size_t begin) {
+    scratch.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      scratch[i] = column[order[i]];
+    std::copy(scratch.begin(), scratch.end(),
+              column.begin() + static_cast<std::ptrdiff_t>(begin));
+  };
+  for (size_t l = 0; l + 1 < first_.size(); ++l) {
+    const size_t begin = first_[l], end = first_[l + 1];
+    if (std::is_sorted(keys.begin() + static_cast<std::ptrdiff_t>(begin),
+                       keys.begin() + static_cast<std::ptrdiff_t>(end)))
+      continue;
+    order.resize(end - begin);
+    std::iota(order.begin(), order.end(), begin);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+    for (std::vector<double> &column : columns_)
+      permute(column, reals, begin);
+    permute(ids_, words, begin);
+    permute(keys, words, begin);
+  }
+  return std::is_sorted(keys.begin(), keys.end());
+}
+
+bool SnapshotWriter::write_particle_file(const std::string &path,
+                                         const MyMath::BoundingBox &bounds,
+                                         bool morton_sorted) const {
+  const FileLayout layout{.count = count_,
+                          .columns = kAllColumns,
+                          .morton_sorted = morton_sorted,
+                          .bounds = bounds};
+  auto created = ParticleFileWriter::create(path, layout);
+  if (created.is_error()) {
+    debug::debug_print("SnapshotWriter: {}: {}", path,
+                       created.error_message());
+    return false;
+  }
+  ParticleFileWriter &writer = *created.value();
+  bool ok = true;
+  for (size_t c = 0; c < columns_.size(); ++c)
+    ok = writer.write(static_cast<Column>(c), 0, columns_[c].data(),
+                      count_) &&
+         ok;
+  ok = writer.write_ids(0, ids_.data(), count_) && ok;
+  return writer.finish() && ok;
+}
+
+// GADGET only records a periodic box at the origin; any other box is left
+// out and the reader takes a cube around the bodies
+bool SnapshotWriter::write_gadget(const std::string &path,
+                                  const MyMath::BoundingBox &bounds) const {
+  const bool at_origin = bounds.min.x == 0.0 && bounds.min.y == 0.0 &&
+                         bounds.min.z == 0.0 && bounds.max.x == bounds.max.y &&
+                         bounds.max.y == bounds.max.z;
+  const GadgetLayout layout{
+      .count = count_,
+      .units = units_,
+      .box_size = at_origin ? bounds.max.x / units_.length : 0.0,
+      .double_precision = true,
+      .num_files = static_cast<int>(std::max(ranks_, 1u))};
+  auto created = GadgetWriter::create(path, layout);
+  if (created.is_error()) {
+    debug::debug_print("SnapshotWriter: {}: {}", path,
+                       created.error_message());
+    return false;
+  }
+  GadgetWriter &writer = *created.value();
+  const auto &c = columns_;
+  bool ok = true;
+  for (size_t i = 0; i < count_ && ok; ++i) {
+    const double position[3] = {c[0][i], c[1][i], c[2][i]};
+    const double velocity[3] = {c[3][i], c[4][i], c[5][i]};
+    ok = writer.append(position, velocity, c[6][i], ids_[i]);
+  }
+  return writer.finish() && ok;
+}
+
+// Names only: the shares sit next to the manifest
+bool SnapshotWriter::write_manifest(uint64_t tick) const {
+  const std::string path = restart_path_for(tick);
+  const std::string part = path + ".part";
+  {
+    std::ofstream out(part, std::ios::trunc);
+    out.write(SnapshotSet::kMagic, sizeof(SnapshotSet::kMagic)) << '\n';
+    for (unsigned r = 0; r < ranks_; ++r)
+      out << std::filesystem::path(share_path(prefix_, r, tick))
+                 .filename()
+                 .string()
+          << '\n';
+    if (!out.flush()) {
+      debug::debug_print("SnapshotWriter: {} not written", path);
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(part, path, ec);
+  if (ec) {
+    debug::debug_print("SnapshotWriter: {} not written", path);
+    std::filesystem::remove(part, ec);
+    return false;
+  }
+  return true;
+}
+
+error::CResult<std::shared_ptr<const SnapshotSet>>
+SnapshotSet::open(const std::string &path) {
+  using Result = error::CResult<std::shared_ptr<const SnapshotSet>>;
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line) ||
+      line != std::string(kMagic, sizeof(kMagic)))
+    return Result::error(1, "not a snapshot set");
+  const std::filesystem::path directory =
+      std::filesystem::path(path).parent_path();
+  std::shared_ptr<SnapshotSet> set(new SnapshotSet());
+  MyMath::Vector3 lo{HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  MyMath::Vector3 hi{-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  bool same_box = true;
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    const std::string share = (directory / line).string();
+    auto opened = ParticleFile::open(share);
+    if (opened.is_error()) {
+      debug::debug_print("SnapshotSet: {}: {}", share,
+                         opened.error_message());
+      return Result::error(2, "snapshot share missing");
+    }
+    const ParticleFile &file = *opened.value();
+    const MyMath::BoundingBox box = file.bounds();
+    if (!set->shares_.empty()) {
+      const MyMath::BoundingBox &first = set->bounds_;
+      same_box = same_box && box.min.x == first.min.x &&
+                 box.min.y == first.min.y && box.min.z == first.min.z &&
+                 box.max.x == first.max.x && box.max.y == first.max.y &&
+                 box.max.z == first.max.z;
+    } else {
+      set->bounds_ = box;
+    }
+    lo = {std::min(lo.x, box.min.x), std::min(lo.y, box.min.y),
+          std::min(lo.z, box.min.z)};
+    hi = {std::max(hi.x, box.max.x), std::max(hi.y, box.max.y),
+          std::max(hi.z, box.max.z)};
+    set->size_ += file.size();
+    set->first_part_.push_back(set->first_part_.back() + file.parts());
+    set->shares_.push_back(std::move(opened.value()));
+  }
+  if (set->shares_.empty())
+    return Result::error(3, "empty snapshot set");
+  if (!same_box)
+    set->bounds_ = enclosing_cube(lo, hi);
+  return Result::success(std::move(set));
+}
+
+void SnapshotSet::for_each(size_t part, const Visitor &visit) const {
+  const size_t share = static_cast<size_t>(
+      std::upper_bound(first_part_.begin(), first_part_.end(), part) -
+      first_part_.begin() - 1);
+  shares_[share]->for_each(part - first_part_[share], visit);
+}
+} // namespace io
@@ -0,0 +1,337 @@
+#include "io/text_table.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace io {
+namespace {
+using TableResult = error::CResult<std::shared_ptr<const TextTable>>;
+
+bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char *line_end(const char *at, const char *end) {
+  const void *nl = std::memchr(at, '\n', static_cast<size_t>(end - at));
+  return nl ? static_cast<const char *>(nl) : end;
+}
+
+// Blank lines and comments carry no row
+bool skip_line(const char *begin, const char *end) {
+  while (begin < end && is_blank(*begin))
+    ++begin;
+  return begin == end || *begin == '#';
+}
+
+// field(index, begin, end) for each field of the line until it returns
+// false. '\0' splits on runs of blanks, anything else on that character
+template <typename F>
+void split(const char *begin, const char *end, char delimiter, F &&field) {
+  for (size_t k = 0;; ++k) {
+    if (delimiter == '\0') {
+      while (begin < end && is_blank(*begin))
+        ++begin;
+      if (begin == end)
+        return;
+      const char *stop = begin;
+      while (stop < end && !is_blank(*stop))
+        ++stop;
+      if (!field(k, begin, stop))
+        return;
+      begin = stop;
+      continue;
+    }
+    const void *found =
+        std::memchr(begin, delimiter, static_cast<size_t>(end - begin));
+    const char *stop = found ? static_cast<const char *>(found) : end;
+    const char *first = begin, *last = stop;
+    while (first < last && is_blank(*first))
+      ++first;
+    while (last > first && is_blank(last[-1]))
+      --last;
+    if (!field(k, first, last) || stop == end)
+      return;
+    begin = stop + 1;
+  }
+}
+
+bool parse_number(const char *begin, const char *end, double &value) {
+  if (begin < end && *begin == '+')
+    ++begin;
+  const auto [stop, ec] = std::from_chars(begin, end, value);
+  return ec == std::errc() && stop == end && begin < end;
+}
+
+bool parse_number(const char *begin, const char *end, uint64_t &value) {
+  const auto [stop, ec] = std::from_chars(begin, end, value);
+  return ec == std::errc() && stop == end && begin < end;
+}
+
+std::string lowercase(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+std::optional<Column> column_from_name(const std::string &name) {
+  static constexpr std::pair<const char *, Column> kNames[] = {
+      {"x", Column::kX},       {"y", Column::kY},   {"z", Column::kZ},
+      {"vx", Column::kVx},     {"vy", Column::kVy}, {"vz", Column::kVz},
+      {"mass", Column::kMass}, {"m", Column::kMass}, {"id", Column::kId}};
+  const std::string key = lowercase(name);
+  for (const auto &[known, column] : kNames)
+    if (key == known)
+      return column;
+  return std::nullopt;
+}
+} // namespace
+
+TextFormat::Header header_from_string(const std::string &name) {
+  const std::string key = lowercase(name);
+  if (key == "auto")
+    return TextFormat::Header::kAuto;
+  if (key == "true" || key == "yes")
+    return TextFormat::Header::kYes;
+  if (key == "false" || key == "no")
+    return TextFormat::Header::kNo;
+  throw std::runtime_error("Unknown CsvHeader '" + name +
+                           "', expected auto|true|false");
+}
+
+TextTable::TextTable(const char *base, size_t bytes)
+    : base_(base), bytes_(bytes) {}
+
+TextTable::~TextTable() { munmap(const_cast<char *>(base_), bytes_); }
+
+const char *TextTable::map_columns(const std::vector<std::string> &names,
+                                   size_t fields, const TextFormat &format) {
+  std::array<int, kColumns> source;
+  source.fill(-1);
+  if (!format.columns.empty()) {
+    std::vector<std::string> pairs;
+    stringify::Split(',', pairs, format.columns);
+    for (const std::string &pair : pairs) {
+      const size_t eq = pair.find('=');
+      const std::optional<Column> column =
+          column_from_name(pair.substr(0, eq));
+      if (eq == std::string::npos || !column)
+        return "bad CsvColumns entry";
+      const std::string from = pair.substr(eq + 1);
+      int index = -1;
+      if (!from.empty() && std::all_of(from.begin(), from.end(), ::isdigit)) {
+        index = std::stoi(from);
+      } else {
+        // Config files arrive lowercased, so names match in any case
+        const auto it = std::find_if(
+            names.begin(), names.end(), [&](const std::string &name) {
+              return lowercase(name) == lowercase(from);
+            });
+        if (it != names.end())
+          index = static_cast<int>(it - names.begin());
+      }
+      if (index < 0 || static_cast<size_t>(index) >= fields)
+        return "CsvColumns names no column";
+      source[static_cast<size_t>(*column)] = index;
+    }
+  } else if (!names.empty()) {
+    for (size_t k = 0; k < names.size(); ++k)
+      if (const std::optional<Column> column = column_from_name(names[k]))
+        if (source[static_cast<size_t>(*column)] < 0)
+          source[static_cast<size_t>(*column)] = static_cast<int>(k);
+  } else {
+    static constexpr Column kFour[] = {Column::kX, Column::kY, Column::kZ,
+                                       Column::kMass};
+    static constexpr Column kSeven[] = {Column::kX,  Column::kY,  Column::kZ,
+                                        Column::kVx, Column::kVy, Column::kVz,
+                                        Column::kMass, Column::kId};
+    if (fields == 4)
+      for (size_t k = 0; k < 4; ++k)
+        source[static_cast<size_t>(kFour[k])] = static_cast<int>(k);
+    else if (fields == 7 || fields == 8)
+      for (size_t k = 0; k < fields; ++k)
+        source[static_cast<size_t>(kSeven[k])] = static_cast<int>(k);
+    else
+      return "set CsvColumns for this table";
+  }
+  for (Column c : {Column::kX, Column::kY, Column::kZ})
+    if (source[static_cast<size_t>(c)] < 0)
+      return "no x, y, z columns";
+
+  const int last = *std::max_element(source.begin(), source.end());
+  field_column_.assign(static_cast<size_t>(last) + 1, kUnused);
+  for (size_t c = 0; c < kColumns; ++c) {
+    if (source[c] < 0)
+      continue;
+    field_column_[static_cast<size_t>(source[c])] = static_cast<int8_t>(c);
+    mapped_ |= column_bit(static_cast<Column>(c));
+  }
+  return nullptr;
+}
+
+bool TextTable::parse_row(const char *begin, const char *end, Row &row,
+                          uint64_t &id) const {
+  row = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0};
+  uint32_t seen = 0;
+  bool ok = true;
+  split(begin, end, delimiter_,
+        [&](size_t k, const char *first, const char *last) {
+          if (k >= field_column_.size())
+            return false; // fields past the last mapped one are not read
+          const int8_t c = field_column_[k];
+          if (c == kUnused)
+            return true;
+          const auto column = static_cast<size_t>(c);
+          ok = static_cast<Column>(c) == Column::kId
+                   ? parse_number(first, last, id)
+                   : parse_number(first, last, row[column]);
+          seen |= column_bit(static_cast<Column>(c));
+          return ok;
+        });
+  return ok && seen == mapped_;
+}
+
+Particle TextTable::to_body(const Row &row, uint64_t id) const {
+  return Particle{row[0], row[1], row[2], row[3], row[4],
+                  row[5], row[6], id};
+}
+
+TableResult TextTable::open(const std::string &path, const TextFormat &format,
+                            ThreadPool &pool) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    debug::debug_print("TextTable: {}: {}", path, std::strerror(errno));
+    return TableResult::error(1, "cannot open table");
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return TableResult::error(2, "no rows in table");
+  }
+  const size_t bytes = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return TableResult::error(3, "cannot map table");
+  madvise(base, bytes, MADV_WILLNEED);
+  // Unmaps on every way out
+  std::shared_ptr<TextTable> table(
+      new TextTable(static_cast<const char *>(base), bytes));
+  const char *const end = table->base_ + bytes;
+
+  // The first line with content says how the rest is laid out
+  const char *at = table->base_;
+  const char *stop = line_end(at, end);
+  while (at < end && skip_line(at, stop)) {
+    at = stop + (stop < end);
+    stop = line_end(at, end);
+  }
+  if (at >= end)
+    return TableResult::error(4, "no rows in table");
+  table->delimiter_ =
+      std::memchr(at, ',', static_cast<size_t>(stop - at)) ? ',' : '\0';
+  std::vector<std::string> tokens;
+  bool numeric = true;
+  split(at, stop, table->delimiter_,
+        [&](size_t, const char *first, const char *last) {
+          double value;
+          numeric = numeric && parse_number(first, last, value);
+          tokens.emplace_back(first, last);
+          return true;
+        });
+  const bool header = format.header == TextFormat::Header::kYes ||
+                      (format.header == TextFormat::Header::kAuto && !numeric);
+  if (const char *problem = table->map_columns(
+          header ? tokens : std::vector<std::string>{}, tokens.size(), format))
+    return TableResult::error(5, problem);
+  if (header)
+    at = stop + (stop < end);
+
+  for (const char *begin = at; begin < end;) {
+    const char *cut = begin + std::min(kPartBytes, size_t(end - begin));
+    if (cut < end)
+      cut = line_end(cut, end) + 1;
+    table->parts_.push_back({begin, std::min(cut, end)});
+    begin = cut;
+  }
+
+  // Rows, bounds and syntax per part, in parallel
+  struct Scan {
+    size_t rows = 0;
+    double lo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
+    double hi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    const char *bad = nullptr;
+  };
+  std::vector<Scan> scans(table->parts_.size());
+  pool.parallel_for(scans.size(), 1, [&](size_t first, size_t last) {
+    for (size_t p = first; p < last; ++p) {
+      Scan &scan = scans[p];
+      const Part &part = table->parts_[p];
+      Row row;
+      uint64_t id = 0;
+      for (const char *line = part.begin; line < part.end;) {
+        const char *line_stop = line_end(line, part.end);
+        if (!skip_line(line, line_stop)) {
+          if (!table->parse_row(line, line_stop, row, id)) {
+            scan.bad = line;
+            break;
+          }
+          ++scan.rows;
+          for (size_t axis = 0; axis < 3; ++axis) {
+            scan.lo[axis] = std::min(scan.lo[axis], row[axis]);
+            scan.hi[axis] = std::max(scan.hi[axis], row[axis]);
+          }
+        }
+        line = line_stop + 1;
+      }
+    }
+  });
+
+  double lo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  double hi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (size_t p = 0; p < scans.size(); ++p) {
+    if (scans[p].bad) {
+      const auto line =
+          1 + std::count(table->base_, scans[p].bad, '\n');
+      debug::debug_print("TextTable: {}:{}: bad row", path, line);
+      return TableResult::error(6, "bad row in table");
+    }
+    table->parts_[p].first_row = table->rows_;
+    table->parts_[p].rows = scans[p].rows;
+    table->rows_ += scans[p].rows;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      lo[axis] = std::min(lo[axis], scans[p].lo[axis]);
+      hi[axis] = std::max(hi[axis], scans[p].hi[axis]);
+    }
+  }
+  if (table->rows_ == 0)
+    return TableResult::error(4, "no rows in table");
+
+  table->bounds_ =
+      enclosing_cube({lo[0], lo[1], lo[2]}, {hi[0], hi[1], hi[2]});
+  return TableResult::success(
+      std::shared_ptr<const TextTable>(std::move(table)));
+}
+
+void TextTable::for_each(size_t part, const Visitor &visit) const {
+  const Part &p = parts_[part];
+  const bool has_ids = (mapped_ & column_bit(Column::kId)) != 0;
+  size_t index = p.first_row;
+  Row row;
+  uint64_t id = 0;
+  for (const char *line = p.begin; line < p.end;) {
+    const char *stop = line_end(line, p.end);
+    // open() checked every row
+    if (!skip_line(line, stop) && parse_row(line, stop, row, id))
+      visit(to_body(row, has_ids ? id : index++));
+    line = stop + 1;
+  }
+}
+} // namespace io
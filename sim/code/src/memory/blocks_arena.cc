@@ -2,18 +2,156 @@
 #include "memory/blocks_arena.h"
 #include "ds/storage/particleBlock.h"
 #include "utils/namespaces/error_namespace.h"
+#include <bit>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
 
-ParticleBlock *BlocksAllocator::allocate() {
+BlockPlacement placement_from_string(const std::string &name) {
+  if (name == "freelist")
+    return BlockPlacement::kFreeList;
+  if (name == "spatial")
+    return BlockPlacement::kSpatial;
+  throw std::runtime_error("Unknown block placement: " + name);
+}
+
+PageSize page_size_from_string(const std::string &name) {
+  if (name == "small")
+    return PageSize::kSmall;
+  if (name == "huge")
+    return PageSize::kHuge;
+  throw std::runtime_error("Unknown page size: " + name);
+}
+
+const char *page_backing_name(PageBacking backing) {
+  switch (backing) {
+  case PageBacking::kSmall:
+    return "small pages";
+  case PageBacking::kHugeTlb:
+    return "hugetlb 2 MB pages";
+  case PageBacking::kTransparent:
+    return "transparent huge pages";
+  }
+  return "unknown";
+}
+
+void BlocksAllocator::mark(size_t index, bool used) {
+  const uint64_t bit = uint64_t{1} << (index % 64);
+  if (used)
+    occupied_[index / 64] |= bit;
+  else
+    occupied_[index / 64] &= ~bit;
+}
+
+// First free slot in [from, end), kNoSlot if none
+size_t BlocksAllocator::find_free_after(size_t from, size_t end) const {
+  if (from >= end)
+    return kNoSlot;
+  size_t word = from / 64;
+  uint64_t free_bits = ~occupied_[word] & (~uint64_t{0} << (from % 64));
+  while (free_bits == 0) {
+    if (++word * 64 >= end)
+      return kNoSlot;
+    free_bits = ~occupied_[word];
+  }
+  const size_t index =
+      word * 64 + static_cast<size_t>(std::countr_zero(free_bits));
+  return index < end ? index : kNoSlot;
+}
+
+// Last free slot in [begin, from], kNoSlot if none
+size_t BlocksAllocator::find_free_before(size_t from, size_t begin) const {
+  if (from < begin)
+    return kNoSlot;
+  size_t word = from / 64;
+  const unsigned shift = 63 - static_cast<unsigned>(from % 64);
+  uint64_t free_bits = ~occupied_[word] & (~uint64_t{0} >> shift);
+  while (free_bits == 0) {
+    if (word-- == 0 || (word + 1) * 64 <= begin)
+      return kNoSlot;
+    free_bits = ~occupied_[word];
+  }
+  const size_t index =
+      word * 64 + 63 - static_cast<size_t>(std::countl_zero(free_bits));
+  return index >= begin ? index : kNoSlot;
+}
+
+size_t BlocksAllocator::find_run_after(size_t from, size_t end,
+                                       size_t count) const {
+  size_t start = find_free_after(from, end);
+  while (start != kNoSlot && start + count <= end) {
+    size_t len = 1;
+    while (len < count && !is_occupied(start + len))
+      ++len;
+    if (len == count)
+      return start;
+    start = find_free_after(start + len + 1, end);
+  }
+  return kNoSlot;
+}
+
+size_t BlocksAllocator::region_for(uint64_t fraction) const {
+  return std::min<size_t>((fraction * regions_.size()) >> 32,
+                          std::max<size_t>(regions_.size(), 1) - 1);
+}
+
+size_t BlocksAllocator::slot_for(uint64_t fraction) const {
+  if (regions_.empty())
+    return 0;
+  const uint64_t scaled = fraction * regions_.size();
+  const size_t r = region_for(fraction);
+  const size_t span = spans_[r].load(std::memory_order_relaxed);
+  return regions_[r].begin + (((scaled & 0xffffffffu) * span) >> 32);
+}
+
+size_t BlocksAllocator::take_slot(size_t region_index, size_t hint) {
+  Region &region = regions_[region_index];
+  if (placement == BlockPlacement::kFreeList) {
+    const size_t index = region.free_head;
+    if (index != kNoSlot)
+      region.free_head = next_free_array[index];
+    return index;
+  }
+
+  // Nearest free slot on either side of the hint
+  hint = std::clamp(hint, region.begin,
+                    region.committed ? region.end() - 1 : region.begin);
+  const size_t after = find_free_after(hint, region.end());
+  const size_t before = find_free_before(hint, region.begin);
+  if (after == kNoSlot)
+    return before;
+  if (before == kNoSlot)
+    return after;
+  return (after - hint <= hint - before) ? after : before;
+}
+
+ParticleBlock *BlocksAllocator::allocate(size_t hint) {
   debug::debug_print("We entered BlocksAllocator::allocate");
-  if (free_head >= capacity) {
-    debug::debug_print("free_head is bigger or equal to capacity: {} >= {}",
-                       free_head, capacity);
+  if (regions_.empty())
+    return nullptr;
+  const size_t home = std::min(region_of(hint), regions_.size() - 1);
+
+  size_t index = take_slot(home, hint);
+  if (index == kNoSlot && grow(home, regions_[home].committed + 1))
+    index = take_slot(home, hint);
+  // Home region is out of reserve: spill over to the others
+  for (size_t r = 0; index == kNoSlot && r < regions_.size(); ++r) {
+    if (r == home)
+      continue;
+    index = take_slot(r, regions_[r].begin);
+    if (index == kNoSlot && grow(r, regions_[r].committed + 1))
+      index = take_slot(r, regions_[r].begin);
+  }
+  if (index == kNoSlot) {
+    debug::debug_print("No free slot left, capacity: {}", capacity);
     return nullptr;
   }
-  size_t index = free_head;
-  free_head = next_free_array[free_head];
+  mark(index, true);
   current_counter++;
 
   std::byte *block_ptr = base + index * k_block_size;
@@ -21,6 +159,33 @@ ParticleBlock *BlocksAllocator::allocate() {
   return reinterpret_cast<ParticleBlock *>(block_ptr);
 }
 
+ParticleBlock *BlocksAllocator::allocate_run(size_t count, size_t hint) {
+  // A LIFO stack has no notion of adjacency
+  if (placement != BlockPlacement::kSpatial || count == 0 || regions_.empty())
+    return nullptr;
+  const size_t home = std::min(region_of(hint), regions_.size() - 1);
+  const Region &region = regions_[home];
+
+  size_t start = find_run_after(hint, region.end(), count);
+  if (start == kNoSlot)
+    start = find_run_after(region.begin, region.end(), count);
+  if (start == kNoSlot) {
+    // The fresh slots are all free, so a run fits at the old end
+    const size_t old_end = region.end();
+    if (grow(home, region.committed + count))
+      start = find_run_after(old_end - std::min(old_end - region.begin, count),
+                             region.end(), count);
+  }
+  if (start == kNoSlot) {
+    debug::debug_print("No run of {} free slots", count);
+    return nullptr;
+  }
+  for (size_t i = start; i < start + count; ++i)
+    mark(i, true);
+  current_counter += count;
+  return reinterpret_cast<ParticleBlock *>(base + start * k_block_size);
+}
+
 void BlocksAllocator::deallocate(ParticleBlock *block) {
   if (!block)
     return;
@@ -28,33 +193,260 @@ void BlocksAllocator::deallocate(ParticleBlock *block) {
       static_cast<size_t>((reinterpret_cast<std::byte *>(block) - base)) /
       k_block_size;
 
-  if (index >= capacity)
+  if (index >= capacity || !is_occupied(index))
     return;
 
-  next_free_array[index] = free_head;
-  free_head = index;
+  mark(index, false);
+  if (placement == BlockPlacement::kFreeList) {
+    Region &region = regions_[region_of(index)];
+    next_free_array[index] = region.free_head;
+    region.free_head = index;
+  }
   current_counter--;
 }
 
+void BlocksAllocator::reassign(const std::vector<size_t> &slots) {
+  for (Region &region : regions_)
+    for (size_t i = region.begin; i < region.end(); ++i)
+      mark(i, false);
+  for (size_t slot : slots)
+    mark(slot, true);
+  current_counter = slots.size();
+
+  if (placement == BlockPlacement::kFreeList) {
+    // Lowest free slot on top of each stack
+    for (Region &region : regions_) {
+      region.free_head = kNoSlot;
+      for (size_t i = region.end(); i-- > region.begin;) {
+        if (is_occupied(i))
+          continue;
+        next_free_array[i] = region.free_head;
+        region.free_head = i;
+      }
+    }
+  }
+}
+
+bool BlocksAllocator::grow(size_t region_index, size_t min_committed) {
+  Region &region = regions_[region_index];
+  if (base == nullptr || min_committed > region_slots_)
+    return false;
+  if (min_committed <= region.committed)
+    return true;
+
+  // Doubling keeps the number of mprotect calls logarithmic
+  const size_t step = commit_granularity_;
+  const size_t target =
+      std::min(std::max(min_committed, region.committed * 2), region_slots_);
+  const size_t bytes =
+      std::min((target * k_block_size + step - 1) / step * step,
+               reserved_bytes_ / regions_.size());
+  if (!commit(region_index,
+              base + region.begin * k_block_size + region.committed_bytes,
+              bytes - region.committed_bytes))
+    return false;
+  region.committed_bytes = bytes;
+  const size_t slots = std::min(bytes / k_block_size, region_slots_);
+
+  // Cold halves of the same slots
+  const size_t page = small_page_;
+  const size_t cold_bytes =
+      std::min((slots * k_cold_size + page - 1) / page * page,
+               cold_reserved_bytes_ / regions_.size());
+  if (cold_bytes > region.cold_committed_bytes) {
+    if (!commit(region_index,
+                cold_base + region.begin * k_cold_size +
+                    region.cold_committed_bytes,
+                cold_bytes - region.cold_committed_bytes))
+      return false;
+    region.cold_committed_bytes = cold_bytes;
+  }
+
+  const size_t old_end = region.end();
+  region.committed = slots;
+  spans_[region_index].store(region.committed, std::memory_order_relaxed);
+  capacity = regions_.back().end();
+  // Slots past the old bitmap are holes until their region commits them
+  occupied_.resize((capacity + 63) / 64, ~uint64_t{0});
+  for (size_t i = old_end; i < region.end(); ++i)
+    mark(i, false);
+  if (placement == BlockPlacement::kFreeList) {
+    next_free_array.resize(capacity, kNoSlot);
+    // Lowest new slot on top of the stack
+    for (size_t i = region.end(); i-- > old_end;) {
+      next_free_array[i] = region.free_head;
+      region.free_head = i;
+    }
+  }
+  last_block = capacity ? base + (capacity - 1) * k_block_size : nullptr;
+  debug::debug_print("Region {} grew {} -> {} slots", region_index,
+                     old_end - region.begin, region.committed);
+  return true;
+}
+
+bool BlocksAllocator::commit(size_t region_index, std::byte *fresh,
+                             size_t bytes) {
+  const bool hot = fresh >= base && fresh < base + reserved_bytes_;
+  if (hot && backing_ == PageBacking::kHugeTlb) {
+    if (!map_huge_tlb(fresh, bytes))
+      return false;
+  } else if (mprotect(fresh, bytes, PROT_READ | PROT_WRITE) != 0) {
+    debug::debug_print("mprotect of {} bytes failed in region {}", bytes,
+                       region_index);
+    return false;
+  }
+  // Before anything touches them, so no page lands on the wrong node
+  if (!nodes_.empty() && !numa::prefer(nodes_[region_index], fresh, bytes))
+    debug::debug_print("Region {}: no NUMA policy for {} bytes", region_index,
+                       bytes);
+  return true;
+}
+
+// Explicit huge pages, mapped over the reserve chunk by chunk as grow()
+// commits. Without MAP_NORESERVE each mmap takes its pages from the pool
+// right away, so a short pool shows up here as ENOMEM rather than as SIGBUS
+// on first touch, and only what is committed is ever held
+bool BlocksAllocator::map_huge_tlb(std::byte *fresh, size_t bytes) {
+#ifdef MAP_HUGETLB
+  if (mmap(fresh, bytes, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1,
+           0) != MAP_FAILED)
+    return true;
+#endif
+  // A failed MAP_FIXED leaves a hole where the chunk was reserved. Regular
+  // pages go there instead, unless another mapping took it meanwhile
+#ifdef MAP_FIXED_NOREPLACE
+  constexpr int kNoReplace = MAP_FIXED_NOREPLACE;
+#else
+  constexpr int kNoReplace = MAP_FIXED;
+#endif
+  void *chunk = mmap(fresh, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | kNoReplace,
+                     -1, 0);
+  if (chunk != fresh) {
+    debug::debug_print("Arena lost {} bytes of its reserve", bytes);
+    if (chunk != MAP_FAILED)
+      munmap(chunk, bytes);
+    return false;
+  }
+  fall_back_from_huge_tlb();
+  return true;
+}
+
+// The pool ran dry: the rest of the arena, committed or not yet, goes on
+// transparent huge pages. Slots already on hugetlb pages stay there
+void BlocksAllocator::fall_back_from_huge_tlb() {
+  debug::debug_print("hugetlb pool exhausted, arena continues on THP");
+  backing_ = PageBacking::kSmall;
+#ifdef MADV_HUGEPAGE
+  if (madvise(base, reserved_bytes_, MADV_HUGEPAGE) == 0)
+    backing_ = PageBacking::kTransparent;
+#endif
+}
+
+// Address space only: nothing is backed until grow() commits it. For huge
+// pages the range starts on a 2 MB boundary
+bool BlocksAllocator::reserve_range(size_t bytes) {
+  const size_t slack = pages == PageSize::kHuge ? kHugePageSize : 0;
+  void *range = mmap(nullptr, bytes + slack, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (range == MAP_FAILED)
+    return false;
+  std::byte *start = static_cast<std::byte *>(range);
+  if (slack != 0) {
+    const auto addr = reinterpret_cast<uintptr_t>(start);
+    const size_t head = (kHugePageSize - addr % kHugePageSize) % kHugePageSize;
+    if (head != 0)
+      munmap(start, head);
+    if (slack - head != 0)
+      munmap(start + head + bytes, slack - head);
+    start += head;
+  }
+  base = start;
+  reserved_bytes_ = bytes;
+  backing_ = PageBacking::kSmall;
+  if (pages == PageSize::kHuge) {
+#ifdef MAP_HUGETLB
+    backing_ = PageBacking::kHugeTlb;
+#else
+    fall_back_from_huge_tlb();
+#endif
+  }
+  return true;
+}
+
 int BlocksAllocator::initialize() {
-  try {
-    base = static_cast<std::byte *>(malloc(capacity * k_block_size));
-    if (base == nullptr)
-      return -1;
-    last_block = base + (capacity - 1) * capacity;
-    return 0;
-  } catch (...) {
+  if (max_capacity == 0)
+    return -1;
+  // Huge pages are committed whole, THP or not
+  commit_granularity_ = pages == PageSize::kHuge
+                            ? kHugePageSize
+                            : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  small_page_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t step = commit_granularity_;
+  const size_t page = small_page_;
+  const size_t n_regions = std::max<size_t>(nodes_.size(), 1);
+
+  // Every region starts on a page boundary in both ranges, so its pages
+  // belong to it alone
+  region_slots_ = (max_capacity + n_regions - 1) / n_regions;
+  if (n_regions > 1) {
+    const size_t unit = std::lcm(step / std::gcd(step, k_block_size),
+                                 page / std::gcd(page, k_cold_size));
+    region_slots_ = (region_slots_ + unit - 1) / unit * unit;
+  }
+  const size_t region_bytes =
+      (region_slots_ * k_block_size + step - 1) / step * step;
+  const size_t bytes = region_bytes * n_regions;
+  const size_t cold_region_bytes =
+      (region_slots_ * k_cold_size + page - 1) / page * page;
+
+  if (!reserve_range(bytes))
+    return -1;
+  void *cold = mmap(nullptr, cold_region_bytes * n_regions, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (cold == MAP_FAILED) {
+    clean_up();
     return -1;
   }
+  cold_base = static_cast<std::byte *>(cold);
+  cold_reserved_bytes_ = cold_region_bytes * n_regions;
+  debug::debug_print("Arena reserved {} + {} cold bytes in {} regions, {}",
+                     reserved_bytes_, cold_reserved_bytes_, n_regions,
+                     page_backing_name(backing_));
+
+  regions_.resize(n_regions);
+  spans_ = std::make_unique<std::atomic<size_t>[]>(n_regions);
+  for (size_t r = 0; r < n_regions; ++r)
+    regions_[r].begin = r * region_slots_;
+  const size_t per_region =
+      std::max<size_t>((initial_capacity_ + n_regions - 1) / n_regions, 1);
+  for (size_t r = 0; r < n_regions; ++r) {
+    if (!grow(r, per_region)) {
+      clean_up();
+      return -1;
+    }
+  }
+  return 0;
 }
 
 // Separate func, as we might get out of range and need reallocate without
 // destroying everything
 void BlocksAllocator::clean_up() {
+  if (cold_base != nullptr) {
+    munmap(cold_base, cold_reserved_bytes_);
+    cold_base = nullptr;
+    cold_reserved_bytes_ = 0;
+  }
   if (base != nullptr) {
-    free(base);
+    munmap(base, reserved_bytes_);
     base = nullptr;
     last_block = nullptr;
+    capacity = 0;
+    reserved_bytes_ = 0;
+    regions_.clear();
+    next_free_array.clear();
+    occupied_.clear();
   };
 };
 
@@ -1,114 +1,375 @@
 #include "memory/blocks_manager.h"
 #include "ds/storage/particleBlock.h"
 #include "memory/blocks_arena.h"
+#include "memory/numa.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
-BlockMemoryManager::BlockMemoryManager(size_t N_body)
-    : arena_(compute_capacity(N_body)) {
+namespace {
+constexpr size_t kNoThreadSlot = BlockMemoryManager::kMaxThreads;
+
+// Dense ids of live threads, recycled on thread exit. A thread that inherits
+// an id also inherits the magazines of its dead predecessor, which is fine:
+// they only hold free slots
+std::atomic<uint64_t> taken_thread_slots{0};
+
+struct ThreadSlot {
+  size_t id = kNoThreadSlot;
+
+  ThreadSlot() {
+    static_assert(BlockMemoryManager::kMaxThreads == 64);
+    uint64_t taken = taken_thread_slots.load(std::memory_order_relaxed);
+    while (taken != ~uint64_t{0}) {
+      const size_t free_id = static_cast<size_t>(std::countr_one(taken));
+      if (taken_thread_slots.compare_exchange_weak(
+              taken, taken | (uint64_t{1} << free_id),
+              std::memory_order_acquire, std::memory_order_relaxed)) {
+        id = free_id;
+        return;
+      }
+    }
+  }
+  ~ThreadSlot() {
+    if (id != kNoThreadSlot)
+      taken_thread_slots.fetch_and(~(uint64_t{1} << id),
+                                   std::memory_order_release);
+  }
+};
+
+size_t thread_slot() {
+  thread_local const ThreadSlot slot;
+  return slot.id;
+}
+} // namespace
+
+BlockMemoryManager::BlockMemoryManager(size_t N_body, sfc::Curve curve,
+                                       BlockPlacement placement,
+                                       PageSize pages, bool numa_regions,
+                                       unsigned max_depth)
+    : arena_(compute_capacity(N_body),
+             compute_max_capacity(N_body, max_depth), placement, pages,
+             numa_regions ? numa::read_nodes() : std::vector<numa::Node>{}),
+      curve_(curve) {
 
   if (arena_.initialize() != 0) {
     throw std::runtime_error("Failed to init arena");
   }
 
-  active_blocks_.resize(arena_.capacity, false);
-  block_keys_.resize(arena_.capacity);
+  magazines_ = std::make_unique<Magazine[]>(kMaxThreads);
+  active_words_ = (arena_.slot_limit() + 63) / 64;
+  active_ = std::make_unique<std::atomic<uint64_t>[]>(active_words_);
+}
+
+BlockMemoryManager::Magazine *BlockMemoryManager::own_magazine() {
+  const size_t id = thread_slot();
+  return id == kNoThreadSlot ? nullptr : &magazines_[id];
+}
+
+size_t BlockMemoryManager::take_cached(Magazine &magazine, size_t hint,
+                                       size_t window) const {
+  if (magazine.count == 0)
+    return BlocksAllocator::kNoSlot;
+  size_t pick = magazine.count - 1;
+  if (arena_.placement == BlockPlacement::kSpatial) {
+    size_t best = window + 1;
+    for (size_t k = 0; k < magazine.count; ++k) {
+      const size_t slot = magazine.slots[k];
+      const size_t distance = slot > hint ? slot - hint : hint - slot;
+      if (distance < best) {
+        best = distance;
+        pick = k;
+      }
+    }
+    if (best > window)
+      return BlocksAllocator::kNoSlot;
+  }
+  const size_t slot = magazine.slots[pick];
+  magazine.slots[pick] = magazine.slots[--magazine.count];
+  return slot;
+}
+
+void BlockMemoryManager::refill(Magazine &magazine, size_t hint) {
+  std::lock_guard<std::mutex> lock(depot_mutex_);
+  for (size_t k = 0; k < kRefillBatch && magazine.count < kMagazineSize;
+       ++k) {
+    ParticleBlock *block = arena_.allocate(hint);
+    if (!block)
+      break;
+    magazine.slots[magazine.count++] =
+        static_cast<uint32_t>(get_block_index(block));
+  }
+}
+
+size_t BlockMemoryManager::take_slot(size_t hint) {
+  Magazine *magazine = own_magazine();
+  if (!magazine) {
+    std::lock_guard<std::mutex> lock(depot_mutex_);
+    ParticleBlock *block = arena_.allocate(hint);
+    return block ? get_block_index(block) : BlocksAllocator::kNoSlot;
+  }
+
+  size_t slot = take_cached(*magazine, hint, kSpatialWindow);
+  if (slot == BlocksAllocator::kNoSlot) {
+    refill(*magazine, hint);
+    // Whatever the arena had nearest, even if the window is missed
+    slot = take_cached(*magazine, hint, BlocksAllocator::kNoSlot - 1);
+  }
+  return slot;
+}
+
+void BlockMemoryManager::give_back(size_t inx) {
+  Magazine *magazine = own_magazine();
+  if (magazine && magazine->count < kMagazineSize) {
+    magazine->slots[magazine->count++] = static_cast<uint32_t>(inx);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(depot_mutex_);
+  arena_.deallocate(block_at(inx));
+  // Full magazine: return half in one go so the next frees stay local
+  if (magazine) {
+    while (magazine->count > kMagazineSize / 2)
+      arena_.deallocate(block_at(magazine->slots[--magazine->count]));
+  }
+}
+
+void BlockMemoryManager::activate(size_t inx, MortonKey key) {
+  ParticleBlock *block = block_at(inx);
+  block->initialize();
+  block->meta_block.key = key;
+  active_[inx / 64].fetch_or(uint64_t{1} << (inx % 64),
+                             std::memory_order_relaxed);
+  live_blocks_.fetch_add(1, std::memory_order_relaxed);
 }
 
 ParticleBlock *BlockMemoryManager::create_block(MortonKey key) {
-  ParticleBlock *block = arena_.allocate();
-  if (!block)
+  const size_t inx =
+      take_slot(slot_hint(sfc::order_key(curve_, key.key_number)));
+  if (inx == BlocksAllocator::kNoSlot)
     return nullptr;
+  activate(inx, key);
+  return block_at(inx);
+}
 
-  size_t index = (size_t)(reinterpret_cast<std::byte *>(block) - arena_.base) /
-                 arena_.k_block_size;
-  block->initialize();
-  block_keys_[index] = key;
-  active_blocks_[index] = true;
+bool BlockMemoryManager::create_child_blocks(MortonKey parent,
+                                             ParticleBlock *out[8]) {
+  std::array<sfc::OrderKey, 8> keys;
+  std::array<std::pair<sfc::OrderKey, unsigned>, 8> by_curve;
+  for (unsigned octant = 0; octant < 8; ++octant) {
+    keys[octant] =
+        sfc::order_key(curve_, sfc::child_code(parent.key_number, octant));
+    by_curve[octant] = {keys[octant], octant};
+  }
+  std::sort(by_curve.begin(), by_curve.end());
+
+  // The children cover the parent's curve range, which starts at the first one
+  ParticleBlock *run = nullptr;
+  if (arena_.placement == BlockPlacement::kSpatial) {
+    std::lock_guard<std::mutex> lock(depot_mutex_);
+    run = arena_.allocate_run(8, slot_hint(by_curve[0].first));
+  }
+  if (run) {
+    const size_t first = get_block_index(run);
+    for (size_t rank = 0; rank < 8; ++rank)
+      out[by_curve[rank].second] = block_at(first + rank);
+  } else {
+    // Fragmented arena or LIFO policy: one slot per child, still near its key
+    for (unsigned octant = 0; octant < 8; ++octant) {
+      const size_t inx = take_slot(slot_hint(keys[octant]));
+      if (inx == BlocksAllocator::kNoSlot) {
+        for (unsigned k = 0; k < 8; ++k) {
+          if (k < octant)
+            give_back(get_block_index(out[k]));
+          out[k] = nullptr;
+        }
+        return false;
+      }
+      out[octant] = block_at(inx);
+    }
+  }
 
-  return block;
+  for (unsigned octant = 0; octant < 8; ++octant)
+    activate(get_block_index(out[octant]),
+             MortonKey{sfc::child_code(parent.key_number, octant)});
+  return true;
 }
 
 void BlockMemoryManager::destroy_block(ParticleBlock *p_bl) {
   if (!p_bl)
     return;
 
-  size_t index = (size_t)(reinterpret_cast<std::byte *>(p_bl) - arena_.base) /
-                 arena_.k_block_size;
-  arena_.deallocate(p_bl);
-  active_blocks_[index] = false;
+  const size_t index = get_block_index(p_bl);
+  const uint64_t bit = uint64_t{1} << (index % 64);
+  // Double release is a no-op, as it used to be for the arena
+  if (!(active_[index / 64].fetch_and(~bit, std::memory_order_relaxed) & bit))
+    return;
+  live_blocks_.fetch_sub(1, std::memory_order_relaxed);
+  give_back(index);
 }
 
-ParticleBlock *BlockMemoryManager::get_block_data(size_t inx) {
-  if (inx >= arena_.capacity || !active_blocks_[inx]) {
-    return nullptr;
+void BlockMemoryManager::flush_magazines() {
+  std::lock_guard<std::mutex> lock(depot_mutex_);
+  for (size_t id = 0; id < kMaxThreads; ++id) {
+    Magazine &magazine = magazines_[id];
+    while (magazine.count > 0)
+      arena_.deallocate(block_at(magazine.slots[--magazine.count]));
   }
-  return reinterpret_cast<ParticleBlock *>(arena_.base +
-                                           inx * arena_.k_block_size);
+}
+
+ParticleBlock *BlockMemoryManager::get_block_data(size_t inx) {
+  return is_active(inx) ? block_at(inx) : nullptr;
 }
 
 const ParticleBlock *BlockMemoryManager::get_block_data(size_t index) const {
-  if (index >= arena_.capacity || !active_blocks_[index]) {
-    return nullptr;
-  }
-  return reinterpret_cast<const ParticleBlock *>(arena_.base +
-                                                 index * arena_.k_block_size);
+  return is_active(index) ? block_at(index) : nullptr;
 }
 
 MortonKey BlockMemoryManager::get_block_key(size_t inx) const {
-  if (inx >= block_keys_.size()) {
+  if (!is_active(inx)) {
     return MortonKey{};
   }
-  return block_keys_[inx];
+  return block_at(inx)->meta_block.key;
 }
 
-void BlockMemoryManager::swap_blocks(size_t inx_a, size_t inx_b) {
-  if (inx_a >= arena_.capacity || inx_b >= arena_.capacity ||
-      !active_blocks_[inx_a] || !active_blocks_[inx_b])
-    return;
+sfc::OrderKey BlockMemoryManager::get_block_order_key(size_t inx) const {
+  const MortonKey key = get_block_key(inx);
+  if (key.key_number == 0)
+    return 0;
+  return sfc::order_key(curve_, key.key_number);
+}
 
+void BlockMemoryManager::swap_blocks(size_t inx_a, size_t inx_b) {
   ParticleBlock *block_a = get_block_data(inx_a);
   ParticleBlock *block_b = get_block_data(inx_b);
 
   if (!block_a || !block_b)
     return;
 
+  // Keys live in the meta block and travel with it
   block_a->swap(*block_b);
-
-  std::swap(block_keys_[inx_a], block_keys_[inx_b]);
 }
 
-void BlockMemoryManager::compact() {
-  size_t free_slot = 0;
-  while (free_slot < arena_.capacity && active_blocks_[free_slot]) {
-    free_slot++;
+std::vector<uint32_t> BlockMemoryManager::compact() {
+  constexpr uint32_t kNone = ParticleBlock::kNoNextBlock;
+  constexpr unsigned kFractionBits = 32;
+  flush_magazines();
+  const size_t bound = arena_.capacity;
+
+  // Overflow blocks are reached through their head, so only heads are sorted
+  std::vector<uint8_t> is_overflow(bound, 0);
+  for (size_t i = 0; i < bound; ++i) {
+    if (!is_active(i))
+      continue;
+    const uint32_t next = block_at(i)->meta_block.next_logical_block;
+    if (next != kNone)
+      is_overflow[next] = 1;
   }
+  std::vector<std::pair<sfc::OrderKey, uint32_t>> heads;
+  for (size_t i = 0; i < bound; ++i)
+    if (is_active(i) && !is_overflow[i])
+      heads.push_back({sfc::order_key(curve_, get_block_key(i).key_number),
+                       static_cast<uint32_t>(i)});
+  std::sort(heads.begin(), heads.end());
 
-  for (size_t i = free_slot + 1; i < arena_.capacity; i++) {
-    if (active_blocks_[i]) {
-      ParticleBlock *src_block = get_block_data(i);
-      ParticleBlock *dest_block = get_block_data(free_slot);
+  struct Entry {
+    uint32_t slot;
+    uint64_t fraction; // curve position, as slot_for() takes it
+  };
+  std::vector<Entry> order;
+  for (const auto &[key, head] : heads)
+    for (uint32_t b = head; b != kNone;
+         b = block_at(b)->meta_block.next_logical_block)
+      order.push_back({b, key >> (3 * sfc::kMaxLevel - kFractionBits)});
 
-      if (src_block && dest_block) {
-        *dest_block = std::move(*src_block);
-        block_keys_[free_slot] = block_keys_[i];
-        active_blocks_[free_slot] = true;
-        active_blocks_[i] = false;
+  // Targets, region by region. Each block lands at or after its slot hint
+  // while leaving room for the blocks behind it, so the spare slots stay
+  // spread the way spatial placement expects. kFreeList just packs
+  std::vector<uint32_t> moved(bound, kNone);
+  std::vector<size_t> targets;
+  targets.reserve(order.size());
+  const size_t regions = arena_.region_count();
+  size_t k = 0;
+  for (size_t r = 0; r < regions; ++r) {
+    size_t last = k;
+    while (last < order.size() &&
+           ((order[last].fraction * regions) >> kFractionBits) == r)
+      ++last;
+    const size_t count = last - k;
+    if (count > arena_.region_committed(r) && !arena_.reserve(r, count))
+      return {};
 
-        arena_.deallocate(src_block);
-      }
-      while (free_slot < arena_.capacity && active_blocks_[free_slot]) {
-        free_slot++;
-      }
+    size_t pos = arena_.region_begin(r);
+    const size_t end = pos + arena_.region_committed(r);
+    for (; k < last; ++k) {
+      size_t target = pos;
+      if (arena_.placement == BlockPlacement::kSpatial)
+        target = std::clamp(arena_.slot_for(order[k].fraction), pos,
+                            end - (last - k));
+      moved[order[k].slot] = static_cast<uint32_t>(target);
+      targets.push_back(target);
+      pos = target + 1;
+    }
+  }
+
+  // Apply the permutation in place by following each cycle with swaps
+  // through its first slot: after swapping with the target, `start` holds
+  // the block that goes next. Every slot on the way is bound to its own
+  // cold half first, so swap() carries the cold data along. A cycle ends
+  // back at `start`, or at a slot whose block has left already (or never
+  // was), which then takes the leftovers
+  for (const Entry &entry : order)
+    block_at(entry.slot)->cold_block = cold_at(entry.slot);
+  for (size_t target : targets)
+    block_at(target)->cold_block = cold_at(target);
+  std::vector<uint8_t> done(bound, 0);
+  bool any_moved = false;
+  for (const Entry &entry : order) {
+    const size_t start = entry.slot;
+    if (done[start] || moved[start] == start) {
+      done[start] = 1;
+      continue;
     }
+    any_moved = true;
+    done[start] = 1;
+    for (size_t to = moved[start]; to != start;) {
+      block_at(start)->swap(*block_at(to));
+      if (to >= bound || moved[to] == kNone || done[to])
+        break;
+      done[to] = 1;
+      to = moved[to];
+    }
+  }
+  if (!any_moved)
+    return {};
+
+  for (const Entry &entry : order) {
+    uint32_t &next =
+        block_at(moved[entry.slot])->meta_block.next_logical_block;
+    if (next != kNone)
+      next = moved[next];
   }
+
+  for (size_t w = 0; w < active_words_; ++w)
+    active_[w].store(0, std::memory_order_relaxed);
+  for (size_t target : targets)
+    active_[target / 64].fetch_or(uint64_t{1} << (target % 64),
+                                  std::memory_order_relaxed);
+  arena_.reassign(targets);
+  return moved;
 }
 
 BlockMemoryManager::Iterator BlockMemoryManager::begin() {
   size_t first_index = 0;
-  while (first_index < arena_.capacity && !active_blocks_[first_index]) {
+  while (first_index < arena_.capacity && !is_active(first_index)) {
     first_index++;
   }
   return Iterator(this, first_index);
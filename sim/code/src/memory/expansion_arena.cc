@@ -0,0 +1,22 @@
+#include "memory/expansion_arena.h"
+#include <cstddef>
+#include <cstdlib>
+
+int ExpansionArena::reserve(size_t bytes) {
+  std::free(base_);
+  base_ = nullptr;
+  capacity_ = 0;
+  used_ = 0;
+
+  // aligned_alloc wants a multiple of the alignment
+  const size_t rounded = (bytes + kAlignment - 1) & ~(kAlignment - 1);
+  if (rounded == 0)
+    return 0;
+  base_ = static_cast<std::byte *>(std::aligned_alloc(kAlignment, rounded));
+  if (base_ == nullptr)
+    return -1;
+  capacity_ = rounded;
+  return 0;
+}
+
+ExpansionArena::~ExpansionArena() { std::free(base_); }
@@ -0,0 +1,95 @@
+#include "memory/numa.h"
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace numa {
+
+std::vector<unsigned> parse_cpu_list(const std::string &list) {
+  std::vector<unsigned> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+                range.end());
+    if (range.empty())
+      continue;
+    try {
+      const size_t dash = range.find('-');
+      const unsigned lo = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+      const unsigned hi =
+          dash == std::string::npos
+              ? lo
+              : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+      if (hi < lo)
+        return {};
+      for (unsigned cpu = lo; cpu <= hi; ++cpu)
+        cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      return {};
+    }
+  }
+  return cpus;
+}
+
+std::vector<Node> read_nodes(const std::string &root) {
+  namespace fs = std::filesystem;
+  std::vector<Node> nodes;
+  std::error_code ec;
+  for (const fs::directory_entry &entry : fs::directory_iterator(root, ec)) {
+    const std::string name = entry.path().filename().string();
+    if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+        !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+      continue;
+
+    std::ifstream file(entry.path() / "cpulist");
+    std::string list;
+    if (!file || !std::getline(file, list))
+      continue;
+    Node node;
+    node.id = static_cast<unsigned>(std::stoul(name.substr(4)));
+    node.cpus = parse_cpu_list(list);
+    // Memory-only nodes (CXL, HBM) have nobody to own their regions
+    if (!node.cpus.empty())
+      nodes.push_back(std::move(node));
+  }
+  std::sort(nodes.begin(), nodes.end(),
+            [](const Node &a, const Node &b) { return a.id < b.id; });
+  return nodes;
+}
+
+bool pin_to(const Node &node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : node.cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// mbind(2) straight through syscall(), there is no libnuma to wrap it
+bool prefer(const Node &node, void *begin, size_t bytes) {
+#ifdef SYS_mbind
+  constexpr int kPreferred = 1; // MPOL_PREFERRED
+  constexpr size_t kBits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node.id / kBits + 1, 0);
+  mask[node.id / kBits] = 1ul << (node.id % kBits);
+  // The kernel reads maxnode - 1 bits
+  return syscall(SYS_mbind, begin, bytes, kPreferred, mask.data(),
+                 mask.size() * kBits + 1, 0u) == 0;
+#else
+  (void)node;
+  (void)begin;
+  (void)bytes;
+  return false;
+#endif
+}
+
+} // namespace numa
@@ -2,12 +2,13 @@
 #include "ctx/simulation_config.h"
 #include "engine/engine.h"
 #include "gfx/gfx.h"
+#include "utils/affinity.h"
 #include <chrono>
 #include <iostream>
 
 Simulation::Simulation(SimulationConfig &config)
     : ctx(config), PE(ctx.physics(), ctx.state(), ctx.storage(), ctx.data()),
-      gfx(ctx.gfx(), ctx.state(), *PE.tree.get()) {
+      gfx(ctx.gfx(), ctx.state(), PE.render_snapshot()) {
   std::cout << "Simulation initialized!\n";
 };
 
@@ -26,6 +27,10 @@ void Simulation::run() {
   std::cout << "Simulation::Run\n";
   auto check_stepping = std::chrono::milliseconds(20);
   ctx.state().set_state(STATE::RUN);
+  // The main thread is the render loop
+  if (!ctx.affinity().render.empty() &&
+      !affinity::pin_current(ctx.affinity().render))
+    std::cerr << "Render thread: could not pin\n";
 
   if (!ctx.gfx().headless)
     gfx.run();
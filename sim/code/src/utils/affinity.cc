@@ -0,0 +1,230 @@
+#include "utils/affinity.h"
+#include "memory/numa.h"
+#include <algorithm>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace affinity {
+
+Layout layout_from_string(const std::string &name) {
+  if (name == "none")
+    return Layout::kNone;
+  if (name == "compact")
+    return Layout::kCompact;
+  if (name == "scatter")
+    return Layout::kScatter;
+  if (name == "nosmt")
+    return Layout::kNoSmt;
+  throw std::runtime_error("Unknown affinity layout: " + name);
+}
+
+namespace {
+bool read_unsigned(const std::string &path, unsigned &out) {
+  std::ifstream file(path);
+  long value = -1;
+  if (!(file >> value) || value < 0)
+    return false;
+  out = static_cast<unsigned>(value);
+  return true;
+}
+
+std::vector<unsigned> allowed_cpus() {
+  std::vector<unsigned> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return cpus;
+  for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back(cpu);
+  return cpus;
+}
+
+cpu_set_t to_set(const std::vector<unsigned> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  return set;
+}
+} // namespace
+
+std::vector<Cpu> read_topology(const std::string &root) {
+  std::vector<Cpu> cpus;
+  for (unsigned id : allowed_cpus()) {
+    const std::string dir = root + "/cpu" + std::to_string(id) + "/topology/";
+    Cpu cpu{.id = id, .core = id};
+    if (!read_unsigned(dir + "core_id", cpu.core))
+      cpu.core = id;
+    read_unsigned(dir + "physical_package_id", cpu.package);
+    std::ifstream file(dir + "thread_siblings_list");
+    std::string list;
+    if (file && std::getline(file, list)) {
+      const std::vector<unsigned> siblings = numa::parse_cpu_list(list);
+      const auto it = std::find(siblings.begin(), siblings.end(), id);
+      if (it != siblings.end())
+        cpu.smt_rank = static_cast<unsigned>(it - siblings.begin());
+    }
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<unsigned> order(std::vector<Cpu> cpus, Layout layout) {
+  if (layout == Layout::kNone)
+    return {};
+  if (layout == Layout::kNoSmt)
+    std::erase_if(cpus, [](const Cpu &cpu) { return cpu.smt_rank != 0; });
+
+  if (layout == Layout::kScatter) {
+    // Rank of the core within its package, so package 0's first core, then
+    // package 1's first core, ...
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu &a, const Cpu &b) {
+      return std::tie(a.package, a.core) < std::tie(b.package, b.core);
+    });
+    std::vector<unsigned> core_rank(cpus.size());
+    for (size_t i = 1; i < cpus.size(); ++i) {
+      const bool same_package = cpus[i].package == cpus[i - 1].package;
+      const bool same_core = same_package && cpus[i].core == cpus[i - 1].core;
+      core_rank[i] = !same_package ? 0
+                     : same_core   ? core_rank[i - 1]
+                                   : core_rank[i - 1] + 1;
+    }
+    std::vector<size_t> index(cpus.size());
+    for (size_t i = 0; i < index.size(); ++i)
+      index[i] = i;
+    std::stable_sort(index.begin(), index.end(), [&](size_t a, size_t b) {
+      return std::tie(cpus[a].smt_rank, core_rank[a], cpus[a].package) <
+             std::tie(cpus[b].smt_rank, core_rank[b], cpus[b].package);
+    });
+    std::vector<unsigned> ids;
+    for (size_t i : index)
+      ids.push_back(cpus[i].id);
+    return ids;
+  }
+
+  std::sort(cpus.begin(), cpus.end(), [](const Cpu &a, const Cpu &b) {
+    return std::tie(a.package, a.core, a.smt_rank, a.id) <
+           std::tie(b.package, b.core, b.smt_rank, b.id);
+  });
+  std::vector<unsigned> ids;
+  for (const Cpu &cpu : cpus)
+    ids.push_back(cpu.id);
+  return ids;
+}
+
+namespace {
+// Runner k belongs to node k * nodes / runners, so the groups are
+// contiguous and as equal as the counts allow
+void plan_by_node(const Request &request, const std::vector<Cpu> &topology,
+                  const std::vector<unsigned> &auto_order, Plan &result) {
+  const size_t runners = result.physics.size();
+  const size_t nodes = request.nodes.size();
+  auto on_node = [&](size_t node, unsigned cpu) {
+    const std::vector<unsigned> &cpus = request.nodes[node];
+    return std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+  };
+  // Per node: the layout's order restricted to it, or with kNone every CPU
+  // of it the process may use
+  std::vector<std::vector<unsigned>> node_cpus(nodes);
+  for (size_t node = 0; node < nodes; ++node) {
+    if (request.layout != Layout::kNone) {
+      for (unsigned cpu : auto_order)
+        if (on_node(node, cpu))
+          node_cpus[node].push_back(cpu);
+    } else {
+      for (const Cpu &cpu : topology)
+        if (on_node(node, cpu.id))
+          node_cpus[node].push_back(cpu.id);
+    }
+  }
+
+  result.homes.resize(runners);
+  std::vector<size_t> taken(nodes, 0);
+  for (size_t k = 0; k < runners; ++k) {
+    size_t home = k * nodes / runners;
+    if (!request.physics_cpus.empty()) {
+      // Explicit CPUs keep their runner, the runner goes with the CPU
+      const std::vector<unsigned> &cpus = request.physics_cpus;
+      const unsigned cpu = cpus[k % cpus.size()];
+      result.physics[k] = {cpu};
+      for (size_t node = 0; node < nodes; ++node)
+        if (on_node(node, cpu))
+          home = node;
+    } else if (request.layout == Layout::kNone) {
+      result.physics[k] = node_cpus[home];
+    } else if (!node_cpus[home].empty()) {
+      const std::vector<unsigned> &cpus = node_cpus[home];
+      result.physics[k] = {cpus[taken[home]++ % cpus.size()]};
+    }
+    result.homes[k] = static_cast<unsigned>(home);
+  }
+}
+} // namespace
+
+Plan plan(const Request &request, const std::vector<Cpu> &topology) {
+  Plan result;
+  const std::vector<unsigned> auto_order = order(topology, request.layout);
+  // An automatic pool that would take every CPU of the layout gives one
+  // back to render and I/O, as long as two runners remain
+  size_t runners = request.physics_runners;
+  const bool roles_auto =
+      request.render_cpus.empty() || request.io_cpus.empty();
+  if (request.auto_runners && roles_auto && request.physics_cpus.empty() &&
+      auto_order.size() > 2 && runners >= auto_order.size())
+    runners = auto_order.size() - 1;
+  result.physics.resize(runners);
+
+  if (request.nodes.size() > 1) {
+    plan_by_node(request, topology, auto_order, result);
+  } else {
+    // One CPU per runner, wrapping if there are more runners than CPUs
+    const std::vector<unsigned> &physics =
+        request.physics_cpus.empty() ? auto_order : request.physics_cpus;
+    if (!physics.empty())
+      for (size_t i = 0; i < result.physics.size(); ++i)
+        result.physics[i] = {physics[i % physics.size()]};
+  }
+
+  // Render and I/O take what the runners left, from the back of the order
+  std::vector<unsigned> spare;
+  for (unsigned cpu : auto_order)
+    if (std::none_of(result.physics.begin(), result.physics.end(),
+                     [cpu](const std::vector<unsigned> &cpus) {
+                       return std::find(cpus.begin(), cpus.end(), cpu) !=
+                              cpus.end();
+                     }))
+      spare.push_back(cpu);
+  // Nothing left: unpinned beats preempting a runner on its own CPU
+  result.render = request.render_cpus;
+  if (result.render.empty() && !spare.empty())
+    result.render = {spare.back()};
+  result.io = request.io_cpus;
+  if (result.io.empty() && !auto_order.empty()) {
+    if (spare.size() > 1)
+      result.io.assign(spare.begin(), spare.end() - 1);
+    else
+      result.io = result.render;
+  }
+  return result;
+}
+
+bool pin(std::thread::native_handle_type thread,
+         const std::vector<unsigned> &cpus) {
+  if (cpus.empty())
+    return false;
+  const cpu_set_t set = to_set(cpus);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+bool pin_current(const std::vector<unsigned> &cpus) {
+  return pin(pthread_self(), cpus);
+}
+
+} // namespace affinity
@@ -1,6 +1,10 @@
 #include "utils/generators.h"
 #include "core/bodies/particles.h"
 #include "gfx/renderer/scene.h"
+#include "io/body_source.h"
+#include "io/gadget.h"
+#include "io/text_table.h"
+#include "utils/thread_pool.h"
 #include "utils/namespaces/MyMath.h"
 #include <random>
 #include <vector>
@@ -179,7 +183,18 @@ CResult<std::vector<Particle>> load_from_file(const std::string &filename) {
     throw std::runtime_error("Filename not specified for FILE mode");
   }
 
-  return CResult<std::vector<Particle>>::error(1, "not implemented");
+  ThreadPool pool;
+  auto input = io::open_body_source(filename, io::TextFormat{},
+                                    io::GadgetUnits{}, pool);
+  if (input.is_error())
+    return CResult<std::vector<Particle>>::error(input.code(),
+                                                 input.error_message());
+  const io::BodySource &source = *input.value();
+  std::vector<Particle> bodies;
+  bodies.reserve(source.size());
+  for (size_t part = 0; part < source.parts(); ++part)
+    source.for_each(part, [&](const Particle &p) { bodies.push_back(p); });
+  return CResult<std::vector<Particle>>::success(std::move(bodies));
 }
 
 CResult<std::vector<Particle>> download_dataset(const std::string &dataset_name,
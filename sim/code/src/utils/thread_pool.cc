@@ -0,0 +1,222 @@
+#include "utils/thread_pool.h"
+#include "utils/affinity.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+// Which pool the current thread works for, and its slot there
+thread_local const ThreadPool *tls_pool = nullptr;
+thread_local unsigned tls_worker = 0;
+
+// Victim selection only needs to spread thieves out
+uint32_t next_random() {
+  thread_local uint32_t state =
+      static_cast<uint32_t>(std::hash<std::thread::id>{}(
+          std::this_thread::get_id())) |
+      1u;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+} // namespace
+
+unsigned ThreadPool::resolve_workers(unsigned workers) {
+  if (workers == 0)
+    return std::max(1u, std::thread::hardware_concurrency()) - 1;
+  return workers;
+}
+
+ThreadPool::ThreadPool(unsigned workers,
+                       std::vector<std::vector<unsigned>> worker_cpus,
+                       std::vector<unsigned> runner_homes) {
+  workers = resolve_workers(workers);
+  unsigned homes = 0;
+  for (unsigned home : runner_homes)
+    homes = std::max(homes, home + 1);
+  for (unsigned h = 0; h < homes; ++h)
+    homes_.push_back(std::make_unique<Inbox>());
+  if (!runner_homes.empty())
+    outside_home_ = runner_homes[0];
+  workers_.reserve(workers);
+  for (unsigned i = 0; i < workers; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+    if (i < worker_cpus.size())
+      workers_[i]->cpus = std::move(worker_cpus[i]);
+    if (i + 1 < runner_homes.size())
+      workers_[i]->home = runner_homes[i + 1];
+  }
+  // Deques exist before any thread can steal from them
+  for (unsigned i = 0; i < workers; ++i)
+    workers_[i]->thread = std::thread(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  stop_.store(true, std::memory_order_release);
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  epoch_.notify_all();
+  for (auto &worker : workers_)
+    worker->thread.join();
+  for (Task *task : inbox_.tasks)
+    delete task;
+  for (auto &home : homes_)
+    for (Task *task : home->tasks)
+      delete task;
+}
+
+unsigned ThreadPool::current_worker() const {
+  return tls_pool == this ? tls_worker : workers();
+}
+
+void ThreadPool::submit(TaskGroup &group, std::function<void()> job,
+                        unsigned home) {
+  group.pending_.fetch_add(1, std::memory_order_relaxed);
+  Task *task = new Task{std::move(job), &group};
+  if (workers_.empty()) {
+    run(task);
+    return;
+  }
+  const unsigned self = current_worker();
+  if (home < homes())
+    push(*homes_[home], task);
+  else if (self < workers())
+    workers_[self]->deque.push(task);
+  else
+    push(inbox_, task);
+  wake_one();
+}
+
+void ThreadPool::push(Inbox &inbox, Task *task) {
+  std::lock_guard lock(inbox.mutex);
+  inbox.tasks.push_back(task);
+  inbox.size.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+  const unsigned self = current_worker();
+  while (!group.done()) {
+    if (Task *task = find_task(self))
+      run(task);
+    else
+      cpu_relax();
+  }
+}
+
+void ThreadPool::run(Task *task) {
+  task->job();
+  task->group->pending_.fetch_sub(1, std::memory_order_release);
+  delete task;
+}
+
+ThreadPool::Task *ThreadPool::find_task(unsigned self) {
+  if (self < workers())
+    if (Task *task = workers_[self]->deque.pop())
+      return task;
+  const unsigned home = self < workers() ? workers_[self]->home : outside_home_;
+  if (home < homes())
+    if (Task *task = take_from(*homes_[home]))
+      return task;
+  if (Task *task = take_from(inbox_))
+    return task;
+  if (Task *task = steal_from_others(self))
+    return task;
+  return take_from_other_homes(home);
+}
+
+ThreadPool::Task *ThreadPool::take_from(Inbox &inbox) {
+  if (inbox.size.load(std::memory_order_relaxed) == 0)
+    return nullptr;
+  std::lock_guard lock(inbox.mutex);
+  if (inbox.tasks.empty())
+    return nullptr;
+  Task *task = inbox.tasks.front();
+  inbox.tasks.pop_front();
+  inbox.size.fetch_sub(1, std::memory_order_relaxed);
+  return task;
+}
+
+// Last resort: another region's work still beats an idle core
+ThreadPool::Task *ThreadPool::take_from_other_homes(unsigned home) {
+  for (unsigned h = 0; h < homes(); ++h)
+    if (h != home)
+      if (Task *task = take_from(*homes_[h]))
+        return task;
+  return nullptr;
+}
+
+bool ThreadPool::any_queued() const {
+  if (inbox_.size.load(std::memory_order_relaxed) != 0)
+    return true;
+  for (const auto &home : homes_)
+    if (home->size.load(std::memory_order_relaxed) != 0)
+      return true;
+  return std::any_of(workers_.begin(), workers_.end(),
+                     [](const auto &w) { return !w->deque.empty(); });
+}
+
+ThreadPool::Task *ThreadPool::steal_from_others(unsigned self) {
+  const unsigned n = workers();
+  const unsigned start = next_random() % n;
+  for (unsigned k = 0; k < n; ++k) {
+    const unsigned victim = (start + k) % n;
+    if (victim == self || workers_[victim]->deque.empty())
+      continue;
+    if (Task *task = workers_[victim]->deque.steal())
+      return task;
+  }
+  return nullptr;
+}
+
+void ThreadPool::worker_loop(unsigned self) {
+  tls_pool = this;
+  tls_worker = self;
+  const std::vector<unsigned> &cpus = workers_[self]->cpus;
+  if (!cpus.empty() && !affinity::pin_current(cpus))
+    std::cerr << "ThreadPool: could not pin worker " << self << "\n";
+  unsigned idle = 0;
+  for (;;) {
+    if (Task *task = find_task(self)) {
+      run(task);
+      idle = 0;
+      continue;
+    }
+    if (stop_.load(std::memory_order_acquire))
+      return;
+    if (++idle <= kSpinRounds) {
+      cpu_relax();
+    } else if (idle <= kSpinRounds + kYieldRounds) {
+      std::this_thread::yield();
+    } else {
+      park();
+      idle = 0;
+    }
+  }
+}
+
+// Announce the sleep, then read the epoch and look once more. A submit that
+// the last look missed bumped the epoch after we read it, so wait() returns
+// at once; a submit that saw sleepers_ == 0 bumped it before, and the look
+// sees its task.
+void ThreadPool::park() {
+  sleepers_.fetch_add(1, std::memory_order_seq_cst);
+  const uint64_t seen = epoch_.load(std::memory_order_seq_cst);
+  if (!any_queued() && !stop_.load(std::memory_order_acquire))
+    epoch_.wait(seen, std::memory_order_seq_cst);
+  sleepers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::wake_one() {
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_seq_cst) > 0)
+    epoch_.notify_one();
+}
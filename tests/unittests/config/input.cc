@@ -1,6 +1,8 @@
 #include "ctx/simulation_config.h"
 #include "gtest/gtest.h"
 #include <exception>
+#include <filesystem>
+#include <fstream>
 #define private public
 
 TEST(ConfigTest, set_defaults) {
@@ -79,3 +81,47 @@ TEST(ConfigTest, usual_flow) {
           .build();
   EXPECT_EQ(general_config.kNBodies, 1244);
 }
+
+// Everything else in a config file is lowercased, paths must survive as
+// written
+TEST(ConfigTest, paths_keep_their_case) {
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "gravwll_ConfigTest";
+  std::filesystem::create_directories(directory);
+  const std::filesystem::path file = directory / "Mixed.Case.conf";
+  {
+    std::ofstream out(file);
+    out << "DATAMODE=File\n"
+        << "File = /data/Runs/Plummer_A.GWP # the input\n"
+        << "SnapshotDir=Out/Run_B\n"
+        << "SnapshotFormat=GADGET\n"
+        << "ShmName=/Gravwll_Test\n";
+  }
+  const auto config = SimulationConfigBuilder()
+                          .with_defaults()
+                          .with_config_file(file.string())
+                          .build();
+  std::filesystem::remove_all(directory);
+  EXPECT_EQ(config.data_population_mode, SimulationConfig::FILE);
+  EXPECT_EQ(config.filename, "/data/Runs/Plummer_A.GWP");
+  EXPECT_EQ(config.kSnapshotDir, "Out/Run_B");
+  EXPECT_EQ(config.kSnapshotFormat, io::SnapshotFormat::kGadget);
+  EXPECT_EQ(config.kShmName, "/Gravwll_Test");
+}
+
+// Location codes run out below sfc::kMaxLevel, deeper trees are refused
+TEST(ConfigTest, tree_depth_fits_location_codes) {
+  const std::filesystem::path file =
+      std::filesystem::temp_directory_path() / "gravwll_ConfigDepth.conf";
+  const auto depth = [&](int value) {
+    std::ofstream(file) << "TreeMaxDepth=" << value << "\n";
+    return SimulationConfigBuilder()
+        .with_defaults()
+        .with_config_file(file.string())
+        .build()
+        .kTreeMaxDepth;
+  };
+  EXPECT_EQ(depth(static_cast<int>(sfc::kMaxLevel)), sfc::kMaxLevel);
+  EXPECT_THROW(depth(static_cast<int>(sfc::kMaxLevel) + 1), std::out_of_range);
+  std::filesystem::remove(file);
+}
@@ -0,0 +1,63 @@
+#include "dist/domain.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <vector>
+
+namespace {
+bool contains(const MyMath::BoundingBox &box, const MyMath::Vector3 &p) {
+  return p.x >= box.min.x && p.x < box.max.x && p.y >= box.min.y &&
+         p.y < box.max.y && p.z >= box.min.z && p.z < box.max.z;
+}
+} // namespace
+
+TEST(DecompositionTest, SplitsBodiesEvenlyAndCellsCoverEachDomain) {
+  constexpr unsigned kRanks = 5;
+  const MyMath::BoundingBox bounds{{0.0, 0.0, 0.0}, {2.0, 1.0, 1.0}};
+  std::mt19937 rng(3);
+  // Clustered, so equal counts do not mean equal volumes
+  std::normal_distribution<double> around(0.5, 0.15);
+  std::vector<Particle> bodies;
+  for (int i = 0; i < 4000; ++i)
+    bodies.push_back(Particle{std::clamp(around(rng) * 2.0, 0.0, 1.999),
+                              std::clamp(around(rng), 0.0, 0.999),
+                              std::clamp(around(rng), 0.0, 0.999), 0, 0, 0,
+                              1.0});
+
+  const dist::Decomposition domain =
+      dist::Decomposition::balance(bodies, bounds, kRanks);
+  ASSERT_EQ(domain.ranks(), kRanks);
+  EXPECT_EQ(domain.splits().front(), 0u);
+  EXPECT_EQ(domain.splits().back(), dist::Decomposition::kEnd);
+
+  std::vector<std::vector<MyMath::BoundingBox>> cells;
+  for (unsigned r = 0; r < kRanks; ++r)
+    cells.push_back(domain.cells(r));
+
+  std::vector<size_t> counts(kRanks);
+  for (const Particle &p : bodies) {
+    const unsigned owner = domain.owner(p.getPosition());
+    ASSERT_LT(owner, kRanks);
+    ++counts[owner];
+    // Inside one of its owner's cells and no other rank's
+    for (unsigned r = 0; r < kRanks; ++r) {
+      const bool inside = std::any_of(
+          cells[r].begin(), cells[r].end(),
+          [&](const auto &cell) { return contains(cell, p.getPosition()); });
+      EXPECT_EQ(inside, r == owner) << "rank " << r;
+    }
+  }
+  for (size_t count : counts)
+    EXPECT_NEAR(static_cast<double>(count), 800.0, 1.0);
+}
+
+TEST(DecompositionTest, BodiesSurviveThePackedForm) {
+  const std::vector<Particle> bodies{{0.1, 0.2, 0.3, 1, 2, 3, 5.0, 17},
+                                     {0.9, 0.8, 0.7, -1, -2, -3, 0.5, 4}};
+  std::vector<Particle> out;
+  ASSERT_TRUE(dist::unpack_bodies(dist::pack_bodies(bodies), out));
+  ASSERT_EQ(out.size(), 2u);
+  EXPECT_EQ(out[1].getPosition().x, 0.9);
+  EXPECT_EQ(out[1].getVelocity().z, -3.0);
+  EXPECT_EQ(out[0].getMass(), 5.0);
+  EXPECT_FALSE(dist::unpack_bodies(dist::Bytes(3), out));
+}
@@ -0,0 +1,192 @@
+#include "dist/domain.h"
+#include "dist/let.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "engine/expansions.h"
+#include "engine/pairwise.h"
+#include "memory/expansion_arena.h"
+#include "gtest/gtest.h"
+#include <cmath>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+namespace {
+const MyMath::BoundingBox kUnitBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}};
+
+using Pulls = std::map<std::tuple<double, double, double>, MyMath::Vector3>;
+
+// One rank's share of the bodies with its tree, upward pass and near-field
+// lists, as PhysicsEngine keeps them
+struct Rank {
+  explicit Rank(const std::vector<Particle> &bodies)
+      : storage(4000), tree(8, kUnitBox, storage) {
+    tree.insert_batch(bodies);
+    tree.collect_nodes(nodes);
+    tree.collect_leaves(leaves);
+    lists.rebuild(leaves, storage);
+    EXPECT_EQ(arena.reserve(Expansions::bytes_for(nodes.size())), 0);
+    EXPECT_TRUE(ex.carve(arena, nodes.size()));
+    upward_pass(nodes, storage, ex);
+  }
+
+  // Near field, own far field, then `remote`: the pull of a whole tick
+  void pull(const dist::EssentialTree &remote, Pulls &out) {
+    dist::EssentialTree far;
+    for (size_t leaf = 0; leaf < lists.leaf_count(); ++leaf) {
+      ParticleBlock *head = storage.block_at(lists.leaf_block(leaf));
+      for (ParticleBlock *block = head; block;
+           block = storage.next_block(block)) {
+        block->get_ax().fill(0);
+        block->get_ay().fill(0);
+        block->get_az().fill(0);
+      }
+      calc_leaf_ax(lists, storage, leaf);
+      std::vector<uint32_t> near(lists.neighbour_blocks(leaf).begin(),
+                                 lists.neighbour_blocks(leaf).end());
+      near.push_back(lists.leaf_block(leaf));
+      far.clear();
+      dist::collect_far_field(*tree.get_root(), storage, ex,
+                              leaves[leaf]->bounds, near,
+                              dist::kDefaultTheta, far);
+      for (ParticleBlock *block = head; block;
+           block = storage.next_block(block)) {
+        dist::apply_essential(far, *block);
+        dist::apply_essential(remote, *block);
+        for (size_t i = 0; i < block->size(); ++i)
+          out[{block->get_x()[i], block->get_y()[i], block->get_z()[i]}] = {
+              block->get_ax()[i], block->get_ay()[i], block->get_az()[i]};
+      }
+    }
+  }
+
+  Storage storage;
+  AROctree tree;
+  std::vector<AROctreeNode *> nodes, leaves;
+  LeafNeighbourLists lists;
+  ExpansionArena arena;
+  Expansions ex;
+};
+} // namespace
+
+// Two ranks in one process: the pull of rank 0's essential tree on rank 1's
+// bodies against the direct sum over rank 0's bodies
+TEST(EssentialTreeTest, MatchesTheDirectSumAcrossTheBoundary) {
+  const MyMath::BoundingBox bounds{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}};
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<double> coord(0.0, 1.0), weight(0.5, 2.0);
+  std::vector<Particle> bodies;
+  for (int i = 0; i < 4000; ++i)
+    bodies.push_back(
+        Particle{coord(rng), coord(rng), coord(rng), 0, 0, 0, weight(rng)});
+  const dist::Decomposition domain =
+      dist::Decomposition::balance(bodies, bounds, 2);
+  std::vector<Particle> mine, theirs;
+  for (const Particle &p : bodies)
+    (domain.owner(p.getPosition()) == 0 ? theirs : mine).push_back(p);
+
+  Storage their_storage{4000}, my_storage{4000};
+  AROctree their_tree{8, bounds, their_storage};
+  AROctree my_tree{8, bounds, my_storage};
+  their_tree.insert_batch(theirs);
+  my_tree.insert_batch(mine);
+
+  std::vector<AROctreeNode *> nodes;
+  their_tree.collect_nodes(nodes);
+  ExpansionArena arena;
+  ASSERT_EQ(arena.reserve(Expansions::bytes_for(nodes.size())), 0);
+  Expansions ex;
+  ASSERT_TRUE(ex.carve(arena, nodes.size()));
+  upward_pass(nodes, their_storage, ex);
+
+  dist::EssentialTree essential;
+  dist::export_essential(*their_tree.get_root(), their_storage, ex,
+                         domain.cells(1), dist::kDefaultTheta, essential);
+  // The far side of the other domain goes out as multipoles
+  EXPECT_FALSE(essential.multipoles.empty());
+  EXPECT_LT(essential.bodies.size(), theirs.size());
+  dist::EssentialTree received;
+  ASSERT_TRUE(dist::unpack(dist::pack(essential), received));
+  ASSERT_EQ(received.bodies.size(), essential.bodies.size());
+
+  std::vector<AROctreeNode *> leaves;
+  my_tree.collect_leaves(leaves);
+  double worst = 0.0;
+  size_t checked = 0;
+  for (AROctreeNode *leaf : leaves)
+    for (ParticleBlock *block = leaf->localBlock; block;
+         block = my_storage.next_block(block)) {
+      block->get_ax().fill(0);
+      block->get_ay().fill(0);
+      block->get_az().fill(0);
+      dist::apply_essential(received, *block);
+      for (size_t i = 0; i < block->size(); ++i, ++checked) {
+        double ax = 0.0, ay = 0.0, az = 0.0;
+        for (const Particle &p : theirs) {
+          const double dx = p.getPosition().x - block->get_x()[i];
+          const double dy = p.getPosition().y - block->get_y()[i];
+          const double dz = p.getPosition().z - block->get_z()[i];
+          const double r = std::sqrt(dx * dx + dy * dy + dz * dz);
+          const double common = 6.67430 * 10e-11 * p.getMass() / (r * r * r);
+          ax += common * dx;
+          ay += common * dy;
+          az += common * dz;
+        }
+        const double error =
+            std::sqrt((block->get_ax()[i] - ax) * (block->get_ax()[i] - ax) +
+                      (block->get_ay()[i] - ay) * (block->get_ay()[i] - ay) +
+                      (block->get_az()[i] - az) * (block->get_az()[i] - az));
+        worst = std::max(worst,
+                         error / std::sqrt(ax * ax + ay * ay + az * az));
+      }
+    }
+  EXPECT_EQ(checked, mine.size());
+  // theta = 0.5 with quadrupoles; monopoles alone would be off by ~1e-2
+  EXPECT_LT(worst, 1e-3);
+}
+
+// The same bodies on one rank and split over two: the near field, the local
+// far field and the other rank's essential tree together have to give every
+// body the same pull
+TEST(EssentialTreeTest, OneAndTwoRanksAgree) {
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> coord(0.0, 1.0), weight(0.5, 2.0);
+  std::vector<Particle> bodies;
+  for (int i = 0; i < 4000; ++i)
+    bodies.push_back(
+        Particle{coord(rng), coord(rng), coord(rng), 0, 0, 0, weight(rng)});
+
+  Pulls alone;
+  Rank whole{bodies};
+  whole.pull({}, alone);
+  ASSERT_EQ(alone.size(), bodies.size());
+
+  const dist::Decomposition domain =
+      dist::Decomposition::balance(bodies, kUnitBox, 2);
+  std::vector<Particle> shares[2];
+  for (const Particle &p : bodies)
+    shares[domain.owner(p.getPosition())].push_back(p);
+  Rank first{shares[0]}, second{shares[1]};
+  dist::EssentialTree to_first, to_second;
+  dist::export_essential(*second.tree.get_root(), second.storage, second.ex,
+                         domain.cells(0), dist::kDefaultTheta, to_first);
+  dist::export_essential(*first.tree.get_root(), first.storage, first.ex,
+                         domain.cells(1), dist::kDefaultTheta, to_second);
+  Pulls split;
+  first.pull(to_first, split);
+  second.pull(to_second, split);
+  ASSERT_EQ(split.size(), bodies.size());
+
+  double worst = 0.0;
+  for (const auto &[position, a] : alone) {
+    const MyMath::Vector3 &b = split.at(position);
+    const double error = std::sqrt((a.x - b.x) * (a.x - b.x) +
+                                   (a.y - b.y) * (a.y - b.y) +
+                                   (a.z - b.z) * (a.z - b.z));
+    worst = std::max(worst, error / std::sqrt(a.x * a.x + a.y * a.y +
+                                              a.z * a.z));
+  }
+  // Both are within ~1e-3 of the direct sum, only the grouping differs
+  EXPECT_LT(worst, 2e-3);
+}
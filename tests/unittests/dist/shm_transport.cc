@@ -0,0 +1,77 @@
+#include "dist/shm_transport.h"
+#include "gtest/gtest.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+std::string segment_name() {
+  return "/gravwll_test_" + std::to_string(getpid());
+}
+
+// Payload from `from` to `to` in round `round`, long enough to wrap a small
+// ring many times over
+dist::Bytes message(unsigned from, unsigned to, unsigned round) {
+  dist::Bytes bytes((from + 1) * 5000 + to * 7 + round);
+  for (size_t i = 0; i < bytes.size(); ++i)
+    bytes[i] = static_cast<std::byte>((i * 31 + from * 7 + to + round) & 0xff);
+  return bytes;
+}
+} // namespace
+
+// Ranks are threads here; they share nothing but the segment, as processes
+// would
+TEST(ShmTransportTest, ExchangesLargeMessagesThroughSmallRings) {
+  constexpr unsigned kRanks = 3;
+  constexpr unsigned kRounds = 4;
+  const std::string name = segment_name();
+  std::unique_ptr<dist::ShmTransport> root =
+      dist::ShmTransport::create(name, kRanks, 256);
+
+  const auto run_rank = [&](dist::Transport &transport) {
+    const unsigned self = transport.rank();
+    for (unsigned round = 0; round < kRounds; ++round) {
+      std::vector<dist::Bytes> out(kRanks);
+      for (unsigned to = 0; to < kRanks; ++to)
+        out[to] = message(self, to, round);
+      // Empty messages go through as well
+      if (round == 1)
+        out[(self + 1) % kRanks].clear();
+      const std::vector<dist::Bytes> in = transport.exchange(out);
+      ASSERT_EQ(in.size(), kRanks);
+      for (unsigned from = 0; from < kRanks; ++from) {
+        if (round == 1 && (from + 1) % kRanks == self)
+          EXPECT_TRUE(in[from].empty());
+        else
+          EXPECT_EQ(in[from], message(from, self, round))
+              << "rank " << self << " from " << from << " round " << round;
+      }
+      transport.barrier();
+    }
+  };
+
+  std::vector<std::thread> others;
+  for (unsigned rank = 1; rank < kRanks; ++rank)
+    others.emplace_back([&, rank] {
+      std::unique_ptr<dist::ShmTransport> t =
+          dist::ShmTransport::attach(name, rank);
+      EXPECT_EQ(t->size(), kRanks);
+      run_rank(*t);
+    });
+  run_rank(*root);
+  for (std::thread &t : others)
+    t.join();
+}
+
+TEST(ShmTransportTest, AttachFailsWithoutTheSegmentOrOutOfRange) {
+  const std::string name = segment_name() + "_missing";
+  EXPECT_THROW(
+      dist::ShmTransport::attach(name, 1, std::chrono::milliseconds(20)),
+      std::runtime_error);
+  std::unique_ptr<dist::ShmTransport> root =
+      dist::ShmTransport::create(name, 2, 64);
+  EXPECT_THROW(dist::ShmTransport::attach(name, 2), std::runtime_error);
+}
@@ -0,0 +1,97 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/neighbour_lists.h"
+#include "ds/tree/octree.h"
+#include "engine/load_balance.h"
+#include "engine/pairwise.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+TEST(LeafCostModelTest, CutsASkewedSequenceIntoEqualCostChunks) {
+  // A dense core in the middle of the curve, a sparse halo around it
+  LeafCostModel model;
+  model.reset(1000);
+  for (size_t leaf = 0; leaf < 1000; ++leaf) {
+    const bool core = leaf >= 450 && leaf < 550;
+    model.record(leaf, {.p2p_pairs = core ? 10000u : 100u});
+  }
+  const std::vector<size_t> &cuts = model.partition(4);
+  ASSERT_EQ(cuts.size(), 5u);
+  EXPECT_EQ(cuts.front(), 0u);
+  EXPECT_EQ(cuts.back(), 1000u);
+  // Two of the four chunks fall inside the core
+  EXPECT_GT(cuts[1], 450u);
+  EXPECT_LT(cuts[3], 550u);
+
+  // Once measured, time wins over pair counts: the same split, timed
+  for (size_t leaf = 0; leaf < 1000; ++leaf)
+    model.record(leaf, {.p2p_pairs = 1, .ns = model.costs()[leaf].p2p_pairs});
+  model.close_tick();
+  EXPECT_LT(model.imbalance(), 1.05);
+  ASSERT_EQ(model.chunk_ns().size(), 4u);
+
+  // More parts than leaves: one leaf per chunk
+  model.reset(3);
+  EXPECT_EQ(model.partition(8), (std::vector<size_t>{0, 1, 2, 3}));
+}
+
+TEST(LeafCostModelTest, FarFieldTimeCountsOnceTheTickCloses) {
+  LeafCostModel model;
+  model.reset(2);
+  model.record(0, {.p2p_pairs = 10, .ns = 100});
+  model.record(1, {.p2p_pairs = 10, .ns = 100});
+  model.record_far(1, 7, 300);
+  EXPECT_EQ(model.costs()[1].ns, 100u);
+  model.partition(2);
+  model.close_tick();
+  EXPECT_EQ(model.costs()[0].ns, 100u);
+  EXPECT_EQ(model.costs()[1].ns, 400u);
+  EXPECT_EQ(model.costs()[1].far_multipoles, 7u);
+  EXPECT_DOUBLE_EQ(model.imbalance(), 1.6);
+
+  // The far slots start over every tick
+  model.record(1, {.p2p_pairs = 10, .ns = 100});
+  model.close_tick();
+  EXPECT_EQ(model.costs()[1].ns, 100u);
+}
+
+TEST(LeafCostModelTest, ChunksStayInsideTheirSegment) {
+  LeafCostModel model;
+  model.reset(100);
+  for (size_t leaf = 0; leaf < 100; ++leaf)
+    model.record(leaf, {.p2p_pairs = 100});
+  // Two NUMA regions of 30 and 70 leaves, an empty third one, 2 + 4 chunks
+  const size_t bounds[] = {0, 30, 100, 100};
+  const size_t parts[] = {2, 4, 4};
+  const std::vector<size_t> &cuts = model.partition(bounds, parts);
+  EXPECT_EQ(cuts, (std::vector<size_t>{0, 15, 30, 48, 65, 83, 100}));
+}
+
+TEST(LeafCostModelTest, PairEstimateMatchesTheKernel) {
+  std::mt19937 rng(4);
+  std::normal_distribution<double> coord(0.5, 0.1);
+  std::vector<Particle> particles;
+  for (int i = 0; i < 1500; ++i)
+    particles.push_back(Particle{std::clamp(coord(rng), 0.0, 1.0),
+                                 std::clamp(coord(rng), 0.0, 1.0),
+                                 std::clamp(coord(rng), 0.0, 1.0), 0, 0, 0,
+                                 1});
+  Storage storage{1500};
+  AROctree tree{4, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(particles);
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+  LeafNeighbourLists lists;
+  lists.rebuild(leaves, storage);
+
+  uint64_t total = 0;
+  for (size_t leaf = 0; leaf < lists.leaf_count(); ++leaf) {
+    const uint64_t estimate = leaf_pairs(lists, storage, leaf);
+    ASSERT_EQ(calc_leaf_ax(lists, storage, leaf), estimate) << "leaf " << leaf;
+    total += estimate;
+  }
+  EXPECT_GT(total, 0u);
+}
@@ -0,0 +1,54 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "engine/phases.h"
+#include "gtest/gtest.h"
+#include <thread>
+#include <vector>
+
+TEST(PhaseTrackerTest, RejectsOutOfOrderPhases) {
+  PhaseTracker phases{4};
+  phases.enter(Phase::kBuild);
+  phases.enter(Phase::kForce);
+  phases.enter(Phase::kIntegrate);
+  phases.enter(Phase::kMigrate);
+  phases.enter(Phase::kForce);
+  EXPECT_EQ(phases.current(), Phase::kForce);
+  EXPECT_DEATH(phases.enter(Phase::kMigrate), "illegal transition");
+}
+
+TEST(PhaseTrackerTest, SecondClaimerAborts) {
+  PhaseTracker phases{4, true};
+  phases.enter(Phase::kBuild);
+  phases.enter(Phase::kForce);
+  phases.claim(1);
+  phases.claim(1); // same thread again is fine
+  EXPECT_DEATH(std::thread([&] { phases.claim(1); }).join(), "claimed by");
+  // A new phase releases every claim
+  phases.enter(Phase::kIntegrate);
+  std::thread([&] { phases.claim(1); }).join();
+}
+
+TEST(PhaseTrackerTest, MigrantsReturnToTheirLeaf) {
+  Storage storage{64};
+  AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  for (unsigned k = 0; k < 17; ++k)
+    tree.insert(Particle{0.1 + 0.8 * ((k >> 2) & 1), 0.1 + 0.8 * ((k >> 1) & 1),
+                         0.1 + 0.8 * (k & 1), 0, 0, 0, 1});
+
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+  // Push one body across the root centre
+  AROctreeNode *origin = tree.get_root()->children[0];
+  origin->localBlock->get_x()[0] = 0.9;
+
+  std::vector<Particle> migrants;
+  tree.extract_migrants(leaves, migrants);
+  ASSERT_EQ(migrants.size(), 1u);
+  for (const Particle &p : migrants)
+    tree.insert(p);
+
+  AROctreeNode *target = tree.get_root()->children[4];
+  EXPECT_EQ(origin->localBlock->data_block.size, 2u);
+  EXPECT_EQ(target->localBlock->data_block.size, 3u);
+}
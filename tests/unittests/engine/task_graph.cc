@@ -0,0 +1,73 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "engine/expansions.h"
+#include "engine/task_graph.h"
+#include "memory/expansion_arena.h"
+#include "utils/thread_pool.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <random>
+#include <vector>
+
+TEST(ForceTaskGraphTest, MatchesTheLevelOrderPassAndRunsEveryTaskOnce) {
+  std::mt19937 rng(9);
+  std::uniform_real_distribution<double> coord(0.0, 1.0), weight(0.5, 2.0);
+  std::vector<Particle> particles;
+  for (int i = 0; i < 3000; ++i)
+    particles.push_back(
+        Particle{coord(rng), coord(rng), coord(rng), 0, 0, 0, weight(rng)});
+
+  Storage storage{3000};
+  AROctree tree{8, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(particles);
+  std::vector<AROctreeNode *> nodes;
+  tree.collect_nodes(nodes);
+  ASSERT_GT(nodes.size(), 73u);
+
+  ExpansionArena arena;
+  ASSERT_EQ(arena.reserve(2 * Expansions::bytes_for(nodes.size())), 0);
+  Expansions serial, graph;
+  ASSERT_TRUE(serial.carve(arena, nodes.size()));
+  ASSERT_TRUE(graph.carve(arena, nodes.size()));
+  upward_pass(nodes, storage, serial);
+
+  // Two homes, the last chunk for anyone
+  ThreadPool pool{3, {}, {0, 0, 1, 1}};
+  ForceTaskGraph force_graph;
+  std::vector<std::atomic<int>> near_hits(500), far_hits(500);
+  std::atomic<int> early_far{0};
+  const std::vector<size_t> cuts{0, 7, 8, 200, 500};
+  const std::vector<unsigned> homes{0, 1, 1};
+  // Twice: counters must be rearmed by every run
+  for (int run = 0; run < 2; ++run) {
+    graph.mass[0] = -1.0;
+    force_graph.run(
+        pool, nodes, storage, graph, cuts, homes,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i)
+            near_hits[i]++;
+        },
+        [&](size_t begin, size_t end) {
+          // Released by the root's M2M, never before
+          if (graph.mass[0] != serial.mass[0])
+            early_far++;
+          for (size_t i = begin; i < end; ++i)
+            far_hits[i]++;
+        });
+  }
+
+  EXPECT_EQ(early_far.load(), 0);
+  for (size_t i = 0; i < near_hits.size(); ++i) {
+    ASSERT_EQ(near_hits[i].load(), 2) << "item " << i;
+    ASSERT_EQ(far_hits[i].load(), 2) << "item " << i;
+  }
+  // Same children in the same order: results are bit-identical
+  for (size_t k = 0; k < nodes.size(); ++k) {
+    ASSERT_EQ(graph.mass[k], serial.mass[k]) << "node " << k;
+    EXPECT_EQ(graph.com_x[k], serial.com_x[k]);
+    EXPECT_EQ(graph.qxy[k], serial.qxy[k]);
+    EXPECT_EQ(graph.qzz[k], serial.qzz[k]);
+    EXPECT_EQ(nodes[k]->pending_children.load(), 0u);
+  }
+}
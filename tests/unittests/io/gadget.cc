@@ -0,0 +1,187 @@
+#include "io/gadget.h"
+#include "ds/storage/storage.h"
+#include "io/text_table.h"
+#include "test_files.h"
+#include "utils/thread_pool.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+using io_test::all_bodies;
+using io_test::temp_path;
+
+// Fortran records by hand, as another code would write them
+class RecordFile {
+public:
+  explicit RecordFile(const std::string &path, bool format2)
+      : out_(path, std::ios::binary), format2_(format2) {}
+
+  template <typename T>
+  void record(const char *name, const std::vector<T> &values) {
+    const auto bytes = static_cast<int32_t>(values.size() * sizeof(T));
+    if (format2_) {
+      const int32_t eight = 8, next = bytes + 8;
+      put(eight);
+      out_.write(name, 4);
+      put(next);
+      put(eight);
+    }
+    put(bytes);
+    out_.write(reinterpret_cast<const char *>(values.data()), bytes);
+    put(bytes);
+  }
+  void header(const io::GadgetHeader &h) {
+    record("HEAD", std::vector<io::GadgetHeader>{h});
+  }
+
+private:
+  void put(int32_t n) { out_.write(reinterpret_cast<const char *>(&n), 4); }
+  std::ofstream out_;
+  bool format2_;
+};
+} // namespace
+
+TEST(GadgetTest, ReadsSplitFormat2SetsWithPerTypeMasses) {
+  ThreadPool pool{2};
+  const std::string stem = temp_path("split");
+  // Two files; type 0 with per-body masses, type 1 with a header mass.
+  // Double precision, 32-bit ids
+  for (int f = 0; f < 2; ++f) {
+    io::GadgetHeader h{};
+    h.npart[0] = 2;
+    h.npart[1] = 3;
+    h.mass[1] = 0.5;
+    h.npart_total[0] = 4;
+    h.npart_total[1] = 6;
+    h.num_files = 2;
+    h.box_size = 100.0;
+    std::vector<double> pos, vel, mass;
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < 5; ++i) {
+      const double v = 10.0 * f + i;
+      pos.insert(pos.end(), {v, v + 0.25, v + 0.5});
+      vel.insert(vel.end(), {-v, 0.0, 1.0});
+      ids.push_back(static_cast<uint32_t>(100 * f + i));
+    }
+    mass = {2.0 + f, 3.0 + f};
+    RecordFile file(stem + "." + std::to_string(f), true);
+    file.header(h);
+    file.record("POS ", pos);
+    file.record("U   ", std::vector<float>{1.0f, 2.0f}); // skipped
+    file.record("VEL ", vel);
+    file.record("MASS", mass);
+    file.record("ID  ", ids);
+  }
+
+  const io::GadgetUnits units{.length = 2.0, .mass = 10.0, .velocity = 3.0};
+  auto opened = io::GadgetSnapshot::open(stem, units, pool);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::GadgetSnapshot &snapshot = *opened.value();
+  EXPECT_EQ(snapshot.files(), 2u);
+  ASSERT_EQ(snapshot.size(), 10u);
+  EXPECT_EQ(snapshot.bounds().max.x, 200.0);
+
+  const std::vector<Particle> bodies = all_bodies(snapshot);
+  ASSERT_EQ(bodies.size(), 10u);
+  // Second file, first type-1 body
+  const Particle &p = bodies[7];
+  EXPECT_EQ(p.getX(), 2.0 * 12.0);
+  EXPECT_EQ(p.getZ(), 2.0 * 12.5);
+  EXPECT_EQ(p.getVx(), 3.0 * -12.0);
+  EXPECT_EQ(p.getMass(), 10.0 * 0.5);
+  // Per-body masses of type 0
+  EXPECT_EQ(bodies[1].getMass(), 10.0 * 3.0);
+  EXPECT_EQ(bodies[6].getMass(), 10.0 * 4.0);
+
+  // "stem.0" names the same set, and the generic opener finds it
+  EXPECT_TRUE(io::GadgetSnapshot::open(stem + ".0", units, pool).is_ok());
+  auto source = io::open_body_source(stem, {}, units, pool);
+  ASSERT_TRUE(source.is_ok()) << source.error_message();
+  EXPECT_EQ(source.value()->size(), 10u);
+
+  // A missing member of the set
+  std::filesystem::remove(stem + ".1");
+  EXPECT_TRUE(io::GadgetSnapshot::open(stem, units, pool).is_error());
+  std::filesystem::remove(stem + ".0");
+}
+
+TEST(GadgetTest, WriterStreamsBlocksAndReadsBack) {
+  ThreadPool pool{2};
+  Storage storage{200};
+  uint64_t id = 0;
+  for (int b = 0; b < 7; ++b) {
+    std::vector<Particle> block;
+    for (int i = 0; i < 13; ++i, ++id) {
+      const double v = static_cast<double>(id);
+      block.push_back(Particle{v, -v, 0.5 * v, 1.0, 2.0, v, 1.0 + v, id});
+    }
+    ASSERT_NE(storage.create_memory_block(sfc::kRootCode, block), nullptr);
+  }
+
+  for (const bool format2 : {false, true}) {
+    const std::string path = temp_path("written.g");
+    const io::GadgetUnits units{.length = 4.0, .mass = 2.0, .velocity = 0.5};
+    ASSERT_TRUE(io::write_gadget_snapshot(
+        path, storage,
+        {.units = units, .time = 0.25, .format2 = format2}));
+    auto opened = io::GadgetSnapshot::open(path, units, pool);
+    ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+    const io::GadgetSnapshot &snapshot = *opened.value();
+    EXPECT_EQ(snapshot.header().time, 0.25);
+    EXPECT_EQ(snapshot.header().npart[1], 91);
+    // No box: a cube around the bodies
+    EXPECT_LT(snapshot.bounds().min.y, -89.0);
+    EXPECT_GT(snapshot.bounds().max.x, 90.0);
+
+    const std::vector<Particle> bodies = all_bodies(snapshot);
+    ASSERT_EQ(bodies.size(), 91u);
+    // Slot order is creation order here
+    for (size_t i = 0; i < bodies.size(); ++i) {
+      const double v = static_cast<double>(i);
+      ASSERT_FLOAT_EQ(static_cast<float>(bodies[i].getY()),
+                      static_cast<float>(-v));
+      ASSERT_FLOAT_EQ(static_cast<float>(bodies[i].getVz()),
+                      static_cast<float>(v));
+      ASSERT_FLOAT_EQ(static_cast<float>(bodies[i].getMass()),
+                      static_cast<float>(1.0 + v));
+      ASSERT_EQ(bodies[i].getVisualId(), i);
+    }
+    std::filesystem::remove(path);
+  }
+}
+
+TEST(GadgetTest, RejectsBrokenFiles) {
+  ThreadPool pool{1};
+  const std::string path = temp_path("broken.g");
+  const auto write = [&](int32_t n, size_t pos_values) {
+    io::GadgetHeader h{};
+    h.npart[1] = n;
+    h.mass[1] = 1.0;
+    RecordFile file(path, false);
+    file.header(h);
+    file.record("POS ", std::vector<float>(pos_values));
+    file.record("VEL ", std::vector<float>(pos_values));
+    file.record("ID  ", std::vector<uint32_t>(static_cast<size_t>(n)));
+  };
+  write(4, 12);
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {}, pool).is_ok());
+  write(4, 11); // POS one value short
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {}, pool).is_error());
+  write(0, 0);  // nothing in it
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {}, pool).is_error());
+
+  // Cut in the middle of a record
+  write(4, 12);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 6);
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {}, pool).is_error());
+  // Bad units, and no file at all
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {.length = 0.0}, pool)
+                  .is_error());
+  std::filesystem::remove(path);
+  EXPECT_FALSE(io::GadgetSnapshot::looks_like(path));
+  EXPECT_TRUE(io::GadgetSnapshot::open(path, {}, pool).is_error());
+}
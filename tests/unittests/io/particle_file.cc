@@ -0,0 +1,130 @@
+#include "io/particle_file.h"
+#include "test_files.h"
+#include "utils/generators.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+using io_test::temp_path;
+
+std::vector<Particle> some_bodies(size_t n) {
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> coord(0.0, 4.0), speed(-1.0, 1.0);
+  std::vector<Particle> bodies;
+  for (size_t i = 0; i < n; ++i)
+    bodies.push_back(Particle{coord(rng), coord(rng), coord(rng), speed(rng),
+                              speed(rng), speed(rng), 1.0 + speed(rng)});
+  return bodies;
+}
+} // namespace
+
+TEST(ParticleFileTest, RoundTripsThroughFileUnits) {
+  const std::string path = temp_path("round_trip.gwp");
+  const std::vector<Particle> bodies = some_bodies(1000);
+  io::FileLayout layout{.morton_sorted = true,
+                        .bounds = {{0.0, 0.0, 0.0}, {2.0, 2.0, 2.0}},
+                        .length_unit = 2.0,
+                        .mass_unit = 0.5,
+                        .velocity_unit = 4.0};
+  ASSERT_TRUE(io::write_particle_file(path, bodies, layout));
+  EXPECT_EQ(io::ParticleFile::peek_count(path), 1000u);
+
+  auto opened = io::ParticleFile::open(path);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::ParticleFile &file = *opened.value();
+  ASSERT_EQ(file.size(), bodies.size());
+  EXPECT_TRUE(file.morton_sorted());
+  EXPECT_EQ(file.bounds().max.y, 4.0);
+  EXPECT_EQ(file.ids(), nullptr);
+  // Columns hold file units and sit on their own pages
+  EXPECT_EQ(file.column(io::Column::kX)[3], bodies[3].getX() / 2.0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(file.column(io::Column::kVz)) %
+                io::FileHeader::kColumnAlignment,
+            0u);
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    const Particle p = file.body(i);
+    ASSERT_DOUBLE_EQ(p.getX(), bodies[i].getX());
+    ASSERT_DOUBLE_EQ(p.getZ(), bodies[i].getZ());
+    ASSERT_DOUBLE_EQ(p.getVy(), bodies[i].getVy());
+    ASSERT_DOUBLE_EQ(p.getMass(), bodies[i].getMass());
+  }
+
+  auto loaded = data_loader::load_from_file(path);
+  ASSERT_TRUE(loaded.is_ok());
+  EXPECT_EQ(loaded.value().size(), bodies.size());
+  std::filesystem::remove(path);
+}
+
+TEST(ParticleFileTest, WriterTakesColumnsInPiecesAndIdsAreOptional) {
+  const std::string path = temp_path("pieces.gwp");
+  constexpr size_t kCount = 100;
+  auto created = io::ParticleFileWriter::create(
+      path, {.count = kCount,
+             .columns = io::kPositionColumns |
+                        io::column_bit(io::Column::kMass) |
+                        io::column_bit(io::Column::kId),
+             .bounds = {{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}}});
+  ASSERT_TRUE(created.is_ok()) << created.error_message();
+  io::ParticleFileWriter &writer = *created.value();
+  std::vector<double> values(kCount);
+  std::vector<uint64_t> ids(kCount);
+  for (size_t i = 0; i < kCount; ++i) {
+    values[i] = static_cast<double>(i) / kCount;
+    ids[i] = 1000 + i;
+  }
+  // Back half first, one column at a time
+  for (io::Column c : {io::Column::kMass, io::Column::kZ, io::Column::kY,
+                       io::Column::kX}) {
+    ASSERT_TRUE(writer.write(c, 50, values.data() + 50, 50));
+    ASSERT_TRUE(writer.write(c, 0, values.data(), 50));
+  }
+  ASSERT_TRUE(writer.write_ids(0, ids.data(), kCount));
+  EXPECT_FALSE(writer.write(io::Column::kVx, 0, values.data(), 1));
+  EXPECT_FALSE(writer.write(io::Column::kX, 90, values.data(), 20));
+  ASSERT_TRUE(writer.finish());
+
+  auto opened = io::ParticleFile::open(path);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::ParticleFile &file = *opened.value();
+  EXPECT_EQ(file.column(io::Column::kVx), nullptr);
+  EXPECT_EQ(file.ids()[7], 1007u);
+  const Particle p = file.body(73);
+  EXPECT_EQ(p.getY(), 0.73);
+  EXPECT_EQ(p.getVx(), 0.0);
+  std::filesystem::remove(path);
+}
+
+TEST(ParticleFileTest, RejectsWhatIsNotAWholeFile) {
+  const std::string path = temp_path("broken.gwp");
+  const std::vector<Particle> bodies = some_bodies(600);
+  ASSERT_TRUE(io::write_particle_file(
+      path, bodies, {.bounds = {{0.0, 0.0, 0.0}, {4.0, 4.0, 4.0}}}));
+
+  // Cut short: the last column no longer holds `count` values
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4096);
+  EXPECT_TRUE(io::ParticleFile::open(path).is_error());
+
+  // Unknown version
+  ASSERT_TRUE(io::write_particle_file(
+      path, bodies, {.bounds = {{0.0, 0.0, 0.0}, {4.0, 4.0, 4.0}}}));
+  {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    const uint32_t version = io::FileHeader::kVersion + 1;
+    f.seekp(offsetof(io::FileHeader, version));
+    f.write(reinterpret_cast<const char *>(&version), sizeof(version));
+  }
+  EXPECT_TRUE(io::ParticleFile::open(path).is_error());
+  EXPECT_FALSE(io::ParticleFile::peek_count(path).has_value());
+
+  // Not a particle file at all, and no file
+  { std::ofstream(path) << "x,y,z,mass\n0,0,0,1\n"; }
+  EXPECT_TRUE(io::ParticleFile::open(path).is_error());
+  std::filesystem::remove(path);
+  EXPECT_TRUE(io::ParticleFile::open(path).is_error());
+  // Empty bounds are refused at write time
+  EXPECT_FALSE(io::write_particle_file(path, bodies, {}));
+}
@@ -0,0 +1,208 @@
+#include "io/snapshot_writer.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "io/gadget.h"
+#include "io/text_table.h"
+#include "test_files.h"
+#include "utils/thread_pool.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+std::filesystem::path temp_dir(const std::string &name) {
+  return std::filesystem::temp_directory_path() /
+         ("gravwll_" + std::to_string(getpid()) + "_" + name);
+}
+
+// `n` bodies along a diagonal, in a tree over `box`. Body k has id 1000 + k
+// and everything else follows from k (expect_body)
+struct Bodies {
+  Storage storage;
+  AROctree tree;
+  std::vector<AROctreeNode *> leaves;
+
+  Bodies(size_t n, double shift, const MyMath::BoundingBox &box)
+      : storage{static_cast<uint>(8 * n + 400)}, tree{5, box, storage} {
+    std::vector<Particle> bodies;
+    for (uint64_t id = 0; id < n; ++id) {
+      const double v = static_cast<double>(id) / 100.0;
+      bodies.push_back(
+          Particle{v + shift, v, 0.5, -v, 0.0, 1.0, 1.0 + v, 1000 + id});
+    }
+    // Against the curve, so every leaf's block needs sorting
+    std::reverse(bodies.begin(), bodies.end());
+    EXPECT_EQ(tree.insert_batch(bodies), 0u);
+    tree.collect_leaves(leaves);
+  }
+};
+
+void expect_body(const Particle &p, uint64_t id, double shift = 0.0) {
+  const double v = static_cast<double>(id - 1000) / 100.0;
+  EXPECT_DOUBLE_EQ(p.getX(), v + shift) << id;
+  EXPECT_DOUBLE_EQ(p.getY(), v) << id;
+  EXPECT_DOUBLE_EQ(p.getVx(), -v) << id;
+  EXPECT_DOUBLE_EQ(p.getMass(), 1.0 + v) << id;
+}
+} // namespace
+
+TEST(SnapshotWriterTest, WritesRestartableParticleFiles) {
+  const std::filesystem::path dir = temp_dir("snapshots");
+  ThreadPool pool{2};
+  const MyMath::BoundingBox box{{0.0, 0.0, 0.0}, {4.0, 4.0, 4.0}};
+  Bodies run(220, 0.0, box);
+  ASSERT_GT(run.leaves.size(), 8u);
+  {
+    io::SnapshotWriter writer((dir / "run").string());
+    ASSERT_TRUE(writer.capture(run.storage, run.leaves, 10, box, pool));
+    writer.wait();
+    EXPECT_EQ(writer.stats().written, 1u);
+    EXPECT_EQ(writer.path_for(10), (dir / "run_00000010.gwp").string());
+
+    auto opened = io::ParticleFile::open(writer.path_for(10));
+    ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+    const io::ParticleFile &file = *opened.value();
+    ASSERT_EQ(file.size(), 220u);
+    // Everything inside: the run's box is kept
+    EXPECT_EQ(file.bounds().max.x, 4.0);
+    std::vector<uint64_t> ids;
+    for (size_t i = 0; i < file.size(); ++i) {
+      expect_body(file.body(i), file.ids()[i]);
+      ids.push_back(file.ids()[i]);
+    }
+    std::sort(ids.begin(), ids.end());
+    EXPECT_EQ(std::adjacent_find(ids.begin(), ids.end()), ids.end());
+    // Staged leaf by leaf along the curve: a restart needs no sort
+    EXPECT_TRUE(file.morton_sorted());
+    for (size_t i = 1; i < file.size(); ++i)
+      ASSERT_LE(sfc::point_key(sfc::Curve::kMorton,
+                               file.body(i - 1).getPosition(), box),
+                sfc::point_key(sfc::Curve::kMorton,
+                               file.body(i).getPosition(), box))
+          << i;
+
+    // A body outside the box widens the recorded bounds
+    Bodies drifted(11, 4.0, {{0.0, 0.0, 0.0}, {8.0, 8.0, 8.0}});
+    ASSERT_TRUE(
+        writer.capture(drifted.storage, drifted.leaves, 20, box, pool));
+    // The destructor finishes what is in flight
+  }
+  auto opened = io::ParticleFile::open((dir / "run_00000020.gwp").string());
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  EXPECT_GT(opened.value()->bounds().max.x, 4.1);
+  EXPECT_FALSE(std::filesystem::exists(dir / "run_00000020.gwp.part"));
+  std::filesystem::remove_all(dir);
+}
+
+TEST(SnapshotWriterTest, SkipsWhileBusyAndCountsFailures) {
+  const std::filesystem::path dir = temp_dir("busy");
+  ThreadPool pool{1};
+  const MyMath::BoundingBox box{{0.0, 0.0, 0.0}, {200.0, 200.0, 200.0}};
+  Bodies run(16500, 0.0, box);
+  io::SnapshotWriter writer((dir / "run").string());
+  // Whichever captures come while a write is in flight are skipped; none
+  // of them waits
+  size_t taken = 0;
+  for (uint64_t tick = 1; tick <= 50; ++tick)
+    taken += writer.capture(run.storage, run.leaves, tick, box, pool);
+  writer.wait();
+  const io::SnapshotWriter::Stats stats = writer.stats();
+  EXPECT_EQ(stats.written, taken);
+  EXPECT_EQ(stats.written + stats.skipped, 50u);
+
+  // The directory went away: the write fails and nothing is left behind
+  std::filesystem::remove_all(dir);
+  ASSERT_TRUE(writer.capture(run.storage, run.leaves, 99, box, pool));
+  writer.wait();
+  EXPECT_EQ(writer.stats().failed, 1u);
+  EXPECT_FALSE(std::filesystem::exists(dir));
+}
+
+// Two ranks write their shares; the manifest loads them as one set, which
+// is what every rank of a restart opens
+TEST(SnapshotWriterTest, RanksShareOneRestartableSet) {
+  const std::filesystem::path dir = temp_dir("ranks");
+  ThreadPool pool{2};
+  const MyMath::BoundingBox box{{0.0, 0.0, 0.0}, {4.0, 4.0, 4.0}};
+  Bodies left(33, 0.0, box), right(55, 2.0, box);
+  {
+    io::SnapshotWriter first((dir / "run").string(), {}, 0, 2);
+    io::SnapshotWriter second((dir / "run").string(), {}, 1, 2);
+    EXPECT_EQ(first.path_for(10), (dir / "run_r0_00000010.gwp").string());
+    EXPECT_EQ(second.path_for(10), (dir / "run_r1_00000010.gwp").string());
+    EXPECT_EQ(first.restart_path_for(10),
+              (dir / "run_00000010.gws").string());
+    ASSERT_TRUE(first.capture(left.storage, left.leaves, 10, box, pool));
+    ASSERT_TRUE(second.capture(right.storage, right.leaves, 10, box, pool));
+  }
+
+  auto opened = io::open_body_source((dir / "run_00000010.gws").string(),
+                                     io::TextFormat{}, io::GadgetUnits{},
+                                     pool);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::BodySource &set = *opened.value();
+  ASSERT_EQ(set.size(), 33u + 55u);
+  EXPECT_EQ(set.bounds().max.x, 4.0);
+  // Share by share, rank 0's bodies first
+  size_t visited = 0;
+  for (size_t part = 0; part < set.parts(); ++part)
+    set.for_each(part, [&](const Particle &p) {
+      EXPECT_EQ(p.getX() < 2.0, visited < 33) << visited;
+      ++visited;
+    });
+  EXPECT_EQ(visited, set.size());
+
+  // A share that never made it fails the open rather than losing bodies
+  std::filesystem::remove(dir / "run_r1_00000010.gwp");
+  EXPECT_TRUE(
+      io::SnapshotSet::open((dir / "run_00000010.gws").string()).is_error());
+  std::filesystem::remove_all(dir);
+}
+
+// The same snapshot as GADGET, alone and as a two-rank split set; both
+// read back through the generic opener a restart uses
+TEST(SnapshotWriterTest, WritesGadgetWhenAsked) {
+  const std::filesystem::path dir = temp_dir("gadget");
+  ThreadPool pool{2};
+  const MyMath::BoundingBox box{{0.0, 0.0, 0.0}, {4.0, 4.0, 4.0}};
+  Bodies left(33, 0.0, box), right(55, 2.0, box);
+  const io::GadgetUnits units{.length = 2.0, .mass = 0.5, .velocity = 4.0};
+  const auto open = [&](const std::string &path) {
+    auto opened = io::open_body_source(path, io::TextFormat{}, units, pool);
+    EXPECT_TRUE(opened.is_ok()) << opened.error_message();
+    return opened.is_ok() ? opened.value() : nullptr;
+  };
+  {
+    io::SnapshotWriter writer((dir / "run").string(), {}, 0, 1,
+                              io::SnapshotFormat::kGadget, units);
+    EXPECT_EQ(writer.path_for(10), (dir / "run_00000010").string());
+    ASSERT_TRUE(writer.capture(left.storage, left.leaves, 10, box, pool));
+    writer.wait();
+    EXPECT_EQ(writer.stats().written, 1u);
+    const auto source = open(writer.restart_path_for(10));
+    ASSERT_NE(source, nullptr);
+    EXPECT_EQ(source->bounds().max.x, 4.0);
+    const std::vector<Particle> bodies = io_test::all_bodies(*source);
+    ASSERT_EQ(bodies.size(), 33u);
+    for (const Particle &p : bodies)
+      expect_body(p, p.getVisualId());
+  }
+  {
+    io::SnapshotWriter first((dir / "run").string(), {}, 0, 2,
+                             io::SnapshotFormat::kGadget, units);
+    io::SnapshotWriter second((dir / "run").string(), {}, 1, 2,
+                              io::SnapshotFormat::kGadget, units);
+    EXPECT_EQ(second.path_for(20), (dir / "run_00000020.1").string());
+    EXPECT_EQ(first.restart_path_for(20), (dir / "run_00000020").string());
+    ASSERT_TRUE(first.capture(left.storage, left.leaves, 20, box, pool));
+    ASSERT_TRUE(second.capture(right.storage, right.leaves, 20, box, pool));
+  }
+  EXPECT_FALSE(std::filesystem::exists(dir / "run_00000020.gws"));
+  const auto set = open((dir / "run_00000020").string());
+  ASSERT_NE(set, nullptr);
+  EXPECT_EQ(set->size(), 33u + 55u);
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "core/bodies/particles.h"
+#include "io/body_source.h"
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Scratch files and read-back shared by the io tests
+namespace io_test {
+// In the temp directory, tagged with the pid so concurrent runs don't meet
+inline std::string temp_path(const std::string &name) {
+  return (std::filesystem::temp_directory_path() /
+          ("gravwll_" + std::to_string(getpid()) + "_" + name))
+      .string();
+}
+
+// Every body of `source`, parts in order
+inline std::vector<Particle> all_bodies(const io::BodySource &source) {
+  std::vector<Particle> bodies;
+  for (size_t part = 0; part < source.parts(); ++part)
+    source.for_each(part, [&](const Particle &p) { bodies.push_back(p); });
+  return bodies;
+}
+} // namespace io_test
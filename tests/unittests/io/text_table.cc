@@ -0,0 +1,161 @@
+#include "io/gadget.h"
+#include "io/text_table.h"
+#include "test_files.h"
+#include "utils/thread_pool.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+using io_test::all_bodies;
+using io_test::temp_path;
+
+std::string write_table(const std::string &name, const std::string &text) {
+  const std::string path = temp_path(name);
+  std::ofstream(path, std::ios::binary) << text;
+  return path;
+}
+} // namespace
+
+TEST(TextTableTest, ReadsHeaderNamesCommentsAndCrlf) {
+  ThreadPool pool{2};
+  const std::string path = write_table(
+      "named.csv", "# exported catalog\n"
+                   "\n"
+                   "id, mass, z, y, x, extra\r\n"
+                   "7, 2.5, 3, 2, 1, junk\r\n"
+                   "# halfway\n"
+                   "9, +1e-3, -3.5e1, 0.25, -1, junk\r\n");
+  auto opened = io::TextTable::open(path, {}, pool);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::TextTable &table = *opened.value();
+  ASSERT_EQ(table.size(), 2u);
+  const std::vector<Particle> bodies = all_bodies(table);
+  ASSERT_EQ(bodies.size(), 2u);
+  EXPECT_EQ(bodies[0].getX(), 1.0);
+  EXPECT_EQ(bodies[0].getZ(), 3.0);
+  EXPECT_EQ(bodies[0].getMass(), 2.5);
+  EXPECT_EQ(bodies[0].getVx(), 0.0);
+  EXPECT_EQ(bodies[1].getZ(), -35.0);
+  EXPECT_EQ(bodies[1].getMass(), 1e-3);
+  // A cube around both bodies
+  const MyMath::BoundingBox b = table.bounds();
+  EXPECT_LT(b.min.z, -35.0);
+  EXPECT_GT(b.max.z, 3.0);
+  EXPECT_DOUBLE_EQ(b.max.x - b.min.x, b.max.z - b.min.z);
+  std::filesystem::remove(path);
+}
+
+TEST(TextTableTest, PicksColumnsByCountOrByFormat) {
+  ThreadPool pool{1};
+  // Whitespace, no header: x y z vx vy vz mass
+  std::string path = write_table("seven.txt", "0 0 0 1 2 3 4\n"
+                                              "\t1   1 1 0 0 0 5  \n");
+  auto seven = io::TextTable::open(path, {}, pool);
+  ASSERT_TRUE(seven.is_ok()) << seven.error_message();
+  std::vector<Particle> bodies = all_bodies(*seven.value());
+  ASSERT_EQ(bodies.size(), 2u);
+  EXPECT_EQ(bodies[0].getVz(), 3.0);
+  EXPECT_EQ(bodies[1].getMass(), 5.0);
+
+  // Explicit mapping by index and by (any case) header name; the mass
+  // column is left out and defaults to 1
+  path = write_table("mapped.csv", "a,PosX,b,PosY,PosZ\n"
+                                   "9,1,9,2,3\n");
+  const io::TextFormat format{.columns = "x=posx,y=3,z=PosZ"};
+  auto mapped = io::TextTable::open(path, format, pool);
+  ASSERT_TRUE(mapped.is_ok()) << mapped.error_message();
+  bodies = all_bodies(*mapped.value());
+  ASSERT_EQ(bodies.size(), 1u);
+  EXPECT_EQ(bodies[0].getX(), 1.0);
+  EXPECT_EQ(bodies[0].getY(), 2.0);
+  EXPECT_EQ(bodies[0].getZ(), 3.0);
+  EXPECT_EQ(bodies[0].getMass(), 1.0);
+
+  // A numeric first row forced to be the header
+  path = write_table("forced.csv", "1,2,3,4\n5,6,7,8\n");
+  auto forced = io::TextTable::open(
+      path, {.header = io::TextFormat::Header::kYes, .columns = "x=0,y=1,z=2"},
+      pool);
+  ASSERT_TRUE(forced.is_ok()) << forced.error_message();
+  EXPECT_EQ(forced.value()->size(), 1u);
+  std::filesystem::remove(path);
+}
+
+TEST(TextTableTest, PartsCoverTheTableInOrder) {
+  ThreadPool pool{4};
+  constexpr size_t kRows = 220000; // about 9.5 MiB: three parts
+  std::string text = "x,y,z,vx,vy,vz,mass\n";
+  for (size_t i = 0; i < kRows; ++i)
+    text += std::to_string(i) + ".5,1.25,-2,0.125,0,0,1.0000000000001\n";
+  const std::string path = write_table("large.csv", text);
+  auto opened = io::TextTable::open(path, {}, pool);
+  ASSERT_TRUE(opened.is_ok()) << opened.error_message();
+  const io::TextTable &table = *opened.value();
+  EXPECT_EQ(table.size(), kRows);
+  EXPECT_GE(table.parts(), 3u);
+
+  // In order, ids are rows
+  const std::vector<Particle> bodies = all_bodies(table);
+  ASSERT_EQ(bodies.size(), kRows);
+  for (size_t i = 0; i < kRows; ++i)
+    ASSERT_EQ(bodies[i].getX(), static_cast<double>(i) + 0.5) << i;
+
+  // Parts read at once
+  std::atomic<size_t> seen{0};
+  pool.parallel_for(table.parts(), 1, [&](size_t begin, size_t end) {
+    for (size_t part = begin; part < end; ++part)
+      table.for_each(part, [&](const Particle &) { ++seen; });
+  });
+  EXPECT_EQ(seen.load(), kRows);
+  std::filesystem::remove(path);
+}
+
+TEST(TextTableTest, RejectsWhatItCannotRead) {
+  ThreadPool pool{2};
+  const auto fails = [&](const std::string &text,
+                         const io::TextFormat &format = {}) {
+    const std::string path = write_table("bad.csv", text);
+    const bool failed = io::TextTable::open(path, format, pool).is_error();
+    std::filesystem::remove(path);
+    return failed;
+  };
+  EXPECT_TRUE(fails(""));
+  EXPECT_TRUE(fails("# only a comment\n\n"));
+  EXPECT_TRUE(fails("x,y,z\n"));                  // header, no rows
+  EXPECT_TRUE(fails("1,2,3,4\n1,2,x,4\n"));       // not a number
+  EXPECT_TRUE(fails("1,2,3,4\n1,2,3\n"));         // field missing
+  EXPECT_TRUE(fails("1 2 3 4 5\n"));              // no default for five
+  EXPECT_TRUE(fails("x,y,mass\n1,2,3\n"));        // no z
+  EXPECT_TRUE(fails("1,2,3,4\n", {.columns = "x=0,y=1,z=9"}));
+  EXPECT_TRUE(fails("1,2,3,4\n", {.columns = "w=0"}));
+  EXPECT_FALSE(fails("1,2,3,4\n"));
+  EXPECT_TRUE(io::TextTable::open(temp_path("missing.csv"), {}, pool)
+                  .is_error());
+  EXPECT_THROW(io::header_from_string("maybe"), std::runtime_error);
+}
+
+TEST(TextTableTest, OpenBodySourceGoesByContent) {
+  ThreadPool pool{1};
+  const std::string gwp = temp_path("source.gwp");
+  ASSERT_TRUE(io::write_particle_file(
+      gwp, {Particle{0.5, 0.5, 0.5, 0, 0, 0, 1}},
+      {.bounds = {{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}}}));
+  auto file = io::open_body_source(gwp, {}, {}, pool);
+  ASSERT_TRUE(file.is_ok()) << file.error_message();
+  EXPECT_NE(dynamic_cast<const io::ParticleFile *>(file.value().get()),
+            nullptr);
+
+  // The extension does not matter
+  const std::string csv = write_table("source.gwp.txt", "1 2 3 4\n");
+  auto table = io::open_body_source(csv, {}, {}, pool);
+  ASSERT_TRUE(table.is_ok()) << table.error_message();
+  EXPECT_NE(dynamic_cast<const io::TextTable *>(table.value().get()),
+            nullptr);
+  EXPECT_EQ(all_bodies(*table.value())[0].getMass(), 4.0);
+  std::filesystem::remove(gwp);
+  std::filesystem::remove(csv);
+}
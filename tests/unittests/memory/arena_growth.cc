@@ -0,0 +1,94 @@
+#include "ds/storage/particleBlock.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "memory/blocks_arena.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <vector>
+
+TEST(ArenaGrowthTest, GrowsWithoutMovingBlocks) {
+  for (BlockPlacement placement :
+       {BlockPlacement::kFreeList, BlockPlacement::kSpatial}) {
+    BlocksAllocator arena{4, 256, placement};
+    ASSERT_EQ(arena.initialize(), 0);
+    const size_t initial = arena.capacity;
+    std::byte *base = arena.base;
+
+    std::vector<ParticleBlock *> blocks;
+    for (unsigned k = 0; k < 200; ++k) {
+      ParticleBlock *block = arena.allocate(0);
+      ASSERT_NE(block, nullptr) << "allocation " << k;
+      block->initialize();
+      block->get_x()[0] = k;
+      blocks.push_back(block);
+    }
+    EXPECT_GT(arena.capacity, initial);
+    EXPECT_EQ(arena.base, base);
+    EXPECT_EQ(arena.current_counter, 200u);
+
+    // Everything written before the arena grew is still in place
+    for (unsigned k = 0; k < blocks.size(); ++k)
+      EXPECT_EQ(blocks[k]->get_x()[0], k);
+  }
+}
+
+TEST(ArenaGrowthTest, RunsAndReserveLimit) {
+  BlocksAllocator arena{8, 64, BlockPlacement::kSpatial};
+  ASSERT_EQ(arena.initialize(), 0);
+
+  // Runs that don't fit the committed part commit more pages
+  for (unsigned k = 0; k < 4; ++k)
+    ASSERT_NE(arena.allocate_run(8, 0), nullptr) << "run " << k;
+
+  while (arena.current_counter < arena.max_capacity)
+    ASSERT_NE(arena.allocate(0), nullptr);
+  EXPECT_EQ(arena.allocate(0), nullptr);
+  EXPECT_EQ(arena.allocate_run(8, 0), nullptr);
+}
+
+TEST(ArenaGrowthTest, HugePagesFallBackGracefully) {
+  // Whatever the kernel offers, the arena must come up and stay usable
+  BlocksAllocator arena{8, 4096, BlockPlacement::kSpatial, PageSize::kHuge};
+  ASSERT_EQ(arena.initialize(), 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(arena.base) %
+                BlocksAllocator::kHugePageSize,
+            0u)
+      << page_backing_name(arena.page_backing());
+
+  for (unsigned k = 0; k < 2000; ++k) {
+    ParticleBlock *block = arena.allocate(k);
+    ASSERT_NE(block, nullptr);
+    block->initialize();
+  }
+}
+
+TEST(ArenaGrowthTest, TreeReportsExhaustedArena) {
+  // Reserve sized for a depth-1 tree, then clusters that split to depth 20
+  Storage storage{16, sfc::Curve::kMorton, BlockPlacement::kSpatial,
+                  PageSize::kSmall, false, 1};
+  AROctree tree{20, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+
+  size_t stored = 0, dropped = 0;
+  for (unsigned c = 0; c < 1000 && dropped == 0; ++c) {
+    const double at = (c + 0.5) / 1000.0;
+    for (unsigned i = 0; i <= ParticleBlock::N; ++i) {
+      const double t = at + 1e-9 * i;
+      if (tree.insert(Particle{t, at, at, 0, 0, 0, 1}))
+        ++stored;
+      else
+        ++dropped;
+    }
+  }
+  ASSERT_GT(dropped, 0u);
+
+  // Whatever went in is still reachable
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+  size_t found = 0;
+  for (const AROctreeNode *leaf : leaves)
+    for (const ParticleBlock *b = leaf->localBlock; b;
+         b = storage.next_block(b))
+      found += b->size();
+  EXPECT_EQ(found, stored);
+}
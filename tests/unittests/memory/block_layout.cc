@@ -0,0 +1,61 @@
+#include "core/bodies/particles.h"
+#include "ds/storage/particleBlock.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+namespace {
+std::vector<Particle> numbered(unsigned n) {
+  std::vector<Particle> out;
+  for (unsigned k = 0; k < n; ++k)
+    out.push_back(
+        Particle{k + 0.25, k + 0.5, k + 0.75, -1.0 * k, 0, 0, k + 1.0});
+  return out;
+}
+
+// Same bodies in, same bodies out, whatever the hot layout
+template <class Block> void round_trip() {
+  typename Block::ColdBlock cold{};
+  Block block{sfc::kRootCode, &cold, numbered(Block::N)};
+  ASSERT_TRUE(block.is_full());
+  for (unsigned k = 0; k < Block::N; ++k) {
+    const Particle p = block.getParticle(k);
+    EXPECT_EQ(p.getX(), k + 0.25);
+    EXPECT_EQ(p.getZ(), k + 0.75);
+    EXPECT_EQ(p.getVx(), -1.0 * k);
+    EXPECT_EQ(p.getMass(), k + 1.0);
+    EXPECT_EQ(block.get_y()[k], k + 0.5);
+  }
+
+  // The last body fills the hole
+  const Particle removed = block.deleteParticle(3);
+  EXPECT_EQ(removed.getX(), 3.25);
+  EXPECT_EQ(block.size(), Block::N - 1);
+  EXPECT_EQ(block.get_x()[3], Block::N - 1 + 0.25);
+  EXPECT_EQ(block.get_vx()[3], -1.0 * (Block::N - 1));
+}
+} // namespace
+
+TEST(BlockLayoutTest, SoAAndAoSoAHoldTheSameBodies) {
+  round_trip<BasicParticleBlock<double, 16, BlockLayout::kSoA>>();
+  round_trip<BasicParticleBlock<double, 24, BlockLayout::kAoSoA>>();
+  round_trip<BasicParticleBlock<float, 32, BlockLayout::kAoSoA>>();
+}
+
+TEST(BlockLayoutTest, TilesPackOneRegisterPerField) {
+  using Tiled = BasicParticleBlock<double, 24, BlockLayout::kAoSoA>;
+  using Tile = Tiled::TiledBlock::Tile;
+  EXPECT_EQ(sizeof(Tile), 256u);
+  EXPECT_EQ(sizeof(BasicParticleBlock<float, 32, BlockLayout::kAoSoA>::
+                       TiledBlock::Tile),
+            256u);
+  EXPECT_EQ(Tiled::TiledBlock::kTiles, 3u);
+
+  Tiled::ColdBlock cold{};
+  Tiled block{sfc::kRootCode, &cold, numbered(Tiled::N)};
+  // Body 9 is lane 1 of the second tile
+  const Tile &tile = block.data_block.tiles[1];
+  EXPECT_EQ(tile.x[1], 9.25);
+  EXPECT_EQ(tile.y[1], 9.5);
+  EXPECT_EQ(tile.mass[1], 10.0);
+  EXPECT_EQ(&block.get_z()[9], &tile.z[1]);
+}
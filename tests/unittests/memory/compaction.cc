@@ -0,0 +1,111 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/neighbour_lists.h"
+#include "ds/tree/octree.h"
+#include "ds/tree/sfc.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+struct Body {
+  double x, y, z;
+  bool operator<(const Body &o) const {
+    return std::tie(x, y, z) < std::tie(o.x, o.y, o.z);
+  }
+  bool operator==(const Body &o) const = default;
+};
+
+std::vector<Body> bodies_of(const Storage &storage,
+                            const std::vector<AROctreeNode *> &leaves) {
+  std::vector<Body> out;
+  for (const AROctreeNode *leaf : leaves)
+    for (const ParticleBlock *b = leaf->localBlock; b;
+         b = storage.next_block(b))
+      for (unsigned i = 0; i < b->data_block.size; ++i)
+        out.push_back({b->data_block.x[i], b->data_block.y[i],
+                       b->data_block.z[i]});
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+std::vector<Particle> scattered(size_t n) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<Particle> out;
+  // A crowded corner on top of a uniform cloud, so max-depth chains appear
+  for (size_t i = 0; i < n; ++i)
+    out.push_back(i % 4 ? Particle{u(rng), u(rng), u(rng), 0, 0, 0, 1}
+                        : Particle{1e-4, 1e-4, 1e-4, 0, 0, 0, 1});
+  return out;
+}
+} // namespace
+
+TEST(CompactionTest, ReordersIntoCurveOrderAndFixesPointers) {
+  for (BlockPlacement placement :
+       {BlockPlacement::kFreeList, BlockPlacement::kSpatial}) {
+    Storage storage{2000, sfc::Curve::kMorton, placement};
+    AROctree tree{4, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                  storage};
+    tree.insert_batch(scattered(2000), 3);
+    storage.flush_block_caches();
+
+    std::vector<AROctreeNode *> leaves;
+    tree.collect_leaves(leaves);
+    const std::vector<Body> before = bodies_of(storage, leaves);
+    const size_t used = storage.used_blocks();
+    const uint64_t version = tree.topology_version();
+
+    tree.relocate_blocks(storage.compact_blocks());
+    EXPECT_GT(tree.topology_version(), version);
+    EXPECT_EQ(storage.used_blocks(), used);
+
+    // Same bodies behind the same nodes
+    EXPECT_EQ(bodies_of(storage, leaves), before);
+
+    // Leaf blocks now ascend in curve order, chains right behind their head
+    size_t previous = 0;
+    bool first = true, saw_chain = false;
+    for (const AROctreeNode *leaf : leaves) {
+      if (!leaf->localBlock)
+        continue;
+      size_t expected = storage.block_index(leaf->localBlock);
+      if (!first) {
+        EXPECT_GT(expected, previous);
+      }
+      first = false;
+      for (const ParticleBlock *b = leaf->localBlock; b;
+           b = storage.next_block(b)) {
+        const bool packed = placement == BlockPlacement::kFreeList;
+        if (packed || b != leaf->localBlock) {
+          EXPECT_EQ(storage.block_index(b), expected);
+        }
+        expected = storage.block_index(b) + 1;
+        saw_chain |= b != leaf->localBlock;
+        previous = storage.block_index(b);
+      }
+    }
+    EXPECT_TRUE(saw_chain);
+
+    // Neighbour lists built afterwards point at the new slots
+    LeafNeighbourLists lists;
+    lists.rebuild(leaves, storage);
+    for (size_t leaf = 0; leaf < lists.leaf_count(); ++leaf)
+      EXPECT_EQ(storage.block_at(lists.leaf_block(leaf)),
+                leaves[leaf]->localBlock);
+
+    // The arena hands out the freed holes again without clobbering anything
+    tree.insert_batch(scattered(500));
+    tree.collect_leaves(leaves);
+    EXPECT_EQ(bodies_of(storage, leaves).size(), before.size() + 500);
+  }
+}
+
+TEST(CompactionTest, SecondPassIsANoOp) {
+  Storage storage{500, sfc::Curve::kHilbert, BlockPlacement::kSpatial};
+  AROctree tree{6, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(scattered(500));
+  tree.relocate_blocks(storage.compact_blocks());
+  EXPECT_TRUE(storage.compact_blocks().empty());
+}
@@ -0,0 +1,87 @@
+#include "ds/storage/particleBlock.h"
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "memory/blocks_arena.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+// Velocity is a function of position, so any cold half that ends up behind
+// the wrong hot half shows up
+Particle tagged(double x, double y, double z) {
+  return Particle{x, y, z, 2 * x, 3 * y, 4 * z, 1};
+}
+
+void expect_tagged(const ParticleBlock &block) {
+  for (unsigned i = 0; i < block.size(); ++i) {
+    EXPECT_EQ(block.get_vx()[i], 2 * block.get_x()[i]);
+    EXPECT_EQ(block.get_vy()[i], 3 * block.get_y()[i]);
+    EXPECT_EQ(block.get_vz()[i], 4 * block.get_z()[i]);
+  }
+}
+} // namespace
+
+TEST(HotColdTest, HotHalfIsCacheLineAligned) {
+  EXPECT_EQ(sizeof(ParticleBlock) % 64, 0u);
+  EXPECT_LT(sizeof(ParticleBlock), sizeof(ParticleBlock::ColdBlock));
+
+  BlocksAllocator arena{4, 256, BlockPlacement::kSpatial};
+  ASSERT_EQ(arena.initialize(), 0);
+  ParticleBlock *block = arena.allocate(17);
+  ASSERT_NE(block, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(block->data_block.x.data()) % 64, 0u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(block->data_block.mass.data()) % 64,
+            0u);
+}
+
+TEST(HotColdTest, ColdHalvesFollowSlotsAcrossGrowth) {
+  Storage storage{16};
+  std::vector<ParticleBlock *> blocks;
+  for (unsigned k = 0; k < 500; ++k) {
+    ParticleBlock *block =
+        storage.create_memory_block(sfc::kRootCode, {tagged(k, k + 1, k + 2)});
+    ASSERT_NE(block, nullptr) << "block " << k;
+    blocks.push_back(block);
+  }
+  EXPECT_GT(storage.capacity(), 32u);
+  for (ParticleBlock *block : blocks) {
+    ASSERT_EQ(block->size(), 1u);
+    expect_tagged(*block);
+  }
+
+  blocks[0]->swap(*blocks[1]);
+  EXPECT_EQ(blocks[0]->get_x()[0], 1.0);
+  expect_tagged(*blocks[0]);
+  expect_tagged(*blocks[1]);
+}
+
+TEST(HotColdTest, CompactionMovesColdHalves) {
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<Particle> particles;
+  for (size_t i = 0; i < 2000; ++i)
+    particles.push_back(tagged(u(rng), u(rng), u(rng)));
+
+  Storage storage{2000};
+  AROctree tree{6, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(particles, 3);
+  storage.flush_block_caches();
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+
+  const std::vector<uint32_t> moved = storage.compact_blocks();
+  ASSERT_FALSE(moved.empty());
+  tree.relocate_blocks(moved);
+
+  size_t bodies = 0;
+  for (const AROctreeNode *leaf : leaves)
+    for (const ParticleBlock *b = leaf->localBlock; b;
+         b = storage.next_block(b)) {
+      expect_tagged(*b);
+      bodies += b->size();
+    }
+  EXPECT_EQ(bodies, particles.size());
+}
@@ -0,0 +1,118 @@
+#include "ds/storage/particleBlock.h"
+#include "memory/blocks_arena.h"
+#include "memory/numa.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+namespace fs = std::filesystem;
+
+// Same layout as /sys/devices/system/node on a dual-socket box with a
+// memory-only node
+struct FakeSysfs {
+  fs::path root = fs::temp_directory_path() / "gravwll_numa_test";
+
+  FakeSysfs() {
+    fs::remove_all(root);
+    write("node0/cpulist", "0-3,8-11\n");
+    write("node1/cpulist", "4-7,12-15\n");
+    write("node2/cpulist", "\n");
+    write("possible", "0-2\n");
+    fs::create_directories(root / "power");
+  }
+  ~FakeSysfs() { fs::remove_all(root); }
+
+  void write(const std::string &file, const std::string &text) {
+    fs::create_directories((root / file).parent_path());
+    std::ofstream(root / file) << text;
+  }
+};
+
+// Two nodes that both run on CPU 0, so pinning works on any box
+std::vector<numa::Node> two_nodes() { return {{0, {0}}, {1, {0}}}; }
+} // namespace
+
+TEST(NumaTest, ParsesCpuLists) {
+  EXPECT_EQ(numa::parse_cpu_list("0-2,5,7-8"),
+            (std::vector<unsigned>{0, 1, 2, 5, 7, 8}));
+  EXPECT_EQ(numa::parse_cpu_list("3\n"), (std::vector<unsigned>{3}));
+  EXPECT_TRUE(numa::parse_cpu_list("").empty());
+  EXPECT_TRUE(numa::parse_cpu_list("4-1").empty());
+  EXPECT_TRUE(numa::parse_cpu_list("a-b").empty());
+}
+
+TEST(NumaTest, ReadsNodesWithCpus) {
+  FakeSysfs sysfs;
+  const std::vector<numa::Node> nodes = numa::read_nodes(sysfs.root.string());
+  ASSERT_EQ(nodes.size(), 2u);
+  EXPECT_EQ(nodes[0].id, 0u);
+  EXPECT_EQ(nodes[1].id, 1u);
+  EXPECT_EQ(nodes[1].cpus,
+            (std::vector<unsigned>{4, 5, 6, 7, 12, 13, 14, 15}));
+
+  EXPECT_TRUE(numa::read_nodes((sysfs.root / "missing").string()).empty());
+}
+
+TEST(NumaTest, ArenaRegionsFollowTheCurve) {
+  for (BlockPlacement placement :
+       {BlockPlacement::kFreeList, BlockPlacement::kSpatial}) {
+    BlocksAllocator arena{64, 1024, placement, PageSize::kSmall, two_nodes()};
+    ASSERT_EQ(arena.initialize(), 0);
+    ASSERT_EQ(arena.region_count(), 2u);
+    ASSERT_NE(arena.region_node(1), nullptr);
+    EXPECT_EQ(arena.region_node(1)->id, 1u);
+
+    // First half of the curve maps to region 0, second half to region 1
+    const size_t low = arena.slot_for(0x10000000u);
+    const size_t high = arena.slot_for(0xc0000000u);
+    EXPECT_EQ(arena.region_of(low), 0u);
+    EXPECT_EQ(arena.region_of(high), 1u);
+
+    // Each region grows on its own, blocks never leave their region
+    std::vector<ParticleBlock *> high_blocks;
+    for (unsigned k = 0; k < 100; ++k) {
+      ParticleBlock *block = arena.allocate(high);
+      ASSERT_NE(block, nullptr);
+      block->get_x()[0] = k;
+      high_blocks.push_back(block);
+    }
+    for (unsigned k = 0; k < 100; ++k) {
+      ParticleBlock *block = arena.allocate(low);
+      ASSERT_NE(block, nullptr);
+      EXPECT_EQ(arena.region_of(static_cast<size_t>(
+                    reinterpret_cast<std::byte *>(block) - arena.base) /
+                arena.k_block_size),
+                0u);
+    }
+    for (unsigned k = 0; k < high_blocks.size(); ++k) {
+      const size_t index = static_cast<size_t>(
+          reinterpret_cast<std::byte *>(high_blocks[k]) - arena.base) /
+          arena.k_block_size;
+      EXPECT_EQ(arena.region_of(index), 1u);
+      EXPECT_EQ(high_blocks[k]->get_x()[0], k);
+    }
+  }
+}
+
+TEST(NumaTest, FullRegionSpillsOver) {
+  BlocksAllocator arena{8, 16, BlockPlacement::kSpatial, PageSize::kSmall,
+                        two_nodes()};
+  ASSERT_EQ(arena.initialize(), 0);
+
+  // Asking region 0 for everything ends up in region 1 once it is full
+  const size_t hint = arena.slot_for(0);
+  size_t got = 0, in_second = 0;
+  while (ParticleBlock *block = arena.allocate(hint)) {
+    const size_t index = static_cast<size_t>(
+        reinterpret_cast<std::byte *>(block) - arena.base) /
+        arena.k_block_size;
+    in_second += arena.region_of(index);
+    ++got;
+  }
+  EXPECT_GE(got, arena.max_capacity);
+  EXPECT_EQ(got, arena.current_counter);
+  EXPECT_EQ(in_second, got / 2);
+}
@@ -0,0 +1,65 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "ds/tree/sfc.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+void fill_two_levels(AROctree &tree) {
+  for (unsigned k = 0; k < 17; ++k) {
+    const unsigned sub = k % 8;
+    tree.insert(Particle{0.125 + 0.25 * ((sub >> 2) & 1),
+                         0.125 + 0.25 * ((sub >> 1) & 1),
+                         0.125 + 0.25 * (sub & 1), 0, 0, 0, 1});
+  }
+}
+} // namespace
+
+TEST(BlockPlacementTest, SiblingsAreContiguousInCurveOrder) {
+  for (sfc::Curve curve : {sfc::Curve::kMorton, sfc::Curve::kHilbert}) {
+    Storage storage{64, curve, BlockPlacement::kSpatial};
+    AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                  storage};
+    fill_two_levels(tree);
+
+    std::vector<AROctreeNode *> leaves;
+    tree.collect_leaves(leaves);
+    ASSERT_EQ(leaves.size(), 15u);
+
+    // Every group of siblings occupies 8 adjacent slots ranked by the curve
+    std::vector<AROctreeNode *> parents{tree.get_root(),
+                                        tree.get_root()->children[0]};
+    for (AROctreeNode *parent : parents) {
+      std::vector<std::pair<sfc::OrderKey, size_t>> slots;
+      for (AROctreeNode *child : parent->children) {
+        if (!child->localBlock)
+          continue; // the split child 0 of the root gave its block back
+        slots.push_back({sfc::order_key(curve, child->code),
+                         storage.block_index(child->localBlock)});
+      }
+      std::sort(slots.begin(), slots.end());
+      for (size_t k = 1; k < slots.size(); ++k)
+        EXPECT_GT(slots[k].second, slots[k - 1].second);
+      EXPECT_LE(slots.back().second - slots.front().second, 7u);
+    }
+  }
+}
+
+TEST(BlockPlacementTest, FreeListStillServesEveryLeaf) {
+  Storage storage{64, sfc::Curve::kMorton, BlockPlacement::kFreeList};
+  AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  fill_two_levels(tree);
+
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+  ASSERT_EQ(leaves.size(), 15u);
+  std::vector<size_t> slots;
+  for (AROctreeNode *leaf : leaves) {
+    ASSERT_NE(leaf->localBlock, nullptr);
+    slots.push_back(storage.block_index(leaf->localBlock));
+  }
+  std::sort(slots.begin(), slots.end());
+  EXPECT_EQ(std::unique(slots.begin(), slots.end()), slots.end());
+}
@@ -0,0 +1,67 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "engine/expansions.h"
+#include "memory/expansion_arena.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+TEST(ExpansionArenaTest, BumpAllocatesAlignedAndResets) {
+  ExpansionArena arena;
+  ASSERT_EQ(arena.reserve(1000), 0);
+  double *a = arena.allocate<double>(3);
+  double *b = arena.allocate<double>(5);
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % ExpansionArena::kAlignment, 0u);
+  EXPECT_EQ(arena.allocate<double>(1000), nullptr);
+
+  arena.reset();
+  EXPECT_EQ(arena.allocate<double>(3), a);
+}
+
+TEST(ExpansionsTest, UpwardPassMatchesDirectMoments) {
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<double> coord(0.0, 1.0), weight(0.5, 2.0);
+  std::vector<Particle> particles;
+  for (int i = 0; i < 300; ++i)
+    particles.push_back(
+        Particle{coord(rng), coord(rng), coord(rng), 0, 0, 0, weight(rng)});
+
+  Storage storage{300};
+  AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(particles);
+  std::vector<AROctreeNode *> nodes;
+  tree.collect_nodes(nodes);
+  ASSERT_GT(nodes.size(), 9u);
+
+  ExpansionArena arena;
+  ASSERT_EQ(arena.reserve(Expansions::bytes_for(nodes.size())), 0);
+  Expansions ex;
+  ASSERT_TRUE(ex.carve(arena, nodes.size()));
+  upward_pass(nodes, storage, ex);
+
+  double m = 0, cx = 0, cy = 0, cz = 0;
+  for (const Particle &p : particles) {
+    m += p.getMass();
+    cx += p.getMass() * p.getX();
+    cy += p.getMass() * p.getY();
+    cz += p.getMass() * p.getZ();
+  }
+  cx /= m, cy /= m, cz /= m;
+  double xx = 0, yz = 0;
+  for (const Particle &p : particles) {
+    xx += p.getMass() * (p.getX() - cx) * (p.getX() - cx);
+    yz += p.getMass() * (p.getY() - cy) * (p.getZ() - cz);
+  }
+
+  EXPECT_EQ(nodes[0], tree.get_root());
+  EXPECT_NEAR(ex.mass[0], m, 1e-9);
+  EXPECT_NEAR(ex.com_x[0], cx, 1e-12);
+  EXPECT_NEAR(ex.com_y[0], cy, 1e-12);
+  EXPECT_NEAR(ex.com_z[0], cz, 1e-12);
+  EXPECT_NEAR(ex.qxx[0], xx, 1e-9);
+  EXPECT_NEAR(ex.qyz[0], yz, 1e-9);
+}
@@ -0,0 +1,44 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <vector>
+
+namespace {
+std::vector<Particle> random_particles(size_t n, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> coord(0.0, 1.0);
+  std::vector<Particle> out;
+  out.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+    out.push_back(Particle{coord(rng), coord(rng), coord(rng), 0, 0, 0, 1});
+  return out;
+}
+
+bool inside(const MyMath::BoundingBox &b, double x, double y, double z) {
+  return x >= b.min.x && x <= b.max.x && y >= b.min.y && y <= b.max.y &&
+         z >= b.min.z && z <= b.max.z;
+}
+} // namespace
+
+TEST(ConcurrentInsertTest, ParallelBuildKeepsEveryParticle) {
+  const std::vector<Particle> particles = random_particles(2000, 3);
+  Storage storage{2000};
+  AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  tree.insert_batch(particles, 4);
+
+  std::vector<AROctreeNode *> leaves;
+  tree.collect_leaves(leaves);
+  size_t total = 0;
+  for (AROctreeNode *leaf : leaves) {
+    ASSERT_NE(leaf->localBlock, nullptr);
+    const auto &block = leaf->localBlock->data_block;
+    EXPECT_LE(block.size, AROctreeNode::kSplitThreshold);
+    for (size_t i = 0; i < block.size; ++i)
+      EXPECT_TRUE(inside(leaf->bounds, block.x[i], block.y[i], block.z[i]));
+    total += block.size;
+  }
+  EXPECT_EQ(total, particles.size());
+  EXPECT_GT(tree.topology_version(), 0u);
+}
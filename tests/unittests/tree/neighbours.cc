@@ -0,0 +1,87 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/neighbour_lists.h"
+#include "ds/tree/octree.h"
+#include "ds/tree/sfc.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <set>
+#include <vector>
+
+namespace {
+// Root split plus a second split of octant 0: 7 leaves at depth 1 and 8 at
+// depth 2 sharing faces, edges and corners with them
+struct TwoLevelTree {
+  Storage storage{64};
+  AROctree tree{10, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+  std::vector<AROctreeNode *> leaves;
+  LeafNeighbourLists lists;
+
+  TwoLevelTree() {
+    for (unsigned k = 0; k < 17; ++k) {
+      const unsigned sub = k % 8;
+      tree.insert(Particle{0.125 + 0.25 * ((sub >> 2) & 1),
+                           0.125 + 0.25 * ((sub >> 1) & 1),
+                           0.125 + 0.25 * (sub & 1), 0, 0, 0, 1});
+    }
+    tree.collect_leaves(leaves);
+    lists.rebuild(leaves, storage);
+  }
+
+  std::set<sfc::LocationCode> neighbour_codes(sfc::LocationCode code) const {
+    std::set<sfc::LocationCode> out;
+    for (size_t leaf = 0; leaf < lists.leaf_count(); ++leaf) {
+      if (lists.leaf_code(leaf) != code)
+        continue;
+      for (uint32_t nb : lists.neighbours(leaf))
+        out.insert(lists.leaf_code(nb));
+    }
+    return out;
+  }
+};
+
+sfc::LocationCode code_of(std::initializer_list<unsigned> path) {
+  sfc::LocationCode code = sfc::kRootCode;
+  for (unsigned octant : path)
+    code = sfc::child_code(code, octant);
+  return code;
+}
+} // namespace
+
+TEST(NeighbourListsTest, MixedDepthNeighbours) {
+  TwoLevelTree t;
+  ASSERT_EQ(t.lists.leaf_count(), 15u);
+
+  // Depth-1 corner cell sees its 6 depth-1 siblings and one depth-2 corner
+  std::set<sfc::LocationCode> expected;
+  for (unsigned octant = 1; octant < 7; ++octant)
+    expected.insert(code_of({octant}));
+  expected.insert(code_of({0, 7}));
+  EXPECT_EQ(t.neighbour_codes(code_of({7})), expected);
+
+  // Deep cell at the origin only touches its siblings
+  expected.clear();
+  for (unsigned octant = 1; octant < 8; ++octant)
+    expected.insert(code_of({0, octant}));
+  EXPECT_EQ(t.neighbour_codes(code_of({0, 0})), expected);
+
+  // Deep cell at the centre touches every other leaf
+  EXPECT_EQ(t.neighbour_codes(code_of({0, 7})).size(), 14u);
+}
+
+TEST(NeighbourListsTest, SymmetricAndBlockIndexed) {
+  TwoLevelTree t;
+  for (size_t leaf = 0; leaf < t.lists.leaf_count(); ++leaf) {
+    const auto nbs = t.lists.neighbours(leaf);
+    const auto blocks = t.lists.neighbour_blocks(leaf);
+    ASSERT_EQ(nbs.size(), blocks.size());
+    for (size_t k = 0; k < nbs.size(); ++k) {
+      EXPECT_EQ(blocks[k], t.lists.leaf_block(nbs[k]));
+      EXPECT_EQ(t.storage.block_at(blocks[k]), t.leaves[nbs[k]]->localBlock);
+
+      const auto back = t.lists.neighbours(nbs[k]);
+      EXPECT_TRUE(std::find(back.begin(), back.end(), leaf) != back.end())
+          << "leaf " << leaf << " missing from neighbour " << nbs[k];
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#include "ds/storage/storage.h"
+#include "ds/tree/octree.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace {
+// Depth-1 tree, so a crowded octant can't split and must chain
+struct ShallowTree {
+  Storage storage{400};
+  AROctree tree{1, MyMath::BoundingBox{{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0}},
+                storage};
+
+  size_t chain_length(const AROctreeNode *leaf) const {
+    size_t blocks = 0;
+    for (const ParticleBlock *b = leaf->localBlock; b; b = storage.next_block(b))
+      ++blocks;
+    return blocks;
+  }
+  size_t chain_bodies(const AROctreeNode *leaf) const {
+    size_t bodies = 0;
+    for (const ParticleBlock *b = leaf->localBlock; b; b = storage.next_block(b))
+      bodies += b->data_block.size;
+    return bodies;
+  }
+};
+
+std::vector<Particle> crowd(size_t n, double offset) {
+  std::vector<Particle> out;
+  for (size_t i = 0; i < n; ++i) {
+    const double t = offset + 0.4 * static_cast<double>(i) / double(n);
+    out.push_back(Particle{t, t, t, 0, 0, 0, 1});
+  }
+  return out;
+}
+
+size_t blocks_for(size_t bodies) {
+  return (bodies + ParticleBlock::N - 1) / ParticleBlock::N;
+}
+} // namespace
+
+TEST(OverflowChainTest, MaxDepthLeafKeepsEveryBody) {
+  ShallowTree t;
+  t.tree.insert_batch(crowd(100, 0.05), 4);
+
+  AROctreeNode *crowded = t.tree.get_root()->children[0];
+  EXPECT_EQ(t.chain_bodies(crowded), 100u);
+  EXPECT_EQ(t.chain_length(crowded), blocks_for(100));
+}
+
+TEST(OverflowChainTest, MigrationCompactsTheChain) {
+  ShallowTree t;
+  t.tree.insert_batch(crowd(60, 0.05));
+  std::vector<AROctreeNode *> leaves;
+  t.tree.collect_leaves(leaves);
+  AROctreeNode *crowded = t.tree.get_root()->children[0];
+  ASSERT_EQ(t.chain_length(crowded), blocks_for(60));
+
+  // Move the first 30 bodies of the chain to the far corner
+  size_t moved = 0;
+  for (ParticleBlock *b = crowded->localBlock; b && moved < 30;
+       b = t.storage.next_block(b))
+    for (size_t i = 0; i < b->data_block.size && moved < 30; ++i, ++moved)
+      b->get_x()[i] = b->get_y()[i] = b->get_z()[i] = 0.9;
+
+  std::vector<Particle> migrants;
+  t.tree.extract_migrants(leaves, migrants);
+  ASSERT_EQ(migrants.size(), 30u);
+  EXPECT_EQ(t.chain_bodies(crowded), 30u);
+  EXPECT_EQ(t.chain_length(crowded), blocks_for(30));
+  EXPECT_EQ(crowded->localBlock->size(),
+            std::min<size_t>(30, ParticleBlock::N));
+
+  // Slots handed out after compaction continue where the chain ends
+  for (const Particle &p : crowd(20, 0.05))
+    t.tree.insert(p);
+  EXPECT_EQ(t.chain_bodies(crowded), 50u);
+  EXPECT_EQ(t.chain_length(crowded), blocks_for(50));
+}
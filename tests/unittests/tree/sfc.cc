@@ -0,0 +1,67 @@
+#include "ds/tree/sfc.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+constexpr unsigned kLevel = 4;
+constexpr uint32_t kSide = 1u << kLevel;
+
+std::vector<sfc::GridCoord> walk_curve(sfc::Curve curve) {
+  std::vector<sfc::GridCoord> cells(kSide * kSide * kSide);
+  for (uint32_t x = 0; x < kSide; ++x)
+    for (uint32_t y = 0; y < kSide; ++y)
+      for (uint32_t z = 0; z < kSide; ++z) {
+        const sfc::LocationCode code = sfc::encode_code({x, y, z}, kLevel);
+        const sfc::OrderKey key = sfc::order_key(curve, code) >>
+                                  (3 * (sfc::kMaxLevel - kLevel));
+        cells[key] = {x, y, z};
+      }
+  return cells;
+}
+} // namespace
+
+TEST(SfcTest, MortonCodeRoundTrip) {
+  const sfc::GridCoord cell{5, 11, 2};
+  const sfc::LocationCode code = sfc::encode_code(cell, kLevel);
+  EXPECT_EQ(sfc::code_level(code), kLevel);
+
+  const sfc::GridCoord back = sfc::decode_code(code);
+  EXPECT_EQ(back.x, cell.x);
+  EXPECT_EQ(back.y, cell.y);
+  EXPECT_EQ(back.z, cell.z);
+
+  // Octant digits are x|y|z, the same convention as AROctreeNode
+  EXPECT_EQ(sfc::encode_code({1, 0, 0}, 1), sfc::child_code(sfc::kRootCode, 4));
+  EXPECT_EQ(sfc::encode_code({0, 1, 1}, 1), sfc::child_code(sfc::kRootCode, 3));
+}
+
+TEST(SfcTest, HilbertStepsAreFaceAdjacent) {
+  const auto cells = walk_curve(sfc::Curve::kHilbert);
+  for (size_t i = 1; i < cells.size(); ++i) {
+    const int dist = std::abs(int(cells[i].x) - int(cells[i - 1].x)) +
+                     std::abs(int(cells[i].y) - int(cells[i - 1].y)) +
+                     std::abs(int(cells[i].z) - int(cells[i - 1].z));
+    EXPECT_EQ(dist, 1) << "Hilbert jump at position " << i;
+  }
+}
+
+TEST(SfcTest, OrderKeyIsRangeStart) {
+  for (auto curve : {sfc::Curve::kMorton, sfc::Curve::kHilbert}) {
+    const sfc::LocationCode parent = sfc::encode_code({3, 1, 2}, 2);
+    const sfc::OrderKey parent_key = sfc::order_key(curve, parent);
+    const sfc::OrderKey span = sfc::OrderKey{1} << (3 * (sfc::kMaxLevel - 2));
+
+    std::vector<sfc::OrderKey> child_keys;
+    for (unsigned octant = 0; octant < 8; ++octant) {
+      const sfc::OrderKey key =
+          sfc::order_key(curve, sfc::child_code(parent, octant));
+      EXPECT_GE(key, parent_key);
+      EXPECT_LT(key, parent_key + span);
+      child_keys.push_back(key);
+    }
+    std::sort(child_keys.begin(), child_keys.end());
+    EXPECT_EQ(child_keys.front(), parent_key) << sfc::curve_name(curve);
+  }
+}
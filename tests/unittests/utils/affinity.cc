@@ -0,0 +1,132 @@
+#include "utils/affinity.h"
+#include "gtest/gtest.h"
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+namespace {
+// Two packages, two cores each, two SMT siblings per core, numbered the way
+// Linux usually does: first siblings 0-3, second siblings 4-7
+std::vector<affinity::Cpu> two_sockets() {
+  std::vector<affinity::Cpu> cpus;
+  for (unsigned id = 0; id < 8; ++id)
+    cpus.push_back({.id = id,
+                    .core = id % 2,
+                    .package = (id / 2) % 2,
+                    .smt_rank = id / 4});
+  return cpus;
+}
+} // namespace
+
+TEST(AffinityTest, LayoutsOrderTheCpus) {
+  using affinity::Layout;
+  EXPECT_TRUE(affinity::order(two_sockets(), Layout::kNone).empty());
+  // Siblings of a core together, package by package
+  EXPECT_EQ(affinity::order(two_sockets(), Layout::kCompact),
+            (std::vector<unsigned>{0, 4, 1, 5, 2, 6, 3, 7}));
+  // One CPU per core, alternating packages, siblings last
+  EXPECT_EQ(affinity::order(two_sockets(), Layout::kScatter),
+            (std::vector<unsigned>{0, 2, 1, 3, 4, 6, 5, 7}));
+  EXPECT_EQ(affinity::order(two_sockets(), Layout::kNoSmt),
+            (std::vector<unsigned>{0, 1, 2, 3}));
+  EXPECT_EQ(affinity::layout_from_string("nosmt"), Layout::kNoSmt);
+  EXPECT_THROW(affinity::layout_from_string("everywhere"), std::runtime_error);
+}
+
+TEST(AffinityTest, PlanGivesRunnersTheFrontAndRenderTheBack) {
+  affinity::Request request{.layout = affinity::Layout::kNoSmt,
+                            .physics_runners = 2};
+  affinity::Plan plan = affinity::plan(request, two_sockets());
+  ASSERT_EQ(plan.physics.size(), 2u);
+  EXPECT_EQ(plan.physics[0], (std::vector<unsigned>{0}));
+  EXPECT_EQ(plan.physics[1], (std::vector<unsigned>{1}));
+  EXPECT_EQ(plan.render, (std::vector<unsigned>{3}));
+  EXPECT_EQ(plan.io, (std::vector<unsigned>{2}));
+
+  // Explicit lists win; more runners than CPUs wrap around
+  request.physics_runners = 3;
+  request.physics_cpus = {6, 7};
+  request.render_cpus = {0, 1};
+  plan = affinity::plan(request, two_sockets());
+  EXPECT_EQ(plan.physics[2], (std::vector<unsigned>{6}));
+  EXPECT_EQ(plan.render, (std::vector<unsigned>{0, 1}));
+
+  // No layout, no lists: nothing is pinned
+  plan = affinity::plan({.physics_runners = 2}, two_sockets());
+  EXPECT_TRUE(plan.physics[0].empty());
+  EXPECT_TRUE(plan.render.empty());
+  EXPECT_TRUE(plan.io.empty());
+}
+
+TEST(AffinityTest, RenderNeverLandsOnARunnersCpu) {
+  // Four runners on the four CPUs of kNoSmt: nothing is left
+  affinity::Request request{.layout = affinity::Layout::kNoSmt,
+                            .physics_runners = 4};
+  affinity::Plan plan = affinity::plan(request, two_sockets());
+  ASSERT_EQ(plan.physics.size(), 4u);
+  EXPECT_TRUE(plan.render.empty());
+  EXPECT_TRUE(plan.io.empty());
+
+  // Sized automatically, the pool gives one CPU back
+  request.auto_runners = true;
+  plan = affinity::plan(request, two_sockets());
+  ASSERT_EQ(plan.physics.size(), 3u);
+  EXPECT_EQ(plan.render, (std::vector<unsigned>{3}));
+  EXPECT_EQ(plan.io, (std::vector<unsigned>{3}));
+
+  // Both roles placed by hand: no reason to shrink
+  request.render_cpus = {4};
+  request.io_cpus = {5};
+  plan = affinity::plan(request, two_sockets());
+  EXPECT_EQ(plan.physics.size(), 4u);
+}
+
+TEST(AffinityTest, RunnersFollowTheirNumaNode) {
+  // One node per package of two_sockets()
+  const std::vector<std::vector<unsigned>> nodes{{0, 1, 4, 5}, {2, 3, 6, 7}};
+  affinity::Plan plan = affinity::plan({.layout = affinity::Layout::kNoSmt,
+                                        .physics_runners = 4,
+                                        .nodes = nodes},
+                                       two_sockets());
+  // Runners 0-1 live on node 0, 2-3 on node 1, each on a CPU of its node
+  EXPECT_EQ(plan.homes, (std::vector<unsigned>{0, 0, 1, 1}));
+  EXPECT_EQ(plan.physics[0], (std::vector<unsigned>{0}));
+  EXPECT_EQ(plan.physics[1], (std::vector<unsigned>{1}));
+  EXPECT_EQ(plan.physics[2], (std::vector<unsigned>{2}));
+  EXPECT_EQ(plan.physics[3], (std::vector<unsigned>{3}));
+
+  // Compact order would put both runners on package 0 without the nodes
+  plan = affinity::plan({.layout = affinity::Layout::kCompact,
+                         .physics_runners = 2,
+                         .nodes = nodes},
+                        two_sockets());
+  EXPECT_EQ(plan.physics[0], (std::vector<unsigned>{0}));
+  EXPECT_EQ(plan.physics[1], (std::vector<unsigned>{2}));
+  EXPECT_EQ(plan.render, (std::vector<unsigned>{7}));
+
+  // No layout: a runner may use any CPU of its node
+  plan = affinity::plan({.physics_runners = 3, .nodes = nodes},
+                        two_sockets());
+  EXPECT_EQ(plan.homes, (std::vector<unsigned>{0, 0, 1}));
+  EXPECT_EQ(plan.physics[1], nodes[0]);
+  EXPECT_EQ(plan.physics[2], nodes[1]);
+
+  // Explicit CPUs: the runner's home is the CPU's node
+  plan = affinity::plan({.physics_runners = 2,
+                         .physics_cpus = {6, 4},
+                         .nodes = nodes},
+                        two_sockets());
+  EXPECT_EQ(plan.homes, (std::vector<unsigned>{1, 0}));
+}
+
+TEST(AffinityTest, PinsAThreadToAnAllowedCpu) {
+  const std::vector<affinity::Cpu> cpus = affinity::read_topology();
+  ASSERT_FALSE(cpus.empty());
+  const unsigned cpu = cpus.back().id;
+  std::thread pinned([cpu] {
+    ASSERT_TRUE(affinity::pin_current({cpu}));
+    EXPECT_EQ(static_cast<unsigned>(sched_getcpu()), cpu);
+  });
+  pinned.join();
+  EXPECT_FALSE(affinity::pin_current({}));
+}
@@ -0,0 +1,120 @@
+#include "utils/thread_pool.h"
+#include "utils/work_stealing_deque.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST(WorkStealingDequeTest, EveryItemIsTakenExactlyOnce) {
+  // The owner pushes and pops while thieves steal; the ring has to grow
+  constexpr int kItems = 100000;
+  std::vector<int> items(kItems);
+  std::vector<std::atomic<int>> taken(kItems);
+  WorkStealingDeque<int> deque{4};
+  std::atomic<bool> done{false};
+
+  auto mark = [&](int *item) { taken[size_t(item - items.data())]++; };
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < 3; ++t)
+    thieves.emplace_back([&] {
+      while (!done.load(std::memory_order_acquire) || !deque.empty())
+        if (int *item = deque.steal())
+          mark(item);
+    });
+
+  for (int i = 0; i < kItems; ++i) {
+    deque.push(&items[size_t(i)]);
+    if (i % 3 == 0)
+      if (int *item = deque.pop())
+        mark(item);
+  }
+  while (int *item = deque.pop())
+    mark(item);
+  done.store(true, std::memory_order_release);
+  for (auto &thief : thieves)
+    thief.join();
+
+  for (int i = 0; i < kItems; ++i)
+    ASSERT_EQ(taken[size_t(i)].load(), 1) << "item " << i;
+}
+
+TEST(ThreadPoolTest, ParallelForCoversTheRangeOnce) {
+  ThreadPool pool{3};
+  EXPECT_EQ(pool.concurrency(), 4u);
+  std::vector<std::atomic<int>> hits(10007);
+  pool.parallel_for(hits.size(), 0, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      hits[i]++;
+  });
+  for (size_t i = 0; i < hits.size(); ++i)
+    ASSERT_EQ(hits[i].load(), 1) << "index " << i;
+}
+
+TEST(ThreadPoolTest, TasksCanSubmitAndWaitOnTasks) {
+  // Nested groups land on the workers' own deques and get stolen from there
+  ThreadPool pool{3};
+  std::atomic<size_t> leaves{0};
+  pool.parallel_for(16, 1, [&](size_t, size_t) {
+    pool.parallel_for(64, 4, [&](size_t begin, size_t end) {
+      leaves.fetch_add(end - begin, std::memory_order_relaxed);
+    });
+  });
+  EXPECT_EQ(leaves.load(), 16u * 64u);
+}
+
+TEST(ThreadPoolTest, ParkedWorkersWakeForNewWork) {
+  ThreadPool pool{2};
+  // Long enough for both workers to go through spinning and park
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  const std::thread::id self = std::this_thread::get_id();
+  std::atomic<int> on_workers{0};
+  TaskGroup group;
+  for (int i = 0; i < 64; ++i)
+    pool.submit(group, [&] {
+      if (std::this_thread::get_id() != self)
+        on_workers++;
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    });
+  pool.wait(group);
+  EXPECT_TRUE(group.done());
+  EXPECT_GT(on_workers.load(), 0);
+}
+
+TEST(ThreadPoolTest, AutoSizeCountsTheWaitingThread) {
+  ThreadPool pool{0};
+  EXPECT_EQ(pool.concurrency(),
+            std::max(1u, std::thread::hardware_concurrency()));
+  int sum = 0;
+  TaskGroup group;
+  pool.submit(group, [&] { sum += 1; });
+  pool.wait(group);
+  EXPECT_EQ(sum, 1);
+}
+
+TEST(ThreadPoolTest, RunnersPreferTheirHomesWork) {
+  // The waiting thread lives in home 0, the only worker in home 1
+  ThreadPool pool{1, {}, {0, 1}};
+  ASSERT_EQ(pool.homes(), 2u);
+  const std::thread::id self = std::this_thread::get_id();
+  constexpr size_t kPerHome = 16;
+  std::vector<unsigned> homes;
+  for (size_t c = 0; c < kPerHome; ++c)
+    homes.insert(homes.end(), {0u, 1u});
+  std::vector<char> on_waiter(homes.size(), 0);
+  pool.for_each_chunk(homes.size(), homes, [&](size_t c) {
+    on_waiter[c] = std::this_thread::get_id() == self;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  });
+
+  // Each side drains its own inbox first and only helps out at the tail
+  size_t home0_here = 0, home1_there = 0;
+  for (size_t c = 0; c < homes.size(); ++c) {
+    home0_here += homes[c] == 0 && on_waiter[c];
+    home1_there += homes[c] == 1 && !on_waiter[c];
+  }
+  EXPECT_GT(home0_here, kPerHome / 2);
+  EXPECT_GT(home1_there, kPerHome / 2);
+}
@@ -0,0 +1,48 @@
+#include "utils/triple_buffer.h"
+#include "gtest/gtest.h"
+#include <thread>
+#include <vector>
+
+TEST(TripleBufferTest, ConsumerSeesLatestPublishOnly) {
+  TripleBuffer<int> buffer;
+  EXPECT_FALSE(buffer.acquire());
+
+  buffer.write_buffer() = 1;
+  buffer.publish();
+  buffer.write_buffer() = 2;
+  buffer.publish();
+  ASSERT_TRUE(buffer.acquire());
+  EXPECT_EQ(buffer.read_buffer(), 2);
+  EXPECT_FALSE(buffer.acquire());
+  EXPECT_EQ(buffer.read_buffer(), 2);
+}
+
+TEST(TripleBufferTest, FramesAreNeverTorn) {
+  // Every frame is N copies of its sequence number; a torn frame would mix
+  // two of them
+  constexpr int kFrames = 20000;
+  constexpr size_t kWidth = 64;
+  TripleBuffer<std::vector<int>> buffer;
+
+  std::thread producer([&] {
+    for (int frame = 1; frame <= kFrames; ++frame) {
+      buffer.write_buffer().assign(kWidth, frame);
+      buffer.publish();
+    }
+  });
+
+  int last = 0;
+  while (last < kFrames) {
+    if (!buffer.acquire()) {
+      std::this_thread::yield();
+      continue;
+    }
+    const std::vector<int> &frame = buffer.read_buffer();
+    ASSERT_EQ(frame.size(), kWidth);
+    for (int value : frame)
+      ASSERT_EQ(value, frame.front());
+    ASSERT_GT(frame.front(), last);
+    last = frame.front();
+  }
+  producer.join();
+}